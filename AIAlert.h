@@ -51,12 +51,15 @@
 
 #include "translate.h"
 #include "has_print_on.h"
+#include "SmallVector.h"
 
-#include <deque>
+#include <algorithm>
+#include <cstdint>
 #include <exception>
 #include <string>
-#include <map>
+#include <string_view>
 #include <sstream>
+#include <type_traits>
 #include <boost/lexical_cast.hpp>
 
 //===================================================================================================================================
@@ -155,47 +158,173 @@
 /**
  * Arguments for AIAlert::Error.
  *
- * A wrapper around a `std::map` (translate::format_map_t) to allow constructing a dictionary on one line by doing:
+ * A replacement dictionary (see translate::format_map_t) that can be constructed on one line by doing:
  *
  * @{AIArgs("[ARG1]", arg1)("[ARG2]", arg2)("[ARG3]", arg3)...}
  *
- * Here the arguments are serialized into characters by using argX.print_on if
- * that exists, otherwise by using boost::lexical_cast<std::string>.
+ * Serialization of the arguments into characters is deferred: most alerts are
+ * thrown in error paths where the catch site suppresses or aggregates them and
+ * the message text is never built, so paying for boost::lexical_cast on the
+ * throw path would be wasted work. Arithmetic values are therefore captured
+ * by value and strings are just copied; only when the replacement map is first
+ * requested (when the alert is actually formatted for display) is each captured
+ * value converted to text, by using argX.print_on if that exists, otherwise by
+ * using boost::lexical_cast<std::string>. User defined types are still
+ * serialized immediately, because a reference to them can not be assumed to
+ * survive until the catch site.
  */
 class AIArgs
 {
   private:
-    translate::format_map_t mArgs;    ///< The underlying replacement map.
+    /// A single captured replacement; the value is either already text (mString) or still a raw arithmetic value.
+    struct Replacement
+    {
+      enum kind_type : char
+      {
+        is_string,              ///< The value is mString.
+        is_signed,              ///< The value is mSigned.
+        is_unsigned,            ///< The value is mUnsigned.
+        is_float,               ///< The value is mFloat.
+        is_double,              ///< The value is mDouble.
+        is_long_double          ///< The value is mLongDouble.
+      };
+      std::string mKey;         ///< The "[KEY]" that this replacement was registered under.
+      std::string mString;      ///< The serialized value; only valid when mKind == is_string.
+      kind_type mKind;          ///< Which of the below holds the captured value.
+      union
+      {
+        intmax_t mSigned;
+        uintmax_t mUnsigned;
+        float mFloat;
+        double mDouble;
+        long double mLongDouble;
+      };
+    };
+
+    utils::SmallVector<Replacement, 4> mReplacements;   ///< The captured replacements, in insertion order.
+    mutable translate::format_map_t mArgs;              ///< The serialized replacement map; built by serialize().
+    mutable bool mSerialized = true;                    ///< Set when mArgs is up to date with mReplacements.
+
+    /// Return the entry for @a key, appending a new one when the key is not known yet.
+    Replacement* find_or_append(char const* key)
+    {
+      for (Replacement& entry : mReplacements)
+        if (entry.mKey == key)
+          return &entry;
+      mReplacements.emplace_back();
+      mReplacements.back().mKey = key;
+      return &mReplacements.back();
+    }
+
+    /// Capture @a replacement under @a key, serializing it immediately only when deferral would not be safe.
+    template<typename T>
+    void capture(char const* key, T const& replacement)
+    {
+      using U = std::decay_t<T const>;
+      Replacement* entry = find_or_append(key);
+      if constexpr (std::is_same_v<U, std::string> || std::is_same_v<U, std::string_view> ||
+                    std::is_same_v<U, char const*> || std::is_same_v<U, char*>)
+      {
+        entry->mKind = Replacement::is_string;
+        entry->mString = std::string(replacement);
+      }
+      // Character types are excluded: boost::lexical_cast prints those as a character, not as a number.
+      else if constexpr (std::is_integral_v<U> && !std::is_same_v<U, char> && !std::is_same_v<U, signed char> &&
+                         !std::is_same_v<U, unsigned char> && !std::is_same_v<U, wchar_t> &&
+                         !std::is_same_v<U, char16_t> && !std::is_same_v<U, char32_t>)
+      {
+        if constexpr (std::is_signed_v<U>)
+        {
+          entry->mKind = Replacement::is_signed;
+          entry->mSigned = replacement;
+        }
+        else
+        {
+          entry->mKind = Replacement::is_unsigned;
+          entry->mUnsigned = replacement;
+        }
+      }
+      // Each floating point type keeps its own slot so that the deferred
+      // boost::lexical_cast produces the exact same text as the eager one did.
+      else if constexpr (std::is_same_v<U, float>)
+      {
+        entry->mKind = Replacement::is_float;
+        entry->mFloat = replacement;
+      }
+      else if constexpr (std::is_same_v<U, double>)
+      {
+        entry->mKind = Replacement::is_double;
+        entry->mDouble = replacement;
+      }
+      else if constexpr (std::is_same_v<U, long double>)
+      {
+        entry->mKind = Replacement::is_long_double;
+        entry->mLongDouble = replacement;
+      }
+      // boost::lexical_cast doesn't work when T only has a print_on method.
+      else if constexpr (utils::has_print_on<T const>)
+      {
+        std::ostringstream oss;
+        replacement.print_on(oss);
+        entry->mKind = Replacement::is_string;
+        entry->mString = oss.str();
+      }
+      else
+      {
+        entry->mKind = Replacement::is_string;
+        entry->mString = boost::lexical_cast<std::string>(replacement);
+      }
+      mSerialized = false;
+    }
+
+    /// Build mArgs from the captured replacements, converting deferred values to text.
+    void serialize() const
+    {
+      if (mSerialized)
+        return;
+      mArgs = translate::format_map_t();
+      for (Replacement const& entry : mReplacements)
+      {
+        std::string& value = mArgs[entry.mKey];
+        switch (entry.mKind)
+        {
+          case Replacement::is_string:
+            value = entry.mString;
+            break;
+          case Replacement::is_signed:
+            value = boost::lexical_cast<std::string>(entry.mSigned);
+            break;
+          case Replacement::is_unsigned:
+            value = boost::lexical_cast<std::string>(entry.mUnsigned);
+            break;
+          case Replacement::is_float:
+            value = boost::lexical_cast<std::string>(entry.mFloat);
+            break;
+          case Replacement::is_double:
+            value = boost::lexical_cast<std::string>(entry.mDouble);
+            break;
+          case Replacement::is_long_double:
+            value = boost::lexical_cast<std::string>(entry.mLongDouble);
+            break;
+        }
+      }
+      mSerialized = true;
+    }
 
   public:
     /// Construct an empty map.
     AIArgs() { }
     /// Construct a map with a single replacement.
-    // boost::lexical_cast doesn't work when T only has a print_on method.
-    template<typename T, typename std::enable_if<!utils::has_print_on<T const>, int>::type = 0>
-    AIArgs(char const* key, T const& replacement) { mArgs[key] = boost::lexical_cast<std::string>(replacement); }
-    template<typename T, typename std::enable_if<utils::has_print_on<T const>, int>::type = 0>
-    AIArgs(char const* key, T const& replacement) { std::ostringstream oss; replacement.print_on(oss); mArgs[key] = oss.str(); }
+    template<typename T>
+    AIArgs(char const* key, T const& replacement) { capture(key, replacement); }
     /// Add another replacement.
-    template<typename T, typename std::enable_if<!utils::has_print_on<T const>, int>::type = 0>
-    AIArgs& operator()(char const* key, T const& replacement) { mArgs[key] = boost::lexical_cast<std::string>(replacement); return *this; }
-    template<typename T, typename std::enable_if<utils::has_print_on<T const>, int>::type = 0>
-    AIArgs& operator()(char const* key, T const& replacement) { std::ostringstream oss; replacement.print_on(oss); mArgs[key] = oss.str(); return *this; }
+    template<typename T>
+    AIArgs& operator()(char const* key, T const& replacement) { capture(key, replacement); return *this; }
 
-    /// Accessor, returns the underlaying map.
-    translate::format_map_t const& operator*() const { return mArgs; }
+    /// Accessor, returns the underlaying map; serializes any still deferred values first.
+    translate::format_map_t const& operator*() const { serialize(); return mArgs; }
 };
 
-// No need to call boost::lexical_cast when it already is a std::string or a char const*.
-/// Map @a replacement to @a key. Specialization for `std::string`.
-template<> inline AIArgs::AIArgs(char const* key, std::string const& replacement) { mArgs[key] = replacement; }
-/// Map @a replacement to @a key. Specialization for `char const*`.
-template<> inline AIArgs::AIArgs(char const* key, char const* const& replacement) { mArgs[key] = replacement; }
-/// Map @a replacement to @a key. Specialization for `std::string`.
-template<> inline AIArgs& AIArgs::operator()(char const* key, std::string const& replacement) { mArgs[key] = replacement; return *this; }
-/// Map @a replacement to @a key. Specialization for `char const*`.
-template<> inline AIArgs& AIArgs::operator()(char const* key, char const* const& replacement) { mArgs[key] = replacement; return *this; }
-
 namespace AIAlert {
 
 /// Whether or not an alert should be modal.
@@ -292,6 +421,45 @@ class Line
     bool is_function_name() const { return mType == pretty_function_prefix; }
 };
 
+/**
+ * The lines of an Error.
+ *
+ * A thin wrapper around utils::SmallVector with inline storage for the
+ * usual one to three lines, so that constructing-and-throwing an alert
+ * does not allocate. push_front is O(size), which at these sizes is
+ * cheaper than any node based container.
+ */
+class Lines
+{
+  public:
+    using container_type = utils::SmallVector<Line, 4>;
+    using const_iterator = container_type::const_iterator;
+
+  private:
+    container_type mLines;       ///< The actual lines.
+
+  public:
+    /// Return true when there are no lines at all.
+    bool empty() const { return mLines.empty(); }
+    /// The number of lines.
+    size_t size() const { return mLines.size(); }
+    /// Accessors for the first line.
+    Line& front() { return mLines.front(); }
+    Line const& front() const { return mLines.front(); }
+    /// Iterators over all lines.
+    const_iterator begin() const { return mLines.begin(); }
+    const_iterator end() const { return mLines.end(); }
+
+    /// Append a line.
+    void push_back(Line const& line) { mLines.push_back(line); }
+    /// Prepend a line.
+    void push_front(Line const& line)
+    {
+      mLines.push_back(line);
+      std::rotate(mLines.begin(), mLines.end() - 1, mLines.end());
+    }
+};
+
 /**
  * Exception class used to throw an error with an informative user message.
  *
@@ -309,10 +477,10 @@ class Line
 class Error : public std::exception
 {
   public:
-    using lines_type = std::deque<Line>; ///< The type of mLines.
+    using lines_type = Lines; ///< The type of mLines.
 
     // Accessors.
-    /// Accessor for the lines deque.
+    /// Accessor for the lines container.
     lines_type const& lines() const { return mLines; }
     /// Return true if the alert should be modal.
     bool is_modal() const { return mModal == modal; }
@@ -28,7 +28,9 @@
 #pragma once
 
 #include "utils/FuzzyBool.h"
+#include "utils/threading/aithreadid.h"
 #include <atomic>
+#include <thread>
 #include <boost/intrusive_ptr.hpp>
 #include "debug.h"
 
@@ -82,8 +84,33 @@
 //
 // And then later, somewhere else, do:
 //
-//   intrusive_ptr_release(ptr);        // Cancel initial call to intrusive_ptr_add_ref.
+//   intrusive_ptr_release(ptr);        // Cancel the initial call to intrusive_ptr_add_ref.
 //                                      // This *might* cause ptr to be destructed immediately.
+//
+//
+// Note 3
+//
+// When the vast majority of the reference count traffic happens in a single
+// thread, that thread can opt-in to biased reference counting:
+//
+//   my_class->bias_to_current_thread();
+//
+// From that moment on copies made (and destructed) by the calling thread - the
+// owner of the bias - only touch a plain, non-atomic counter; other threads keep
+// using the shared atomic counter as before. The bias is given up automatically
+// when the owner drops its last reference: the plain counter is then folded back
+// into the shared counter (and the object is destructed when that hits zero, as
+// usual). The caller must hold at least one reference and only one thread at a
+// time can own the bias.
+//
+// While the bias is held there is one restriction: a reference that was obtained
+// by the owner thread must also be released by the owner thread, and vice versa
+// (otherwise the two counters each become unbalanced). Hence, do not create an
+// intrusive_ptr in the owner thread and destruct it in another thread (or the
+// other way around). Another thread can always safely take its own reference
+// from a raw pointer (the add_ref then runs in that thread), or the owner can
+// call unbias() first when it really wants to hand over a reference. Violations
+// are ASSERT'ed when compiled with debugging.
 
 class AIRefCount
 {
@@ -91,22 +118,82 @@ class AIRefCount
 #if CW_DEBUG
   static constexpr int s_deleted = -0x6de1e7ed;                 // A negative magic number.
 #endif
+  static constexpr int s_biased = 1 << 30;                      // Set in m_count while a thread owns the bias; it stands for all
+                                                                // of the references that are counted in m_owner_count.
   mutable std::atomic<int> m_count;
+  mutable int m_owner_count;                                    // Only accessed by the owner thread, while s_biased is set.
+  mutable std::atomic<std::thread::id> m_owner;                 // The thread whose references are counted in m_owner_count,
+                                                                // or aithreadid::none when nobody owns the bias.
 
  public:
   friend void intrusive_ptr_add_ref(AIRefCount const* ptr)
   {
+    if (ptr->m_owner.load(std::memory_order_relaxed) == std::this_thread::get_id())
+    {
+      // While biased the owner always holds at least one reference (or the bias would have been given up).
+      ASSERT(ptr->m_owner_count > 0);
+      ++ptr->m_owner_count;
+      return;
+    }
     ptr->m_count.fetch_add(1, std::memory_order_relaxed);
   }
 
   friend void intrusive_ptr_release(AIRefCount const* ptr)
   {
-    if (ptr->m_count.fetch_sub(1, std::memory_order_release) == 1)
+    if (ptr->m_owner.load(std::memory_order_relaxed) == std::this_thread::get_id())
     {
-      std::atomic_thread_fence(std::memory_order_acquire);
-      DEBUG_ONLY(ptr->m_count = s_deleted);
-      delete ptr;
+      // A reference obtained by the owner thread must also be released by the owner thread (see Note 3).
+      ASSERT(ptr->m_owner_count > 0);
+      if (--ptr->m_owner_count > 0)
+        return;
+      // The owner dropped its last reference: give up the bias by removing
+      // s_biased (which represented the, now zero, m_owner_count) again.
+      ptr->m_owner.store(aithreadid::none, std::memory_order_relaxed);
+      if (ptr->m_count.fetch_sub(s_biased, std::memory_order_release) != s_biased)
+        return;
+    }
+    else
+    {
+      int const prev_count = ptr->m_count.fetch_sub(1, std::memory_order_release);
+      // While biased, a reference obtained by a non-owner thread must also be released by a non-owner thread (see Note 3).
+      ASSERT((prev_count & (s_biased - 1)) > 0);
+      if (prev_count != 1)
+        return;
     }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    DEBUG_ONLY(ptr->m_count = s_deleted);
+    delete ptr;
+  }
+
+  // Make the reference count of the calling thread non-atomic; see Note 3 above.
+  // The calling thread must hold at least one reference.
+  void bias_to_current_thread() const
+  {
+    // Only one thread at a time can own the bias.
+    ASSERT(m_owner.load(std::memory_order_relaxed) == aithreadid::none);
+    // The calling thread must hold a reference (see also inhibit_deletion).
+    ASSERT((m_count.load(std::memory_order_relaxed) & ~s_biased) > 0);
+    m_owner_count = 1;
+    // Move one reference from the shared counter to m_owner_count, and set s_biased:
+    // as long as that bit is set the shared counter can not reach zero.
+    m_count.fetch_add(s_biased - 1, std::memory_order_relaxed);
+    m_owner.store(std::this_thread::get_id(), std::memory_order_relaxed);
+  }
+
+  // Give up the bias again, folding the plain counter back into the shared counter.
+  // Must be called by the thread that called bias_to_current_thread, for example
+  // just before it hands its reference(s) over to another thread.
+  void unbias() const
+  {
+    // Only the owner of the bias can give it up.
+    ASSERT(m_owner.load(std::memory_order_relaxed) == std::this_thread::get_id());
+    int const owner_count = m_owner_count;
+    // While biased the owner always holds at least one reference, therefore
+    // folding can not cause the shared counter to reach zero here.
+    ASSERT(owner_count > 0);
+    m_owner_count = 0;
+    m_owner.store(aithreadid::none, std::memory_order_relaxed);
+    m_count.fetch_add(owner_count - s_biased, std::memory_order_release);
   }
 
   // Increment m_count; returns the previous value (mainly for debugging purposes).
@@ -185,8 +272,8 @@ class AIRefCount
   void intrusive_ptr_release(AIRefCount const*);
 
  protected:
-  AIRefCount() : m_count(0) { }
-  AIRefCount(AIRefCount const&) : m_count(0) { }
+  AIRefCount() : m_count(0), m_owner_count(0), m_owner(aithreadid::none) { }
+  AIRefCount(AIRefCount const&) : m_count(0), m_owner_count(0), m_owner(aithreadid::none) { }
   virtual ~AIRefCount() { }
   AIRefCount& operator=(AIRefCount const&) { return *this; }
   void swap(AIRefCount&) { }
@@ -195,11 +282,28 @@ class AIRefCount
   // Returns true if there is only one reference to this object left.
   // If this function returns true it is therefore guaranteed to stay true,
   // but if it returns false it might become true shortly afterwards.
-  utils::FuzzyBool unique() const { return std::atomic_load_explicit(&m_count, std::memory_order_relaxed) == 1 ? fuzzy::True : fuzzy::WasFalse; }
+  utils::FuzzyBool unique() const
+  {
+    int count = std::atomic_load_explicit(&m_count, std::memory_order_relaxed);
+    if (m_owner.load(std::memory_order_relaxed) == std::this_thread::get_id())
+      count += m_owner_count - s_biased;        // For the owner of the bias, s_biased stands for m_owner_count references.
+    return count == 1 ? fuzzy::True : fuzzy::WasFalse;
+  }
 
 #if CW_DEBUG
   // Pretty unreliable, but sometimes useful.
   bool is_destructed() const { int cnt = std::atomic_load_explicit(&m_count, std::memory_order_relaxed); return cnt < 0; }
+  // Returns an instantaneous snapshot of the total number of references (negative after destruction).
+  // Unreliable in the face of other threads; only use this for debug checks (e.g. borrowed_ptr).
+  int ref_count() const
+  {
+    int count = std::atomic_load_explicit(&m_count, std::memory_order_relaxed);
+    if ((count & s_biased))
+      // Only the owner of the bias can read m_owner_count; for any other thread
+      // all we know is that the owner holds at least one reference.
+      count += (m_owner.load(std::memory_order_relaxed) == std::this_thread::get_id() ? m_owner_count : 1) - s_biased;
+    return count;
+  }
   // Used when deferred deleting an object.
   void mark_deleted() const { m_count = s_deleted; }
 #endif
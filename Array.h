@@ -46,29 +46,29 @@ class ArrayIndex
   int m_value;
 
  public:
-  ArrayIndex() : m_value(-1) { }
+  constexpr ArrayIndex() : m_value(-1) { }
   explicit constexpr ArrayIndex(int value) : m_value(value) { }
-  int get_value() const { return m_value; }
+  constexpr int get_value() const { return m_value; }
 
-  ArrayIndex& operator++() { ++m_value; return *this; }
-  ArrayIndex operator++(int) { ArrayIndex old(m_value); ++m_value; return old; }
-  ArrayIndex& operator--() { --m_value; return *this; }
-  ArrayIndex operator--(int) { ArrayIndex old(m_value); --m_value; return old; }
+  constexpr ArrayIndex& operator++() { ++m_value; return *this; }
+  constexpr ArrayIndex operator++(int) { ArrayIndex old(m_value); ++m_value; return old; }
+  constexpr ArrayIndex& operator--() { --m_value; return *this; }
+  constexpr ArrayIndex operator--(int) { ArrayIndex old(m_value); --m_value; return old; }
 
-  void set_to_zero() { m_value = 0; }
-  bool is_zero() const { return m_value == 0; }
-  void set_to_undefined() { m_value = -1; }
-  bool undefined() const { return m_value == -1; }
+  constexpr void set_to_zero() { m_value = 0; }
+  constexpr bool is_zero() const { return m_value == 0; }
+  constexpr void set_to_undefined() { m_value = -1; }
+  constexpr bool undefined() const { return m_value == -1; }
 
-  bool operator==(ArrayIndex const& index) const { return m_value == index.m_value; }
-  bool operator!=(ArrayIndex const& index) const { return m_value != index.m_value; }
-  bool operator<(ArrayIndex const& index) const { return m_value < index.m_value; }
-  bool operator>(ArrayIndex const& index) const { return m_value > index.m_value; }
-  bool operator<=(ArrayIndex const& index) const { return m_value <= index.m_value; }
-  bool operator>=(ArrayIndex const& index) const { return m_value >= index.m_value; }
+  constexpr bool operator==(ArrayIndex const& index) const { return m_value == index.m_value; }
+  constexpr bool operator!=(ArrayIndex const& index) const { return m_value != index.m_value; }
+  constexpr bool operator<(ArrayIndex const& index) const { return m_value < index.m_value; }
+  constexpr bool operator>(ArrayIndex const& index) const { return m_value > index.m_value; }
+  constexpr bool operator<=(ArrayIndex const& index) const { return m_value <= index.m_value; }
+  constexpr bool operator>=(ArrayIndex const& index) const { return m_value >= index.m_value; }
 
-  ArrayIndex operator-(int n) const { return ArrayIndex{m_value - n}; }
-  ArrayIndex operator+(int n) const { return ArrayIndex{m_value + n}; }
+  constexpr ArrayIndex operator-(int n) const { return ArrayIndex{m_value - n}; }
+  constexpr ArrayIndex operator+(int n) const { return ArrayIndex{m_value + n}; }
 
   friend std::ostream& operator<<<>(std::ostream& os, ArrayIndex<Category> const& index);
 };
@@ -80,6 +80,13 @@ std::ostream& operator<<(std::ostream& os, ArrayIndex<Category> const& index)
   return os;
 }
 
+// Since Array is an aggregate (a public base and no constructors) and all
+// accessors are constexpr, a lookup table can be built entirely at compile
+// time and live in .rodata:
+//
+//   constexpr utils::Array<int, 3, ArrayIndex<Cat>> table = {{ 2, 3, 5 }};
+//   static_assert(table[ArrayIndex<Cat>(1)] == 3);
+//
 template<typename T, std::size_t N, typename _Index = ArrayIndex<T>>
 class Array : public std::array<T, N>
 {
@@ -89,14 +96,14 @@ class Array : public std::array<T, N>
   using const_reference = typename _Base::const_reference;
   using index_type = _Index;
 
-  reference operator[](index_type __n) _GLIBCXX_NOEXCEPT { return _Base::operator[](__n.get_value()); }
-  const_reference operator[](index_type __n) const _GLIBCXX_NOEXCEPT { return _Base::operator[](__n.get_value()); }
+  constexpr reference operator[](index_type __n) _GLIBCXX_NOEXCEPT { return _Base::operator[](__n.get_value()); }
+  constexpr const_reference operator[](index_type __n) const _GLIBCXX_NOEXCEPT { return _Base::operator[](__n.get_value()); }
 
-  reference at(index_type __n) { return _Base::at(__n.get_value()); }
-  const_reference at(index_type __n) const { return _Base::at(__n.get_value()); }
+  constexpr reference at(index_type __n) { return _Base::at(__n.get_value()); }
+  constexpr const_reference at(index_type __n) const { return _Base::at(__n.get_value()); }
 
-  index_type ibegin() const { return index_type(0); }
-  index_type iend() const { return index_type((int)N); }
+  constexpr index_type ibegin() const { return index_type(0); }
+  constexpr index_type iend() const { return index_type((int)N); }
 };
 
 } // namespace utils
@@ -0,0 +1,128 @@
+/**
+ * ai-utils -- C++ Core utilities
+ *
+ * @file
+ * @brief Declaration of class AtomicBitSet.
+ *
+ * @Copyright (C) 2021  Carlo Wood.
+ *
+ * RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+ * Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+ *
+ * This file is part of ai-utils.
+ *
+ * ai-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ai-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ai-utils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "BitSet.h"
+#include "macros.h"
+#include "debug.h"
+#include <atomic>
+
+namespace utils {
+
+// class AtomicBitSet<T>
+//
+// The lock-free counterpart of BitSet<T>, intended as a concurrent free-slot
+// map (connection slots, buffer slots): a zero bit is a free slot, claim()
+// atomically finds and sets the first zero bit and release() clears it again.
+// No mutex, no system call: one atomic read-modify-write per (un)successful
+// claim attempt.
+//
+// Usage:
+//
+//   utils::AtomicBitSet<uint64_t> slots;          // All slots free.
+//   ...
+//   auto index = slots.claim();
+//   if (AI_UNLIKELY(index == slots.iend()))
+//     ...                                         // All slots in use.
+//   buffer[index()] = ...;                        // This slot is ours.
+//   ...
+//   slots.release(index);
+//
+// Iteration keeps the BitSet idiom, over a snapshot:
+//
+//   for (auto bit : slots.load())                 // Every currently claimed slot.
+//     ...
+template<typename T>
+class AtomicBitSet
+{
+  static_assert(std::is_unsigned<T>::value, "utils::AtomicBitSet<> template parameter must be an unsigned integral type.");
+
+ public:
+  using mask_type = T;
+  using Index = bitset::Index;
+
+ private:
+  std::atomic<T> m_bitmask;
+
+ public:
+  // Construct an AtomicBitSet with all bits zero (all slots free).
+  constexpr AtomicBitSet() : m_bitmask(0) { }
+
+  // Construct an AtomicBitSet with the bits of bitmask already set.
+  explicit constexpr AtomicBitSet(mask_type bitmask) : m_bitmask(bitmask) { }
+
+  // Return the number of bits.
+  static constexpr std::size_t size() { return 8 * sizeof(T); }
+
+  // "One past the last bit"; returned by claim() when every bit was already set.
+  static constexpr bitset::IndexPOD iend() { return bitset::index_end<T>; }
+
+  // Atomically set the first (least significant) zero bit and return its index,
+  // or iend() when all bits were already set. One fetch_or per attempt; an
+  // attempt only fails when another thread claimed the very same bit first, in
+  // which case the value returned by the fetch_or is used to pick the next zero
+  // bit. An acquire operation: pairs with the release of release(index), so
+  // everything the previous owner wrote to the slot is visible.
+  Index claim()
+  {
+    T mask = m_bitmask.load(std::memory_order_relaxed);
+    for (;;)
+    {
+      if (AI_UNLIKELY(mask == static_cast<T>(-1)))
+        return iend();
+      T const bit = static_cast<T>(~mask & (mask + 1));         // The least significant zero bit of mask.
+      mask = m_bitmask.fetch_or(bit, std::memory_order_acquire);
+      if (AI_LIKELY(!(mask & bit)))                             // Did we set it?
+        return bitset::IndexPOD{static_cast<int8_t>(ctz(bit))};
+    }
+  }
+
+  // Atomically clear the bit at index, which must be set (e.g. returned by
+  // claim() before). A release operation, see claim().
+  void release(Index const& index)
+  {
+    T const bit = static_cast<T>(static_cast<T>(1) << index());
+    DEBUG_ONLY(T const prev_mask =) m_bitmask.fetch_and(static_cast<T>(~bit), std::memory_order_release);
+    // The bit being released must have been set.
+    ASSERT((prev_mask & bit) != 0);
+  }
+
+  // Return whether the bit at index is set. A relaxed snapshot: under
+  // concurrency the answer can be stale by the time it is returned.
+  bool test(Index const& index) const { return m_bitmask.load(std::memory_order_relaxed) & (static_cast<T>(1) << index()); }
+
+  // The number of set bits. Approximate under concurrency (a relaxed
+  // snapshot), exact when no other thread is claiming or releasing.
+  std::size_t count() const { return _popcount(m_bitmask.load(std::memory_order_relaxed)); }
+
+  // Return a snapshot of the bits as a plain BitSet, e.g. for the usual
+  // iteration idiom; see the usage example above.
+  BitSet<T> load(std::memory_order order = std::memory_order_relaxed) const { return BitSet<T>(m_bitmask.load(order)); }
+};
+
+} // namespace utils
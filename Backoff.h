@@ -0,0 +1,137 @@
+/**
+ * ai-utils -- C++ Core utilities
+ *
+ * @file
+ * @brief Definition of class Backoff.
+ *
+ * @Copyright (C) 2021  Carlo Wood.
+ *
+ * RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+ * Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+ *
+ * This file is part of ai-utils.
+ *
+ * ai-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ai-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ai-utils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "cpu_relax.h"
+#include <cstdint>
+#include <sched.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+namespace utils {
+
+// class Backoff
+//
+// The retry policy for spin loops, so that not every spin loop hand-rolls
+// its own: exponentially growing runs of pause instructions, then - on CPUs
+// with WAITPKG (Tremont/Sapphire Rapids and later) - tpause, which halts the
+// logical core at low power until a TSC deadline instead of burning full-rate
+// pause cycles on the shared physical core (the hyperthread sibling gets the
+// whole core meanwhile), and finally sched_yield() for when the holder isn't
+// even running.
+//
+// Usage:
+//
+//   utils::Backoff backoff;
+//   while (!try_something())
+//     backoff.pause();
+//
+// A Backoff is cheap to construct; use a fresh one (or call reset()) per
+// acquisition so that the next acquisition starts polite again.
+//
+class Backoff
+{
+ private:
+  static constexpr int max_pauses = 64;         // Saturation of the exponential phase; roughly a microsecond.
+  static constexpr int yield_threshold = 16;    // Saturated rounds before escalating to sched_yield().
+  static constexpr uint32_t tpause_cycles = 2048;       // TSC cycles per tpause; of the order of max_pauses pauses.
+
+  int m_pauses = 1;                             // The number of pause instructions to execute next round.
+  int m_saturated_rounds = 0;                   // The number of rounds executed since m_pauses saturated.
+
+  // True when the CPU supports the WAITPKG instructions (umonitor/umwait/tpause).
+  static bool has_waitpkg()
+  {
+#if defined(__x86_64__) || defined(__i386__)
+    static bool const has_waitpkg_ = [](){
+      uint32_t eax, ebx, ecx, edx;
+      if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+        return false;
+      return (ecx & (1 << 5)) != 0;             // CPUID.(EAX=7,ECX=0):ECX.WAITPKG[bit 5].
+    }();
+    return has_waitpkg_;
+#else
+    return false;
+#endif
+  }
+
+  // Halt the logical core in the C0.2 power state until the TSC reaches deadline
+  // (or an interrupt arrives). Only call when has_waitpkg() returned true.
+  static void tpause(uint64_t deadline)
+  {
+#if defined(__x86_64__) || defined(__i386__)
+    uint32_t const lo = deadline;
+    uint32_t const hi = deadline >> 32;
+    // "tpause ecx" - encoded as bytes so that this compiles without -mwaitpkg.
+    // ecx = 0 selects C0.2 (the deeper of the two states); edx:eax is the deadline.
+    asm volatile (".byte 0x66, 0x0f, 0xae, 0xf1" : : "c"(0), "a"(lo), "d"(hi));
+#else
+    (void)deadline;
+#endif
+  }
+
+ public:
+  // Call once per failed attempt.
+  void pause()
+  {
+    if (m_pauses < max_pauses)
+    {
+      // The exponential phase: 1, 2, 4, ... pause instructions.
+      for (int i = m_pauses; i != 0; --i)
+        cpu_relax();
+      m_pauses *= 2;
+      return;
+    }
+    if (++m_saturated_rounds >= yield_threshold)
+    {
+      // We spun for tens of microseconds; whoever we are waiting for is
+      // probably not running. Give up the time slice.
+      sched_yield();
+      return;
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    if (has_waitpkg())
+    {
+      tpause(__builtin_ia32_rdtsc() + tpause_cycles);
+      return;
+    }
+#endif
+    for (int i = max_pauses; i != 0; --i)
+      cpu_relax();
+  }
+
+  // Start a new acquisition: be polite again.
+  void reset()
+  {
+    m_pauses = 1;
+    m_saturated_rounds = 0;
+  }
+};
+
+} // namespace utils
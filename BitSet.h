@@ -35,6 +35,7 @@
 #include <cstdint>
 #include <type_traits>
 #include <iosfwd>
+#include <string>
 
 namespace utils {
 
@@ -310,6 +311,40 @@ class const_iterator
   inline BitSet<T> operator*() const;
 };
 
+template<typename T>
+class const_reverse_iterator
+{
+  T m_mask;     // A copy of the bitset this iterator refers to, but with the more significant bits removed.
+                // The actual position of the iterator is the most significant set bit.
+                // A value of all zeros means 'rend'.
+
+ public:
+  // Default constructor returns 'rend'.
+  const_reverse_iterator() : m_mask(0) { }
+  // Construct a const_reverse_iterator from bitmask.
+  const_reverse_iterator(T bitmask) : m_mask(bitmask) { }
+  // Copy-constructor.
+  const_reverse_iterator(const_reverse_iterator const& iter) : m_mask(iter.m_mask) { }
+  // Assignment.
+  const_reverse_iterator& operator=(const_reverse_iterator const& iter) { m_mask = iter.m_mask; return *this; }
+
+  // Comparision operators.
+
+  bool operator==(const_reverse_iterator const& iter) const { return m_mask == iter.m_mask; }
+  bool operator!=(const_reverse_iterator const& iter) const { return m_mask != iter.m_mask; }
+
+  // Reverse iterator (runs from the most- to the least significant set bit).
+
+  const_reverse_iterator& operator++()
+  {
+    // Remove the most significant bit.
+    m_mask ^= ::utils::mssb(m_mask);
+    return *this;
+  }
+
+  inline BitSet<T> operator*() const;
+};
+
 } // namespace bitset
 
 template<typename T>
@@ -325,6 +360,18 @@ class BitSet : protected BitSetPOD<T>
   [[gnu::always_inline]] static T index2mask(Index i1) { return static_cast<T>(1) << i1(); }
   // Convert a mask_type to the index of its least significant set bit.
   [[gnu::always_inline]] static Index mask2index(T mask) { return ctz(mask); }
+  // Return a mask_type with the bits [0, n) set; n must be in the range [0, N].
+  // A shift over the full width of T is undefined, hence the test against N.
+  [[gnu::always_inline]] static constexpr T mask_below(int n)
+  {
+    return n == static_cast<int>(8 * sizeof(T)) ? static_cast<T>(-1) : static_cast<T>((static_cast<T>(1) << n) - 1);
+  }
+  // Convert the half-open index range [first, end) to a mask_type with exactly those bits set.
+  // Both arguments must be in the range [0, N], with first <= end; [0, N) returns all bits set.
+  [[gnu::always_inline]] static constexpr T range2mask(int first, int end)
+  {
+    return mask_below(end) & static_cast<T>(~mask_below(first));
+  }
 
   // Constructors.
 
@@ -406,6 +453,15 @@ class BitSet : protected BitSetPOD<T>
   // Toggle the bits from m1.
   void flip(BitSet const& m1) { m_bitmask ^= m1.m_bitmask; }
 
+  // Set the bits in the half-open range [i1, i2).
+  void set_range(Index const& i1, Index const& i2) { m_bitmask |= range2mask(i1(), i2()); }
+
+  // Reset the bits in the half-open range [i1, i2).
+  void reset_range(Index const& i1, Index const& i2) { m_bitmask &= ~range2mask(i1(), i2()); }
+
+  // Toggle the bits in the half-open range [i1, i2).
+  void flip_range(Index const& i1, Index const& i2) { m_bitmask ^= range2mask(i1(), i2()); }
+
   // Left shift by n positions.
   BitSet& operator<<=(unsigned int n) { m_bitmask <<= n; return *this; }
   friend BitSet operator<<(BitSet m1, unsigned int n) { m1 <<= n; return m1; }
@@ -429,10 +485,10 @@ class BitSet : protected BitSetPOD<T>
   std::size_t count() const { return ::utils::_popcount(m_bitmask); }
 
   // Return a mask with just the least significant set bit.
-  BitSet lssb() const { return {m_bitmask & -m_bitmask}; }
+  BitSet lssb() const { return BitSet(m_bitmask & -m_bitmask); }
 
   // Return a mask with just the most significant set bit.
-  BitSet mssb() const { return {::utils::mssb(m_bitmask)}; }
+  BitSet mssb() const { return BitSet(::utils::mssb(m_bitmask)); }
 
   // Return the index to the least significant set bit.
   // Returns index_end<T> if the BitSet is zero.
@@ -457,6 +513,12 @@ class BitSet : protected BitSetPOD<T>
   // Test if any bit in m1 is set.
   bool test(BitSet const& m1) const { return m_bitmask & m1.m_bitmask; }
 
+  // Test if any bit in the half-open range [i1, i2) is set.
+  bool test_range(Index const& i1, Index const& i2) const { return m_bitmask & range2mask(i1(), i2()); }
+
+  // Test if all bits in the half-open range [i1, i2) are set.
+  bool all_range(Index const& i1, Index const& i2) const { T const mask = range2mask(i1(), i2()); return (m_bitmask & mask) == mask; }
+
   // Return the inverse of the BitSet.
   BitSet operator~() const { return BitSet(~m_bitmask); }
 
@@ -534,6 +596,8 @@ class BitSet : protected BitSetPOD<T>
 
   bitset::const_iterator<T> begin() const { return {m_bitmask}; }
   bitset::const_iterator<T> end() const { return {}; }
+  bitset::const_reverse_iterator<T> rbegin() const { return {m_bitmask}; }
+  bitset::const_reverse_iterator<T> rend() const { return {}; }
 };
 
 namespace bitset {
@@ -559,6 +623,13 @@ BitSet<T> const_iterator<T>::operator*() const
   return BitSet<T>{m_mask & -m_mask};
 }
 
+template<typename T>
+BitSet<T> const_reverse_iterator<T>::operator*() const
+{
+  // Return just the most significant bit.
+  return BitSet<T>{::utils::mssb(m_mask)};
+}
+
 } // namespace bitset
 
 template<typename T>
@@ -54,4 +54,12 @@ struct BuiltinArg<unsigned long long>
   using type = unsigned long long;
 };
 
+#ifdef __SIZEOF_INT128__
+template<>
+struct BuiltinArg<unsigned __int128>
+{
+  using type = unsigned __int128;
+};
+#endif
+
 } // namespace utils
@@ -47,6 +47,13 @@
 // use_color may be called for any color in the range [0, 6> as many times as
 // you want; it keeps automatically track of which color hasn't been used for
 // the longest time, which then will be returned by get_color().
+//
+// Up to 8 colors the whole history fits in a single uint64_t (one byte per
+// least-recent-use position, one bit per color) and both operations are
+// branch-free. Above 8 colors - say, picking among 64 connection slots - the
+// same interface is provided by a second implementation that keeps the colors
+// in an intrusive doubly-linked LRU list over two fixed arrays: still O(1)
+// for both operations and allocation-free, just no longer branch-free.
 
 namespace utils {
 
@@ -57,10 +64,14 @@ static constexpr uint64_t fake_history = 0x0102040810204080ULL;
 static constexpr uint64_t color2mask(int color) { return one << color; }
 } // namespace cs
 
+template<int number_of_colors, bool = (number_of_colors <= 8)>
+class ColorPool;
+
+// The implementation for up to 8 colors: one uint64_t of history.
 template<int number_of_colors>
-class ColorPool
+class ColorPool<number_of_colors, true>
 {
-  static_assert(0 < number_of_colors && number_of_colors <= 8, "number_of_colors must be in the range [1, 8].");
+  static_assert(0 < number_of_colors, "number_of_colors must be larger than 0.");
 
  private:
   uint64_t history;
@@ -73,7 +84,7 @@ class ColorPool
 };
 
 template<int number_of_colors>
-void ColorPool<number_of_colors>::use_color(int color)
+void ColorPool<number_of_colors, true>::use_color(int color)
 {
   uint64_t where = cs::ones << color;
   uint64_t color_in_history = history & where;
@@ -86,9 +97,61 @@ void ColorPool<number_of_colors>::use_color(int color)
 }
 
 template<int number_of_colors>
-int ColorPool<number_of_colors>::get_color() const
+int ColorPool<number_of_colors, true>::get_color() const
 {
   return log2(history >> (8 * (number_of_colors - 1)));
 }
 
+// The implementation for 9 up to 256 colors: an intrusive doubly-linked LRU
+// list over two fixed arrays of one byte per color. get_color() returns the
+// tail (the least recently used color); use_color() unlinks the color and
+// relinks it at the head.
+template<int number_of_colors>
+class ColorPool<number_of_colors, false>
+{
+  static_assert(number_of_colors <= 256, "number_of_colors must be in the range [1, 256].");
+
+ private:
+  uint8_t m_next[number_of_colors];     // The neighbor one step closer to the tail (less recently used).
+  uint8_t m_prev[number_of_colors];     // The neighbor one step closer to the head (more recently used).
+  uint8_t m_head;                       // The most recently used color.
+  uint8_t m_tail;                       // The least recently used color.
+
+ public:
+  void use_color(int color);
+  int get_color() const { return m_tail; }
+
+  ColorPool()
+  {
+    // The equivalent of fake_history: color 0 is the least- and color
+    // number_of_colors - 1 the most recently used. m_next[0] and
+    // m_prev[number_of_colors - 1] are unused and left uninitialized.
+    for (int color = 1; color < number_of_colors; ++color)
+      m_next[color] = color - 1;
+    for (int color = 0; color < number_of_colors - 1; ++color)
+      m_prev[color] = color + 1;
+    m_head = number_of_colors - 1;
+    m_tail = 0;
+  }
+};
+
+template<int number_of_colors>
+void ColorPool<number_of_colors, false>::use_color(int color)
+{
+  if (color == m_head)
+    return;
+  uint8_t const prev = m_prev[color];
+  if (color == m_tail)
+    m_tail = prev;          // The next pointer of the new tail is simply left stale.
+  else
+  {
+    uint8_t const next = m_next[color];
+    m_next[prev] = next;
+    m_prev[next] = prev;
+  }
+  m_prev[m_head] = color;
+  m_next[color] = m_head;
+  m_head = color;
+}
+
 } // namespace utils
@@ -0,0 +1,102 @@
+/**
+ * ai-utils -- C++ Core utilities
+ *
+ * @file
+ * @brief Implementation of class DeferredStreamSink.
+ *
+ * @Copyright (C) 2021  Carlo Wood.
+ *
+ * RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+ * Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+ *
+ * This file is part of ai-utils.
+ *
+ * ai-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ai-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ai-utils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sys.h"
+#include "DeferredStreamSink.h"
+#include <chrono>
+
+namespace utils {
+
+//static
+thread_local DeferredStreamSink::ThreadBuffers DeferredStreamSink::tl_buffers;
+
+//static
+std::atomic<uint64_t> DeferredStreamSink::s_next_id{0};
+
+DeferredStreamSink::Buffer* DeferredStreamSink::create_buffer()
+{
+  std::unique_lock<std::mutex> lock(m_buffers_mutex);
+  m_buffers.push_back(std::make_unique<Buffer>(m_nchunks));
+  return m_buffers.back().get();
+}
+
+//static
+void DeferredStreamSink::print_record(std::ostream& os, Record const& record)
+{
+  char const* p = record.format;
+  unsigned int arg = 0;
+  unsigned char const* raw = record.args;
+  while (*p)
+  {
+    if (p[0] == '{' && p[1] == '}' && arg < record.table->nargs)
+    {
+      record.table->printers[arg](os, raw);
+      raw += record.table->sizes[arg];
+      ++arg;
+      p += 2;
+    }
+    else
+      os << *p++;
+  }
+  os << '\n';
+}
+
+size_t DeferredStreamSink::flush()
+{
+  size_t count = 0;
+  std::unique_lock<std::mutex> lock(m_buffers_mutex);
+  for (std::unique_ptr<Buffer> const& buffer : m_buffers)
+    while (Record const* record = buffer->pop())
+    {
+      print_record(m_os, *record);
+      ++count;
+    }
+  return count;
+}
+
+void DeferredStreamSink::start()
+{
+  // Don't start the formatting thread twice.
+  ASSERT(!m_thread.joinable());
+  m_stop.store(false, std::memory_order_relaxed);
+  m_thread = std::thread([this]{
+    while (!m_stop.load(std::memory_order_relaxed))
+      if (flush() == 0)
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    flush();    // Drain what was queued before (or while) stop() was called.
+  });
+}
+
+void DeferredStreamSink::stop()
+{
+  if (!m_thread.joinable())
+    return;
+  m_stop.store(true, std::memory_order_relaxed);
+  m_thread.join();
+}
+
+} // namespace utils
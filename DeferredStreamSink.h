@@ -0,0 +1,232 @@
+/**
+ * ai-utils -- C++ Core utilities
+ *
+ * @file
+ * @brief Definition of class DeferredStreamSink.
+ *
+ * @Copyright (C) 2021  Carlo Wood.
+ *
+ * RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+ * Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+ *
+ * This file is part of ai-utils.
+ *
+ * ai-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ai-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ai-utils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "threading/FIFOBuffer.h"
+#include "macros.h"
+#include "debug.h"
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace utils {
+
+// class DeferredStreamSink
+//
+// Deferred, off-thread formatting of log output. A hot thread that calls
+// log() only writes a compact binary record - a pointer to the (static)
+// format string, a pointer to a (static) argument table and the raw bytes
+// of the arguments - into its own lock-free FIFOBuffer: one bounded memcpy,
+// no allocation and no ostream formatting. A background thread (see start())
+// pops the records and does the actual formatting.
+//
+// Arguments are copied as raw bytes and must therefore be trivially
+// copyable values. Anything streamable with operator<< works, which
+// includes a print_using object taking its argument by value (see
+// print_using.h): the formatting still runs through that machinery,
+// just later and on another thread.
+//
+// Usage:
+//
+//   utils::DeferredStreamSink sink(std::clog);
+//   sink.start();                                        // Start the formatting thread.
+//   ...
+//   sink.log("Frame {} took {} ms", frame, milliseconds);
+//   sink.log("x = {}", utils::print_using(x, &X::print_on_by_value));
+//   ...
+//   sink.stop();                                         // Drain and join.
+//
+// Each occurrence of "{}" in the format string is replaced by the next
+// argument. When the buffer of a thread is full the record is dropped
+// (log() returns false and dropped() counts it) - the hot thread is never
+// blocked. The format string must have static storage duration: only its
+// pointer is recorded.
+//
+// Like the thread magazines of MemoryPagePool, the per-thread buffers are
+// found through a small thread_local table indexed by sink. Every sink gets
+// a unique id, so that a new sink constructed at the address of a destroyed
+// one is never confused with it; but the table has only max_sinks slots per
+// thread and a slot of a destroyed sink at another address stays occupied:
+// don't create log sinks in a loop.
+class DeferredStreamSink
+{
+ public:
+  static constexpr size_t record_size = 64;                             // The total size of one binary record, in bytes.
+  static constexpr unsigned int max_args = 6;                           // The maximum number of arguments per log() call.
+  static constexpr size_t max_args_size = record_size - 2 * sizeof(void*);      // Room for the raw argument bytes of one record.
+  static constexpr int default_nchunks = 1024;                          // The default capacity of the buffer of one thread, in records.
+
+  // Print one argument from its raw bytes.
+  using ArgPrinter = void (*)(std::ostream&, unsigned char const*);
+
+  // How to interpret the raw argument bytes of a record: one printer and one
+  // size per argument. A single constexpr table exists per argument pack,
+  // see arg_table below; a record only stores a pointer to it.
+  struct ArgTable
+  {
+    unsigned int nargs;
+    ArgPrinter printers[max_args];
+    unsigned char sizes[max_args];
+  };
+
+  // The compact binary record that log() writes into the FIFOBuffer.
+  struct Record
+  {
+    char const* format;
+    ArgTable const* table;
+    unsigned char args[max_args_size];
+  };
+
+  using Buffer = threading::FIFOBuffer<1, Record>;
+
+ private:
+  // Copy the raw bytes back into a T and hand it to operator<<.
+  template<typename T>
+  static void print_raw(std::ostream& os, unsigned char const* raw)
+  {
+    std::aligned_storage_t<sizeof(T), alignof(T)> storage;
+    std::memcpy(&storage, raw, sizeof(T));
+    os << *reinterpret_cast<T const*>(&storage);
+  }
+
+  template<typename... Args>
+  static constexpr ArgTable arg_table = {
+    static_cast<unsigned int>(sizeof...(Args)),
+    { &print_raw<Args>... },
+    { static_cast<unsigned char>(sizeof(Args))... }
+  };
+
+  static std::atomic<uint64_t> s_next_id;       // Source of unique sink ids.
+
+  std::ostream& m_os;                           // The stream that the background thread formats to.
+  uint64_t const m_id;                          // Unique id of this sink, see ThreadBuffers::find.
+  int const m_nchunks;                          // The capacity of the buffer of one thread, in records.
+  std::mutex m_buffers_mutex;                   // Protects m_buffers.
+  std::vector<std::unique_ptr<Buffer>> m_buffers;       // One FIFOBuffer per producer thread, owned by the sink.
+  std::atomic<size_t> m_dropped;                // The number of records dropped because the buffer of a thread was full.
+  std::thread m_thread;                         // The formatting thread, when started.
+  std::atomic<bool> m_stop;                     // Tells the formatting thread to drain and exit.
+
+  // The buffers of one thread; one buffer per DeferredStreamSink that the thread logs to.
+  struct ThreadBuffers
+  {
+    static constexpr int max_sinks = 4;         // The maximum number of different sinks per thread that get a buffer.
+    struct Slot
+    {
+      DeferredStreamSink* m_sink;               // The sink that m_buffer belongs to, or nullptr when this slot is unused.
+      uint64_t m_id;                            // The id of that sink when the slot was claimed.
+      Buffer* m_buffer;
+    };
+    Slot m_slots[max_sinks] = {};
+
+    // Return the buffer for sink, claiming an empty slot (and registering a new
+    // buffer with the sink) if it doesn't have one yet. Returns nullptr when this
+    // thread already logs to max_sinks other sinks; the record is then dropped.
+    Buffer* find(DeferredStreamSink* sink)
+    {
+      for (int i = 0; i < max_sinks; ++i)
+      {
+        if (m_slots[i].m_sink == sink)
+        {
+          if (AI_LIKELY(m_slots[i].m_id == sink->m_id))
+            return m_slots[i].m_buffer;
+          // A new sink was constructed at the address of a destroyed one;
+          // its buffer is gone, reuse the slot.
+          m_slots[i].m_id = sink->m_id;
+          m_slots[i].m_buffer = sink->create_buffer();
+          return m_slots[i].m_buffer;
+        }
+        if (!m_slots[i].m_sink)
+        {
+          m_slots[i].m_sink = sink;
+          m_slots[i].m_id = sink->m_id;
+          m_slots[i].m_buffer = sink->create_buffer();
+          return m_slots[i].m_buffer;
+        }
+      }
+      return nullptr;
+    }
+  };
+
+  static thread_local ThreadBuffers tl_buffers;
+
+  // Allocate and register the buffer for the calling thread.
+  Buffer* create_buffer();
+
+  // Format one record; each "{}" in the format string consumes the next argument.
+  static void print_record(std::ostream& os, Record const& record);
+
+ public:
+  DeferredStreamSink(std::ostream& os, int nchunks = default_nchunks) :
+    m_os(os), m_id(s_next_id.fetch_add(1, std::memory_order_relaxed)), m_nchunks(nchunks), m_dropped(0), m_stop(false) { }
+  ~DeferredStreamSink() { stop(); flush(); }
+
+  // Append one binary record to the buffer of the calling thread.
+  // Returns false (and counts the record as dropped) when the buffer is full.
+  template<typename... Args>
+  bool log(char const* format, Args const&... args)
+  {
+    static_assert(sizeof...(Args) <= max_args, "Too many arguments for one log record.");
+    static_assert((std::is_trivially_copyable_v<Args> && ...),
+        "log() copies its arguments as raw bytes: pass trivially copyable values (e.g. a print_using object taking its argument by value).");
+    static_assert((size_t{0} + ... + sizeof(Args)) <= max_args_size, "The arguments do not fit the raw bytes of one record.");
+    Buffer* buffer = tl_buffers.find(this);
+    Record record;
+    record.format = format;
+    record.table = &arg_table<Args...>;
+    unsigned char* p = record.args;
+    ((std::memcpy(p, &args, sizeof(Args)), p += sizeof(Args)), ...);
+    if (AI_UNLIKELY(!buffer || !buffer->push(&record)))
+    {
+      m_dropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    return true;
+  }
+
+  // Format and write out every record that is currently queued, from every
+  // thread's buffer; returns the number of records that was formatted.
+  // Serialized internally: safe to call from any thread, including next to
+  // the background thread.
+  size_t flush();
+
+  // Start the background formatting thread / drain and join it.
+  void start();
+  void stop();
+
+  // The number of records dropped so far because a buffer was full.
+  size_t dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+};
+
+} // namespace utils
@@ -30,9 +30,13 @@
 #include "debug.h"
 #include <algorithm>
 #include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
 #include <set>
 #include <map>
 #include <random>
+#include <sstream>
 #include <thread>
 #include <pthread.h>
 
@@ -645,4 +649,142 @@ unsigned int DelayLoopCalibrationBase::peak_detect(double goal
   return loop_size;
 }
 
+//static
+std::string DelayLoopCalibrationCache::host_fingerprint()
+{
+  // Calibration results depend on the CPU (model and microcode revision,
+  // the latter because updates can change instruction timing) and on the
+  // clock source that std::chrono::steady_clock ends up using.
+  std::string model_name;
+  std::string microcode;
+  std::ifstream cpuinfo("/proc/cpuinfo");
+  std::string line;
+  while (std::getline(cpuinfo, line) && (model_name.empty() || microcode.empty()))
+  {
+    auto colon = line.find(':');
+    if (colon == std::string::npos)
+      continue;
+    auto start = line.find_first_not_of(" \t", colon + 1);
+    std::string value = start == std::string::npos ? std::string() : line.substr(start);
+    if (model_name.empty() && line.compare(0, 10, "model name") == 0)
+      model_name = value;
+    else if (microcode.empty() && line.compare(0, 9, "microcode") == 0)
+      microcode = value;
+  }
+  std::string clock_source;
+  std::ifstream clocksource("/sys/devices/system/clocksource/clocksource0/current_clocksource");
+  std::getline(clocksource, clock_source);
+  return model_name + '|' + microcode + '|' + clock_source;
+}
+
+DelayLoopCalibrationCache::DelayLoopCalibrationCache()
+{
+  // Determine the location of the cache file; no usable environment means caching is disabled.
+  char const* cache_home = std::getenv("XDG_CACHE_HOME");
+  if (cache_home && *cache_home)
+    m_path = cache_home;
+  else
+  {
+    char const* home = std::getenv("HOME");
+    if (!home || !*home)
+      return;
+    m_path = std::string(home) + "/.cache";
+  }
+  m_path += "/ai-utils-delay-loop-calibration";
+
+  std::ifstream file(m_path);
+  if (!file)
+    return;
+
+  // The first line of the file is the fingerprint of the host that the
+  // results were measured on; when it doesn't match, everything is stale.
+  std::string fingerprint;
+  if (!std::getline(file, fingerprint) || fingerprint != host_fingerprint())
+  {
+    Dout(dc::delayloop, "DelayLoopCalibrationCache: discarding stale cache \"" << m_path << "\".");
+    return;
+  }
+
+  // Each subsequent line is: <name>\t<value> [<value>...]
+  std::string line;
+  while (std::getline(file, line))
+  {
+    auto tab = line.find('\t');
+    if (tab == std::string::npos)
+      continue;
+    std::istringstream iss(line.substr(tab + 1));
+    std::vector<unsigned int> values;
+    unsigned int value;
+    while (iss >> value)
+      values.push_back(value);
+    if (!values.empty())
+      m_entries[line.substr(0, tab)] = std::move(values);
+  }
+}
+
+bool DelayLoopCalibrationCache::lookup(std::string const& name, std::vector<unsigned int>& values) const
+{
+  auto entry = m_entries.find(name);
+  if (entry == m_entries.end())
+    return false;
+  values = entry->second;
+  Dout(dc::delayloop, "DelayLoopCalibrationCache: using cached calibration result for \"" << name << "\".");
+  return true;
+}
+
+void DelayLoopCalibrationCache::store(std::string const& name, std::vector<unsigned int> const& values)
+{
+  if (m_path.empty())
+    return;
+  m_entries[name] = values;
+  std::ofstream file(m_path, std::ios_base::trunc);
+  if (!file)
+  {
+    // ~/.cache might not exist; not being able to cache is not an error.
+    Dout(dc::delayloop, "DelayLoopCalibrationCache: could not write \"" << m_path << "\".");
+    return;
+  }
+  file << host_fingerprint() << '\n';
+  for (auto&& entry : m_entries)
+  {
+    file << entry.first << '\t';
+    char const* separator = "";
+    for (unsigned int value : entry.second)
+    {
+      file << separator << value;
+      separator = " ";
+    }
+    file << '\n';
+  }
+}
+
+std::vector<std::vector<int>> core_clusters()
+{
+  unsigned int const number_of_cpus = std::thread::hardware_concurrency();
+  // Group the CPUs by maximum frequency, fastest first.
+  std::map<unsigned long, std::vector<int>, std::greater<unsigned long>> clusters_by_freq;
+  for (unsigned int cpu = 0; cpu < number_of_cpus; ++cpu)
+  {
+    std::ifstream max_freq_file("/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/cpufreq/cpuinfo_max_freq");
+    unsigned long max_freq;
+    if (!(max_freq_file >> max_freq))
+    {
+      // No usable sysfs information; assume a homogeneous host.
+      clusters_by_freq.clear();
+      break;
+    }
+    clusters_by_freq[max_freq].push_back(cpu);
+  }
+  std::vector<std::vector<int>> clusters;
+  for (auto&& cluster : clusters_by_freq)
+    clusters.push_back(std::move(cluster.second));
+  if (clusters.empty())
+  {
+    clusters.emplace_back();
+    for (unsigned int cpu = 0; cpu < number_of_cpus; ++cpu)
+      clusters[0].push_back(cpu);
+  }
+  return clusters;
+}
+
 } // namespace utils
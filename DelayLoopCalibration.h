@@ -28,6 +28,9 @@
 #include "debug.h"
 #include "utils/Global.h"
 #include <chrono>
+#include <map>
+#include <string>
+#include <vector>
 
 #if defined(CWDEBUG) && !defined(DOXYGEN)
 NAMESPACE_DEBUG_CHANNELS_START
@@ -72,6 +75,61 @@ class DelayLoopCalibrationBase
   virtual void set_fit_params(double a, double b) = 0;
 };
 
+// class DelayLoopCalibrationCache
+//
+// A persistent, per-host cache for calibration results, so that a process
+// restart can skip the hundreds of timed delay-loop executions that a full
+// calibration costs and just load the outcome of a previous run.
+//
+// The cache is a small text file in $XDG_CACHE_HOME (or ~/.cache), keyed by
+// a fingerprint of the host: CPU model name, microcode version and the
+// current clock source. When any of those changed - new hardware, a
+// microcode update, a switch from tsc to hpet - the whole cache is
+// considered stale and is silently discarded, forcing recalibration.
+// When neither environment variable is set, caching is disabled and
+// lookup() simply always fails.
+//
+// Usage:
+//
+//   utils::DelayLoopCalibrationCache cache;
+//   std::vector<unsigned int> values;
+//   if (!cache.lookup("my_delay_loop", values))
+//   {
+//     values = /* run the full calibration */;
+//     cache.store("my_delay_loop", values);
+//   }
+//
+class DelayLoopCalibrationCache
+{
+ private:
+  std::string m_path;                                           // Path of the cache file, or empty when caching is disabled.
+  std::map<std::string, std::vector<unsigned int>> m_entries;   // The (still valid) cached calibration results, by name.
+
+ public:
+  // Read the cache file, if any; entries are discarded when the host fingerprint changed.
+  DelayLoopCalibrationCache();
+
+  // Returns true and fills values when name is in the cache.
+  bool lookup(std::string const& name, std::vector<unsigned int>& values) const;
+
+  // Add (or overwrite) an entry and rewrite the cache file.
+  void store(std::string const& name, std::vector<unsigned int> const& values);
+
+  // A single line describing the hardware that calibration results depend on.
+  static std::string host_fingerprint();
+};
+
+// Returns the online CPUs grouped into clusters of identical core type.
+//
+// On hybrid hosts (Intel P/E-cores, ARM big.LITTLE) a delay loop calibrated
+// on one core type is off by the performance ratio on the other, so such
+// hosts need one calibration per cluster. Cores are grouped by their
+// cpuinfo_max_freq as reported by sysfs - cores of different types never
+// advertise the same maximum frequency - with the fastest cluster first.
+// On homogeneous hosts (or when sysfs is unavailable) a single cluster
+// containing every CPU is returned.
+std::vector<std::vector<int>> core_clusters();
+
 // class DelayLoopCalibration
 //
 // Finds a linear approximation for the delay in milliseconds (as double)
@@ -1,22 +1,98 @@
 #include "sys.h"
 #include "Dictionary.h"
+#include "nearest_power_of_two.h"
+#include <algorithm>
 
 namespace utils {
 
-size_t DictionaryBase::add_new_unique_word(std::string&& word)
+size_t DictionaryBase::add_new_unique_word(std::string_view const& word)
 {
-  size_t index = m_unique_words.size();
-  m_unique_words.emplace_back(std::move(word));
-  std::string& stored_word = m_unique_words.back();
-  m_string_view_to_index.emplace(stored_word, index);
+  // Keep the load factor at or below 50%, so that probe runs in lookup stay short.
+  if (AI_UNLIKELY(2 * (m_unique_words.size() + 1) > m_table.size()))
+    grow_table();
+  size_t const index = m_unique_words.size();
+  // Intern the word: append its bytes to the arena.
+  size_t const offset = m_word_arena.size();
+  bool const reallocates = offset + word.size() > m_word_arena.capacity();
+  m_word_arena.append(word.data(), word.size());
+  m_unique_words.push_back(Word{offset, word.size()});
+  if (AI_UNLIKELY(reallocates))
+    rebase_table();
+  std::string_view const stored_view(m_word_arena.data() + offset, word.size());
+  uint64_t const h = dictionary::hash(stored_view);
+  size_t pos = h & m_mask;
+  while (m_table[pos].m_word.data() != nullptr)
+    pos = (pos + 1) & m_mask;
+  m_table[pos] = Entry{h, index, stored_view};
   return index;
 }
 
+void DictionaryBase::grow_table()
+{
+  size_t const new_size = std::max(initial_table_size, nearest_power_of_two(2 * m_table.size()));
+  std::vector<Entry> new_table(new_size);
+  size_t const new_mask = new_size - 1;
+  for (Entry const& entry : m_table)
+  {
+    if (entry.m_word.data() == nullptr)
+      continue;
+    size_t pos = entry.m_hash & new_mask;
+    while (new_table[pos].m_word.data() != nullptr)
+      pos = (pos + 1) & new_mask;
+    new_table[pos] = entry;
+  }
+  m_table = std::move(new_table);
+  m_mask = new_mask;
+}
+
+void DictionaryBase::rebase_table()
+{
+  for (Entry& entry : m_table)
+  {
+    if (entry.m_word.data() == nullptr)
+      continue;
+    Word const& w = m_unique_words[entry.m_index];
+    entry.m_word = std::string_view(m_word_arena.data() + w.m_offset, w.m_length);
+  }
+}
+
 size_t DictionaryBase::add_extra_word(std::string_view const& word)
 {
-  std::string extra_word(word);
-  add_new_data(m_unique_words.size(), extra_word);
-  return add_new_unique_word(std::move(extra_word));
+  add_new_data(m_unique_words.size(), std::string(word));
+  return add_new_unique_word(word);
+}
+
+size_t ConcurrentDictionaryBase::add_new_unique_word(std::string&& word)
+{
+  std::lock_guard<std::mutex> lock(m_write_mutex);
+  size_t const index = m_unique_words.size();
+  m_unique_words.emplace_back(std::move(word));
+  std::string_view const stored_view(m_unique_words.back());
+
+  // Rebuild: copy the current snapshot into a new Table - doubled in size when
+  // the new word would push the load factor over 50% - and add the new entry.
+  Table const* old_table = m_current.load(std::memory_order_relaxed);
+  size_t new_size = old_table->m_entries.size();
+  if (2 * (index + 1) > new_size)
+    new_size *= 2;
+  auto new_table = std::make_unique<Table>(new_size);
+  new_table->m_words = old_table->m_words;
+  new_table->m_words.push_back(stored_view);
+  for (Entry const& entry : old_table->m_entries)
+    if (entry.m_word.data() != nullptr)
+      new_table->insert(entry);
+  new_table->insert(Entry{dictionary::hash(stored_view), index, stored_view});
+
+  // Publish; the old snapshot is retired (m_tables keeps it alive for readers
+  // that are still probing it) and freed by the destructor.
+  m_current.store(new_table.get(), std::memory_order_release);
+  m_tables.emplace_back(std::move(new_table));
+  return index;
+}
+
+size_t ConcurrentDictionaryBase::add_extra_word(std::string_view const& word)
+{
+  return add_new_unique_word(std::string(word));
 }
 
 } // namespace utils
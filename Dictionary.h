@@ -2,42 +2,130 @@
 
 #include "macros.h"
 #include "debug.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <iterator>
 #include <string_view>
 #include <string>
-#include <unordered_map>
 #include <deque>
 #include <vector>
 #include <exception>
 
 namespace utils {
 
+namespace dictionary {
+
+// One slot of the flat open-addressing (linear probing) hash tables below.
+// An entry is 32 bytes, so a probe run of two touches at most two cache lines
+// and in the common case - the hashes rarely collide - the key bytes are only
+// compared for the final, matching slot.
+struct Entry
+{
+  uint64_t m_hash;              // Precomputed hash of m_word.
+  size_t m_index;               // The value: an index into m_unique_words.
+  std::string_view m_word;      // The key; views word bytes owned by the dictionary (DictionaryBase: its
+                                // word arena, ConcurrentDictionaryBase: a deque of std::string).
+                                // data() == nullptr means the slot is empty.
+};
+
+// FNV-1a, with the basis perturbed by seed (see StaticDictionary).
+constexpr uint64_t hash(std::string_view const& word, uint64_t seed)
+{
+  uint64_t h = 0xcbf29ce484222325 ^ (seed * 0x9e3779b97f4a7c15);
+  for (char c : word)
+  {
+    h ^= static_cast<uint8_t>(c);
+    h *= 0x100000001b3;
+  }
+  return h;
+}
+
+// FNV-1a.
+constexpr uint64_t hash(std::string_view const& word)
+{
+  return hash(word, 0);
+}
+
+} // namespace dictionary
+
 class DictionaryBase
 {
  protected:
-  std::unordered_map<std::string_view, size_t> m_string_view_to_index;
-  std::deque<std::string> m_unique_words;       // This must be a random access container that can be accessed through an index and does not invalidate references.
+  using Entry = dictionary::Entry;
+
+  // An interned word: a range of m_word_arena.
+  struct Word
+  {
+    size_t m_offset;
+    size_t m_length;
+  };
+
+  static constexpr size_t initial_table_size = 16;      // Must be a power of two.
+
+  std::vector<Entry> m_table;                   // The hash table; the size is a power of two and
+                                                // at most half the slots are occupied.
+  size_t m_mask;                                // Always m_table.size() - 1.
+  std::string m_word_arena;                     // The bytes of all words, appended contiguously: iterating over
+                                                // or comparing against the dictionary walks sequential memory.
+  std::vector<Word> m_unique_words;             // Index to the range of m_word_arena holding that word.
 
  protected:
-  size_t add_new_unique_word(std::string&& word);
+  size_t add_new_unique_word(std::string_view const& word);
+  // Double the size of m_table and re-insert all entries.
+  void grow_table();
+  // Re-point the views of m_table into m_word_arena; called on the rare
+  // occasion that appending a word reallocated the arena.
+  void rebase_table();
 
  public:
+  DictionaryBase() : m_table(initial_table_size), m_mask(initial_table_size - 1) { }
+
   // This should be called when lookup throws.
   size_t add_extra_word(std::string_view const& word);
 
+  static constexpr size_t not_found = ~size_t{0};
+
+  // As lookup below, but returning not_found instead of throwing;
+  // for callers where an unknown word is not exceptional.
+  size_t find(std::string_view const& word) const noexcept
+  {
+    uint64_t const h = dictionary::hash(word);
+    for (size_t pos = h & m_mask;; pos = (pos + 1) & m_mask)
+    {
+      Entry const& entry = m_table[pos];
+      if (AI_UNLIKELY(entry.m_word.data() == nullptr))
+        return not_found;
+      if (AI_LIKELY(entry.m_hash == h) && entry.m_word == word)
+        return entry.m_index;
+    }
+  }
+
   struct NonExistingWord : std::exception { };
   size_t lookup(std::string_view const& word) const
   {
     //------------------------------------------------------------------------
     // This is the part that has to be fast.
-    auto iter = m_string_view_to_index.find(word);
-    if (AI_LIKELY(iter != m_string_view_to_index.end()))
-      return iter->second;
+    uint64_t const h = dictionary::hash(word);
+    for (size_t pos = h & m_mask;; pos = (pos + 1) & m_mask)
+    {
+      Entry const& entry = m_table[pos];
+      if (AI_UNLIKELY(entry.m_word.data() == nullptr))  // Empty slot: the word does not exist
+        break;                                          // (the load factor is kept at or below 50%, so probe runs are short).
+      if (AI_LIKELY(entry.m_hash == h) && entry.m_word == word)
+        return entry.m_index;
+    }
     //------------------------------------------------------------------------
 
     throw NonExistingWord{};
   }
 
-  std::string const& word(int i) const { return m_unique_words[i]; }
+  std::string_view word(int i) const
+  {
+    Word const& w = m_unique_words[i];
+    return { m_word_arena.data() + w.m_offset, w.m_length };
+  }
 
  private:
   // This does nothing, unless this is a DictionaryData class.
@@ -125,18 +213,11 @@ class Dictionary : public DictionaryBase
   // Pre-fill the dictionary with pre-defined words.
   // The idea is that if index_type is an enum, then add() should
   // be called for each enumerator in the enum sequentially.
-  void add(ENUM_TYPE index, std::string word)
+  void add(ENUM_TYPE index, std::string_view const& word)
   {
     // index must be sequential, starting with 0 and 1 larger every call.
     ASSERT(m_unique_words.size() == static_cast<size_t>(index));
-    this->add_new_unique_word(std::move(word));
-  }
-
-  void add(ENUM_TYPE index, std::string_view&& word)
-  {
-    // index must be sequential, starting with 0 and 1 larger every call.
-    ASSERT(m_unique_words.size() == static_cast<size_t>(index));
-    this->add_new_unique_word(std::string{word});
+    this->add_new_unique_word(word);
   }
 
   // Return a unique index for each unique word.
@@ -232,4 +313,334 @@ class DictionaryData : public Dictionary<ENUM_TYPE, INDEX_TYPE>
   operator[](enum_type index) const { return m_data[static_cast<index_type>(static_cast<size_t>(index))]; }
 };
 
+// StaticDictionary
+//
+// The compile-time counterpart of Dictionary, for word sets that are fully
+// known at compile time (protocol keywords, enumerator names, ...): a perfect
+// hash over the words is constructed during constant evaluation, so index()
+// is one hash plus a single compare against constant tables in .rodata -
+// nothing is built at static-init time and nothing is hashed into a table at
+// startup.
+//
+// The perfect hash is the usual "hash, displace, compare" two-level scheme:
+// the 64-bit FNV-1a hash of the word selects a bucket whose displacement
+// value, found by a compile-time greedy search (retried with a new hash seed
+// in the rare case that the search fails), moves every word to a distinct
+// slot of a table with a load factor of at most 50%.
+//
+// Usage:
+//
+// enum protocol_keyword {
+//   get,
+//   put,
+//   post
+// };
+//
+// struct ProtocolWords {
+//   static constexpr std::string_view words[] = { "GET", "PUT", "POST" };    // words[i] is the word of enumerator i.
+// };
+//
+// using protocol_dictionary = utils::StaticDictionary<ProtocolWords, protocol_keyword>;
+//
+// protocol_keyword k = protocol_dictionary::index("PUT");    // Throws NonExistingWord when unknown.
+// ASSERT(k == put);
+// size_t i = protocol_dictionary::find("BLAH");              // As find of DictionaryBase: returns not_found instead.
+// ASSERT(i == protocol_dictionary::not_found);
+// static_assert(protocol_dictionary::word(post) == "POST");
+//
+template<typename WORDS, typename INDEX_TYPE = size_t>
+class StaticDictionary
+{
+ public:
+  using index_type = INDEX_TYPE;
+
+  static constexpr size_t size = std::size(WORDS::words);
+  static constexpr size_t not_found = DictionaryBase::not_found;
+  using NonExistingWord = DictionaryBase::NonExistingWord;
+
+  static_assert(size > 0, "WORDS::words must not be empty.");
+  static_assert(std::is_enum_v<index_type> || std::is_constructible_v<index_type, size_t>,
+      "INDEX_TYPE must be an enum or constructible from a size_t.");
+
+ private:
+  static constexpr size_t power_of_two_of_at_least(size_t n)
+  {
+    size_t p = 1;
+    while (p < n)
+      p *= 2;
+    return p;
+  }
+
+  static constexpr size_t bucket_count = power_of_two_of_at_least(size);      // One displacement value per bucket.
+  static constexpr size_t slot_count = power_of_two_of_at_least(2 * size);    // Load factor at most 50%, as with DictionaryBase.
+  static constexpr uint32_t empty = 0xffffffff;
+
+  struct Tables
+  {
+    uint64_t m_seed;                    // The hash seed that the greedy search succeeded with.
+    uint32_t m_disp[bucket_count];      // Displacement per bucket.
+    uint32_t m_index[slot_count];       // Slot to word index, or empty.
+  };
+
+  static constexpr bool all_words_unique()
+  {
+    for (size_t i = 0; i < size; ++i)
+      for (size_t j = i + 1; j < size; ++j)
+        if (WORDS::words[i] == WORDS::words[j])
+          return false;
+    return true;
+  }
+  static_assert(all_words_unique(), "WORDS::words contains a duplicate word.");
+
+  // FNV-1a avalanches poorly in its upper bits for short, similar keys, while
+  // the bucket (low bits) and the slot (high bits) must be independent here;
+  // finalize it with murmur3's fmix64.
+  static constexpr uint64_t mix(uint64_t h)
+  {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccd;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53;
+    h ^= h >> 33;
+    return h;
+  }
+
+  // The slot that word i hashes to, given its hash and the displacement of its bucket.
+  static constexpr size_t slot_of(uint64_t word_hash, uint32_t disp)
+  {
+    return (static_cast<uint32_t>(word_hash >> 32) + disp) & (slot_count - 1);
+  }
+
+  // Greedily place all buckets, largest first; returns false when some bucket
+  // has no displacement that puts all of its words in free slots (try the next seed).
+  static constexpr bool try_build(Tables& tables, uint64_t seed)
+  {
+    uint64_t word_hash[size] = {};
+    uint32_t bucket_size[bucket_count] = {};
+    uint32_t largest = 0;
+    for (size_t i = 0; i < size; ++i)
+    {
+      word_hash[i] = mix(dictionary::hash(WORDS::words[i], seed));
+      uint32_t const b = word_hash[i] & (bucket_count - 1);
+      if (++bucket_size[b] > largest)
+        largest = bucket_size[b];
+    }
+    // Counting sort the word indexes by bucket, so that below only the words
+    // of the bucket at hand are visited (and not all words per trial).
+    uint32_t bucket_start[bucket_count + 1] = {};
+    for (size_t b = 0; b < bucket_count; ++b)
+      bucket_start[b + 1] = bucket_start[b] + bucket_size[b];
+    uint32_t members[size] = {};
+    {
+      uint32_t next[bucket_count] = {};
+      for (size_t b = 0; b < bucket_count; ++b)
+        next[b] = bucket_start[b];
+      for (size_t i = 0; i < size; ++i)
+        members[next[word_hash[i] & (bucket_count - 1)]++] = i;
+    }
+    bool used[slot_count] = {};
+    for (uint32_t current_size = largest; current_size >= 1; --current_size)
+      for (size_t b = 0; b < bucket_count; ++b)
+      {
+        if (bucket_size[b] != current_size)
+          continue;
+        size_t slots[size] = {};        // The slots of this bucket for the displacement being tried.
+        uint32_t disp = 0;
+        for (;; ++disp)
+        {
+          if (disp == slot_count)
+            return false;       // No displacement works (e.g. two words of this bucket always land on the same slot).
+          bool ok = true;
+          for (uint32_t m = bucket_start[b]; m < bucket_start[b + 1] && ok; ++m)
+          {
+            size_t const slot = slot_of(word_hash[members[m]], disp);
+            if (used[slot])
+              ok = false;
+            else
+            {
+              // Also reject a collision between two words of this same bucket.
+              for (uint32_t n = bucket_start[b]; n < m && ok; ++n)
+                if (slots[n - bucket_start[b]] == slot)
+                  ok = false;
+              slots[m - bucket_start[b]] = slot;
+            }
+          }
+          if (ok)
+            break;
+        }
+        // Commit this bucket.
+        tables.m_disp[b] = disp;
+        for (uint32_t m = bucket_start[b]; m < bucket_start[b + 1]; ++m)
+        {
+          used[slots[m - bucket_start[b]]] = true;
+          tables.m_index[slots[m - bucket_start[b]]] = members[m];
+        }
+      }
+    return true;
+  }
+
+  static constexpr Tables build()
+  {
+    for (uint64_t seed = 0;; ++seed)
+    {
+      Tables tables = {};
+      for (size_t slot = 0; slot < slot_count; ++slot)
+        tables.m_index[slot] = empty;
+      if (try_build(tables, seed))
+      {
+        tables.m_seed = seed;
+        return tables;
+      }
+    }
+  }
+
+  static constexpr Tables s_tables = build();
+
+ public:
+  // As DictionaryBase::find: returns not_found when word is unknown.
+  static constexpr size_t find(std::string_view const& word) noexcept
+  {
+    uint64_t const h = mix(dictionary::hash(word, s_tables.m_seed));
+    size_t const slot = slot_of(h, s_tables.m_disp[h & (bucket_count - 1)]);
+    uint32_t const i = s_tables.m_index[slot];
+    if (AI_LIKELY(i != empty && WORDS::words[i] == word))
+      return i;
+    return not_found;
+  }
+
+  // As DictionaryBase::lookup: throws NonExistingWord when word is unknown.
+  static constexpr size_t lookup(std::string_view const& word)
+  {
+    size_t const i = find(word);
+    if (AI_UNLIKELY(i == not_found))
+      throw NonExistingWord{};
+    return i;
+  }
+
+  // See Dictionary::index.
+  static constexpr index_type index(std::string_view const& word) { return static_cast<index_type>(lookup(word)); }
+
+  // Return the word that index i was assigned to.
+  static constexpr std::string_view word(size_t i) { return WORDS::words[i]; }
+};
+
+// The concurrent counterpart of DictionaryBase/Dictionary.
+//
+// The documented way to share a Dictionary between threads is to wrap it in
+// aithreadsafe with a ReadWrite policy (see above), which makes every lookup()
+// take a read lock. When words are almost never added but looked up constantly,
+// that read lock is pure overhead: here the lookup structure is an immutable
+// snapshot that writers rebuild and publish with a single release-store, and
+// readers pick up with a single acquire-load - the read path takes no lock,
+// performs no read-modify-write and therefore never contends.
+//
+// Writers (add() / add_extra_word()) are serialized with a mutex and rebuild
+// the whole table per insertion; that is O(n), which is fine because insertion
+// is rare by assumption. Superseded snapshots are retired, not deleted: a
+// reader can still be probing one. They are freed by the destructor, at which
+// point no reader may be active anymore; since the table doubles in size when
+// it grows, all retired snapshots together are at most the size of the current
+// one.
+//
+class ConcurrentDictionaryBase
+{
+ protected:
+  using Entry = dictionary::Entry;
+
+  // An immutable snapshot of the lookup structure. Once published it is never modified.
+  struct Table
+  {
+    size_t m_mask;                              // m_entries.size() - 1; the size is a power of two.
+    std::vector<Entry> m_entries;               // The open-addressing hash table; see DictionaryBase.
+    std::vector<std::string_view> m_words;      // Index to word; views the std::strings stored in m_unique_words.
+
+    Table(size_t size) : m_mask(size - 1), m_entries(size) { }
+
+    void insert(Entry const& entry)
+    {
+      size_t pos = entry.m_hash & m_mask;
+      while (m_entries[pos].m_word.data() != nullptr)
+        pos = (pos + 1) & m_mask;
+      m_entries[pos] = entry;
+    }
+  };
+
+  static constexpr size_t initial_table_size = 16;      // Must be a power of two.
+
+  std::atomic<Table*> m_current;                // The published snapshot that readers probe.
+  std::mutex m_write_mutex;                     // Serializes the writers.
+  std::vector<std::unique_ptr<Table>> m_tables; // Owns the current and all retired snapshots. Only accessed by writers.
+  std::deque<std::string> m_unique_words;       // The word storage; references stay valid. Only accessed by writers.
+
+ protected:
+  size_t add_new_unique_word(std::string&& word);
+
+ public:
+  ConcurrentDictionaryBase()
+  {
+    m_tables.emplace_back(std::make_unique<Table>(initial_table_size));
+    m_current.store(m_tables.back().get(), std::memory_order_relaxed);
+  }
+
+  // This should be called when lookup throws.
+  size_t add_extra_word(std::string_view const& word);
+
+  using NonExistingWord = DictionaryBase::NonExistingWord;
+  size_t lookup(std::string_view const& word) const
+  {
+    //------------------------------------------------------------------------
+    // This is the part that has to be fast.
+    uint64_t const h = dictionary::hash(word);
+    Table const* table = m_current.load(std::memory_order_acquire);
+    for (size_t pos = h & table->m_mask;; pos = (pos + 1) & table->m_mask)
+    {
+      Entry const& entry = table->m_entries[pos];
+      if (AI_UNLIKELY(entry.m_word.data() == nullptr))
+        break;
+      if (AI_LIKELY(entry.m_hash == h) && entry.m_word == word)
+        return entry.m_index;
+    }
+    //------------------------------------------------------------------------
+
+    throw NonExistingWord{};
+  }
+
+  // Return the word that index i was assigned to. Unlike DictionaryBase::word
+  // this returns a view (into storage that is never freed before destruction),
+  // read from the same snapshot mechanism as lookup(), so that it is safe to
+  // call concurrently with writers. i must have been obtained from lookup() or
+  // add_extra_word().
+  std::string_view word(int i) const { return m_current.load(std::memory_order_acquire)->m_words[i]; }
+};
+
+// The drop-in concurrent counterpart of Dictionary; see the usage comment above
+// Dictionary. No external locking is needed: add() / add_extra_word() calls may
+// run concurrently with each other and with index() / lookup() of other threads.
+template<typename ENUM_TYPE, typename INDEX_TYPE>
+class ConcurrentDictionary : public ConcurrentDictionaryBase
+{
+ public:
+  using enum_type = ENUM_TYPE;
+  using index_type = INDEX_TYPE;
+
+  static_assert(std::is_convertible_v<ENUM_TYPE, size_t>, "ENUM_TYPE must be convertible to size_t.");
+  static_assert(std::is_constructible_v<index_type, size_t>, "INDEX_TYPE must be constructible from a size_t.");
+
+  // Pre-fill the dictionary with pre-defined words; see Dictionary::add.
+  void add(ENUM_TYPE index, std::string word)
+  {
+    DEBUG_ONLY(size_t new_index =) this->add_new_unique_word(std::move(word));
+    // index must be sequential, starting with 0 and 1 larger every call.
+    ASSERT(new_index == static_cast<size_t>(index));
+  }
+
+  void add(ENUM_TYPE index, std::string_view&& word)
+  {
+    add(index, std::string{word});
+  }
+
+  // See Dictionary::index.
+  index_type index(std::string_view const& word) const { return static_cast<index_type>(this->lookup(word)); }
+};
+
 } // namespace utils
@@ -0,0 +1,225 @@
+/**
+ * ai-utils -- C++ Core utilities
+ *
+ * @file
+ * @brief Implementation of FastClock.
+ *
+ * @Copyright (C) 2021  Carlo Wood.
+ *
+ * RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+ * Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+ *
+ * This file is part of ai-utils.
+ *
+ * ai-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ai-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ai-utils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sys.h"
+#include "FastClock.h"
+#include "DelayLoopCalibration.h"
+#include "debug.h"
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#if defined(__x86_64__)
+#include <cpuid.h>
+#endif
+
+namespace utils {
+
+//static
+std::atomic<int> FastClock::s_state{FastClock::uninitialized};
+
+#if defined(__x86_64__)
+
+//static
+std::atomic<uint32_t> FastClock::s_seq{0};
+//static
+std::atomic<uint64_t> FastClock::s_tsc_base{0};
+//static
+std::atomic<int64_t> FastClock::s_ns_base{0};
+//static
+std::atomic<uint64_t> FastClock::s_ns_per_tick_q32{0};
+//static
+std::atomic_flag FastClock::s_resync_lock = ATOMIC_FLAG_INIT;
+//static
+uint64_t FastClock::s_resync_ticks;
+
+namespace {
+
+// The TSC is only usable as a wall clock when it runs at a constant rate,
+// independent of frequency scaling and C-states: CPUID leaf 0x80000007,
+// EDX bit 8 ("Invariant TSC").
+bool has_invariant_tsc()
+{
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx))
+    return false;
+  return (edx & (1 << 8)) != 0;
+}
+
+// The kernel demotes tsc as clock source when it found it to be unstable
+// (unsynchronized sockets, broken firmware); trust its verdict over CPUID.
+// When sysfs is unavailable (a container) the CPUID bit is all we have.
+bool clocksource_allows_tsc()
+{
+  std::ifstream clocksource("/sys/devices/system/clocksource/clocksource0/current_clocksource");
+  std::string name;
+  if (!(clocksource >> name))
+    return true;
+  return name == "tsc";
+}
+
+// Return a (TSC, CLOCK_MONOTONIC) pair that belong to the same moment as
+// closely as possible: out of eight attempts, keep the one where the two
+// rdtsc's bracketing the clock_gettime are the fewest ticks apart (a wide
+// bracket means we were interrupted), and attribute the reading to the
+// middle of the bracket.
+void best_sample(uint64_t& tsc_out, int64_t& ns_out) noexcept
+{
+  uint64_t best_width = std::numeric_limits<uint64_t>::max();
+  for (int attempt = 0; attempt < 8; ++attempt)
+  {
+    uint64_t const tsc0 = __builtin_ia32_rdtsc();
+    int64_t const ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    uint64_t const tsc1 = __builtin_ia32_rdtsc();
+    if (tsc1 - tsc0 < best_width)
+    {
+      best_width = tsc1 - tsc0;
+      tsc_out = tsc0 + (tsc1 - tsc0) / 2;
+      ns_out = ns;
+    }
+  }
+}
+
+// Measure the TSC frequency in kHz against CLOCK_MONOTONIC over ~20 ms.
+// The resulting rate only has to be good to ~0.1%; resynchronize() slews
+// away the residual error within a few intervals.
+unsigned int measure_tsc_khz()
+{
+  uint64_t tsc0, tsc1;
+  int64_t ns0, ns1;
+  best_sample(tsc0, ns0);
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  best_sample(tsc1, ns1);
+  if (ns1 <= ns0 || tsc1 <= tsc0)
+    return 0;
+  double const khz = (tsc1 - tsc0) * 1e6 / (ns1 - ns0);
+  if (khz < 1e5 || khz > 1e7)   // Outside 100 MHz - 10 GHz? Don't trust it.
+    return 0;
+  return static_cast<unsigned int>(khz + 0.5);
+}
+
+} // namespace
+
+// Re-discipline the TSC-to-nanoseconds conversion against CLOCK_MONOTONIC.
+//
+// Called from the first now() that notices that s_resync_ticks have passed
+// since the current epoch; costs that caller one clock_gettime. The new
+// epoch is based at what the *old* parameters return for the sample moment,
+// so the clock never steps; the measured offset error is instead corrected
+// by adjusting the rate, clamped to +/- 1/64th so that FastClock always
+// stays close to real time even directly after a bad sample.
+//static
+void FastClock::resynchronize() noexcept
+{
+  if (s_resync_lock.test_and_set(std::memory_order_acquire))
+    return;                                     // Another thread is already re-disciplining.
+
+  uint64_t tsc;
+  int64_t mono_ns;
+  best_sample(tsc, mono_ns);
+
+  // We are the only writer (s_resync_lock), so these can't change underneath us.
+  uint64_t const tsc_base = s_tsc_base.load(std::memory_order_relaxed);
+  int64_t const ns_base = s_ns_base.load(std::memory_order_relaxed);
+  uint64_t const ns_per_tick_q32 = s_ns_per_tick_q32.load(std::memory_order_relaxed);
+
+  int64_t delta_ticks = static_cast<int64_t>(tsc - tsc_base);
+  if (AI_UNLIKELY(delta_ticks < 0))
+    delta_ticks = 0;
+  int64_t const fast_ns = ns_base + static_cast<int64_t>(static_cast<unsigned __int128>(delta_ticks) * ns_per_tick_q32 >> 32);
+  int64_t const error_ns = mono_ns - fast_ns;   // Positive when FastClock runs behind CLOCK_MONOTONIC.
+
+  // Slew the rate such that the error is gone by the next re-discipline.
+  double const interval_ns = s_resync_ticks * (ns_per_tick_q32 / 4294967296.0);
+  double const adjust = std::clamp(1.0 + error_ns / interval_ns, 1.0 - 1.0 / 64, 1.0 + 1.0 / 64);
+
+  uint32_t const seq = s_seq.load(std::memory_order_relaxed);
+  s_seq.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  s_tsc_base.store(tsc, std::memory_order_relaxed);
+  s_ns_base.store(fast_ns, std::memory_order_relaxed);
+  s_ns_per_tick_q32.store(static_cast<uint64_t>(ns_per_tick_q32 * adjust), std::memory_order_relaxed);
+  s_seq.store(seq + 2, std::memory_order_release);
+
+  s_resync_lock.clear(std::memory_order_release);
+}
+
+#endif // __x86_64__
+
+//static
+int FastClock::initialize()
+{
+  static std::mutex mutex;
+  std::lock_guard<std::mutex> lock(mutex);
+  int state = s_state.load(std::memory_order_relaxed);
+  if (state != uninitialized)
+    return state;
+  state = use_steady_clock;
+#if defined(__x86_64__)
+  try
+  {
+    if (has_invariant_tsc() && clocksource_allows_tsc())
+    {
+      // The frequency is a property of the host; cache it across runs so
+      // that a restart skips the 20 ms measurement.
+      unsigned int tsc_khz = 0;
+      DelayLoopCalibrationCache cache;
+      std::vector<unsigned int> values;
+      if (cache.lookup("FastClock", values) && values.size() == 1)
+        tsc_khz = values[0];
+      else if ((tsc_khz = measure_tsc_khz()) != 0)
+        cache.store("FastClock", { tsc_khz });
+      if (tsc_khz != 0)
+      {
+        uint64_t tsc;
+        int64_t mono_ns;
+        best_sample(tsc, mono_ns);
+        s_tsc_base.store(tsc, std::memory_order_relaxed);
+        s_ns_base.store(mono_ns, std::memory_order_relaxed);
+        s_ns_per_tick_q32.store(static_cast<uint64_t>(4294967296.0 * 1e6 / tsc_khz), std::memory_order_relaxed);
+        s_resync_ticks = static_cast<uint64_t>(tsc_khz) * 1000;         // Re-discipline about once per second.
+        state = use_tsc;
+        Dout(dc::notice, "FastClock: using the invariant TSC at " << tsc_khz << " kHz.");
+      }
+    }
+  }
+  catch (...)
+  {
+    // Calibration is an optimization; never let it escape through the noexcept now().
+    state = use_steady_clock;
+  }
+  if (state == use_steady_clock)
+    Dout(dc::notice, "FastClock: falling back to steady_clock.");
+#endif
+  s_state.store(state, std::memory_order_release);
+  return state;
+}
+
+} // namespace utils
@@ -0,0 +1,181 @@
+/**
+ * ai-utils -- C++ Core utilities
+ *
+ * @file
+ * @brief Definition of class FastClock.
+ *
+ * @Copyright (C) 2021  Carlo Wood.
+ *
+ * RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+ * Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+ *
+ * This file is part of ai-utils.
+ *
+ * ai-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ai-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ai-utils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "cpu_relax.h"
+#include "macros.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace utils {
+
+// class FastClock
+//
+// A drop-in replacement for std::chrono::steady_clock whose now() does not
+// enter the kernel - not even the vDSO: on x86-64 with an invariant TSC it
+// is an rdtsc plus a multiplication, against ~20ns (and a serializing read)
+// for clock_gettime(CLOCK_MONOTONIC). Code that timestamps millions of
+// times per second - probes, lock profilers, histograms - should use this
+// as its time base; Probe (Probe.h) records raw cycle *deltas* and doesn't
+// need it, but anything that wants comparable nanosecond timestamps does.
+//
+// now() returns (approximately) the same epoch and value as steady_clock:
+// the TSC reading is converted to nanoseconds with a ratio that is
+// calibrated on first use (and cached across runs, see
+// DelayLoopCalibrationCache) and then re-disciplined against
+// CLOCK_MONOTONIC about once per second. The re-discipline is piggy-backed
+// onto whatever call to now() notices that the interval expired, and slews
+// the conversion rate - NTP style - instead of stepping the clock, so that
+// FastClock stays continuous and monotonic while tracking CLOCK_MONOTONIC
+// to within a few microseconds.
+//
+// When the TSC cannot be trusted - no invariant-TSC CPUID bit, a kernel
+// that demoted tsc as clock source, or a non-x86-64 host - now() silently
+// falls back to steady_clock::now(); correctness never depends on the fast
+// path. Use is_fast() to find out (and to front-load the first-use
+// calibration at a convenient moment).
+//
+// Usage:
+//
+//   auto start = utils::FastClock::now();
+//   ...
+//   std::chrono::nanoseconds delta = utils::FastClock::now() - start;
+//
+class FastClock
+{
+ public:
+  using rep = int64_t;
+  using period = std::nano;
+  using duration = std::chrono::nanoseconds;
+  using time_point = std::chrono::time_point<FastClock>;
+  static constexpr bool is_steady = true;
+
+  static time_point now() noexcept;
+
+  // Returns true when now() uses the TSC fast path.
+  // Triggers the first-use calibration when now() was never called before.
+  static bool is_fast() noexcept;
+
+ private:
+  enum state_type : int
+  {
+    uninitialized,              // First call to now() still has to happen.
+    use_tsc,                    // rdtsc plus conversion.
+    use_steady_clock            // Graceful fallback.
+  };
+
+  static std::atomic<int> s_state;
+
+  // Calibrate on first use; returns the new value of s_state.
+  static int initialize();
+
+  // The current time according to CLOCK_MONOTONIC, in nanoseconds since its epoch.
+  static int64_t steady_now_ns() noexcept
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+#if defined(__x86_64__)
+  // The parameters that convert a TSC reading to nanoseconds:
+  //
+  //   ns = s_ns_base + (tsc - s_tsc_base) * s_ns_per_tick_q32 / 2^32
+  //
+  // s_ns_per_tick_q32 is the calibrated nanoseconds-per-tick ratio as a
+  // 32.32 fixed point number (a tick is 0.2 - 1 ns, so it fits easily).
+  // resynchronize() replaces all three with a new, continuous epoch about
+  // once per second; the seqlock s_seq (odd while a write is in progress)
+  // lets readers detect a torn triple and retry - the fast path pays only
+  // two uncontended loads of s_seq for this.
+  static std::atomic<uint32_t> s_seq;
+  static std::atomic<uint64_t> s_tsc_base;
+  static std::atomic<int64_t> s_ns_base;
+  static std::atomic<uint64_t> s_ns_per_tick_q32;
+  static std::atomic_flag s_resync_lock;
+
+  // The number of ticks between two re-disciplines (about one second).
+  // Written once by initialize(), before s_state is set to use_tsc.
+  static uint64_t s_resync_ticks;
+
+  // Re-discipline the conversion against CLOCK_MONOTONIC (see FastClock.cxx).
+  static void resynchronize() noexcept;
+
+  static int64_t tsc_now_ns() noexcept
+  {
+    uint64_t const tsc = __builtin_ia32_rdtsc();
+    uint64_t tsc_base;
+    int64_t ns_base;
+    uint64_t ns_per_tick_q32;
+    for (;;)
+    {
+      uint32_t const seq = s_seq.load(std::memory_order_acquire);
+      if (AI_LIKELY(!(seq & 1)))
+      {
+        tsc_base = s_tsc_base.load(std::memory_order_relaxed);
+        ns_base = s_ns_base.load(std::memory_order_relaxed);
+        ns_per_tick_q32 = s_ns_per_tick_q32.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (AI_LIKELY(s_seq.load(std::memory_order_relaxed) == seq))
+          break;
+      }
+      cpu_relax();
+    }
+    // The TSC is synchronized across cores, but not perfectly: right after a
+    // resynchronize() on another core our reading can be a few ticks before
+    // the new base. Clamp instead of letting the subtraction wrap.
+    int64_t delta_ticks = static_cast<int64_t>(tsc - tsc_base);
+    if (AI_UNLIKELY(delta_ticks < 0))
+      delta_ticks = 0;
+    if (AI_UNLIKELY(delta_ticks >= static_cast<int64_t>(s_resync_ticks)))
+      resynchronize();          // Returns immediately when another thread is already on it.
+    return ns_base + static_cast<int64_t>(static_cast<unsigned __int128>(delta_ticks) * ns_per_tick_q32 >> 32);
+  }
+#endif
+};
+
+inline FastClock::time_point FastClock::now() noexcept
+{
+  int state = s_state.load(std::memory_order_acquire);
+  if (AI_UNLIKELY(state == uninitialized))
+    state = initialize();
+#if defined(__x86_64__)
+  if (AI_LIKELY(state == use_tsc))
+    return time_point(duration(tsc_now_ns()));
+#endif
+  return time_point(duration(steady_now_ns()));
+}
+
+inline bool FastClock::is_fast() noexcept
+{
+  int state = s_state.load(std::memory_order_acquire);
+  if (AI_UNLIKELY(state == uninitialized))
+    state = initialize();
+  return state == use_tsc;
+}
+
+} // namespace utils
@@ -0,0 +1,208 @@
+/**
+ * ai-utils -- C++ Core utilities
+ *
+ * @file
+ * @brief Definition of class FuzzyBoolArray.
+ *
+ * @Copyright (C) 2021  Carlo Wood.
+ *
+ * RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+ * Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+ *
+ * This file is part of ai-utils.
+ *
+ * ai-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ai-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ai-utils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "FuzzyBool.h"
+#include "debug.h"
+#include <cstdint>
+#include <vector>
+
+namespace utils {
+
+// class FuzzyBoolArray
+//
+// A packed array of FuzzyBool values with bit-parallel bulk logic.
+//
+// Each value is stored as its 2-bit code (m_val >> 2): F=00, U=01, L=10,
+// T=11 - in that order the fuzzy AND of two values is simply the *minimum*
+// of their codes, OR is the maximum and NOT is the complement (verify
+// against the tables in FuzzyBool.h). min/max/complement of packed 2-bit
+// lanes need only a handful of boolean word operations, so the bulk
+// operators below process 32 values per 64-bit word instead of doing 32
+// table lookups.
+//
+// Usage:
+//
+//   utils::FuzzyBoolArray states(1000, fuzzy::True);
+//   states.set(13, fuzzy::WasFalse);
+//   states &= other_states;                      // Element-wise fuzzy AND.
+//   states |= more_states;                       // Element-wise fuzzy OR.
+//   states.invert();                             // Element-wise fuzzy NOT.
+//   utils::FuzzyBool all = states.reduce_and();  // The conjunction of all values.
+//   utils::FuzzyBool any = states.reduce_or();   // The disjunction of all values.
+//
+class FuzzyBoolArray
+{
+ public:
+  static constexpr int values_per_word = 32;
+
+ private:
+  static constexpr uint64_t low_bits = 0x5555555555555555UL;    // The low bit of every 2-bit lane.
+
+  std::vector<uint64_t> m_words;        // The packed codes; value i is stored in bits [2i, 2i+2) of word i / 32.
+  size_t m_size;                        // The number of values. Unused lanes of the last word are kept zero.
+
+  static constexpr uint64_t code(FuzzyBoolPOD fb) { return static_cast<uint64_t>(fb.m_val) >> 2; }
+  static constexpr FuzzyBoolEnum enum_of(uint64_t code) { return static_cast<FuzzyBoolEnum>(code << 2); }
+
+  // Element-wise fuzzy AND of two packed words: the minimum of every pair of 2-bit lanes.
+  static uint64_t and_words(uint64_t w1, uint64_t w2)
+  {
+    uint64_t const l1 = w1 & low_bits;
+    uint64_t const h1 = (w1 >> 1) & low_bits;
+    uint64_t const l2 = w2 & low_bits;
+    uint64_t const h2 = (w2 >> 1) & low_bits;
+    uint64_t const min_h = h1 & h2;
+    // The low bit of min(v1, v2): both low bits set, or the low bit of the strictly smaller value.
+    uint64_t const min_l = (l1 & l2) | (l1 & ~h1 & h2) | (l2 & ~h2 & h1);
+    return (min_h << 1) | min_l;
+  }
+
+  // Element-wise fuzzy OR: the maximum of every pair of 2-bit lanes. By De
+  // Morgan (fuzzy NOT being the complement): max(v1, v2) = ~min(~v1, ~v2).
+  static uint64_t or_words(uint64_t w1, uint64_t w2)
+  {
+    return ~and_words(~w1, ~w2);
+  }
+
+  // Returns a mask with the lanes of the last word that hold a value.
+  uint64_t last_word_mask() const
+  {
+    int const used = m_size - (m_words.size() - 1) * values_per_word;
+    return used == values_per_word ? ~static_cast<uint64_t>(0) : (static_cast<uint64_t>(1) << (2 * used)) - 1;
+  }
+
+ public:
+  // Construct an array of size values, all equal to init.
+  FuzzyBoolArray(size_t size, FuzzyBoolPOD init = fuzzy::False) : m_words((size + values_per_word - 1) / values_per_word), m_size(size)
+  {
+    if (code(init) != 0 && !m_words.empty())
+    {
+      uint64_t const pattern = code(init) * low_bits;   // The code replicated in every lane.
+      for (uint64_t& word : m_words)
+        word = pattern;
+      m_words.back() &= last_word_mask();
+    }
+  }
+
+  // Construct an array as a packed copy of the size values at values.
+  FuzzyBoolArray(FuzzyBoolPOD const* values, size_t size) : m_words((size + values_per_word - 1) / values_per_word), m_size(size)
+  {
+    for (size_t i = 0; i < size; ++i)
+      m_words[i / values_per_word] |= code(values[i]) << (2 * (i % values_per_word));
+  }
+
+  size_t size() const { return m_size; }
+
+  FuzzyBool operator[](size_t i) const
+  {
+    ASSERT(i < m_size);
+    return FuzzyBool{enum_of((m_words[i / values_per_word] >> (2 * (i % values_per_word))) & 3)};
+  }
+
+  void set(size_t i, FuzzyBoolPOD fb)
+  {
+    ASSERT(i < m_size);
+    uint64_t& word = m_words[i / values_per_word];
+    int const shift = 2 * (i % values_per_word);
+    word = (word & ~(static_cast<uint64_t>(3) << shift)) | (code(fb) << shift);
+  }
+
+  // Unpack into the size() FuzzyBoolPOD values at values.
+  void unpack(FuzzyBoolPOD* values) const
+  {
+    for (size_t i = 0; i < m_size; ++i)
+      values[i].m_val = enum_of((m_words[i / values_per_word] >> (2 * (i % values_per_word))) & 3);
+  }
+
+  // Element-wise fuzzy AND with arr. Both arrays must have the same size.
+  FuzzyBoolArray& operator&=(FuzzyBoolArray const& arr)
+  {
+    ASSERT(m_size == arr.m_size);
+    for (size_t w = 0; w < m_words.size(); ++w)
+      m_words[w] = and_words(m_words[w], arr.m_words[w]);
+    return *this;
+  }
+
+  // Element-wise fuzzy OR with arr. Both arrays must have the same size.
+  FuzzyBoolArray& operator|=(FuzzyBoolArray const& arr)
+  {
+    ASSERT(m_size == arr.m_size);
+    for (size_t w = 0; w < m_words.size(); ++w)
+      m_words[w] = or_words(m_words[w], arr.m_words[w]);
+    return *this;
+  }
+
+  // Element-wise fuzzy NOT.
+  void invert()
+  {
+    for (uint64_t& word : m_words)
+      word = ~word;
+    if (!m_words.empty())
+      m_words.back() &= last_word_mask();       // Keep the unused lanes zero.
+  }
+
+  // Returns the fuzzy AND over all values; True when the array is empty.
+  FuzzyBool reduce_and() const
+  {
+    if (m_size == 0)
+      return FuzzyBool{fuzzy_true};
+    uint64_t result = m_words.back() | ~last_word_mask();       // Fill the unused lanes with T, the AND identity.
+    for (size_t w = 0; w < m_words.size() - 1; ++w)
+      result = and_words(result, m_words[w]);
+    // Fold the 32 lanes of the last word; shifted-in zeroes are masked to T.
+    for (int shift = 32; shift >= 2; shift >>= 1)
+      result = and_words(result, (result >> shift) | (~static_cast<uint64_t>(0) << (64 - shift)));
+    return FuzzyBool{enum_of(result & 3)};
+  }
+
+  // Returns the fuzzy OR over all values; False when the array is empty.
+  FuzzyBool reduce_or() const
+  {
+    if (m_size == 0)
+      return FuzzyBool{fuzzy_false};
+    uint64_t result = m_words[0];               // Unused lanes are zero: F, the OR identity.
+    for (size_t w = 1; w < m_words.size(); ++w)
+      result = or_words(result, m_words[w]);
+    for (int shift = 32; shift >= 2; shift >>= 1)
+      result = or_words(result, result >> shift);
+    return FuzzyBool{enum_of(result & 3)};
+  }
+
+  friend bool operator==(FuzzyBoolArray const& arr1, FuzzyBoolArray const& arr2)
+  {
+    return arr1.m_size == arr2.m_size && arr1.m_words == arr2.m_words;
+  }
+
+  friend bool operator!=(FuzzyBoolArray const& arr1, FuzzyBoolArray const& arr2)
+  {
+    return !(arr1 == arr2);
+  }
+};
+
+} // namespace utils
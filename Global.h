@@ -156,10 +156,13 @@
 #error "You cannot define DEBUGGLOBAL without having CWDEBUG, CWDEBUG_ALLOC and CWDEBUG_LOCATION defined."
 #endif
 #endif
-#ifdef DEBUGGLOBAL
 #include "utils/macros.h"
+#ifdef DEBUGGLOBAL
 #include <execinfo.h>   // For backtrace(3).
 #endif
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <new>
 
 // Forward declarations.
@@ -204,6 +207,7 @@ namespace _internal_
   protected:
     static char instance_[/*sizeof(InstanceDummy)*/];
     static char initialized;
+    static std::atomic<TYPE*> instance_ptr_;    // The final TYPE*, published (once) when initialization completed; see instance_fast().
 #ifdef DEBUGGLOBAL
     static bool initialized_and_after_global_constructors;
     static bool instantiated_from_constructor;
@@ -218,6 +222,7 @@ public:
 
   public:
     static inline TYPE& instance();
+    static inline TYPE& instance_fast();
 
 #ifdef DEBUGGLOBAL
   private:
@@ -431,9 +436,13 @@ template<class TYPE, int inst, class CONVERTER>
 void Global<TYPE, inst, CONVERTER>::initialize_instance_()
 {
   base_type::initialized = -1;				// Stop Global<TYPE, inst>::Global() from calling us again.
+  auto const start = std::chrono::steady_clock::now();	// Always-on: two clock reads per global, and this runs once.
   Instance* globalObject = new (base_type::instance_) Instance(inst);
+  auto const stop = std::chrono::steady_clock::now();
   base_type::initialized = 1;
-  Singleton<GlobalObjectManager>::instance().registerGlobalObject(globalObject);
+  base_type::instance_ptr_.store(static_cast<TYPE*>(globalObject), std::memory_order_release);	// Publish the final pointer for instance_fast().
+  Singleton<GlobalObjectManager>::instance().registerGlobalObject(globalObject,
+      std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count());
 }
 
 namespace utils {
@@ -449,6 +458,9 @@ namespace utils {
     template<class TYPE, int inst>
     char GlobalBase<TYPE, inst>::initialized;
 
+    template<class TYPE, int inst>
+    std::atomic<TYPE*> GlobalBase<TYPE, inst>::instance_ptr_{nullptr};  // Constant-initialized: usable before any dynamic initialization ran.
+
     template<class TYPE, int inst>
     inline TYPE& GlobalBase<TYPE, inst>::instance()
     {
@@ -460,6 +472,24 @@ namespace utils {
       return *static_cast<TYPE*>(ptr);	// If `instance_' is not yet initialized, then define DEBUGGLOBAL to find out why.
     }
 
+    // The fast accessor for hot paths: once initialization completed (and the
+    // final object pointer was published by initialize_instance_()) this is a
+    // single relaxed load plus dereference, which the compiler can hoist out
+    // of loops. Before that it falls back to instance(), including all of its
+    // DEBUGGLOBAL checking.
+    //
+    // The relaxed load is sufficient because the pointer is published before
+    // main() is entered (from the static constructor of the Global<> object),
+    // and thus before any thread that can call instance_fast() is created.
+    template<class TYPE, int inst>
+    inline TYPE& GlobalBase<TYPE, inst>::instance_fast()
+    {
+      TYPE* ptr = instance_ptr_.load(std::memory_order_relaxed);
+      if (AI_UNLIKELY(ptr == nullptr))
+        return instance();
+      return *ptr;
+    }
+
 #ifdef DEBUGGLOBAL
     template<class TYPE, int inst>
     bool GlobalBase<TYPE, inst>::initialized_and_after_global_constructors = false;
@@ -29,6 +29,15 @@
 #include "GlobalObjectManager.h"
 #include "debug.h"
 
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <typeinfo>
+
 #ifdef CWDEBUG
 #include <libcwd/cwprint.h>
 #endif
@@ -40,9 +49,10 @@ bool GlobalObjectManager::after_global_constructors = false;
 #endif
 
 /// @cond Doxygen_Suppress
-void GlobalObjectManager::registerGlobalObject(GlobalObject* globalObject)
+void GlobalObjectManager::registerGlobalObject(GlobalObject* globalObject, uint64_t nanoseconds)
 {
   globalObjects.push_back(globalObject);
+  initializationTimes.push_back({globalObject, typeid(*globalObject).name(), nanoseconds});
 }
 
 void GlobalObjectManager::deleteGlobalObjects()
@@ -60,6 +70,144 @@ void GlobalObjectManager::deleteGlobalObjects()
 }
 /// @endcond
 
+std::vector<GlobalObjectManager::InitializationTime> GlobalObjectManager::initializationReport() const
+{
+  std::vector<InitializationTime> report(initializationTimes.begin(), initializationTimes.end());
+  std::sort(report.begin(), report.end(),
+      [](InitializationTime const& lhs, InitializationTime const& rhs){ return lhs.nanoseconds > rhs.nanoseconds; });
+  return report;
+}
+
+void GlobalObjectManager::dumpInitializationReport(std::ostream& os) const
+{
+  std::vector<InitializationTime> const report = initializationReport();
+  uint64_t total = 0;
+  for (InitializationTime const& entry : report)
+    total += entry.nanoseconds;
+  os << "Global/singleton initialization, most expensive first (total " << total << " ns):\n";
+  for (InitializationTime const& entry : report)
+  {
+    os << "  " << entry.nanoseconds << " ns : ";
+#ifdef DEBUGGLOBAL
+    entry.object->print_type_name(os);
+#else
+    os << entry.type_name;
+#endif
+    os << '\n';
+  }
+}
+
+void GlobalObjectManager::registerInitializer(char const* name, void (*function)(), std::vector<char const*> dependencies)
+{
+  initializers.push_back({name, function, std::move(dependencies)});
+}
+
+void GlobalObjectManager::runInitializers(unsigned int number_of_threads)
+{
+  size_t const number_of_tasks = initializers.size();
+  if (number_of_tasks == 0)
+    return;
+
+  // Build the dependency graph.
+  auto index_of = [this, number_of_tasks](char const* name) -> size_t {
+    for (size_t i = 0; i < number_of_tasks; ++i)
+      if (std::strcmp(initializers[i].name, name) == 0)
+        return i;
+    return number_of_tasks;
+  };
+  std::vector<std::vector<size_t>> dependents(number_of_tasks);
+  std::vector<int> blockers(number_of_tasks, 0);
+  for (size_t i = 0; i < number_of_tasks; ++i)
+    for (char const* dependency : initializers[i].dependencies)
+    {
+      size_t const di = index_of(dependency);
+      // Every declared dependency must name a registered initializer.
+      ASSERT(di < number_of_tasks);
+      dependents[di].push_back(i);
+      ++blockers[i];
+    }
+
+  std::mutex mutex;
+  std::condition_variable condition;
+  std::vector<size_t> ready;
+  size_t completed = 0;
+  std::exception_ptr error;
+
+  for (size_t i = 0; i < number_of_tasks; ++i)
+    if (blockers[i] == 0)
+      ready.push_back(i);
+
+#ifdef CWDEBUG
+  // Detect dependency cycles up front, by simulating the schedule.
+  {
+    std::vector<int> simulated_blockers = blockers;
+    std::vector<size_t> queue = ready;
+    size_t seen = 0;
+    while (!queue.empty())
+    {
+      size_t const i = queue.back();
+      queue.pop_back();
+      ++seen;
+      for (size_t dependent : dependents[i])
+        if (--simulated_blockers[dependent] == 0)
+          queue.push_back(dependent);
+    }
+    // The declared dependencies may not contain a cycle.
+    ASSERT(seen == number_of_tasks);
+  }
+#endif
+
+  auto worker = [&](){
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;)
+    {
+      if (completed == number_of_tasks || error)
+        return;
+      if (ready.empty())
+      {
+        condition.wait(lock);
+        continue;
+      }
+      size_t const i = ready.back();
+      ready.pop_back();
+      lock.unlock();
+      try
+      {
+        initializers[i].function();
+      }
+      catch (...)
+      {
+        lock.lock();
+        if (!error)
+          error = std::current_exception();
+        condition.notify_all();
+        return;
+      }
+      lock.lock();
+      ++completed;
+      for (size_t dependent : dependents[i])
+        if (--blockers[dependent] == 0)
+          ready.push_back(dependent);
+      condition.notify_all();
+    }
+  };
+
+  if (number_of_threads == 0)
+    number_of_threads = std::thread::hardware_concurrency();
+  number_of_threads = std::max<size_t>(1, std::min<size_t>(number_of_threads, number_of_tasks));
+  std::vector<std::thread> threads;
+  threads.reserve(number_of_threads - 1);
+  for (unsigned int t = 1; t < number_of_threads; ++t)
+    threads.emplace_back(worker);
+  worker();                     // The calling thread participates too.
+  for (std::thread& thread : threads)
+    thread.join();
+
+  initializers.clear();
+  if (error)
+    std::rethrow_exception(error);
+}
+
 #ifdef DEBUGGLOBAL
 void GlobalObjectManager::main_entered()
 {
@@ -33,6 +33,8 @@
 #include "Singleton.h"
 #include "debug.h"
 
+#include <cstdint>
+#include <iosfwd>
 #include <vector>
 
 #if defined(CWDEBUG) && CWDEBUG_ALLOC
@@ -47,14 +49,27 @@
 class GlobalObjectManager : public Singleton<GlobalObjectManager>
 {
   friend_Instance;
+public:
+  /// The measured construction cost of one global/singleton; see initializationReport.
+  struct InitializationTime
+  {
+    utils::_internal_::GlobalObject const* object;      ///< The instance; used for the type name when DEBUGGLOBAL is defined.
+    char const* type_name;                              ///< The (mangled) type name of the instance.
+    uint64_t nanoseconds;                               ///< The duration of its construction.
+  };
+
 private:
 #if defined(CWDEBUG) && CWDEBUG_ALLOC
   using globalObjects_type = std::vector<utils::_internal_::GlobalObject*,
       libcwd::_private_::auto_internal_allocator::rebind<utils::_internal_::GlobalObject*>::other>;
+  using initializationTimes_type = std::vector<InitializationTime,
+      libcwd::_private_::auto_internal_allocator::rebind<InitializationTime>::other>;
 #else
   using globalObjects_type = std::vector<utils::_internal_::GlobalObject*>;
+  using initializationTimes_type = std::vector<InitializationTime>;
 #endif
   globalObjects_type globalObjects;
+  initializationTimes_type initializationTimes;
   int number_of_global_objects;
 
 private:
@@ -77,7 +92,47 @@ private:
   void deleteGlobalObjects();
 
 public:
-  void registerGlobalObject(utils::_internal_::GlobalObject* globalObject);
+  void registerGlobalObject(utils::_internal_::GlobalObject* globalObject, uint64_t nanoseconds = 0);
+
+  /// Return the construction cost of every global/singleton initialized so
+  /// far, sorted by cost (most expensive first): when startup regresses this
+  /// answers "which Global was at fault" without bisecting.
+  std::vector<InitializationTime> initializationReport() const;
+
+  /// Write initializationReport() to os (e.g. std::cerr), one line per global.
+  void dumpInitializationReport(std::ostream& os) const;
+
+  /// An initialization task for runInitializers; see registerInitializer.
+  struct Initializer
+  {
+    char const* name;                           ///< Unique name of this task.
+    void (*function)();                         ///< The initialization function to call.
+    std::vector<char const*> dependencies;      ///< Names of tasks that must have completed before this one may run.
+  };
+
+  /// Register an initialization task.
+  ///
+  /// The construction of Global<>/Singleton objects happens during static
+  /// initialization and is necessarily sequential; the expensive part of
+  /// application start up is usually the subsequent initialization of those
+  /// (sub)systems. Such initialization can be registered here as a named task,
+  /// optionally declaring which other tasks it depends on (the default is:
+  /// no dependencies), and then be run - independent tasks in parallel - by
+  /// calling runInitializers() at the top of main().
+  void registerInitializer(char const* name, void (*function)(), std::vector<char const*> dependencies = {});
+
+  /// Run all registered initialization tasks and return when all completed.
+  ///
+  /// The dependency graph is topologically sorted and independent tasks run
+  /// concurrently on (at most) number_of_threads threads, the calling thread
+  /// included; 0 means std::thread::hardware_concurrency(). A dependency on
+  /// an unregistered name, or a dependency cycle, is a bug (ASSERT'ed).
+  /// When a task throws, no new tasks are started and the exception is
+  /// rethrown here. The list of registered tasks is cleared afterwards.
+  void runInitializers(unsigned int number_of_threads = 0);
+
+private:
+  std::vector<Initializer> initializers;
 
 #ifndef DEBUGGLOBAL
 private:
@@ -0,0 +1,182 @@
+/**
+ * ai-utils -- C++ Core utilities
+ *
+ * @file
+ * @brief Definition of InplaceFunction.
+ *
+ * @Copyright (C) 2021  Carlo Wood.
+ *
+ * RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+ * Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+ *
+ * This file is part of ai-utils.
+ *
+ * ai-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ai-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ai-utils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "debug.h"
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+#include <new>
+
+// Just like std::function, InplaceFunction will wrap any callable and hide its
+// actual type, exposing only its signature - and unlike FunctionView it *owns*
+// its callable, so it may outlive it. Unlike std::function however the callable
+// is stored in a fixed-size buffer inside the InplaceFunction itself: it never
+// allocates. A callable that doesn't fit the buffer is rejected at compile time
+// (increase max_size at the declaration in that case).
+//
+// InplaceFunction is move-only, which means that - again unlike std::function -
+// it can own non-copyable callables, such as a lambda that captured a
+// std::unique_ptr or a std::promise. This makes it the right type for task
+// queues: tasks are produced in one place, moved into the queue, moved out and
+// invoked, without a single heap allocation.
+//
+// Example use:
+//
+//   utils::InplaceFunction<void()> task = [ptr = std::move(some_unique_ptr)]{ ptr->run(); };
+//   queue.push(std::move(task));
+//   ...
+//   queue.pop()();
+//
+// The default max_size of six pointers makes sizeof(InplaceFunction) exactly
+// 64 bytes (one cache line) on x86-64.
+
+namespace utils {
+
+template<typename T, std::size_t max_size = 6 * sizeof(void*)>
+class InplaceFunction;  // Undefined.
+
+template<typename RetT, typename... ArgT, std::size_t max_size>
+class InplaceFunction<RetT(ArgT...), max_size> final
+{
+ public:
+  // Default constructor. Creates an empty InplaceFunction.
+  InplaceFunction() noexcept : m_call(nullptr), m_manage(nullptr) { }
+  // Constructor that accepts nullptr. Also creates an empty InplaceFunction.
+  InplaceFunction(std::nullptr_t) noexcept : InplaceFunction() { }
+
+  // Constructor for lambdas and other callables (including function pointers);
+  // it accepts every type except InplaceFunction itself (we have the move
+  // constructor for that).
+  template<typename F,
+      typename std::enable_if<
+          !std::is_same<InplaceFunction,
+                        typename std::remove_cv<typename std::remove_reference<F>::type>::type>::value>::type* = nullptr>
+  InplaceFunction(F&& f)
+  {
+    using Functor = typename std::decay<F>::type;
+    static_assert(sizeof(Functor) <= max_size,
+        "This callable does not fit the inline buffer of this InplaceFunction; increase its max_size template parameter.");
+    static_assert(alignof(Functor) <= alignof(std::max_align_t),
+        "This callable is over-aligned for the inline buffer of InplaceFunction.");
+    static_assert(std::is_nothrow_move_constructible<Functor>::value,
+        "InplaceFunction requires a nothrow move-constructible callable (it is moved when the InplaceFunction is moved).");
+    new (static_cast<void*>(m_storage)) Functor(std::forward<F>(f));
+    m_call = Call<Functor>;
+    m_manage = Manage<Functor>;
+  }
+
+  InplaceFunction(InplaceFunction&& other) noexcept : m_call(other.m_call), m_manage(other.m_manage)
+  {
+    if (m_manage)
+      m_manage(Op::move_construct, m_storage, other.m_storage);
+    other.reset();
+  }
+
+  InplaceFunction& operator=(InplaceFunction&& other) noexcept
+  {
+    if (this != &other)
+    {
+      if (m_manage)
+        m_manage(Op::destroy, m_storage, nullptr);
+      m_call = other.m_call;
+      m_manage = other.m_manage;
+      if (m_manage)
+        m_manage(Op::move_construct, m_storage, other.m_storage);
+      other.reset();
+    }
+    return *this;
+  }
+
+  InplaceFunction& operator=(std::nullptr_t) noexcept
+  {
+    if (m_manage)
+      m_manage(Op::destroy, m_storage, nullptr);
+    m_call = nullptr;
+    m_manage = nullptr;
+    return *this;
+  }
+
+  // Owning a callable means: not copyable (the callable might not be).
+  InplaceFunction(InplaceFunction const&) = delete;
+  InplaceFunction& operator=(InplaceFunction const&) = delete;
+
+  ~InplaceFunction()
+  {
+    if (m_manage)
+      m_manage(Op::destroy, m_storage, nullptr);
+  }
+
+  RetT operator()(ArgT... args)
+  {
+    ASSERT(m_call);
+    return m_call(m_storage, static_cast<ArgT&&>(args)...);
+  }
+
+  // Returns true if we have a callable, false if we don't (i.e., we're null).
+  explicit operator bool() const { return !!m_call; }
+
+ private:
+  enum class Op { move_construct, destroy };
+
+  // Destroy the (moved-from) stored callable and become empty.
+  void reset() noexcept
+  {
+    if (m_manage)
+      m_manage(Op::destroy, m_storage, nullptr);
+    m_call = nullptr;
+    m_manage = nullptr;
+  }
+
+  template<typename Functor>
+  static RetT Call(void* storage, ArgT&&... args)
+  {
+    return (*static_cast<Functor*>(storage))(std::forward<ArgT>(args)...);
+  }
+
+  template<typename Functor>
+  static void Manage(Op op, void* storage, void* from)
+  {
+    if (op == Op::move_construct)
+      new (storage) Functor(std::move(*static_cast<Functor*>(from)));
+    else
+      static_cast<Functor*>(storage)->~Functor();
+  }
+
+  // The inline buffer that the callable lives in.
+  alignas(std::max_align_t) unsigned char m_storage[max_size];
+  // Pointer to a dispatch function that knows the type of the callable thing
+  // that's stored in m_storage, and how to call it. An InplaceFunction object
+  // is empty (null) iff m_call is null.
+  RetT (*m_call)(void*, ArgT&&...);
+  // Pointer to a dispatch function that knows how to move and destroy the
+  // callable thing that's stored in m_storage.
+  void (*m_manage)(Op, void*, void*);
+};
+
+} // namespace utils
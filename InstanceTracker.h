@@ -29,7 +29,11 @@
 
 #include "threadsafe/aithreadsafe.h"
 #include "utils/print_using.h"
+#include "utils/cpu_relax.h"
+#include "utils/macros.h"
+#include <atomic>
 #include <set>
+#include <vector>
 #include "debug.h"
 
 #if defined(CWDEBUG) && !defined(DOXYGEN)
@@ -110,6 +114,174 @@ class InstanceCollection : public InstanceCollectionTracker
       func(instance);
   }
 
+  // As for_each_instance(), but the mutex is only held while copying the
+  // instance pointers into buffer; func is then invoked without any lock held,
+  // so that a slow func does not block add() and remove() of other threads.
+  //
+  // The price is that the caller must guarantee that the instances stay alive
+  // until the pass is finished by other means: for_each_instance() excludes
+  // remove() - and therefore destruction of a tracked instance - for its whole
+  // duration, for_each_snapshot() only while taking the snapshot. An instance
+  // that is removed after that is still passed to func.
+  //
+  // buffer is cleared first and retains its capacity afterwards, so that a
+  // buffer that is reused for a periodic pass stops allocating once it reached
+  // the high-water mark of the collection.
+  void for_each_snapshot(std::function<void(T const*)> const& func, std::vector<T const*>& buffer) const
+  {
+    buffer.clear();
+    {
+      typename collection_t::crat collection_r(m_collection);
+      buffer.insert(buffer.end(), collection_r->begin(), collection_r->end());
+    }
+    for (T const* instance : buffer)
+      func(instance);
+  }
+
+ private:
+#ifdef CWDEBUG
+  // Implementation of base class interface.
+  void dump() const override
+  {
+    Dout(dc::tracker, "Instances of " << type_info_of<T>().demangled_name() << ":");
+    debug::Indent indent(2);
+    for_each_instance([&](T const* instance)
+    {
+      Dout(dc::tracker, utils::print_using(*instance, &T::print_tracker_info_on));
+    });
+  }
+#endif
+};
+
+// The read-mostly counterpart of InstanceCollection.
+//
+// InstanceCollection takes a mutex in add(), remove() and for_each_instance();
+// when something like a stats scraper iterates the instances every second,
+// every constructor and destructor of the tracked type can stall behind it.
+// Here the instances live in chunked blocks of atomic slots:
+//
+// - add() claims a free slot with a single compare-exchange and returns it,
+//   so that remove() is a single store into that slot - neither ever blocks,
+//   in particular not behind a for_each_instance() in progress.
+// - for_each_instance() announces itself by incrementing a reader counter and
+//   walks the slots lock-free; blocks are never freed (before destruction of
+//   the collection itself), so the walk is always safe.
+// - Only remove() synchronizes with readers: after clearing its slot it waits
+//   until no for_each_instance() that might still have loaded the pointer is
+//   in progress, because the instance is about to be destructed. When no
+//   iteration is in flight - the common case - that check is a single load.
+//
+template<typename T>
+class ConcurrentInstanceCollection : public InstanceCollectionTracker
+{
+ public:
+  static constexpr int block_size = 64;         // The number of instance slots per block.
+
+  struct Block
+  {
+    std::atomic<T*> m_instances[block_size];    // The tracked instances; nullptr means the slot is free.
+    std::atomic<Block*> m_next;                 // The next block, allocated on demand when all slots are in use.
+
+    Block() : m_next(nullptr)
+    {
+      for (int slot = 0; slot < block_size; ++slot)
+        m_instances[slot].store(nullptr, std::memory_order_relaxed);
+    }
+  };
+
+ private:
+  Block m_first_block;                          // The head of the block chain; part of the collection itself.
+  mutable std::atomic<int> m_readers;           // The number of for_each_instance() calls in progress (mutated by the const for_each_instance()).
+
+ public:
+  ConcurrentInstanceCollection() : m_readers(0) { }
+
+  ~ConcurrentInstanceCollection()
+  {
+    // All tracked instances must have been destructed before their collection.
+    Block* block = m_first_block.m_next.load(std::memory_order_relaxed);
+    while (block)
+    {
+      Block* next = block->m_next.load(std::memory_order_relaxed);
+      delete block;
+      block = next;
+    }
+  }
+
+  // Claim a free slot for instance and return it (to be passed to remove()).
+  std::atomic<T*>* add(T* instance)
+  {
+    for (Block* block = &m_first_block;; )
+    {
+      for (int slot = 0; slot < block_size; ++slot)
+      {
+        T* expected = nullptr;
+        if (block->m_instances[slot].load(std::memory_order_relaxed) == nullptr &&
+            block->m_instances[slot].compare_exchange_strong(expected, instance, std::memory_order_release))
+          return &block->m_instances[slot];
+      }
+      Block* next = block->m_next.load(std::memory_order_acquire);
+      if (!next)
+      {
+        // All slots in use; append a new block. If another thread beats us to
+        // it, delete ours again and continue in theirs.
+        Block* new_block = new Block;
+        if (block->m_next.compare_exchange_strong(next, new_block, std::memory_order_acq_rel))
+          next = new_block;
+        else
+          delete new_block;
+      }
+      block = next;
+    }
+  }
+
+  // Release the slot that add() returned. Waits until no reader that might
+  // still use the instance is left, because it is about to be destructed.
+  void remove(std::atomic<T*>* slot)
+  {
+    slot->store(nullptr, std::memory_order_release);
+    while (AI_UNLIKELY(m_readers.load(std::memory_order_acquire) != 0))
+      cpu_relax();
+  }
+
+  void for_each_instance(std::function<void(T const*)> const& func) const
+  {
+    m_readers.fetch_add(1, std::memory_order_acquire);
+    for (Block const* block = &m_first_block; block; block = block->m_next.load(std::memory_order_acquire))
+      for (int slot = 0; slot < block_size; ++slot)
+      {
+        T const* instance = block->m_instances[slot].load(std::memory_order_acquire);
+        if (instance)
+          func(instance);
+      }
+    m_readers.fetch_sub(1, std::memory_order_release);
+  }
+
+  // As for_each_instance(), but the reader count is only held while copying
+  // the instance pointers into buffer; func is then invoked entirely outside
+  // it. remove() spin-waits until m_readers is zero, so a slow func inside
+  // for_each_instance() still stalls every destructor of the tracked type;
+  // with for_each_snapshot() that window shrinks to the copy.
+  //
+  // The same caveat as for InstanceCollection::for_each_snapshot() applies:
+  // an instance that is removed after the snapshot was taken is still passed
+  // to func; the caller must guarantee its lifetime by other means.
+  void for_each_snapshot(std::function<void(T const*)> const& func, std::vector<T const*>& buffer) const
+  {
+    buffer.clear();
+    m_readers.fetch_add(1, std::memory_order_acquire);
+    for (Block const* block = &m_first_block; block; block = block->m_next.load(std::memory_order_acquire))
+      for (int slot = 0; slot < block_size; ++slot)
+      {
+        T const* instance = block->m_instances[slot].load(std::memory_order_acquire);
+        if (instance)
+          buffer.push_back(instance);
+      }
+    m_readers.fetch_sub(1, std::memory_order_release);
+    for (T const* instance : buffer)
+      func(instance);
+  }
+
  private:
 #ifdef CWDEBUG
   // Implementation of base class interface.
@@ -149,9 +321,72 @@ class InstanceTracker
   {
     s_collection.for_each_instance(func);
   }
+
+  // Invoke func on a snapshot of the instances, without holding the lock (see
+  // InstanceCollection::for_each_snapshot() for the lifetime caveat). Without
+  // a buffer argument a thread_local one is used that retains its capacity, so
+  // that a periodic pass does not allocate in the steady state.
+  static void for_each_snapshot(std::function<void(T const*)> const& func, std::vector<T const*>& buffer)
+  {
+    s_collection.for_each_snapshot(func, buffer);
+  }
+
+  static void for_each_snapshot(std::function<void(T const*)> const& func)
+  {
+    static thread_local std::vector<T const*> buffer;
+    s_collection.for_each_snapshot(func, buffer);
+  }
 };
 
 template<typename T>
 typename detail::InstanceCollection<T> InstanceTracker<T>::s_collection;
 
+// The read-mostly counterpart of InstanceTracker (see ConcurrentInstanceCollection
+// above): construction and destruction of the tracked type never block behind a
+// for_each_instance() of another thread. Use this instead of InstanceTracker when
+// instances are created and destroyed on hot paths while the collection is
+// iterated frequently.
+template<typename T>
+class ConcurrentInstanceTracker
+{
+ private:
+  static detail::ConcurrentInstanceCollection<T> s_collection;
+
+  std::atomic<T*>* m_tracker_slot;      // The slot in s_collection that this instance occupies.
+
+ protected:
+  ConcurrentInstanceTracker()
+  {
+    m_tracker_slot = s_collection.add(static_cast<T*>(this));
+  }
+
+  ~ConcurrentInstanceTracker()
+  {
+    s_collection.remove(m_tracker_slot);
+  }
+
+ public:
+  static void for_each_instance(std::function<void(T const*)> const& func)
+  {
+    s_collection.for_each_instance(func);
+  }
+
+  // Invoke func on a snapshot of the instances, keeping the reader window that
+  // remove() waits for as short as the copy (see
+  // ConcurrentInstanceCollection::for_each_snapshot() for the lifetime caveat).
+  static void for_each_snapshot(std::function<void(T const*)> const& func, std::vector<T const*>& buffer)
+  {
+    s_collection.for_each_snapshot(func, buffer);
+  }
+
+  static void for_each_snapshot(std::function<void(T const*)> const& func)
+  {
+    static thread_local std::vector<T const*> buffer;
+    s_collection.for_each_snapshot(func, buffer);
+  }
+};
+
+template<typename T>
+typename detail::ConcurrentInstanceCollection<T> ConcurrentInstanceTracker<T>::s_collection;
+
 } // namespace utils
@@ -29,16 +29,67 @@
 #include "MemoryPagePool.h"
 #include "log2.h"
 #include "nearest_power_of_two.h"
+#include <fstream>
+#include <string>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#ifndef MPOL_BIND
+#define MPOL_BIND 2     // From <numaif.h>, which is only present when libnuma-dev is installed.
+#endif
 
 namespace utils {
 
-MemoryPagePool::MemoryPagePool(size_t block_size, blocks_t minimum_chunk_size, blocks_t maximum_chunk_size) :
-  m_block_size(block_size), m_pool_blocks(0),
+namespace details {
+
+//static
+size_t MemoryPageSize::huge_page_size()
+{
+  static size_t const huge_page_size_ = [](){
+    // Read the default huge page size from /proc/meminfo; e.g. "Hugepagesize:       2048 kB".
+    std::ifstream meminfo("/proc/meminfo");
+    std::string line;
+    while (std::getline(meminfo, line))
+      if (line.compare(0, 13, "Hugepagesize:") == 0)
+        return std::stoul(line.substr(13)) * 1024;
+    return size_t{0x200000};    // Assume 2 MiB when /proc/meminfo doesn't tell us.
+  }();
+  return huge_page_size_;
+}
+
+} // namespace details
+
+//static
+thread_local MemoryPagePool::ThreadMagazines MemoryPagePool::tl_magazines;
+
+MemoryPagePool::ThreadMagazines::~ThreadMagazines()
+{
+  // Return all cached blocks to their pool. This requires that no MemoryPagePool that
+  // this thread allocated from was destructed yet, see the comment above allocate().
+  for (int i = 0; i < max_pools; ++i)
+    if (m_magazines[i].m_pool)
+      m_magazines[i].m_pool->flush(&m_magazines[i], 0);
+}
+
+void MemoryPagePool::flush(Magazine* magazine, int keep)
+{
+  SimpleSegregatedStorage::BlockList list;
+  while (magazine->m_count > keep)
+    list.push(magazine->m_blocks[--magazine->m_count]);
+  m_sss.deallocate_list(list);
+}
+
+MemoryPagePool::MemoryPagePool(size_t block_size, blocks_t minimum_chunk_size, blocks_t maximum_chunk_size, pages_type pages, int numa_node,
+    blocks_t warm_up_blocks) :
+  m_block_size(block_size), m_pages(pages), m_numa_node(numa_node), m_pool_blocks(0),
   m_minimum_chunk_size(minimum_chunk_size ? minimum_chunk_size : default_minimum_chunk_size()),
   m_maximum_chunk_size(maximum_chunk_size ? maximum_chunk_size : default_maximum_chunk_size(m_minimum_chunk_size))
 {
   // block_size must be a multiple of memory_page_size (and larger than 0).
   ASSERT(block_size % memory_page_size() == 0);
+  // With huge page backing, block_size must divide - or be a multiple of - the huge page
+  // size, so that chunks can be rounded up to whole huge pages without wasting blocks.
+  ASSERT(m_pages == conventional_pages || huge_page_size() % block_size == 0 || block_size % huge_page_size() == 0);
   // minimum_chunk_size must be larger or equal than 1.
   ASSERT(m_minimum_chunk_size >= 1);
   // maximum_chunk_size must be larger or equal than minimum_chunk_size.
@@ -50,6 +101,86 @@ MemoryPagePool::MemoryPagePool(size_t block_size, blocks_t minimum_chunk_size, b
   m_chunks.reserve(nearest_power_of_two(1 + log2(m_maximum_chunk_size)));
   Dout(dc::notice, "The block size (" << block_size << " bytes) is " << (block_size / memory_page_size()) << " times the memory page size on this machine.");
   Dout(dc::notice, "The capacity of m_chunks is " << m_chunks.capacity() << '.');
+
+  if (AI_UNLIKELY(warm_up_blocks > 0))
+    warm_up(warm_up_blocks);
+}
+
+bool MemoryPagePool::add_chunk()
+{
+  // First revive a lazily reclaimed chunk, if any (see reclaim_idle()); writing the
+  // free list pointers into its blocks cancels the MADV_FREE and soft-faults the
+  // pages back in as needed.
+  for (Chunk& chunk : m_chunks)
+    if (AI_UNLIKELY(chunk.m_advised))
+    {
+      chunk.m_advised = false;
+      m_sss.add_block(chunk.m_start, chunk.m_size, m_block_size);
+      return true;
+    }
+  blocks_t extra_blocks = std::clamp(m_pool_blocks.load(std::memory_order_relaxed), m_minimum_chunk_size, m_maximum_chunk_size);
+  size_t extra_size = extra_blocks * m_block_size;
+  void* chunk = new_chunk_memory(extra_size, extra_blocks);
+  if (AI_UNLIKELY(chunk == nullptr))
+    return false;
+  m_sss.add_block(chunk, extra_size, m_block_size);
+  m_pool_blocks += extra_blocks;
+  m_chunks.push_back({chunk, extra_size});
+  m_stats.count_grow();
+  chunk_added(chunk, extra_size);
+  return true;
+}
+
+void* MemoryPagePool::new_chunk_memory(size_t& size, blocks_t& blocks)
+{
+  void* chunk;
+  if (m_pages == huge_pages)
+  {
+    size_t const hps = huge_page_size();
+    // Round the chunk up to a whole number of huge pages; exact in blocks, see the ASSERT in the constructor.
+    size = ((size + hps - 1) / hps) * hps;
+    blocks = size / m_block_size;
+    chunk = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (chunk == MAP_FAILED)
+    {
+      // No (or no more) hugetlb pages are reserved on this machine; fall back to transparent
+      // huge pages: over-map so we can hand madvise a region aligned to the huge page size.
+      char* raw = static_cast<char*>(mmap(nullptr, size + hps, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+      if (AI_UNLIKELY(raw == MAP_FAILED))
+        return nullptr;
+      char* aligned = reinterpret_cast<char*>((reinterpret_cast<size_t>(raw) + hps - 1) & ~(hps - 1));
+      if (aligned > raw)
+        munmap(raw, aligned - raw);
+      if (aligned + size < raw + size + hps)
+        munmap(aligned + size, raw + hps - aligned);
+      madvise(aligned, size, MADV_HUGEPAGE);
+      chunk = aligned;
+    }
+  }
+  else
+  {
+    chunk = std::aligned_alloc(memory_page_size(), size);
+    if (AI_UNLIKELY(chunk == nullptr))
+      return nullptr;
+  }
+  if (AI_UNLIKELY(m_numa_node >= 0))
+  {
+    // Bind the chunk to the requested NUMA node, so that its pages are faulted in there
+    // regardless of which thread touches them first. Call the syscall directly to avoid
+    // a dependency on libnuma; failure (e.g. no NUMA support) is not fatal: the chunk
+    // then simply gets first-touch placement.
+    unsigned long nodemask = 1UL << m_numa_node;
+    syscall(SYS_mbind, chunk, size, MPOL_BIND, &nodemask, sizeof(nodemask) * 8 + 1, 0UL);
+  }
+  return chunk;
+}
+
+void MemoryPagePool::free_chunk(Chunk const& chunk)
+{
+  if (m_pages == huge_pages)
+    munmap(chunk.m_start, chunk.m_size);
+  else
+    std::free(chunk.m_start);
 }
 
 void MemoryPagePool::release()
@@ -57,9 +188,335 @@ void MemoryPagePool::release()
   DoutEntering(dc::notice, "MemoryPagePool::release()");
   std::scoped_lock<std::mutex> lock(m_sss.m_add_block_mutex);
   // Wink out any remaining allocations.
-  for (auto ptr : m_chunks)
-    std::free(ptr);
-  Dout(dc::notice, "current size is " << (m_pool_blocks * m_block_size) << " bytes.");
+  for (Chunk const& chunk : m_chunks)
+    free_chunk(chunk);
+  for (RunChunk const& chunk : m_run_chunks)
+    free_chunk({chunk.m_start, chunk.m_size});
+  Dout(dc::notice, "current size is " << (m_pool_blocks.load(std::memory_order_relaxed) * m_block_size) << " bytes.");
+}
+
+MemoryPagePool::blocks_t MemoryPagePool::shrink(blocks_t keep)
+{
+  DoutEntering(dc::notice, "MemoryPagePool::shrink(" << keep << ")");
+  // Holding m_add_block_mutex blocks chunk growth: a concurrent allocate() that finds the
+  // free list empty waits in try_allocate_more() until the surviving blocks are back.
+  std::scoped_lock<std::mutex> lock(m_sss.m_add_block_mutex);
+
+  // Detach the whole free list so we privately own every free block.
+  SimpleSegregatedStorage::BlockList list;
+  m_sss.detach_all(list);
+
+  // Count the number of free blocks per chunk.
+  auto chunk_of = [this](void* ptr) -> size_t {
+    for (size_t ci = 0; ci < m_chunks.size(); ++ci)
+      if (ptr >= m_chunks[ci].m_start && ptr < static_cast<char*>(m_chunks[ci].m_start) + m_chunks[ci].m_size)
+        return ci;
+    // Every block returned by allocate() lies inside one of our chunks.
+    ASSERT(false);
+    return 0;
+  };
+  std::vector<blocks_t> free_blocks(m_chunks.size(), 0);
+  {
+    SimpleSegregatedStorage::BlockList counted;
+    while (void* ptr = list.pop())
+    {
+      ++free_blocks[chunk_of(ptr)];
+      counted.push(ptr);
+    }
+    list = counted;
+  }
+
+  // Select fully free chunks for release, from the back, while the pool stays at or above keep blocks.
+  std::vector<bool> releasing(m_chunks.size(), false);
+  blocks_t released_blocks = 0;
+  for (size_t ci = m_chunks.size(); ci > 0; --ci)
+  {
+    blocks_t const chunk_blocks = m_chunks[ci - 1].m_size / m_block_size;
+    // A lazily reclaimed chunk is fully free by construction (its blocks just aren't on the free list).
+    bool const fully_free = m_chunks[ci - 1].m_advised || free_blocks[ci - 1] == chunk_blocks;
+    if (fully_free && m_pool_blocks.load(std::memory_order_relaxed) - released_blocks >= keep + chunk_blocks)
+    {
+      releasing[ci - 1] = true;
+      released_blocks += chunk_blocks;
+    }
+  }
+
+  // Give the surviving free blocks back to the free list and release the selected chunks.
+  if (released_blocks > 0)
+  {
+    SimpleSegregatedStorage::BlockList surviving;
+    while (void* ptr = list.pop())
+      if (!releasing[chunk_of(ptr)])
+        surviving.push(ptr);
+    list = surviving;
+    size_t wi = 0;
+    for (size_t ci = 0; ci < m_chunks.size(); ++ci)
+    {
+      if (releasing[ci])
+        free_chunk(m_chunks[ci]);
+      else
+        m_chunks[wi++] = m_chunks[ci];
+    }
+    m_chunks.resize(wi);
+    m_pool_blocks -= released_blocks;
+  }
+  m_sss.deallocate_list(list);
+
+  Dout(dc::notice, "Released " << released_blocks << " blocks (" << (released_blocks * m_block_size) << " bytes).");
+  return released_blocks;
+}
+
+MemoryPagePool::blocks_t MemoryPagePool::reclaim_idle(blocks_t keep)
+{
+  DoutEntering(dc::notice, "MemoryPagePool::reclaim_idle(" << keep << ")");
+#ifndef MADV_FREE
+  // Pre-4.5 kernel headers; nothing to reclaim lazily.
+  (void)keep;
+  return 0;
+#else
+  // See shrink() for why holding m_add_block_mutex makes this safe.
+  std::scoped_lock<std::mutex> lock(m_sss.m_add_block_mutex);
+
+  // Detach the whole free list so we privately own every free block.
+  SimpleSegregatedStorage::BlockList list;
+  m_sss.detach_all(list);
+
+  // Count the number of free blocks per chunk.
+  auto chunk_of = [this](void* ptr) -> size_t {
+    for (size_t ci = 0; ci < m_chunks.size(); ++ci)
+      if (ptr >= m_chunks[ci].m_start && ptr < static_cast<char*>(m_chunks[ci].m_start) + m_chunks[ci].m_size)
+        return ci;
+    // Every block returned by allocate() lies inside one of our chunks.
+    ASSERT(false);
+    return 0;
+  };
+  std::vector<blocks_t> free_blocks(m_chunks.size(), 0);
+  blocks_t total_free = 0;
+  {
+    SimpleSegregatedStorage::BlockList counted;
+    while (void* ptr = list.pop())
+    {
+      ++free_blocks[chunk_of(ptr)];
+      ++total_free;
+      counted.push(ptr);
+    }
+    list = counted;
+  }
+
+  // Select fully free chunks, from the back, while at least keep free blocks stay immediately usable.
+  std::vector<bool> advising(m_chunks.size(), false);
+  blocks_t advised_blocks = 0;
+  for (size_t ci = m_chunks.size(); ci > 0; --ci)
+  {
+    if (m_chunks[ci - 1].m_advised)
+      continue;
+    blocks_t const chunk_blocks = m_chunks[ci - 1].m_size / m_block_size;
+    if (free_blocks[ci - 1] == chunk_blocks && total_free - advised_blocks >= keep + chunk_blocks)
+    {
+      advising[ci - 1] = true;
+      advised_blocks += chunk_blocks;
+    }
+  }
+
+  if (advised_blocks > 0)
+  {
+    // The blocks of the selected chunks must stay off the free list: the kernel may
+    // zero MADV_FREE'd pages at any moment, which would destroy the chain pointers.
+    // They are put back, re-carved, by add_chunk() when the pool runs dry.
+    SimpleSegregatedStorage::BlockList surviving;
+    while (void* ptr = list.pop())
+      if (!advising[chunk_of(ptr)])
+        surviving.push(ptr);
+    list = surviving;
+    for (size_t ci = 0; ci < m_chunks.size(); ++ci)
+      if (advising[ci])
+      {
+        madvise(m_chunks[ci].m_start, m_chunks[ci].m_size, MADV_FREE);
+        m_chunks[ci].m_advised = true;
+      }
+  }
+  m_sss.deallocate_list(list);
+
+  Dout(dc::notice, "Advised away " << advised_blocks << " blocks (" << (advised_blocks * m_block_size) << " bytes).");
+  return advised_blocks;
+#endif
+}
+
+MemoryPagePool::blocks_t MemoryPagePool::warm_up(blocks_t blocks)
+{
+  DoutEntering(dc::notice, "MemoryPagePool::warm_up(" << blocks << ")");
+  // See shrink() for why holding m_add_block_mutex makes this safe.
+  std::scoped_lock<std::mutex> lock(m_sss.m_add_block_mutex);
+
+  // Grow the pool until it holds at least blocks blocks.
+  while (m_pool_blocks.load(std::memory_order_relaxed) < blocks)
+    if (AI_UNLIKELY(!add_chunk()))
+      break;                    // Out of memory; warm up what we did get.
+
+  blocks_t touched = 0;
+#ifdef MADV_POPULATE_WRITE
+  // Let the kernel fault all pages in at once; this doesn't alter their contents,
+  // so it is safe for chunks that have blocks currently handed out as well.
+  bool populated = true;
+  for (Chunk const& chunk : m_chunks)
+  {
+    // Leave lazily reclaimed chunks alone: faulting those back in would defeat reclaim_idle().
+    if (AI_UNLIKELY(chunk.m_advised))
+      continue;
+    if (AI_UNLIKELY(madvise(chunk.m_start, chunk.m_size, MADV_POPULATE_WRITE) == -1))
+    {
+      populated = false;        // Pre-5.14 kernel; fall through to touching by hand.
+      break;
+    }
+    touched += chunk.m_size / m_block_size;
+  }
+  if (AI_LIKELY(populated))
+  {
+    Dout(dc::notice, "Populated " << touched << " blocks (" << (touched * m_block_size) << " bytes).");
+    return touched;
+  }
+  touched = 0;
+#endif
+  // Touching must not write into blocks that are currently handed out: detach the
+  // free list, so that we privately own every free block and may dirty its pages.
+  SimpleSegregatedStorage::BlockList list;
+  m_sss.detach_all(list);
+  size_t const page_size = memory_page_size();
+  SimpleSegregatedStorage::BlockList warmed;
+  while (void* ptr = list.pop())
+  {
+    char* const block = static_cast<char*>(ptr);
+    for (size_t offset = 0; offset < m_block_size; offset += page_size)
+      *static_cast<char volatile*>(static_cast<void*>(block + offset)) = 0;
+    ++touched;
+    warmed.push(ptr);
+  }
+  m_sss.deallocate_list(warmed);
+
+  Dout(dc::notice, "Touched " << touched << " blocks (" << (touched * m_block_size) << " bytes).");
+  return touched;
+}
+
+//static
+long MemoryPagePool::find_free_run(std::vector<uint64_t> const& bitmap, blocks_t n)
+{
+  // carry is the number of free bits at the end of the preceding words that are
+  // contiguous with bit 0 of the current word; it lets runs cross word boundaries.
+  blocks_t carry = 0;
+  for (size_t w = 0; w < bitmap.size(); ++w)
+  {
+    uint64_t const occupied = bitmap[w];
+    if (carry > 0)
+    {
+      // The number of free bits at the bottom of this word.
+      blocks_t const lead = occupied ? __builtin_ctzll(occupied) : 64;
+      if (carry + lead >= n)
+        return static_cast<long>(w) * 64 - carry;
+    }
+    if (occupied == 0)
+    {
+      carry += 64;
+      if (carry >= n)
+        return static_cast<long>(w + 1) * 64 - carry;
+      continue;
+    }
+    if (n <= 64)
+    {
+      // After n - 1 times `f &= f >> 1`, bit b is set iff bits [b, b + n) are all free.
+      uint64_t f = ~occupied;
+      for (blocks_t i = 1; i < n && f; ++i)
+        f &= f >> 1;
+      if (f)
+        return static_cast<long>(w) * 64 + __builtin_ctzll(f);
+    }
+    // The number of free bits at the top of this word.
+    carry = (occupied & (uint64_t{1} << 63)) ? 0 : __builtin_clzll(occupied);
+  }
+  return -1;
+}
+
+//static
+void MemoryPagePool::mark_run(std::vector<uint64_t>& bitmap, blocks_t first, blocks_t n, bool occupied)
+{
+  while (n > 0)
+  {
+    size_t const w = first / 64;
+    int const bit = first % 64;
+    int const count = std::min(n, static_cast<blocks_t>(64 - bit));
+    uint64_t const mask = (count == 64 ? ~uint64_t{0} : ((uint64_t{1} << count) - 1)) << bit;
+    if (occupied)
+    {
+      // Double allocation of (part of) this run?!
+      ASSERT((bitmap[w] & mask) == 0);
+      bitmap[w] |= mask;
+    }
+    else
+    {
+      // Freeing (part of) a run that isn't allocated?!
+      ASSERT((bitmap[w] & mask) == mask);
+      bitmap[w] &= ~mask;
+    }
+    first += count;
+    n -= count;
+  }
+}
+
+void* MemoryPagePool::allocate_contiguous(blocks_t n)
+{
+  // Allocating zero blocks makes no sense.
+  ASSERT(n >= 1);
+  if (n == 1)
+    return allocate();                  // Keep the common case on the magazine / free list path.
+  DoutEntering(dc::notice, "MemoryPagePool::allocate_contiguous(" << n << ")");
+  m_stats.count_allocate(n);
+  std::scoped_lock<std::mutex> lock(m_run_mutex);
+  for (RunChunk& chunk : m_run_chunks)
+  {
+    long const first = find_free_run(chunk.m_bitmap, n);
+    if (first >= 0)
+    {
+      mark_run(chunk.m_bitmap, first, n, true);
+      return static_cast<char*>(chunk.m_start) + first * m_block_size;
+    }
+  }
+  // No existing run chunk has a large enough run; allocate a new one of at least n blocks.
+  blocks_t blocks = std::max(n, std::clamp(m_pool_blocks.load(std::memory_order_relaxed), m_minimum_chunk_size, m_maximum_chunk_size));
+  size_t size = blocks * m_block_size;
+  void* start = new_chunk_memory(size, blocks);
+  if (AI_UNLIKELY(start == nullptr))
+    return nullptr;
+  std::vector<uint64_t> bitmap((blocks + 63) / 64, 0);
+  if (blocks % 64 != 0)
+    mark_run(bitmap, blocks, 64 - blocks % 64, true);   // The tail bits don't correspond to blocks; keep them occupied.
+  mark_run(bitmap, 0, n, true);
+  m_run_chunks.push_back({start, size, std::move(bitmap)});
+  m_pool_blocks += blocks;
+  m_stats.count_grow();
+  chunk_added(start, size);
+  return start;
+}
+
+void MemoryPagePool::deallocate_contiguous(void* ptr, blocks_t n)
+{
+  ASSERT(n >= 1);
+  if (n == 1)
+  {
+    deallocate(ptr);
+    return;
+  }
+  DoutEntering(dc::notice, "MemoryPagePool::deallocate_contiguous(" << ptr << ", " << n << ")");
+  m_stats.count_deallocate(n);
+  std::scoped_lock<std::mutex> lock(m_run_mutex);
+  for (RunChunk& chunk : m_run_chunks)
+    if (ptr >= chunk.m_start && ptr < static_cast<char*>(chunk.m_start) + chunk.m_size)
+    {
+      blocks_t const first = (static_cast<char*>(ptr) - static_cast<char*>(chunk.m_start)) / m_block_size;
+      // Clearing the bits merges the run with any free neighbours; no explicit coalescing needed.
+      mark_run(chunk.m_bitmap, first, n, false);
+      return;
+    }
+  // ptr was not returned by allocate_contiguous().
+  ASSERT(false);
 }
 
 } // namespace utils
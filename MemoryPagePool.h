@@ -28,9 +28,12 @@
 #pragma once
 
 #include "macros.h"
+#include "MemoryPoolStats.h"
 #include "SimpleSegregatedStorage.h"
 #include "debug.h"
+#include <cstdint>
 #include <mutex>
+#include <vector>
 #include <unistd.h>
 
 namespace utils {
@@ -45,6 +48,9 @@ struct MemoryPageSize
     static size_t const memory_page_size_ = sysconf(_SC_PAGE_SIZE);
     return memory_page_size_;
   }
+
+  // The default huge page size of this machine (as reported by /proc/meminfo), in bytes.
+  static size_t huge_page_size();
 };
 
 } // namespace details
@@ -56,53 +62,279 @@ class MemoryPagePool : public details::MemoryPageSize
  public:
   using blocks_t = unsigned int;
 
+  // How the chunks of this pool are backed by the kernel.
+  enum pages_type
+  {
+    conventional_pages,                 // Chunks are allocated with std::aligned_alloc.
+    huge_pages                          // Chunks are allocated with mmap(MAP_HUGETLB), falling back to
+                                        // transparent huge pages (madvise(MADV_HUGEPAGE)) when that fails.
+  };
+
+  static constexpr int magazine_size = 32;      // The maximum number of blocks of a given pool that a thread caches in its magazine.
+
  private:
+  struct Chunk
+  {
+    void* m_start;                      // The start of the contiguous memory region of this chunk.
+    size_t m_size;                      // The size of that region, in bytes.
+    bool m_advised = false;             // True while this chunk is lazily reclaimed: its blocks are off the
+                                        // free list and its pages are marked MADV_FREE, see reclaim_idle().
+  };
+
+  // A chunk that serves allocate_contiguous(): occupancy is tracked per block in a bitmap
+  // (bit set = block in use) instead of carving the chunk into the shared free list, so
+  // that runs of adjacent free blocks can be found and freed runs coalesce by themselves.
+  struct RunChunk
+  {
+    void* m_start;                      // The start of the contiguous memory region of this chunk.
+    size_t m_size;                      // The size of that region, in bytes.
+    std::vector<uint64_t> m_bitmap;     // One bit per block; the tail bits beyond the last block are kept set.
+  };
+
   utils::SimpleSegregatedStorage m_sss;
   size_t const m_block_size;            // The size of a block as returned by allocate(), in bytes.
-  blocks_t m_pool_blocks;               // The total amount of allocated system memory, in blocks.
+  pages_type const m_pages;             // The kind of system pages that back the chunks.
+  int const m_numa_node;                // The NUMA node that chunks are bound to with mbind(2), or -1 when unconstrained.
+  std::atomic<blocks_t> m_pool_blocks;  // The total amount of allocated system memory, in blocks.
   blocks_t const m_minimum_chunk_size;  // The minimum size of internally allocated contiguous memory blocks, in blocks.
   blocks_t const m_maximum_chunk_size;  // The maximum size of internally allocated contiguous memory blocks, in blocks.
-  std::vector<void*> m_chunks;          // All allocated chunks that were allocated with std::aligned_alloc.
+  std::vector<Chunk> m_chunks;          // All allocated chunks, allocated according to m_pages.
+  std::vector<RunChunk> m_run_chunks;   // The chunks that serve allocate_contiguous(), protected by m_run_mutex.
+  std::mutex m_run_mutex;               // Protects m_run_chunks and the bitmaps therein.
+  MemoryPoolStats m_stats;              // Lock-free observability counters, see stats().
+
+  // A small per-thread cache ("magazine") of blocks of one pool, so that most calls to
+  // allocate()/deallocate() don't have to do a CAS on the shared free list in m_sss at all.
+  struct Magazine
+  {
+    MemoryPagePool* m_pool;             // The pool that the cached blocks belong to, or nullptr when this magazine is unused.
+    int m_count;                        // The number of cached blocks in m_blocks.
+    void* m_blocks[magazine_size];      // Cached blocks, previously obtained from m_pool.
+  };
+
+  // The magazines of one thread; one magazine per MemoryPagePool that the thread allocates from.
+  struct ThreadMagazines
+  {
+    static constexpr int max_pools = 4; // The maximum number of different MemoryPagePool's per thread that get a magazine.
+    Magazine m_magazines[max_pools];
+
+    ThreadMagazines() : m_magazines{} { }
+    ~ThreadMagazines();                 // Flush all cached blocks back to their pool.
+
+    // Return the magazine for pool, claiming an empty slot if the pool doesn't have one yet.
+    // Returns nullptr when this thread already uses max_pools other pools; the caller then
+    // has to fall back to the shared free list.
+    Magazine* find(MemoryPagePool* pool)
+    {
+      for (int i = 0; i < max_pools; ++i)
+      {
+        if (m_magazines[i].m_pool == pool)
+          return &m_magazines[i];
+        if (!m_magazines[i].m_pool)
+        {
+          m_magazines[i].m_pool = pool;
+          return &m_magazines[i];
+        }
+      }
+      return nullptr;
+    }
+
+    // Drop the magazine for pool, if any, without returning its blocks (used when pool is destructed).
+    void forget(MemoryPagePool* pool)
+    {
+      for (int i = 0; i < max_pools; ++i)
+        if (m_magazines[i].m_pool == pool)
+        {
+          m_magazines[i].m_pool = nullptr;
+          m_magazines[i].m_count = 0;
+        }
+    }
+  };
+
+  static thread_local ThreadMagazines tl_magazines;
+
+  // Return the blocks in magazine above keep to the shared free list.
+  void flush(Magazine* magazine, int keep);
+
+  // Allocate a new chunk, backed according to m_pages, and add it to the free list.
+  // This runs in the critical area of utils::SimpleSegregatedStorage::m_add_block_mutex.
+  bool add_chunk();
+
+  // Allocate the backing memory for a new chunk of (at least) size bytes, according to
+  // m_pages and m_numa_node. On success size and blocks are updated to the values actually
+  // allocated; returns nullptr when the system is out of memory.
+  void* new_chunk_memory(size_t& size, blocks_t& blocks);
+
+  // Return the index of the first bit of a run of n consecutive zero bits in bitmap,
+  // or -1 when there is none.
+  static long find_free_run(std::vector<uint64_t> const& bitmap, blocks_t n);
+
+  // Set (occupied == true) or clear the n bits [first, first + n) of bitmap.
+  static void mark_run(std::vector<uint64_t>& bitmap, blocks_t first, blocks_t n, bool occupied);
+
+  // Return the memory of chunk to the operating system.
+  void free_chunk(Chunk const& chunk);
+
+  // Pop one block from the shared free list, growing the pool when it is empty.
+  void* pool_allocate()
+  {
+    return m_sss.allocate([this](){ return add_chunk(); });
+  }
 
  protected:
   virtual blocks_t default_minimum_chunk_size() { return 2; }
   virtual blocks_t default_maximum_chunk_size(blocks_t UNUSED_ARG(minimum_chunk_size)) { return 1024; }
 
+  // Called by add_chunk(), while holding m_add_block_mutex, for every new chunk.
+  // Allows derived classes (i.e. NumaMemoryPagePool) to keep track of chunk placement.
+  virtual void chunk_added(void* UNUSED_ARG(chunk), size_t UNUSED_ARG(size)) { }
+
  public:
   MemoryPagePool(size_t block_size,                     // The size of a block as returned by allocate(), in bytes; must be a multiple the memory page size.
                  blocks_t minimum_chunk_size = 0,       // A value of 0 will use the value returned by default_minimum_chunk_size().
-                 blocks_t maximum_chunk_size = 0);      // A value of 0 will use the value returned by default_maximum_chunk_size(minimum_chunk_size).
+                 blocks_t maximum_chunk_size = 0,       // A value of 0 will use the value returned by default_maximum_chunk_size(minimum_chunk_size).
+                 pages_type pages = conventional_pages, // Pass huge_pages to back the chunks with huge pages; block_size must then divide,
+                                                        // or be a multiple of, the huge page size.
+                 int numa_node = -1,                    // When non-negative, bind every chunk to this NUMA node with mbind(2).
+                 blocks_t warm_up_blocks = 0);          // When non-zero, call warm_up(warm_up_blocks) before returning. Derived classes
+                                                        // that override chunk_added() should pass 0 and call warm_up() themselves:
+                                                        // during this constructor their override isn't active yet.
   virtual ~MemoryPagePool()
   {
     DoutEntering(dc::notice, "MemoryPagePool::~MemoryPagePool() [" << this << "]");
+    // Blocks that other threads still cache in their magazine are winked out by release();
+    // drop our own magazine so that a future pool at the same address can't adopt it.
+    tl_magazines.forget(this);
     release();
   }
 
+  // Note: a thread that calls allocate() caches up to magazine_size blocks in a thread_local
+  // magazine; therefore the MemoryPagePool must outlive every thread that allocated from it
+  // (which is the case when, as usual, the pool is a Global/Singleton or defined in main()).
   void* allocate()
   {
-    return m_sss.allocate([this](){
-        // This runs in the critical area of utils::SimpleSegregatedStorage::m_add_block_mutex.
-        blocks_t extra_blocks = std::clamp(m_pool_blocks, m_minimum_chunk_size, m_maximum_chunk_size);
-        size_t extra_size = extra_blocks * m_block_size;
-        void* chunk = std::aligned_alloc(memory_page_size(), extra_size);
-        if (AI_UNLIKELY(chunk == nullptr))
-          return false;
-        m_sss.add_block(chunk, extra_size, m_block_size);
-        m_pool_blocks += extra_blocks;
-        m_chunks.push_back(chunk);
-        return true;
-    });
+    m_stats.count_allocate();
+    Magazine* magazine = tl_magazines.find(this);
+    if (AI_LIKELY(magazine))
+    {
+      if (AI_LIKELY(magazine->m_count > 0))
+        return magazine->m_blocks[--magazine->m_count];
+      // Fill the magazine half-way - with a single CAS on the shared free list - so that
+      // neither an immediately following allocate() nor deallocate() has to touch it again.
+      SimpleSegregatedStorage::BlockList list;
+      m_sss.allocate_n(magazine_size / 2, list, [this](){ return add_chunk(); });
+      while (void* ptr = list.pop())
+        magazine->m_blocks[magazine->m_count++] = ptr;
+      if (AI_UNLIKELY(magazine->m_count == 0))
+        return nullptr;
+      return magazine->m_blocks[--magazine->m_count];
+    }
+    return pool_allocate();
+  }
+
+  // As allocate(), but never allocates a new chunk: returns nullptr when both the
+  // magazine and the shared free list are empty.
+  void* try_allocate()
+  {
+    Magazine* magazine = tl_magazines.find(this);
+    if (AI_LIKELY(magazine && magazine->m_count > 0))
+    {
+      m_stats.count_allocate();
+      return magazine->m_blocks[--magazine->m_count];
+    }
+    SimpleSegregatedStorage::BlockList list;
+    if (m_sss.try_allocate_n(1, list) == 0)
+      return nullptr;
+    m_stats.count_allocate();
+    return list.pop();
   }
 
   void deallocate(void* ptr)
   {
+    m_stats.count_deallocate();
+    Magazine* magazine = tl_magazines.find(this);
+    if (AI_LIKELY(magazine))
+    {
+      if (AI_UNLIKELY(magazine->m_count == magazine_size))
+        flush(magazine, magazine_size / 2);     // Keep the (warm) first half.
+      magazine->m_blocks[magazine->m_count++] = ptr;
+      return;
+    }
     m_sss.deallocate(ptr);
   }
 
+  // Allocate n blocks at once, storing them in blocks (which must have room for n pointers).
+  // Returns the number of blocks actually allocated, which is less than n only when the
+  // system is out of memory. This bypasses the magazine: the blocks are detached from the
+  // shared free list as a single chain, one CAS per chunk growth.
+  blocks_t allocate_n(void** blocks, blocks_t n)
+  {
+    SimpleSegregatedStorage::BlockList list;
+    blocks_t count = m_sss.allocate_n(n, list, [this](){ return add_chunk(); });
+    m_stats.count_allocate(count);
+    for (blocks_t i = 0; i < count; ++i)
+      blocks[i] = list.pop();
+    return count;
+  }
+
+  // Return n blocks, previously returned by allocate() or allocate_n(), with a single CAS.
+  void deallocate_n(void* const* blocks, blocks_t n)
+  {
+    m_stats.count_deallocate(n);
+    SimpleSegregatedStorage::BlockList list;
+    for (blocks_t i = 0; i < n; ++i)
+      list.push(blocks[i]);
+    m_sss.deallocate_list(list);
+  }
+
+  // Allocate n contiguous blocks (n * block_size() bytes of contiguous memory, still
+  // aligned to the memory page size). Returns nullptr when the system is out of memory.
+  //
+  // Runs are served from dedicated chunks whose occupancy is tracked in a per-chunk
+  // bitmap (find-first-run scans with ctz/clz over the bitmap words), not from the
+  // shared free list: freed runs therefore coalesce with their free neighbours
+  // automatically. n == 1 falls through to allocate(), keeping the common case on the
+  // fast (magazine / free list) path. The bitmap path takes a mutex and is intended
+  // for infrequent, longer-lived allocations (e.g. DMA buffers), not the hot path.
+  void* allocate_contiguous(blocks_t n);
+
+  // Return a run of n blocks previously returned by allocate_contiguous(n).
+  void deallocate_contiguous(void* ptr, blocks_t n);
+
   void release();
 
+  // Return fully free chunks to the operating system until the pool would drop below
+  // keep blocks, and return the number of blocks that was released. Thread-safe;
+  // intended to be called periodically (e.g. from a maintenance timer) after load spikes.
+  //
+  // Only chunks whose blocks are all on the shared free list can be released; blocks
+  // that sit in thread magazines pin their chunk until those threads flush.
+  blocks_t shrink(blocks_t keep);
+
+  // Lazily reclaim fully free chunks: their pages are handed back to the kernel with
+  // madvise(MADV_FREE), so that they no longer count against memory pressure, but the
+  // virtual range stays part of the pool - reuse is a soft page fault instead of a
+  // fresh allocation. At least keep free blocks stay immediately usable. Returns the
+  // number of blocks that was advised away. Thread-safe; intended to be called
+  // periodically (e.g. from a maintenance timer), like shrink().
+  blocks_t reclaim_idle(blocks_t keep);
+
+  // Pre-allocate chunks until the pool holds at least blocks blocks, and fault every
+  // page of every chunk in, so that the free list is deep and resident before traffic
+  // arrives: the first allocations after start up then pay neither for chunk growth
+  // nor for page faults inside allocate(). Uses madvise(MADV_POPULATE_WRITE) when the
+  // kernel supports it (5.14) and dirties the free blocks by hand otherwise. Returns
+  // the number of blocks whose pages were faulted in. Thread-safe; intended to be
+  // called once at start up, e.g. from a readiness probe before reporting healthy.
+  blocks_t warm_up(blocks_t blocks);
+
   size_t block_size() const { return m_block_size; }
-  blocks_t pool_blocks() { std::scoped_lock<std::mutex> lock(m_sss.m_add_block_mutex); return m_pool_blocks; }
+
+  // A lock-free snapshot of the usage counters of this pool; cheap enough to scrape periodically.
+  MemoryPoolStats::Snapshot stats() const { return m_stats.snapshot(m_pool_blocks.load(std::memory_order_relaxed)); }
+  // The size of the system pages that back the chunks of this pool.
+  size_t backing_page_size() const { return m_pages == huge_pages ? huge_page_size() : memory_page_size(); }
+  blocks_t pool_blocks() { return m_pool_blocks.load(std::memory_order_relaxed); }
 };
 
 } // namespace utils
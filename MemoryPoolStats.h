@@ -0,0 +1,97 @@
+/**
+ * ai-utils -- C++ Core utilities
+ *
+ * @file
+ * @brief Definition of class MemoryPoolStats.
+ *
+ * @Copyright (C) 2021  Carlo Wood.
+ *
+ * RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+ * Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+ *
+ * This file is part of ai-utils.
+ *
+ * ai-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ai-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ai-utils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <ostream>
+
+namespace utils {
+
+// class MemoryPoolStats
+//
+// Lock-free observability counters for the memory pool classes (MemoryPagePool,
+// NodeMemoryPool and NodeMemoryResource). All updates are relaxed atomic
+// operations, cheap enough for the allocation hot path, and snapshot() can be
+// scraped from any thread at any time; under concurrent updates the snapshot
+// is only approximately consistent, which is fine for monitoring purposes.
+//
+class MemoryPoolStats
+{
+ private:
+  std::atomic<size_t> m_allocations{0};         // Total number of (node/block) allocations.
+  std::atomic<size_t> m_deallocations{0};       // Total number of deallocations.
+  std::atomic<size_t> m_grows{0};               // Number of times more system memory was allocated.
+  std::atomic<size_t> m_high_water{0};          // The largest number of simultaneously live allocations observed.
+
+ public:
+  struct Snapshot
+  {
+    size_t allocations;                 // Total number of allocations.
+    size_t deallocations;               // Total number of deallocations.
+    size_t grows;                       // Number of times the pool allocated more system memory.
+    size_t in_use;                      // Currently live allocations (allocations - deallocations).
+    size_t high_water;                  // The largest value of in_use ever observed.
+    size_t capacity;                    // Total blocks/nodes owned by the pool, or 0 when unknown.
+
+    size_t free() const { return capacity > in_use ? capacity - in_use : 0; }
+
+    friend std::ostream& operator<<(std::ostream& os, Snapshot const& stats)
+    {
+      return os << "{allocations:" << stats.allocations << ", deallocations:" << stats.deallocations <<
+          ", grows:" << stats.grows << ", in_use:" << stats.in_use << ", high_water:" << stats.high_water <<
+          ", capacity:" << stats.capacity << '}';
+    }
+  };
+
+  void count_allocate(size_t n = 1)
+  {
+    size_t const allocations = m_allocations.fetch_add(n, std::memory_order_relaxed) + n;
+    size_t const in_use = allocations - m_deallocations.load(std::memory_order_relaxed);
+    size_t high_water = m_high_water.load(std::memory_order_relaxed);
+    while (in_use > high_water && !m_high_water.compare_exchange_weak(high_water, in_use, std::memory_order_relaxed))
+      ;
+  }
+
+  void count_deallocate(size_t n = 1) { m_deallocations.fetch_add(n, std::memory_order_relaxed); }
+  void count_grow() { m_grows.fetch_add(1, std::memory_order_relaxed); }
+
+  Snapshot snapshot(size_t capacity = 0) const
+  {
+    Snapshot stats;
+    stats.allocations = m_allocations.load(std::memory_order_relaxed);
+    stats.deallocations = m_deallocations.load(std::memory_order_relaxed);
+    stats.grows = m_grows.load(std::memory_order_relaxed);
+    stats.in_use = stats.allocations - stats.deallocations;
+    stats.high_water = m_high_water.load(std::memory_order_relaxed);
+    stats.capacity = capacity;
+    return stats;
+  }
+};
+
+} // namespace utils
@@ -0,0 +1,119 @@
+/**
+ * ai-utils -- C++ Core utilities
+ *
+ * @file
+ * @brief Implementation of class Microbench.
+ *
+ * @Copyright (C) 2021  Carlo Wood.
+ *
+ * RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+ * Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+ *
+ * This file is part of ai-utils.
+ *
+ * ai-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ai-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ai-utils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sys.h"
+#include "Microbench.h"
+#include "debug.h"
+#include <algorithm>
+#include <cmath>
+#include <ostream>
+
+namespace utils {
+
+double Microbench::Result::percentile(double pct) const
+{
+  ASSERT(0.0 < pct && pct <= 100.0 && !samples.empty());
+  // Nearest-rank method on the sorted samples.
+  size_t rank = std::ceil(pct / 100.0 * samples.size());
+  return samples[rank - 1];
+}
+
+std::ostream& operator<<(std::ostream& os, Microbench::Result const& result)
+{
+  os << "{low_avg:" << result.low_avg << " ms, min:" << result.min() << " ms, median:" << result.median() <<
+      " ms, p90:" << result.percentile(90.0) << " ms, p99:" << result.percentile(99.0) << " ms}";
+  return os;
+}
+
+double __attribute__ ((noinline)) Microbench::measure(unsigned int s)
+{
+  auto start = clock_type::now();
+  for (unsigned int i = 0; i < s; ++i)
+    m_fn();
+  auto stop = clock_type::now();
+  return std::chrono::duration<double, std::milli>(stop - start).count();
+}
+
+Microbench::Result Microbench::run()
+{
+  DoutEntering(dc::delayloop, "Microbench::run()");
+  unsigned int const n = GlobalTotalRequiredMeasurements::instantiate();
+  ASSERT(m <= n);
+  Result result;
+  for (unsigned int i = 0; i <= n; ++i)
+    result.samples.push_back(measure(m_iterations) / m_iterations);
+  // Throw away the first measurement (cold caches, cold branch predictor).
+  result.samples.erase(result.samples.begin());
+  std::sort(result.samples.begin(), result.samples.end());
+  double sum = 0.0;
+  for (unsigned int i = 0; i < m; ++i)
+    sum += result.samples[i];
+  result.low_avg = sum / m;
+  Dout(dc::delayloop, "Microbench::run() = " << result);
+  return result;
+}
+
+//static
+unsigned int Microbench::calibrate_iterations(FunctionView<void()> fn, double goal)
+{
+  Microbench bench(fn);
+  return bench.peak_detect(goal);
+}
+
+//static
+double Microbench::compare(FunctionView<void()> old_fn, FunctionView<void()> new_fn, unsigned int iterations)
+{
+  DoutEntering(dc::delayloop, "Microbench::compare(old_fn, new_fn, " << iterations << ")");
+  Microbench old_bench(old_fn, iterations);
+  Microbench new_bench(new_fn, iterations);
+  unsigned int const n = GlobalTotalRequiredMeasurements::instantiate();
+  ASSERT(m <= n);
+  Result old_result;
+  Result new_result;
+  // Interleave the samples of both implementations, so that frequency changes,
+  // thermal throttling etc. hit them equally hard.
+  for (unsigned int i = 0; i <= n; ++i)
+  {
+    old_result.samples.push_back(old_bench.measure(iterations) / iterations);
+    new_result.samples.push_back(new_bench.measure(iterations) / iterations);
+  }
+  for (Result* result : { &old_result, &new_result })
+  {
+    // Throw away the first measurement (cold caches, cold branch predictor).
+    result->samples.erase(result->samples.begin());
+    std::sort(result->samples.begin(), result->samples.end());
+    double sum = 0.0;
+    for (unsigned int i = 0; i < m; ++i)
+      sum += result->samples[i];
+    result->low_avg = sum / m;
+  }
+  Dout(dc::delayloop, "old: " << old_result);
+  Dout(dc::delayloop, "new: " << new_result);
+  return new_result.low_avg / old_result.low_avg;
+}
+
+} // namespace utils
@@ -0,0 +1,112 @@
+/**
+ * ai-utils -- C++ Core utilities
+ *
+ * @file
+ * @brief Definition of class Microbench.
+ *
+ * @Copyright (C) 2021  Carlo Wood.
+ *
+ * RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+ * Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+ *
+ * This file is part of ai-utils.
+ *
+ * ai-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ai-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ai-utils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "DelayLoopCalibration.h"
+#include "FunctionView.h"
+#include <iosfwd>
+#include <vector>
+
+namespace utils {
+
+// class Microbench
+//
+// Times an arbitrary callable with the statistical machinery of
+// DelayLoopCalibrationBase: the number of timed samples is chosen such that
+// with probability 1 - epsilon at least m of them are not outliers (caused
+// by interrupts, scheduling, frequency changes...), and the reported
+// estimate is the average of the lowest m samples, which is very robust
+// against such one-sided noise.
+//
+// Usage:
+//
+//   utils::Microbench bench([]{ code_under_test(); }, 1000);   // 1000 invocations per timed sample.
+//   utils::Microbench::Result result = bench.run();
+//   std::cout << result << std::endl;                          // Prints min/median/percentiles.
+//
+// Pick the number of invocations per sample such that one sample takes
+// roughly 0.1 ms, so that the clock overhead is amortized; when in doubt,
+// let Microbench find it for you:
+//
+//   unsigned int iterations = utils::Microbench::calibrate_iterations([]{ code_under_test(); });
+//
+// To detect a regression, compare two implementations:
+//
+//   double ratio = utils::Microbench::compare(old_implementation, new_implementation, iterations);
+//
+// which interleaves the samples of both (so that they see the same machine
+// conditions) and returns the ratio of their robust estimates: less than 1
+// means the new implementation is faster.
+//
+// All reported times are in milliseconds per invocation of the callable.
+class Microbench : public DelayLoopCalibrationBase
+{
+ public:
+  struct Result
+  {
+    std::vector<double> samples;        // All (per-invocation) sample times, sorted. In milliseconds.
+    double low_avg;                     // The average of the lowest m samples; the robust estimate.
+
+    double min() const { return samples.front(); }
+    double median() const { return percentile(50.0); }
+    // Returns the nearest-rank pct-th percentile (0 < pct <= 100) of the samples.
+    double percentile(double pct) const;
+
+    friend std::ostream& operator<<(std::ostream& os, Result const& result);
+  };
+
+  Microbench(FunctionView<void()> fn, unsigned int iterations = 1) : m_fn(fn), m_iterations(iterations) { }
+
+  // Time s invocations of the callable. Returns the elapsed time in milliseconds.
+  double measure(unsigned int s) override;
+
+  // Take the statistically required number of samples and return the per-invocation statistics.
+  Result run();
+
+  // Returns the number of invocations that takes roughly goal ms, found with peak_detect.
+  static unsigned int calibrate_iterations(FunctionView<void()> fn, double goal = 0.1);
+
+  // Benchmark two implementations of the same thing, with interleaved samples,
+  // and return new_result.low_avg / old_result.low_avg (less than 1 means new_fn is faster).
+  static double compare(FunctionView<void()> old_fn, FunctionView<void()> new_fn, unsigned int iterations = 1);
+
+ protected:
+  void set_fit_params(double a, double b) override
+  {
+    m_a = a;
+    m_b = b;
+  }
+
+ private:
+  FunctionView<void()> m_fn;    // The callable under test.
+  unsigned int m_iterations;    // The number of invocations per timed sample.
+  double m_a{};                 // The fitted slope, in ms per invocation (only set by calibrate_iterations).
+  double m_b{};                 // The fitted offset, in ms.
+};
+
+} // namespace utils
@@ -0,0 +1,141 @@
+/**
+ * ai-utils -- C++ Core utilities
+ *
+ * @file
+ * @brief Definition of class MonotonicArena.
+ *
+ * @Copyright (C) 2021  Carlo Wood.
+ *
+ * RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+ * Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+ *
+ * This file is part of ai-utils.
+ *
+ * ai-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ai-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ai-utils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "utils/MemoryPagePool.h"
+#include "debug.h"
+#include <memory_resource>
+#include <memory>
+#include <new>
+#include <vector>
+
+namespace utils {
+
+// class MonotonicArena
+//
+// A std::pmr::memory_resource that bump-allocates from blocks of a MemoryPagePool
+// and releases everything at once: deallocate() is a no-op, release() (or the
+// destructor) returns all blocks to the pool in O(number of blocks).
+//
+// Intended for request-scoped allocation patterns, where thousands of nodes are
+// allocated while processing a request and all die together at the end of it:
+//
+//   utils::MonotonicArena arena(mpp);
+//   std::pmr::vector<Token> tokens(&arena);            // Never calls malloc.
+//   ...
+//   // End of request: everything is freed by the destructor of arena.
+//
+class MonotonicArena : public std::pmr::memory_resource
+{
+ private:
+  struct Oversized
+  {
+    void* m_ptr;                        // An allocation larger than a pool block, from the heap.
+    size_t m_alignment;                 // The alignment that it was allocated with.
+  };
+
+  MemoryPagePool& m_mpp;                // The upstream pool that the arena draws its blocks from.
+  std::vector<void*> m_blocks;          // All pool blocks owned by this arena.
+  std::vector<Oversized> m_oversized;   // Allocations that didn't fit in a pool block.
+  char* m_current;                      // Bump pointer into the last block of m_blocks, or nullptr.
+  size_t m_remaining;                   // The number of bytes left after m_current.
+
+ public:
+  MonotonicArena(MemoryPagePool& mpp) : m_mpp(mpp), m_current(nullptr), m_remaining(0) { }
+  ~MonotonicArena() override { release(); }
+
+  MonotonicArena(MonotonicArena const&) = delete;
+  MonotonicArena& operator=(MonotonicArena const&) = delete;
+
+  // Return all memory to the pool (and heap), invalidating every allocation made so far.
+  void release()
+  {
+    if (!m_blocks.empty())
+    {
+      m_mpp.deallocate_n(m_blocks.data(), m_blocks.size());
+      m_blocks.clear();
+    }
+    for (Oversized const& oversized : m_oversized)
+      ::operator delete(oversized.m_ptr, std::align_val_t{oversized.m_alignment});
+    m_oversized.clear();
+    m_current = nullptr;
+    m_remaining = 0;
+  }
+
+ protected:
+  void* do_allocate(size_t bytes, size_t alignment) override
+  {
+    // The common case: the allocation fits in the current block.
+    void* ptr = m_current;
+    size_t space = m_remaining;
+    if (AI_LIKELY(ptr && std::align(alignment, bytes, ptr, space)))
+    {
+      m_current = static_cast<char*>(ptr) + bytes;
+      m_remaining = space - bytes;
+      return ptr;
+    }
+    return allocate_slow(bytes, alignment);
+  }
+
+  void do_deallocate(void* UNUSED_ARG(ptr), size_t UNUSED_ARG(bytes), size_t UNUSED_ARG(alignment)) override
+  {
+    // Deliberately empty: all memory is returned at once by release().
+  }
+
+  bool do_is_equal(std::pmr::memory_resource const& other) const noexcept override
+  {
+    return this == &other;
+  }
+
+ private:
+  void* allocate_slow(size_t bytes, size_t alignment)
+  {
+    // Allocations that can't fit in a pool block at all go to the heap.
+    if (AI_UNLIKELY(bytes + alignment > m_mpp.block_size()))
+    {
+      void* ptr = ::operator new(bytes, std::align_val_t{alignment});
+      m_oversized.push_back({ptr, alignment});
+      return ptr;
+    }
+    // Start a new block; what remained in the previous block is wasted (as in
+    // std::pmr::monotonic_buffer_resource), release() still frees it.
+    void* block = m_mpp.allocate();
+    if (AI_UNLIKELY(block == nullptr))
+      throw std::bad_alloc();
+    m_blocks.push_back(block);
+    m_current = static_cast<char*>(block);
+    m_remaining = m_mpp.block_size();
+    void* ptr = m_current;
+    std::align(alignment, bytes, ptr, m_remaining);     // Cannot fail, see the test above.
+    m_current = static_cast<char*>(ptr) + bytes;
+    m_remaining -= bytes;
+    return ptr;
+  }
+};
+
+} // namespace utils
@@ -29,6 +29,12 @@
 
 #include <cstring>
 #include <cassert>
+#include <atomic>
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
 
 // Implements a variable number of loops inside eachother.
 // Usage:
@@ -104,11 +110,43 @@ class MultiLoop
     M_loops(n),
     M_counters(new int[n + 1]),
     M_current_loop(n > 0 ? 1 : 0),
+    M_finish_loop(0),
     M_continued(false)
     {
       M_counters[M_current_loop] = b;
     }
 
+  // Construct a MultiLoop of n loops that continues from a given prefix:
+  // the counters of loops 0..prefix_size-1 are fixed to prefix[0..prefix_size-1]
+  // and iteration starts at loop prefix_size, with begin value b. finished()
+  // becomes true as soon as control would return to one of the prefix loops,
+  // so only the subtree below the prefix is executed. This is what allows the
+  // outermost loop(s) to be distributed over threads; see parallel_multi_loop.
+  MultiLoop(unsigned int n, int const* prefix, unsigned int prefix_size, int b = 0) :
+    M_loops(n),
+    M_counters(new int[n + 1]),
+    M_current_loop(prefix_size + 1),
+    M_finish_loop(prefix_size),
+    M_continued(false)
+    {
+      assert(prefix_size < n);
+      for (unsigned int i = 0; i < prefix_size; ++i)
+        M_counters[i + 1] = prefix[i];
+      M_counters[M_current_loop] = b;
+    }
+
+  // Construct a MultiLoop that resumes from a state blob as returned by serialize().
+  explicit MultiLoop(std::string const& blob) : M_continued(false)
+  {
+    std::istringstream in(blob);
+    in >> M_loops >> M_current_loop >> M_finish_loop >> M_continued;
+    M_counters = new int[M_loops + 1];
+    for (int i = 1; i <= M_current_loop; ++i)
+      in >> M_counters[i];
+    // The blob must be a (complete) string that was returned by serialize().
+    assert(in && M_current_loop <= (int)M_loops);
+  }
+
   // Destructor.
   ~MultiLoop() { delete [] M_counters; }
 
@@ -138,7 +176,7 @@ class MultiLoop
   void breaks(int n) { M_continued = !n; M_current_loop -= (n - 1); assert(M_current_loop > 0); }
 
   // Return true when all loops are finished.
-  bool finished() const { return M_current_loop == 0; }
+  bool finished() const { return M_current_loop == M_finish_loop; }
 
   // Return true when we are in the inner loop.
   bool inner_loop() const { return M_current_loop == (int)M_loops; }
@@ -146,13 +184,126 @@ class MultiLoop
   // Return true when we're at the end of a loop (but not the inner loop).
   int end_of_loop() const { return M_continued ? -1 : M_current_loop - 2; }
 
+  // Serialize the complete loop-counter state (the counters plus current depth)
+  // into a compact blob: a short ASCII string of decimal fields, so it can go
+  // into a job database or over the wire without endianness concerns. Write it
+  // to stable storage to checkpoint a (long running) sweep and pass it to the
+  // constructor above to resume exactly where it left off.
+  std::string serialize() const
+  {
+    std::ostringstream blob;
+    blob << M_loops << ' ' << M_current_loop << ' ' << M_finish_loop << ' ' << M_continued;
+    for (int i = 1; i <= M_current_loop; ++i)
+      blob << ' ' << M_counters[i];
+    return blob.str();
+  }
+
+  // Return true while the current position lies lexicographically before end,
+  // where end is a full counter vector (e.g. Shard::end). A position that is
+  // only a prefix of end counts as before it: the loops below it still contain
+  // positions that are. Used to stop a shard at its boundary, see split().
+  bool before(std::vector<int> const& end) const
+  {
+    assert(end.size() == M_loops);
+    for (int i = 1; i <= M_current_loop; ++i)
+      if (M_counters[i] != end[i - 1])
+        return M_counters[i] < end[i - 1];
+    return M_current_loop < (int)M_loops;
+  }
+
+  // A sub-sweep of the iteration space, see split().
+  struct Shard
+  {
+    std::string begin;          // The state to start at; pass to the blob constructor.
+    std::vector<int> end;       // The first position that is no longer part of this shard; pass to before().
+  };
+
+  // Partition the remaining iteration space - everything from the current
+  // position to the end of a rectangular sweep where loop i runs over
+  // [0, ends[i]) - into (at most) k balanced, consecutive sub-sweeps, by
+  // treating the counters as the digits of a mixed-radix number and cutting
+  // its remaining range into k nearly equal pieces. Each shard is a start
+  // state blob plus an end state; running one looks like the usual idiom with
+  // before(shard.end) added to both loop conditions:
+  //
+  //   for (MultiLoop ml(shard.begin); !ml.finished() && ml.before(shard.end); ml.next_loop())
+  //   {
+  //     while (ml() < ends[*ml] && ml.before(shard.end))
+  //     {
+  //       if (ml.inner_loop())
+  //       {
+  //         // Inner loop body.
+  //       }
+  //       ml.start_next_loop_at(0);
+  //     }
+  //   }
+  //
+  // Together the k shards cover the remaining space exactly once, their sizes
+  // differing by at most one iteration, so a scheduler can farm one sweep out
+  // across machines and - combined with serialize() - resume preempted shards
+  // for free. The total number of iterations must fit in 64 bit. Fewer than k
+  // shards are returned when fewer iterations than k remain.
+  std::vector<Shard> split(unsigned int k, std::vector<int> const& ends) const;
+
  private:
   unsigned int  M_loops;
   int*          M_counters;
   int           M_current_loop;
+  int           M_finish_loop;
   bool          M_continued;
 };
 
+inline std::vector<MultiLoop::Shard> MultiLoop::split(unsigned int k, std::vector<int> const& ends) const
+{
+  assert(k > 0 && ends.size() == M_loops);
+  // The linear index of a position is the value of its counters read as the
+  // digits of a mixed-radix number with radices ends[0..n-1].
+  uint64_t total = 1;
+  for (int end : ends)
+  {
+    assert(end > 0);
+    total *= end;
+  }
+  uint64_t index = 0;
+  for (unsigned int i = 0; i < M_loops; ++i)
+    index = index * ends[i] + ((int)i < M_current_loop ? M_counters[i + 1] : 0);
+  uint64_t const remaining = total - index;
+
+  // Decompose a linear index back into a counter vector. The one-past-the-end
+  // index (== total) decomposes to {ends[0], 0, ...}, which before() correctly
+  // sees as lying after every position of the sweep.
+  auto decompose = [&](uint64_t v){
+    std::vector<int> counters(M_loops);
+    for (unsigned int i = M_loops; i > 0; --i)
+    {
+      counters[i - 1] = v % ends[i - 1];
+      v /= ends[i - 1];
+    }
+    counters[0] += v * ends[0];
+    return counters;
+  };
+  auto make_blob = [](std::vector<int> const& counters){
+    std::ostringstream blob;
+    blob << counters.size() << ' ' << counters.size() << " 0 0";
+    for (int counter : counters)
+      blob << ' ' << counter;
+    return blob.str();
+  };
+
+  std::vector<Shard> shards;
+  uint64_t const chunk = remaining / k;
+  uint64_t const extra = remaining % k;         // The first extra shards get one iteration more.
+  uint64_t boundary = index;
+  for (unsigned int s = 0; s < k; ++s)
+  {
+    uint64_t const next_boundary = boundary + chunk + (s < extra ? 1 : 0);
+    if (next_boundary > boundary)
+      shards.push_back({make_blob(decompose(boundary)), decompose(next_boundary)});
+    boundary = next_boundary;
+  }
+  return shards;
+}
+
 inline void MultiLoop::start_next_loop_at(int b)
 {
   // If we are not in the inner loop, start a next loop.
@@ -167,3 +318,122 @@ inline void MultiLoop::start_next_loop_at(int b)
     ++M_counters[M_current_loop];
   }
 }
+
+// Run the body of a MultiLoop of n loops in parallel, distributing the
+// outermost loop over number_of_threads threads.
+//
+// The range [0, outer_end) of the outermost loop - which therefore must be
+// known up front - is handed out dynamically, one value at a time, to the
+// worker threads, so an uneven subtree cost still balances. For every value
+// the worker constructs a MultiLoop that continues from that one-counter
+// prefix and passes it to body, which must execute the usual idiom:
+//
+//   utils::parallel_multi_loop(23, 3, [](MultiLoop& ml){
+//     for (; !ml.finished(); ml.next_loop())
+//     {
+//       while (ml() < 3)
+//       {
+//         // Loop code; *ml, ml[0..*ml] etc. as in the single-threaded version.
+//         ml.start_next_loop_at(0);
+//       }
+//       if (int loop = ml.end_of_loop(); loop >= 0)
+//       {
+//         // End of loop code.
+//       }
+//     }
+//   });
+//
+// Loop numbering is unchanged: ml[0] is the (fixed) outermost counter. Note
+// that body runs concurrently on all threads: whatever it touches that is
+// shared must be made thread-safe by the caller.
+namespace utils {
+
+// class StaticMultiLoop<N>
+//
+// The compile-time counterpart of MultiLoop, for when the nesting depth is a
+// constant: the N nested loops are expanded at compile time into real nested
+// for statements (recursive instantiation, terminated with if constexpr), so
+// there is no heap allocated counter array and no runtime depth bookkeeping,
+// and the compiler can unroll and vectorize the innermost body.
+//
+// The API is callback shaped rather than the for/while idiom of MultiLoop -
+// the loop structure *is* the generated code - but the counter access is the
+// same: sml[i] is the counter of loop i and sml() that of the innermost loop.
+//
+//   utils::StaticMultiLoop<3> sml;
+//   sml.run({4, 4, 4}, [&](utils::StaticMultiLoop<3> const& sml){
+//     sum += data[sml[0]][sml[1]][sml[2]];
+//   });
+//
+// A second overload takes per-loop begin values: run(begins, ends, body).
+//
+template<int N>
+class StaticMultiLoop
+{
+  static_assert(N > 0, "utils::StaticMultiLoop<> requires at least one loop.");
+
+ private:
+  int M_counters[N];
+
+  template<int LOOP, typename BODY>
+  [[gnu::always_inline]] inline void run_loop(int const (&begins)[N], int const (&ends)[N], BODY& body)
+  {
+    if constexpr (LOOP == N)
+      body(static_cast<StaticMultiLoop const&>(*this));
+    else
+      for (M_counters[LOOP] = begins[LOOP]; M_counters[LOOP] < ends[LOOP]; ++M_counters[LOOP])
+        run_loop<LOOP + 1>(begins, ends, body);
+  }
+
+ public:
+  // Return the value of counter number i.
+  int operator[](int i) const { assert(0 <= i && i < N); return M_counters[i]; }
+
+  // Return the value of the innermost counter.
+  int operator()() const { return M_counters[N - 1]; }
+
+  // Execute the N nested loops, loop i running over [begins[i], ends[i]),
+  // calling body (with this StaticMultiLoop) from the innermost loop.
+  template<typename BODY>
+  void run(int const (&begins)[N], int const (&ends)[N], BODY body)
+  {
+    run_loop<0>(begins, ends, body);
+  }
+
+  // As above with all loops beginning at zero.
+  template<typename BODY>
+  void run(int const (&ends)[N], BODY body)
+  {
+    int const begins[N] = {};
+    run_loop<0>(begins, ends, body);
+  }
+};
+
+template<typename BODY>
+void parallel_multi_loop(unsigned int n, int outer_end, BODY body,
+    unsigned int number_of_threads = std::thread::hardware_concurrency())
+{
+  assert(n > 1);
+  if (number_of_threads == 0)
+    number_of_threads = 1;
+  std::atomic<int> next_outer{0};
+  auto worker = [n, outer_end, &next_outer, &body](){
+    for (;;)
+    {
+      int const outer = next_outer.fetch_add(1, std::memory_order_relaxed);
+      if (outer >= outer_end)
+        break;
+      MultiLoop ml(n, &outer, 1);
+      body(ml);
+    }
+  };
+  std::vector<std::thread> threads;
+  threads.reserve(number_of_threads - 1);
+  for (unsigned int t = 1; t < number_of_threads; ++t)
+    threads.emplace_back(worker);
+  worker();                     // This thread participates too.
+  for (std::thread& thread : threads)
+    thread.join();
+}
+
+} // namespace utils
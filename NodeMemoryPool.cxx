@@ -36,21 +36,15 @@
 
 namespace utils {
 
-union Next
-{
-  size_t n;                     // This must have the same size as a pointer, so that setting this to zero causes ptr == nullptr.
-  FreeList* ptr;
-};
-
 struct FreeList
 {
-  ssize_t* free;                // Points to Begin::free of the current block.
-  Next m_next;                  // m_next.ptr either points to the next free chunk in the free list, or is nullptr when there are no free chunks left.
+  std::atomic<ssize_t>* free;   // Points to Begin::free of the current block.
+  FreeList* m_next;             // Points to the next free chunk in the free list, or is nullptr when there are no free chunks left.
 };
 
 struct Allocated
 {
-  ssize_t* free;
+  std::atomic<ssize_t>* free;
   char data[];                  // m_size bytes of data.
 };
 
@@ -62,7 +56,7 @@ union Chunk
 
 struct Begin
 {
-  ssize_t free;                 // Each allocated memory block (of m_nchunk chunks of size m_size each) begins with a size_t that counts the number of free chunks in the block.
+  std::atomic<ssize_t> free;    // Each allocated memory block (of m_nchunk chunks of size m_size each) begins with a counter of the number of free chunks in the block.
   NodeMemoryPool* pool;         // A pointer to the pool object to support overloading operator delete for objects.
   Chunk first_chunk;            // Subsequently there is a Chunk object, of which this is the first, every offsetof(Allocated, data) + m_size bytes (aka the real size of "Allocated",
                                 // aka the real size of Chunk, where sizeof(FreeList) needs to be less than or equal the size of Allocated. In other words m_size >= sizeof(Next)).
@@ -78,84 +72,174 @@ static constexpr size_t chunk_align_mask = alignof(Chunk) - 1;
 #endif
 
 void* NodeMemoryPool::alloc(size_t size)
+{
+  FreeList* ptr;
+  for (;;)
+  {
+    ptr = m_free_list.load(std::memory_order_acquire);
+    if (AI_UNLIKELY(!ptr))
+    {
+      try_allocate_more(size);
+      continue;
+    }
+    // Pop ptr from the free list with a single CAS (per retry); the same ABA
+    // discipline as SimpleSegregatedStorage::allocate(): a failed CAS reloads
+    // the then current head and re-reads its m_next.
+    while (AI_UNLIKELY(!m_free_list.compare_exchange_weak(ptr, ptr->m_next, std::memory_order_acquire, std::memory_order_acquire)) && ptr)
+      ;
+    if (AI_LIKELY(ptr))
+      break;
+  }
+  // size must fit.
+  ASSERT(size <= m_size);
+  ptr->free->fetch_sub(1, std::memory_order_relaxed);
+  ASSERT(ptr->free->load(std::memory_order_relaxed) >= 0);
+  m_total_free.fetch_sub(1, std::memory_order_relaxed);
+  m_stats.count_allocate();
+  return reinterpret_cast<Chunk*>(ptr)->allocated.data;
+}
+
+void NodeMemoryPool::try_allocate_more(size_t size)
 {
   std::unique_lock<std::mutex> lock(m_pool_mutex);
-  FreeList* ptr = m_free_list;
-  if (AI_UNLIKELY(!ptr))
+  // Another thread might have grown the pool (or try_delete_block re-attached chunks) in the meantime.
+  if (m_free_list.load(std::memory_order_relaxed))
+    return;
+  if (AI_UNLIKELY(!m_size))
+    m_size = size;      // If m_size wasn't initialized yet, set it to the size of the first allocation.
+  // m_size must be greater or equal sizeof(FreeList*), and a multiple of alignof(Chunk).
+  ASSERT(m_size >= sizeof(FreeList*) && (m_size & chunk_align_mask) == 0);
+  Begin* begin;
+  if (AI_UNLIKELY(!m_reserve_blocks.empty()))
+  {
+    // Reuse a parked, fully-free block (see try_delete_block).
+    begin = m_reserve_blocks.back();
+    m_reserve_blocks.pop_back();
+  }
+  else
   {
-    if (AI_UNLIKELY(!m_size))
-      m_size = size;    // If m_size wasn't initialized yet, set it to the size of the first allocation.
-    // m_size must be greater or equal sizeof(Next), and a multiple of alignof(Chunk).
-    ASSERT(m_size >= sizeof(Next) && (m_size & chunk_align_mask) == 0);
     // Allocate space for Begin::free plus Begin::pool followed by m_nchunks of m_size (offsetof(Allocated, data) + m_size) (the real size of Allocated).
-    Dout(dc::notice, "NodeMemoryPool::alloc: allocating " << (offsetof(Begin, first_chunk) + m_nchunks * (offsetof(Allocated, data) + m_size)) << " bytes of memory [" << (void*)this << "].");
-    Begin* begin = static_cast<Begin*>(std::malloc(offsetof(Begin, first_chunk) + m_nchunks * (offsetof(Allocated, data) + m_size)));
+    Dout(dc::notice, "NodeMemoryPool::try_allocate_more: allocating " << (offsetof(Begin, first_chunk) + m_nchunks * (offsetof(Allocated, data) + m_size)) << " bytes of memory [" << (void*)this << "].");
+    begin = static_cast<Begin*>(std::malloc(offsetof(Begin, first_chunk) + m_nchunks * (offsetof(Allocated, data) + m_size)));
     begin->pool = this;
-    ptr = m_free_list = &begin->first_chunk.free_list;
-    ptr->m_next.n = m_nchunks - 1;
-    ptr->free = &begin->free;
-    *ptr->free = m_nchunks;
-    m_blocks.push_back(begin);
-    m_total_free += m_nchunks;
   }
-  // size must fit.
-  ASSERT(size <= m_size);
-  if (AI_UNLIKELY(ptr->m_next.n < m_nchunks && ptr->m_next.ptr))
+  begin->free.store(m_nchunks, std::memory_order_relaxed);
+  // Link all m_nchunks chunks of the new block into a private chain.
+  FreeList* const first = &begin->first_chunk.free_list;
+  FreeList* chunk = first;
+  for (size_t n = 1; n < m_nchunks; ++n)
   {
-    size_t n = ptr->m_next.n;
-    ptr->m_next.ptr = reinterpret_cast<FreeList*>(reinterpret_cast<char*>(ptr) + m_size + offsetof(FreeList, m_next));
-    ASSERT(ptr->m_next.n >= m_nchunks); // Smaller values are used as 'magic' values.
-    ptr->m_next.ptr->m_next.n = n - 1;
-    ptr->m_next.ptr->free = ptr->free;
+    FreeList* next = reinterpret_cast<FreeList*>(reinterpret_cast<char*>(chunk) + offsetof(Allocated, data) + m_size);
+    chunk->free = &begin->free;
+    chunk->m_next = next;
+    chunk = next;
   }
-  m_free_list = ptr->m_next.ptr;
-  --*ptr->free;
-  --m_total_free;
-  ASSERT(*ptr->free >= 0);
-  return reinterpret_cast<Chunk*>(ptr)->allocated.data;
+  chunk->free = &begin->free;
+  m_blocks.push_back(begin);
+  m_total_free.fetch_add(m_nchunks, std::memory_order_relaxed);
+  m_stats.count_grow();
+  // Attach the whole chain to the free list with a single CAS (per retry);
+  // concurrent free()'s can push chunks while we are not looking.
+  chunk->m_next = m_free_list.load(std::memory_order_relaxed);
+  while (!m_free_list.compare_exchange_weak(chunk->m_next, first, std::memory_order_release, std::memory_order_relaxed))
+    ;
 }
 
 void NodeMemoryPool::free(void* p)
 {
   // Interpret the pointer p as pointing to Chunk::allocated::data and reinterpret/convert it to a pointer to Chunk::free_list.
   FreeList* ptr = reinterpret_cast<FreeList*>(reinterpret_cast<char*>(p) - offsetof(Allocated, data));
+  m_stats.count_deallocate();
+  std::atomic<ssize_t>* const free_count = ptr->free;
+  // Count the chunk as free before pushing it onto the free list: once it is
+  // on the list another thread can pop it and decrement the counter again.
+  ssize_t const prev_free = free_count->fetch_add(1, std::memory_order_relaxed);
+  ASSERT(prev_free < (ssize_t)m_nchunks);
+  size_t const total_free = m_total_free.fetch_add(1, std::memory_order_relaxed) + 1;
+  ptr->m_next = m_free_list.load(std::memory_order_relaxed);
+  while (!m_free_list.compare_exchange_weak(ptr->m_next, ptr, std::memory_order_release, std::memory_order_relaxed))
+    ;
+  if (AI_UNLIKELY(prev_free + 1 == (ssize_t)m_nchunks) && total_free >= 2 * m_nchunks)
+  {
+    // The last chunk of this block was freed; try to delete it.
+    Begin* begin = reinterpret_cast<Begin*>(reinterpret_cast<char*>(free_count) - offsetof(Begin, free));
+    try_delete_block(begin);
+  }
+}
+
+void NodeMemoryPool::try_delete_block(Begin* begin)
+{
   std::unique_lock<std::mutex> lock(m_pool_mutex);
-  ptr->m_next.ptr = m_free_list;
-  m_free_list = ptr;
-  ++*ptr->free;
-  ++m_total_free;
-  ASSERT(*ptr->free <= (ssize_t)m_nchunks);
-  if (AI_UNLIKELY(*ptr->free == (ssize_t)m_nchunks) && m_total_free >= 2 * m_nchunks)
+  // Detach the entire free list with a single exchange: concurrent alloc()'s
+  // that run dry now enter try_allocate_more() and block on m_pool_mutex,
+  // while concurrent free()'s simply push onto the new, empty list.
+  FreeList* head = m_free_list.exchange(nullptr, std::memory_order_acquire);
+  // Find begin and end of the block.
+  char* const block_begin = reinterpret_cast<char*>(begin);                                                         // The actual start of the allocated memory block.
+  char* const block_end = block_begin + offsetof(Begin, first_chunk) + m_nchunks * (offsetof(Allocated, data) + m_size);    // One passed the end of the allocated memory block.
+  // Split the detached, now privately owned, chain into the chunks of this block and the rest.
+  FreeList* block_chain = nullptr;
+  FreeList* block_tail = nullptr;
+  size_t block_count = 0;
+  FreeList* rest_chain = nullptr;
+  FreeList* rest_tail = nullptr;
+  while (head)
   {
-    // The last chunk of this block was freed; delete it.
-    // Find begin and end of the block.
-    char* const begin = reinterpret_cast<char*>(ptr->free) - offsetof(Begin, free);                             // The actual start of the allocated memory block (Begin*).
-    char* const end = begin + offsetof(Begin, first_chunk) + m_nchunks * (offsetof(Allocated, data) + m_size);  // One passed the end of the allocated memory block.
-    // Run over the whole free list. Note that when FreeList* == nullptr we reached the end of the free list.
-    // However, if a pointer value interpreted as a size_t is less than m_nchunks then that means that the
-    // next size_t chunks are free chunks and then the free list ends.
-    // m_free_list itself always points to the first free chunk, so the first test is always true.
-    for (FreeList** fpp = &m_free_list; reinterpret_cast<size_t>(*fpp) >= m_nchunks; fpp = &(*fpp)->m_next.ptr)
+    FreeList* next = head->m_next;
+    if (block_begin <= reinterpret_cast<char*>(head) && reinterpret_cast<char*>(head) < block_end)
     {
-      // When *fpp points inside the block that we're about to delete, then just skip it until we
-      // either reach the end of the free list (*fpp == nullptr) or reinterpret_cast<size_t>(*fpp) is
-      // less than m_nchunks (in which case it will not be >= begin either).
-      while (begin <= reinterpret_cast<char*>(*fpp) && reinterpret_cast<char*>(*fpp) < end)
-        *fpp = (*fpp)->m_next.ptr;
-      // Hence, if at this point reinterpret_cast<size_t>(*fpp) < m_nchunks, then that happened
-      // because *fpp was just assigned that value in the above while loop, which means that
-      // all remaining chunks are also part of the deleted block. And we need to set *fpp to nullptr.
-      if (reinterpret_cast<size_t>(*fpp) < m_nchunks)
-      {
-        // We reached the end of the free list.
-        *fpp = nullptr; // Any remaining "free" chunk count refers to the block that is being deleted.
-        break;
-      }
+      if (!block_chain)
+        block_tail = head;
+      head->m_next = block_chain;
+      block_chain = head;
+      ++block_count;
     }
-    m_total_free -= m_nchunks;
-    std::free(begin);
-    m_blocks.erase(std::remove(m_blocks.begin(), m_blocks.end(), reinterpret_cast<Begin*>(begin)));
+    else
+    {
+      if (!rest_chain)
+        rest_tail = head;
+      head->m_next = rest_chain;
+      rest_chain = head;
+    }
+    head = next;
+  }
+  if (AI_LIKELY(block_count == m_nchunks))
+  {
+    // No chunk of this block was popped between the detection in free() and the
+    // detach above: the whole block is privately owned now. Remove it from the pool.
+    m_total_free.fetch_sub(m_nchunks, std::memory_order_relaxed);
+    m_blocks.erase(std::remove(m_blocks.begin(), m_blocks.end(), begin));
+    // The memory cannot be returned to the system here: a concurrent alloc() that
+    // loaded a chunk of this block as free list head before the exchange above can
+    // still read its m_next (the read is discarded when the subsequent CAS fails,
+    // but the memory must remain mapped). Park the block for reuse instead; it is
+    // only really freed by shrink_to_fit().
+    m_reserve_blocks.push_back(begin);
   }
+  else if (block_chain)
+  {
+    // We lost a race with an alloc() (or a concurrent try_delete_block already
+    // deleted the block); put the chunks of the block back too.
+    block_tail->m_next = rest_chain;
+    rest_chain = block_chain;
+    if (!rest_tail)
+      rest_tail = block_tail;
+  }
+  // Re-attach the remaining chunks to the free list.
+  if (rest_chain)
+  {
+    rest_tail->m_next = m_free_list.load(std::memory_order_relaxed);
+    while (!m_free_list.compare_exchange_weak(rest_tail->m_next, rest_chain, std::memory_order_release, std::memory_order_relaxed))
+      ;
+  }
+}
+
+void NodeMemoryPool::shrink_to_fit()
+{
+  std::unique_lock<std::mutex> lock(m_pool_mutex);
+  for (Begin* begin : m_reserve_blocks)
+    std::free(begin);
+  m_reserve_blocks.clear();
 }
 
 //static
@@ -173,10 +257,10 @@ std::ostream& operator<<(std::ostream& os, utils::NodeMemoryPool const& pool)
   std::unique_lock<std::mutex> lock(pool.m_pool_mutex);
   size_t allocated_size = (offsetof(utils::Begin, first_chunk) + pool.m_nchunks * (offsetof(utils::Allocated, data) + pool.m_size)) * pool.m_blocks.size();
   size_t num_chunks = pool.m_nchunks * pool.m_blocks.size();
-  size_t num_free_chunks = 0;
-  for (utils::Begin* begin : pool.m_blocks)
-    num_free_chunks += begin->free;
-  ASSERT(num_free_chunks == pool.m_total_free);
+  // A racy snapshot: alloc() and free() do not take m_pool_mutex (anymore), so the
+  // per-block counters can drift while we add them up. The total is only exact when
+  // no other thread is using the pool concurrently.
+  size_t num_free_chunks = pool.m_total_free.load(std::memory_order_relaxed);
   os << "NodeMemoryPool stats: node size: " << pool.m_size << "; allocated size: " << allocated_size <<
       "; total/used/free: " << num_chunks << '/' << (num_chunks - num_free_chunks) << '/' << num_free_chunks;
   return os;
@@ -27,8 +27,10 @@
 
 #pragma once
 
+#include "MemoryPoolStats.h"
 #include "debug.h"
 #include <vector>
+#include <atomic>
 #include <mutex>
 #include <iosfwd>
 
@@ -89,22 +91,30 @@ struct FreeList;
 // Foo* foo = new(pool) Foo(42);        // Allocate memory from memory pool and construct object.
 // delete foo;                          // Destruct object and return memory to the memory pool.
 //
-// NodeMemoryPool is thread-safe.
+// NodeMemoryPool is thread-safe. The alloc()/free() hot path is lock-free:
+// it pops from / pushes onto an atomic free list head with a single CAS (per
+// retry), following the same discipline as SimpleSegregatedStorage. Only the
+// slow path - allocating a new block of m_nchunks chunks, or deleting a block
+// whose chunks are all free again - takes m_pool_mutex.
 
 class NodeMemoryPool
 {
  private:
-  mutable std::mutex m_pool_mutex;      // Protects the pool against concurrent accesses.
+  mutable std::mutex m_pool_mutex;      // Protects the slow path: m_blocks, m_size and block allocation/deletion.
 
   size_t const m_nchunks;               // The number of `m_size' sized chunks to allocate at once. Should always be larger than 0.
-  FreeList* m_free_list;                // The next free chunk, or nullptr if there isn't any left.
+  std::atomic<FreeList*> m_free_list;   // The next free chunk, or nullptr if there isn't any left.
   std::vector<Begin*> m_blocks;         // A list of all allocated blocks.
+  std::vector<Begin*> m_reserve_blocks; // Fully-free blocks, parked for reuse (see try_delete_block).
   size_t m_size;                        // The (fixed) size of a single chunk in bytes.
                                         // alloc() always returns a chunk of this size except the first time when m_free_list is still 0.
-  size_t m_total_free;                  // The current total number of free chunks in the memory pool.
+  std::atomic<size_t> m_total_free;     // The current total number of free chunks in the memory pool.
+  MemoryPoolStats m_stats;              // Lock-free observability counters, see stats().
 
   friend void* ::operator new(std::size_t size, NodeMemoryPool& pool);
   void* alloc(size_t size);
+  void try_allocate_more(size_t size);
+  void try_delete_block(Begin* begin);
 
  public:
   NodeMemoryPool(int nchunks, size_t chunk_size = 0) : m_nchunks(nchunks), m_free_list(nullptr), m_size(chunk_size), m_total_free(0) { }
@@ -115,6 +125,22 @@ class NodeMemoryPool
   void free(void* ptr);
   static void static_free(void* ptr);
 
+  // Return the parked, fully-free blocks to the system. A concurrent alloc() can
+  // speculatively read from a parked block (see try_delete_block), so this may
+  // only be called when no other thread can be inside alloc() at the same time.
+  void shrink_to_fit();
+
+  // A snapshot of the usage counters of this pool; cheap enough to scrape periodically.
+  // The counters themselves are lock-free; only reading the capacity takes m_pool_mutex
+  // briefly, because blocks can also be freed again.
+  MemoryPoolStats::Snapshot stats() const
+  {
+    MemoryPoolStats::Snapshot stats = m_stats.snapshot();
+    std::unique_lock<std::mutex> lock(m_pool_mutex);
+    stats.capacity = m_nchunks * m_blocks.size();
+    return stats;
+  }
+
   friend std::ostream& ::operator<<(std::ostream& os, NodeMemoryPool const& pool);
 };
 
@@ -28,7 +28,10 @@
 #pragma once
 
 #include "utils/MemoryPagePool.h"
+#include "utils/MemoryPoolStats.h"
 #include "utils/SimpleSegregatedStorage.h"
+#include "utils/nearest_multiple_of_power_of_two.h"
+#include "utils/config.h"
 #include "debug.h"
 
 namespace utils {
@@ -49,16 +52,30 @@ namespace utils {
 // Note: it is possible to specify a block size upon construction (which obviously must be
 // larger or equal to the actual (largest) block size that will be allocated).
 //
+// Pass cacheline_alignment to guarantee that every block returned by allocate() starts at
+// a cache line: the block size is then rounded up to a multiple of the cache line size, so
+// that no two nodes ever false-share a cache line (without having to pad the node type).
+//
 class NodeMemoryResource
 {
  public:
+  // How the (internal) block size relates to the requested block size.
+  enum alignment_type
+  {
+    natural_alignment,                  // The block size is used as-is.
+    cacheline_alignment                 // The block size is rounded up to a multiple of the cache line size, so that
+                                        // no two blocks share a cache line (the blocks of the MemoryPagePool are page
+                                        // aligned and carved into blocks at multiples of the block size).
+  };
+
   // Create an uninitialized NodeMemoryResource. Call init() to initialize it.
-  NodeMemoryResource() : m_mpp(nullptr), m_block_size(0) { }
+  NodeMemoryResource() : m_mpp(nullptr), m_block_size(0), m_alignment(natural_alignment) { }
 
   // Create an initialized NodeMemoryResource.
-  NodeMemoryResource(MemoryPagePool& mpp, size_t block_size = 0) : m_mpp(&mpp), m_block_size(block_size)
+  NodeMemoryResource(MemoryPagePool& mpp, size_t block_size = 0, alignment_type alignment = natural_alignment) :
+    m_mpp(&mpp), m_block_size(aligned_size(block_size, alignment)), m_alignment(alignment)
   {
-    DoutEntering(dc::notice, "NodeMemoryResource::NodeMemoryResource({" << (void*)m_mpp << "}, " << block_size << ") [" << this << "]");
+    DoutEntering(dc::notice, "NodeMemoryResource::NodeMemoryResource({" << (void*)m_mpp << "}, " << block_size << ", " << alignment << ") [" << this << "]");
   }
 
   // Destructor.
@@ -68,13 +85,14 @@ class NodeMemoryResource
   }
 
   // Late initialization.
-  void init(MemoryPagePool* mpp_ptr, size_t block_size = 0)
+  void init(MemoryPagePool* mpp_ptr, size_t block_size = 0, alignment_type alignment = natural_alignment)
   {
     // A NodeMemoryResource object may only be initialized once.
     ASSERT(m_mpp == nullptr);
     m_mpp = mpp_ptr;
-    m_block_size = block_size;
-    Dout(dc::notice(block_size > 0), "NodeMemoryResource::m_block_size using [" << m_mpp << "] set to " << block_size << " [" << this << "]");
+    m_alignment = alignment;
+    m_block_size = aligned_size(block_size, alignment);
+    Dout(dc::notice(block_size > 0), "NodeMemoryResource::m_block_size using [" << m_mpp << "] set to " << m_block_size << " [" << this << "]");
   }
 
   void* allocate(size_t block_size)
@@ -89,8 +107,8 @@ class NodeMemoryResource
       // a statefultask::DefaultMemoryPagePool object at the top of main. Go read the documentation
       // at the top of statefultask/DefaultMemoryPagePool.h.
       ASSERT(m_mpp != nullptr);
-      m_block_size = block_size;
-      Dout(dc::notice, "NodeMemoryResource::m_block_size using [" << m_mpp << "] set to " << block_size << " [" << this << "]");
+      m_block_size = aligned_size(block_size, m_alignment);
+      Dout(dc::notice, "NodeMemoryResource::m_block_size using [" << m_mpp << "] set to " << m_block_size << " [" << this << "]");
     }
 #ifdef CWDEBUG
     else
@@ -101,8 +119,11 @@ class NodeMemoryResource
           if (!chunk)
             return false;
           m_sss.add_block(chunk, m_mpp->block_size(), m_block_size);
+          m_stats.count_grow();
           return true;
         });
+    if (AI_LIKELY(ptr))
+      m_stats.count_allocate();
     //Dout(dc::finish, ptr);
     return ptr;
   }
@@ -110,13 +131,34 @@ class NodeMemoryResource
   void deallocate(void* ptr)
   {
     //DoutEntering(dc::notice, "NodeMemoryResource::deallocate(" << ptr << ")");
+    m_stats.count_deallocate();
     m_sss.deallocate(ptr);
   }
 
+  // The size of the blocks served by allocate(), or 0 when that wasn't determined yet.
+  size_t block_size() const { return m_block_size; }
+
+  // A lock-free snapshot of the usage counters of this resource; cheap enough to scrape periodically.
+  MemoryPoolStats::Snapshot stats() const
+  {
+    MemoryPoolStats::Snapshot stats = m_stats.snapshot();
+    if (m_block_size > 0)
+      stats.capacity = stats.grows * (m_mpp->block_size() / m_block_size);  // Every grow added one upstream block, carved into nodes.
+    return stats;
+  }
+
  private:
+  // Return block_size, rounded up to a multiple of the cache line size when alignment is cacheline_alignment.
+  static size_t aligned_size(size_t block_size, alignment_type alignment)
+  {
+    return alignment == cacheline_alignment ? nearest_multiple_of_power_of_two(block_size, size_t{config::cacheline_size_c}) : block_size;
+  }
+
   MemoryPagePool* m_mpp;
   SimpleSegregatedStorage m_sss;
   size_t m_block_size;
+  alignment_type m_alignment;           // Whether or not m_block_size is rounded up to a multiple of the cache line size.
+  MemoryPoolStats m_stats;              // Lock-free observability counters, see stats().
 };
 
 } // namespace utils
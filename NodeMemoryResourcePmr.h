@@ -0,0 +1,82 @@
+/**
+ * ai-utils -- C++ Core utilities
+ *
+ * @file
+ * @brief Definition of class NodeMemoryResourcePmr.
+ *
+ * @Copyright (C) 2021  Carlo Wood.
+ *
+ * RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+ * Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+ *
+ * This file is part of ai-utils.
+ *
+ * ai-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ai-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ai-utils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "utils/NodeMemoryResource.h"
+#include "debug.h"
+#include <memory_resource>
+#include <new>
+
+namespace utils {
+
+// class NodeMemoryResourcePmr
+//
+// Thin adaptor that plugs a NodeMemoryResource into std::pmr containers.
+//
+// Usage example:
+//
+//   utils::MemoryPagePool mpp(0x8000);
+//   utils::NodeMemoryResource nmr(mpp);
+//   utils::NodeMemoryResourcePmr pmr(nmr);
+//   std::pmr::list<Message> messages(&pmr);
+//
+class NodeMemoryResourcePmr : public std::pmr::memory_resource
+{
+ private:
+  NodeMemoryResource& m_nmr;
+
+ public:
+  NodeMemoryResourcePmr(NodeMemoryResource& nmr) : m_nmr(nmr) { }
+
+ protected:
+  void* do_allocate(size_t bytes, size_t DEBUG_ONLY(alignment)) override
+  {
+    // Nodes are carved out at multiples of the block size from a page-aligned chunk,
+    // so their alignment is the largest power of two that divides the block size.
+    ASSERT(m_nmr.block_size() == 0 || m_nmr.block_size() % alignment == 0);
+    void* ptr = m_nmr.allocate(bytes);
+    if (AI_UNLIKELY(ptr == nullptr))
+      throw std::bad_alloc();
+    return ptr;
+  }
+
+  void do_deallocate(void* ptr, size_t UNUSED_ARG(bytes), size_t UNUSED_ARG(alignment)) override
+  {
+    m_nmr.deallocate(ptr);
+  }
+
+  bool do_is_equal(std::pmr::memory_resource const& other) const noexcept override
+  {
+    // Memory allocated by one NodeMemoryResourcePmr can be deallocated through another
+    // if and only if they adapt the same NodeMemoryResource.
+    NodeMemoryResourcePmr const* adaptor = dynamic_cast<NodeMemoryResourcePmr const*>(&other);
+    return adaptor && &adaptor->m_nmr == &m_nmr;
+  }
+};
+
+} // namespace utils
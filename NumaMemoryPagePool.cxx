@@ -0,0 +1,148 @@
+/**
+ * ai-utils -- C++ Core utilities
+ *
+ * @file
+ * @brief Definition of class NumaMemoryPagePool.
+ *
+ * @Copyright (C) 2021  Carlo Wood.
+ *
+ * RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+ * Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+ *
+ * This file is part of ai-utils.
+ *
+ * ai-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ai-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ai-utils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sys.h"
+#include "NumaMemoryPagePool.h"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <sched.h>
+
+namespace utils {
+
+namespace {
+
+// The NUMA topology of this machine: for every cpu the node it belongs to,
+// read once from /sys/devices/system/node/node*/cpulist.
+std::vector<int> const& cpu_to_node()
+{
+  static std::vector<int> const cpu_to_node_ = [](){
+    std::vector<int> map;
+    for (int node = 0;; ++node)
+    {
+      std::ifstream cpulist("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+      if (!cpulist.is_open())
+        break;
+      // Parse a list like "0-3,8-11".
+      std::string range;
+      while (std::getline(cpulist, range, ','))
+      {
+        int first, last;
+        size_t dash = range.find('-');
+        first = std::stoi(range);
+        last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+        if (last >= static_cast<int>(map.size()))
+          map.resize(last + 1, 0);
+        for (int cpu = first; cpu <= last; ++cpu)
+          map[cpu] = node;
+      }
+    }
+    return map;
+  }();
+  return cpu_to_node_;
+}
+
+} // namespace
+
+//static
+int NumaMemoryPagePool::node_of_cpu(int cpu)
+{
+  std::vector<int> const& map = cpu_to_node();
+  return (cpu < 0 || cpu >= static_cast<int>(map.size())) ? 0 : map[cpu];
+}
+
+//static
+int NumaMemoryPagePool::current_node()
+{
+  return node_of_cpu(sched_getcpu());
+}
+
+NumaMemoryPagePool::NumaMemoryPagePool(size_t block_size, blocks_t minimum_chunk_size, blocks_t maximum_chunk_size) :
+  m_chunk_map(nullptr)
+{
+  DoutEntering(dc::notice, "NumaMemoryPagePool::NumaMemoryPagePool(" << block_size << ", " << minimum_chunk_size << ", " << maximum_chunk_size << ") [" << this << "]");
+  std::vector<int> const& map = cpu_to_node();
+  int const number_of_nodes = map.empty() ? 1 : *std::max_element(map.begin(), map.end()) + 1;
+  for (int node = 0; node < number_of_nodes; ++node)
+    m_node_pools.push_back(std::make_unique<NodePool>(this, node, block_size, minimum_chunk_size, maximum_chunk_size));
+}
+
+NumaMemoryPagePool::~NumaMemoryPagePool()
+{
+  DoutEntering(dc::notice, "NumaMemoryPagePool::~NumaMemoryPagePool() [" << this << "]");
+}
+
+void NumaMemoryPagePool::register_chunk(void* chunk, size_t size, int node)
+{
+  std::scoped_lock<std::mutex> lock(m_chunk_map_mutex);
+  // Copy the current snapshot, insert the new chunk sorted, and republish.
+  chunk_map_type const* current = m_chunk_map.load(std::memory_order_relaxed);
+  auto new_map = std::make_unique<chunk_map_type>(current ? *current : chunk_map_type{});
+  ChunkRange const range{static_cast<char*>(chunk), size, node};
+  new_map->insert(std::upper_bound(new_map->begin(), new_map->end(), range,
+        [](ChunkRange const& lhs, ChunkRange const& rhs){ return lhs.m_start < rhs.m_start; }), range);
+  m_chunk_map.store(new_map.get(), std::memory_order_release);
+  m_retired.push_back(std::move(new_map));
+}
+
+void* NumaMemoryPagePool::allocate()
+{
+  int const node = current_node();
+  NodePool& local = *m_node_pools[node];
+  // The fast path: a block from the local magazine or the local free list.
+  void* ptr = local.try_allocate();
+  if (AI_LIKELY(ptr))
+    return ptr;
+  // The local node ran dry; steal a free block from another node before
+  // allocating more system memory.
+  for (int offset = 1; offset < static_cast<int>(m_node_pools.size()); ++offset)
+  {
+    ptr = m_node_pools[(node + offset) % m_node_pools.size()]->try_allocate();
+    if (ptr)
+      return ptr;
+  }
+  // Every node ran dry; grow the local pool.
+  return local.allocate();
+}
+
+void NumaMemoryPagePool::deallocate(void* ptr)
+{
+  // Route the block back to the node that owns the chunk it belongs to.
+  chunk_map_type const* map = m_chunk_map.load(std::memory_order_acquire);
+  // ptr must have been returned by allocate(), hence at least one chunk exists.
+  ASSERT(map);
+  auto chunk = std::upper_bound(map->begin(), map->end(), ptr,
+      [](void* p, ChunkRange const& range){ return p < range.m_start; });
+  // The chunk map contains the chunk that ptr came from.
+  ASSERT(chunk != map->begin());
+  --chunk;
+  ASSERT(static_cast<char*>(ptr) < chunk->m_start + chunk->m_size);
+  m_node_pools[chunk->m_node]->deallocate(ptr);
+}
+
+} // namespace utils
@@ -0,0 +1,108 @@
+/**
+ * ai-utils -- C++ Core utilities
+ *
+ * @file
+ * @brief Definition of class NumaMemoryPagePool.
+ *
+ * @Copyright (C) 2021  Carlo Wood.
+ *
+ * RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+ * Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+ *
+ * This file is part of ai-utils.
+ *
+ * ai-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ai-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ai-utils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "utils/MemoryPagePool.h"
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace utils {
+
+// class NumaMemoryPagePool
+//
+// A MemoryPagePool front-end for multi-socket machines that keeps one pool - and
+// therefore one free list and one set of chunks, bound to that node with mbind(2) -
+// per NUMA node. allocate() serves the caller from the free list of the NUMA node
+// it currently runs on, steals a free block from another node only when that list
+// is empty, and grows the local pool only when every node ran dry.
+//
+// deallocate() routes a block back to the free list of the node that owns the chunk
+// it came from, looked up in an immutable, atomically republished chunk map, so
+// blocks never lose their placement no matter which thread frees them.
+//
+// On machines without NUMA support this degenerates to a single MemoryPagePool.
+//
+class NumaMemoryPagePool
+{
+ public:
+  using blocks_t = MemoryPagePool::blocks_t;
+
+ private:
+  // The per-node pool: a MemoryPagePool whose chunks are bound to one NUMA node
+  // and that reports new chunks to its parent.
+  class NodePool : public MemoryPagePool
+  {
+   private:
+    NumaMemoryPagePool* m_parent;
+    int m_node;
+
+   public:
+    NodePool(NumaMemoryPagePool* parent, int node, size_t block_size, blocks_t minimum_chunk_size, blocks_t maximum_chunk_size) :
+      MemoryPagePool(block_size, minimum_chunk_size, maximum_chunk_size, conventional_pages, node), m_parent(parent), m_node(node) { }
+
+   protected:
+    void chunk_added(void* chunk, size_t size) override { m_parent->register_chunk(chunk, size, m_node); }
+  };
+
+  struct ChunkRange
+  {
+    char* m_start;                      // The start of a chunk.
+    size_t m_size;                      // The size of that chunk, in bytes.
+    int m_node;                         // The NUMA node whose NodePool owns it.
+  };
+  using chunk_map_type = std::vector<ChunkRange>;       // Sorted by m_start.
+
+  std::vector<std::unique_ptr<NodePool>> m_node_pools;          // One pool per NUMA node.
+  std::atomic<chunk_map_type const*> m_chunk_map;               // The current immutable chunk map snapshot.
+  std::vector<std::unique_ptr<chunk_map_type const>> m_retired; // All snapshots ever published; readers might still
+                                                                // use an old one, and chunk growth is rare and bounded.
+  std::mutex m_chunk_map_mutex;                                 // Serializes register_chunk().
+
+  // Called by a NodePool, while holding its m_add_block_mutex, for every new chunk.
+  void register_chunk(void* chunk, size_t size, int node);
+
+ public:
+  NumaMemoryPagePool(size_t block_size,                 // The size of a block as returned by allocate(), in bytes; must be a multiple the memory page size.
+                     blocks_t minimum_chunk_size = 0,   // As MemoryPagePool; applied per node.
+                     blocks_t maximum_chunk_size = 0);
+  ~NumaMemoryPagePool();
+
+  void* allocate();
+  void deallocate(void* ptr);
+
+  size_t block_size() const { return m_node_pools[0]->block_size(); }
+  int number_of_nodes() const { return m_node_pools.size(); }
+
+  // The NUMA node that cpu belongs to (0 when unknown).
+  static int node_of_cpu(int cpu);
+  // The NUMA node that the calling thread currently runs on.
+  static int current_node();
+};
+
+} // namespace utils
@@ -0,0 +1,100 @@
+/**
+ * ai-utils -- C++ Core utilities
+ *
+ * @file
+ * @brief Definition of class template ObjectPool.
+ *
+ * @Copyright (C) 2021  Carlo Wood.
+ *
+ * RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+ * Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+ *
+ * This file is part of ai-utils.
+ *
+ * ai-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ai-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ai-utils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "AIRefCount.h"
+#include "NodeMemoryPool.h"
+#include <type_traits>
+#include <utility>
+#include <boost/intrusive_ptr.hpp>
+
+namespace utils {
+
+// Base class for objects that are created with ObjectPool<T>::create.
+//
+// Provides the operator delete that returns the memory of the object to the
+// NodeMemoryPool that it was allocated from, instead of to the heap, when its
+// reference count drops to zero (AIRefCount's allow_deletion() path deletes
+// the object through its virtual destructor, which selects this deallocation
+// function because it is a member of the most derived class).
+//
+struct ObjectPoolReturner
+{
+  void operator delete(void* ptr) { NodeMemoryPool::static_free(ptr); }
+};
+
+// class ObjectPool<T>
+//
+// A memory pool for short-lived reference counted objects of a single type T,
+// which must be derived from both AIRefCount and ObjectPoolReturner.
+//
+// Usage:
+//
+// class Message : public AIRefCount, public utils::ObjectPoolReturner
+// {
+//  public:
+//   Message(uint64_t seqnr);
+//   ...
+// };
+//
+// utils::ObjectPool<Message> pool(128);        // Will allocate 128 Message's at a time.
+//
+// boost::intrusive_ptr<Message> msg = pool.create(seqnr);
+//
+// The constructor arguments of create are perfectly forwarded. When the last
+// boost::intrusive_ptr is destructed the Message is destructed and its memory
+// returned to the pool, not to the heap.
+//
+// ObjectPool is as thread-safe as NodeMemoryPool: objects may be created and
+// destructed concurrently, but the ObjectPool must outlive all of its objects.
+//
+template<typename T>
+class ObjectPool
+{
+  static_assert(std::is_base_of_v<AIRefCount, T>, "T must be derived from AIRefCount.");
+  static_assert(std::is_base_of_v<ObjectPoolReturner, T>, "T must be derived from utils::ObjectPoolReturner.");
+
+ private:
+  NodeMemoryPool m_pool;                // The underlying fixed size memory pool.
+
+ public:
+  // Construct a pool that allocates nchunks objects at a time.
+  ObjectPool(int nchunks) : m_pool(nchunks, sizeof(T)) { }
+
+  // Create a new T, allocated from the pool, and return it as intrusive_ptr (reference count 1).
+  template<typename... Args>
+  boost::intrusive_ptr<T> create(Args&&... args)
+  {
+    return boost::intrusive_ptr<T>(new (m_pool) T(std::forward<Args>(args)...));
+  }
+
+  // A snapshot of the usage counters of the underlying pool, see NodeMemoryPool::stats.
+  MemoryPoolStats::Snapshot stats() const { return m_pool.stats(); }
+};
+
+} // namespace utils
@@ -0,0 +1,299 @@
+/**
+ * ai-utils -- C++ Core utilities
+ *
+ * @file
+ * @brief Definition of class PerCpuBlockCache.
+ *
+ * @Copyright (C) 2021  Carlo Wood.
+ *
+ * RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+ * Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+ *
+ * This file is part of ai-utils.
+ *
+ * ai-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ai-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ai-utils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "SimpleSegregatedStorage.h"
+#include "debug.h"
+#include <cstdint>
+#include <vector>
+#include <unistd.h>
+
+// Restartable sequences (rseq(2)): supported on x86-64 with a glibc that
+// registers the rseq area for every thread (2.35 and later; __rseq_offset
+// tells us where it lives relative to the thread pointer). Everywhere else
+// PerCpuBlockCache transparently degrades to the plain shared free list.
+#if defined(__x86_64__) && defined(__GLIBC__) && __GLIBC_PREREQ(2, 35)
+#include <sys/rseq.h>
+#define UTILS_HAVE_RSEQ 1
+#endif
+
+namespace utils {
+
+// class PerCpuBlockCache
+//
+// A per-CPU cache of free blocks in front of a SimpleSegregatedStorage,
+// manipulated inside restartable sequence critical sections: the fast path
+// of allocate() and deallocate() is a handful of plain loads and one plain
+// store - no atomic read-modify-write, no lock prefix, and the cacheline
+// of the cache is only ever touched by the CPU it belongs to. Unlike the
+// thread magazines of MemoryPagePool, a thread that migrates leaves the
+// cached blocks behind on the old CPU, where they stay warm for whoever
+// runs there next (the tcmalloc per-cpu design).
+//
+// The kernel aborts a critical section that is preempted, migrated or
+// signalled, jumping to its abort handler; we then simply retry on the new
+// CPU or fall back to the shared CAS-based free list. The fallback is also
+// taken when the cache of this CPU is empty (refilling it with a single
+// detach of several blocks) or full (overflowing to the shared list), and
+// on hosts or architectures without rseq support.
+//
+// Usage:
+//
+//   utils::SimpleSegregatedStorage sss;
+//   utils::PerCpuBlockCache cache(sss);
+//   ...
+//   void* ptr = cache.allocate([&](){ return grow(sss); });
+//   ...
+//   cache.deallocate(ptr);
+//
+// Blocks must be at least 8 bytes (they already must be for the free list).
+// flush() returns all cached blocks to the shared free list; it walks the
+// per-CPU arrays without synchronization and may therefore only be called
+// when no other thread is using the cache (e.g. from the destructor of the
+// owning pool).
+class PerCpuBlockCache
+{
+ public:
+  static constexpr intptr_t cache_size = 16;   // The number of blocks cached per CPU.
+
+ private:
+  // The cache of one CPU, on its own cacheline. m_count is a plain integer:
+  // it is only written by a critical section running on that CPU.
+  struct alignas(64) Slot
+  {
+    intptr_t m_count;
+    void* m_blocks[cache_size];
+
+    Slot() : m_count(0) { }
+  };
+
+  SimpleSegregatedStorage& m_sss;
+  std::vector<Slot> m_slots;                    // One Slot per possible CPU; empty when rseq is not available.
+
+#ifdef UTILS_HAVE_RSEQ
+  static constexpr uint32_t rseq_signature = 0x53053053;
+
+  // The rseq area that glibc registered for the calling thread.
+  [[gnu::always_inline]] static struct rseq* rseq_area()
+  {
+    return reinterpret_cast<struct rseq*>(static_cast<char*>(__builtin_thread_pointer()) + __rseq_offset);
+  }
+
+  // Whether the kernel actually registered the area (it did not when rseq(2) is unsupported).
+  static bool rseq_available()
+  {
+    return __rseq_size > 0;
+  }
+
+  // The result of slot_pop() when the sequence must be retried (aborted, or the thread
+  // migrated between reading the CPU number and entering the critical section). Blocks
+  // are at least 8 byte aligned, so this can never be a real block.
+  static void* constexpr_retry() { return reinterpret_cast<void*>(1); }
+
+  // Pop one block from slot, which must belong to CPU cpu.
+  // Returns the block, nullptr when the slot is empty, or constexpr_retry().
+  static void* slot_pop(Slot* slot, uint32_t cpu, struct rseq* rs)
+  {
+    void* result;
+    uintptr_t scratch;
+    asm volatile (
+        ".pushsection __rseq_cs, \"aw\"\n\t"
+        ".balign 32\n\t"
+        "3:\n\t"
+        ".long 0x0, 0x0\n\t"                            // version, flags.
+        ".quad 1f, (2f - 1f), 4f\n\t"                   // start_ip, post_commit_offset, abort_ip.
+        ".popsection\n\t"
+        ".pushsection __rseq_failure, \"ax\"\n\t"
+        ".byte 0x0f, 0xb9, 0x3d\n\t"                    // ud1 (the kernel verifies this signature
+        ".long 0x53053053\n\t"                          //      precedes the abort handler).
+        "4:\n\t"
+        "jmp 5f\n\t"                                    // Abort: retry.
+        ".popsection\n\t"
+        "lea 3b(%%rip), %[scratch]\n\t"
+        "mov %[scratch], %[rseq_cs]\n\t"                // Arm the critical section.
+        "1:\n\t"
+        "cmpl %[cpu], %[cpu_id]\n\t"                    // Migrated before we got here?
+        "jne 5f\n\t"
+        "mov %[count], %[scratch]\n\t"
+        "test %[scratch], %[scratch]\n\t"
+        "jz 6f\n\t"                                     // Empty.
+        "mov -8(%[blocks], %[scratch], 8), %[result]\n\t"
+        "dec %[scratch]\n\t"
+        "mov %[scratch], %[count]\n\t"                  // Commit: the single store that makes the pop happen.
+        "2:\n\t"
+        "jmp 7f\n\t"
+        "5:\n\t"
+        "mov $1, %[result]\n\t"                         // constexpr_retry().
+        "jmp 7f\n\t"
+        "6:\n\t"
+        "xor %k[result], %k[result]\n\t"                // nullptr.
+        "7:\n\t"
+        : [result] "=&r" (result), [scratch] "=&r" (scratch),
+          [rseq_cs] "=m" (rs->rseq_cs), [count] "+m" (slot->m_count)
+        : [cpu] "r" (cpu), [cpu_id] "m" (rs->cpu_id), [blocks] "r" (slot->m_blocks)
+        : "memory", "cc");
+    return result;
+  }
+
+  // The result of slot_push(): pushed, the slot was full, or the sequence must be retried.
+  enum push_result { pushed, full, retry };
+
+  // Push ptr onto slot, which must belong to CPU cpu.
+  static push_result slot_push(Slot* slot, void* ptr, uint32_t cpu, struct rseq* rs)
+  {
+    uintptr_t status;
+    uintptr_t scratch;
+    asm volatile (
+        ".pushsection __rseq_cs, \"aw\"\n\t"
+        ".balign 32\n\t"
+        "3:\n\t"
+        ".long 0x0, 0x0\n\t"
+        ".quad 1f, (2f - 1f), 4f\n\t"
+        ".popsection\n\t"
+        ".pushsection __rseq_failure, \"ax\"\n\t"
+        ".byte 0x0f, 0xb9, 0x3d\n\t"
+        ".long 0x53053053\n\t"
+        "4:\n\t"
+        "jmp 5f\n\t"
+        ".popsection\n\t"
+        "lea 3b(%%rip), %[scratch]\n\t"
+        "mov %[scratch], %[rseq_cs]\n\t"
+        "1:\n\t"
+        "cmpl %[cpu], %[cpu_id]\n\t"
+        "jne 5f\n\t"
+        "mov %[count], %[scratch]\n\t"
+        "cmp %[size], %[scratch]\n\t"
+        "jae 6f\n\t"                                    // Full.
+        "mov %[ptr], (%[blocks], %[scratch], 8)\n\t"    // Harmless when aborted: m_count is unchanged.
+        "inc %[scratch]\n\t"
+        "mov %[scratch], %[count]\n\t"                  // Commit.
+        "2:\n\t"
+        "xor %k[status], %k[status]\n\t"                // pushed.
+        "jmp 7f\n\t"
+        "5:\n\t"
+        "mov $2, %k[status]\n\t"                        // retry.
+        "jmp 7f\n\t"
+        "6:\n\t"
+        "mov $1, %k[status]\n\t"                        // full.
+        "7:\n\t"
+        : [status] "=&r" (status), [scratch] "=&r" (scratch),
+          [rseq_cs] "=m" (rs->rseq_cs), [count] "+m" (slot->m_count)
+        : [cpu] "r" (cpu), [cpu_id] "m" (rs->cpu_id), [blocks] "r" (slot->m_blocks),
+          [ptr] "r" (ptr), [size] "re" (cache_size)
+        : "memory", "cc");
+    return static_cast<push_result>(status);
+  }
+#endif // UTILS_HAVE_RSEQ
+
+ public:
+  PerCpuBlockCache(SimpleSegregatedStorage& sss) : m_sss(sss)
+  {
+#ifdef UTILS_HAVE_RSEQ
+    if (rseq_available())
+      m_slots.resize(sysconf(_SC_NPROCESSORS_CONF));
+#endif
+  }
+
+  ~PerCpuBlockCache() { flush(); }
+
+  // Pop one block from the cache of the current CPU, refilling it from the
+  // shared free list when empty. Only when the shared list is empty too is
+  // add_new_block called (under the add_block mutex), as with
+  // SimpleSegregatedStorage::allocate().
+  void* allocate(std::function<bool()> const& add_new_block)
+  {
+#ifdef UTILS_HAVE_RSEQ
+    while (AI_LIKELY(!m_slots.empty()))
+    {
+      struct rseq* rs = rseq_area();
+      uint32_t const cpu = rs->cpu_id;
+      if (AI_UNLIKELY(cpu >= m_slots.size()))
+        break;
+      void* ptr = slot_pop(&m_slots[cpu], cpu, rs);
+      if (AI_UNLIKELY(ptr == constexpr_retry()))
+        continue;
+      if (AI_LIKELY(ptr))
+        return ptr;
+      // This CPU's cache is empty; refill it half-way from the shared free
+      // list with a single detach, plus one block to return right away.
+      SimpleSegregatedStorage::BlockList list;
+      if (m_sss.try_allocate_n(cache_size / 2 + 1, list) == 0)
+        break;                          // The shared list is empty too; grow.
+      void* result = list.pop();
+      while (void* block = list.pop())
+        if (cache_push(block) != pushed)
+          m_sss.deallocate(block);      // Migrated to a full CPU; give it back.
+      return result;
+    }
+#endif
+    return m_sss.allocate(add_new_block);
+  }
+
+  // Push ptr onto the cache of the current CPU, overflowing to the shared
+  // free list when it is full.
+  void deallocate(void* ptr)
+  {
+#ifdef UTILS_HAVE_RSEQ
+    if (AI_LIKELY(!m_slots.empty() && cache_push(ptr) == pushed))
+      return;
+#endif
+    m_sss.deallocate(ptr);
+  }
+
+  // Return all cached blocks to the shared free list.
+  // Not thread-safe: no other thread may use this cache concurrently.
+  void flush()
+  {
+    SimpleSegregatedStorage::BlockList list;
+    for (Slot& slot : m_slots)
+      while (slot.m_count > 0)
+        list.push(slot.m_blocks[--slot.m_count]);
+    m_sss.deallocate_list(list);
+  }
+
+ private:
+#ifdef UTILS_HAVE_RSEQ
+  // Push ptr onto the cache of the CPU that we are running on, retrying
+  // aborted sequences. Returns full when that CPU's cache is full.
+  push_result cache_push(void* ptr)
+  {
+    for (;;)
+    {
+      struct rseq* rs = rseq_area();
+      uint32_t const cpu = rs->cpu_id;
+      if (AI_UNLIKELY(cpu >= m_slots.size()))
+        return full;
+      push_result const result = slot_push(&m_slots[cpu], ptr, cpu, rs);
+      if (AI_LIKELY(result != retry))
+        return result;
+    }
+  }
+#endif
+};
+
+} // namespace utils
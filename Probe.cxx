@@ -0,0 +1,86 @@
+/**
+ * ai-utils -- C++ Core utilities
+ *
+ * @file
+ * @brief Implementation of class Probe.
+ *
+ * @Copyright (C) 2021  Carlo Wood.
+ *
+ * RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+ * Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+ *
+ * This file is part of ai-utils.
+ *
+ * ai-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ai-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ai-utils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sys.h"
+#include "Probe.h"
+#include "debug.h"
+#include <algorithm>
+#include <ostream>
+
+namespace utils {
+
+uint64_t Probe::Histogram::count() const
+{
+  uint64_t total = 0;
+  for (uint64_t bucket : buckets)
+    total += bucket;
+  return total;
+}
+
+uint64_t Probe::Histogram::percentile(double pct) const
+{
+  ASSERT(0.0 < pct && pct <= 100.0);
+  uint64_t const total = count();
+  if (total == 0)
+    return 0;
+  uint64_t const rank = std::max<uint64_t>(1, pct / 100.0 * total);
+  uint64_t seen = 0;
+  for (int b = 0; b < number_of_buckets; ++b)
+  {
+    seen += buckets[b];
+    if (seen >= rank)
+      return b == 63 ? static_cast<uint64_t>(-1) : (static_cast<uint64_t>(1) << (b + 1));
+  }
+  ASSERT(false);        // count() > 0, so some bucket must reach rank.
+  return 0;
+}
+
+Probe::Histogram Probe::read() const
+{
+  Histogram histogram;
+  histogram.buckets.fill(0);
+  for (PerThread const& per_thread : m_histograms)
+    for (int b = 0; b < number_of_buckets; ++b)
+      histogram.buckets[b] += per_thread.buckets[b].load(std::memory_order_relaxed);
+  return histogram;
+}
+
+std::ostream& operator<<(std::ostream& os, Probe::Histogram const& histogram)
+{
+  os << "{count:" << histogram.count();
+  for (int b = 0; b < Probe::number_of_buckets; ++b)
+    if (histogram.buckets[b] > 0)
+      os << ", [2^" << b << ", 2^" << (b + 1) << "):" << histogram.buckets[b];
+  return os << '}';
+}
+
+std::ostream& operator<<(std::ostream& os, Probe const& probe)
+{
+  return os << probe.name() << ' ' << probe.read();
+}
+
+} // namespace utils
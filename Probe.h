@@ -0,0 +1,145 @@
+/**
+ * ai-utils -- C++ Core utilities
+ *
+ * @file
+ * @brief Definition of class Probe.
+ *
+ * @Copyright (C) 2021  Carlo Wood.
+ *
+ * RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+ * Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+ *
+ * This file is part of ai-utils.
+ *
+ * ai-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ai-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ai-utils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "log2.h"
+#include "threading/aithreadid.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iosfwd>
+#include <vector>
+
+namespace utils {
+
+// class Probe
+//
+// Hot-path timing instrumentation that doesn't cost what it measures, and
+// that - unlike Dout - is still there in release builds.
+//
+// A Probe::Scope stamps the TSC on entry and exit and records the cycle
+// delta in a histogram with power-of-two buckets: bucket b counts the
+// intervals with log2(cycles) == b. Each thread records into its own
+// cacheline-aligned slot (indexed with aithreadid::index()), so recording
+// is an rdtsc, a log2 and a non-atomic increment - no locks, no contended
+// cachelines. The per-thread histograms are only merged when read() is
+// called.
+//
+// Usage:
+//
+//   static utils::Probe wait_time_probe("SpinSemaphore::wait");
+//   ...
+//   {
+//     utils::Probe::Scope scope(wait_time_probe);
+//     // ... the code being measured ...
+//   }
+//   ...
+//   std::cout << wait_time_probe << std::endl;    // Prints the merged histogram.
+//
+// A probe allocates max_thread_indices histograms up front (half a
+// megabyte); define a handful of them statically, don't create them on
+// the fly.
+//
+// On non-x86 the TSC is replaced with steady_clock, so buckets are then
+// powers of two of nanoseconds instead of cycles.
+class Probe
+{
+ public:
+  static constexpr int number_of_buckets = 64;
+
+  // The merged result of a read(): bucket b holds the number of recorded
+  // intervals whose duration d (in cycles) satisfies 2^b <= d < 2^{b+1}.
+  struct Histogram
+  {
+    std::array<uint64_t, number_of_buckets> buckets;
+
+    // The total number of recorded intervals.
+    uint64_t count() const;
+    // Returns the upper bound (in cycles) of the bucket that the pct-th
+    // percentile (0 < pct <= 100) falls in, or 0 when the histogram is empty.
+    uint64_t percentile(double pct) const;
+
+    friend std::ostream& operator<<(std::ostream& os, Histogram const& histogram);
+  };
+
+  // Reads the time stamp counter.
+  [[gnu::always_inline]] static uint64_t timestamp()
+  {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+  }
+
+  // The RAII scope; records the number of cycles between its construction and destruction.
+  class Scope
+  {
+   private:
+    Probe& m_probe;
+    uint64_t m_start;
+
+   public:
+    [[gnu::always_inline]] Scope(Probe& probe) : m_probe(probe), m_start(timestamp()) { }
+    [[gnu::always_inline]] ~Scope() { m_probe.record(timestamp() - m_start); }
+  };
+
+  Probe(char const* name) : m_name(name), m_histograms(aithreadid::max_thread_indices) { }
+
+  char const* name() const { return m_name; }
+
+  // Record a single interval of cycles cycles into the histogram of the calling thread.
+  [[gnu::always_inline]] void record(uint64_t cycles)
+  {
+    std::atomic<uint64_t>& bucket = m_histograms[aithreadid::index()].buckets[cycles ? log2(cycles) : 0];
+    // Not a (locked) read-modify-write: this thread is the only writer.
+    bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  }
+
+  // Merge the histograms of all threads. This is the slow path; call it from
+  // a statistics thread, not from the code being measured.
+  Histogram read() const;
+
+  // Prints the merged histogram; equivalent to `os << probe.read()` but also prints the name.
+  friend std::ostream& operator<<(std::ostream& os, Probe const& probe);
+
+ private:
+  // One histogram per thread index, each on its own set of cachelines.
+  struct alignas(64) PerThread
+  {
+    std::array<std::atomic<uint64_t>, number_of_buckets> buckets;
+
+    PerThread() { for (std::atomic<uint64_t>& bucket : buckets) bucket.store(0, std::memory_order_relaxed); }
+  };
+
+  char const* m_name;
+  std::vector<PerThread> m_histograms;
+};
+
+} // namespace utils
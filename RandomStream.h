@@ -31,6 +31,8 @@
 #include <array>
 #include <algorithm>
 #include <random>
+#include <cstdint>
+#include <cstring>
 
 namespace utils {
 
@@ -70,4 +72,179 @@ class RandomStream : public std::istream
   ~RandomStream() { }
 };
 
+// Four interleaved xoshiro256++ streams, state stored structure-of-arrays
+// so that the per-lane loops of fill() reduce to straight line AVX2 code
+// when compiled with -march for such a target: one step produces 32 bytes.
+// Quality and period (2^256 per lane) are those of xoshiro256++.
+class Xoshiro256ppX4
+{
+ private:
+  uint64_t m_s[4][4];           // m_s[word][lane].
+  unsigned char m_pending[32];  // Leftover bytes of the last step.
+  size_t m_pending_fill;        // Number of leftover bytes (at the end of m_pending).
+
+  static uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+
+  static uint64_t splitmix64(uint64_t& state)
+  {
+    uint64_t z = (state += 0x9e3779b97f4a7c15);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+  }
+
+  void fix_zero_lanes()
+  {
+    // The all-zero state is a fixed point of xoshiro.
+    for (int lane = 0; lane < 4; ++lane)
+      if ((m_s[0][lane] | m_s[1][lane] | m_s[2][lane] | m_s[3][lane]) == 0)
+        m_s[0][lane] = lane + 1;
+  }
+
+ public:
+  explicit Xoshiro256ppX4(uint64_t seed) : m_pending_fill(0)
+  {
+    // Expand the seed with splitmix64, as recommended by the xoshiro authors.
+    for (int lane = 0; lane < 4; ++lane)
+      for (int word = 0; word < 4; ++word)
+        m_s[word][lane] = splitmix64(seed);
+  }
+
+  // Seed from a std::seed_seq, for reproducible parallel streams:
+  // give each worker a seed_seq with a distinct stream id appended.
+  explicit Xoshiro256ppX4(std::seed_seq& seq) : m_pending_fill(0)
+  {
+    uint32_t words[32];
+    seq.generate(words, words + 32);
+    for (int lane = 0; lane < 4; ++lane)
+      for (int word = 0; word < 4; ++word)
+        m_s[word][lane] = (static_cast<uint64_t>(words[8 * lane + 2 * word]) << 32) | words[8 * lane + 2 * word + 1];
+    fix_zero_lanes();
+  }
+
+  // Fill buffer with size random bytes.
+  // The byte sequence is independent of how it is cut into fill() calls:
+  // unused bytes of the last 32-byte step are carried over to the next call.
+  void fill(void* buffer, size_t size)
+  {
+    unsigned char* out = static_cast<unsigned char*>(buffer);
+    if (m_pending_fill > 0)
+    {
+      size_t const n = std::min(size, m_pending_fill);
+      std::memcpy(out, m_pending + sizeof(m_pending) - m_pending_fill, n);
+      m_pending_fill -= n;
+      out += n;
+      size -= n;
+    }
+    while (size > 0)
+    {
+      uint64_t result[4];
+      for (int lane = 0; lane < 4; ++lane)
+        result[lane] = rotl(m_s[0][lane] + m_s[3][lane], 23) + m_s[0][lane];
+      for (int lane = 0; lane < 4; ++lane)
+      {
+        uint64_t const t = m_s[1][lane] << 17;
+        m_s[2][lane] ^= m_s[0][lane];
+        m_s[3][lane] ^= m_s[1][lane];
+        m_s[1][lane] ^= m_s[2][lane];
+        m_s[0][lane] ^= m_s[3][lane];
+        m_s[2][lane] ^= t;
+        m_s[3][lane] = rotl(m_s[3][lane], 45);
+      }
+      size_t const n = std::min(size, sizeof(result));
+      std::memcpy(out, result, n);
+      if (n < sizeof(result))
+      {
+        std::memcpy(m_pending, result, sizeof(result));
+        m_pending_fill = sizeof(result) - n;
+        // m_pending_fill bytes remain at the end of m_pending because n bytes were consumed from the front.
+      }
+      out += n;
+      size -= n;
+    }
+  }
+};
+
+// As RandomStreamBuf, but refilled in blocks from Xoshiro256ppX4 instead of
+// one uniform_int_distribution draw per character, and with a direct fill()
+// API so bulk consumers can skip the istream machinery entirely. Note that
+// the byte sequence is unrelated to that of RandomStreamBuf (whose output -
+// and the golden digests in StreamHasher.h - must stay stable).
+class FastRandomStreamBuf : public std::streambuf
+{
+ private:
+  size_t m_size;
+  Xoshiro256ppX4 m_generator;
+  unsigned char m_begin;
+  int m_range;                  // 0 means: full byte range, no remapping.
+  std::array<char, 256> m_buffer;
+
+ protected:
+  int_type underflow() override
+  {
+    if (m_size == 0)
+      return EOF;
+
+    size_t size = std::min(m_size, m_buffer.size());
+    fill(&m_buffer[0], size);
+    setg(&m_buffer[0], &m_buffer[0], &m_buffer[size]);
+    m_size -= size;
+    return 0;
+  }
+
+  std::streamsize xsgetn(char* s, std::streamsize count) override
+  {
+    // First serve what is left in the get area, then fill the rest directly.
+    std::streamsize served = std::min(count, egptr() - gptr());
+    std::memcpy(s, gptr(), served);
+    gbump(served);
+    size_t const direct = std::min(static_cast<size_t>(count - served), m_size);
+    fill(s + served, direct);
+    m_size -= direct;
+    return served + direct;
+  }
+
+ public:
+  // A stream of size random bytes (all 256 values).
+  FastRandomStreamBuf(size_t size, uint64_t seed = 0) : m_size(size), m_generator(seed), m_begin(0), m_range(0) { }
+
+  // A stream of size random characters in the range [b, e].
+  // The characters are mapped from random bytes with a multiply-shift, which
+  // has a bias of at most (e - b + 1) / 256: fine for test data, do not use
+  // this for anything statistical.
+  FastRandomStreamBuf(size_t size, char b, char e, uint64_t seed = 0) :
+      m_size(size), m_generator(seed), m_begin(b), m_range(e - b + 1) { }
+
+  FastRandomStreamBuf(size_t size, std::seed_seq& seq) : m_size(size), m_generator(seq), m_begin(0), m_range(0) { }
+
+  FastRandomStreamBuf(size_t size, char b, char e, std::seed_seq& seq) :
+      m_size(size), m_generator(seq), m_begin(b), m_range(e - b + 1) { }
+
+  // Fill data with size random bytes (remapped to [b, e] when applicable),
+  // bypassing the stream; this does not count against the stream size passed
+  // to the constructor.
+  void fill(void* data, size_t size)
+  {
+    m_generator.fill(data, size);
+    if (m_range != 0)
+    {
+      unsigned char* p = static_cast<unsigned char*>(data);
+      for (size_t i = 0; i < size; ++i)
+        p[i] = m_begin + ((p[i] * m_range) >> 8);
+    }
+  }
+};
+
+class FastRandomStream : public std::istream
+{
+ private:
+  FastRandomStreamBuf m_random_streambuf;
+
+ public:
+  FastRandomStream(size_t size, uint64_t seed = 0) : m_random_streambuf(size, seed) { rdbuf(&m_random_streambuf); }
+  FastRandomStream(size_t size, char b, char e, uint64_t seed = 0) : m_random_streambuf(size, b, e, seed) { rdbuf(&m_random_streambuf); }
+  FastRandomStream(size_t size, std::seed_seq& seq) : m_random_streambuf(size, seq) { rdbuf(&m_random_streambuf); }
+  FastRandomStream(size_t size, char b, char e, std::seed_seq& seq) : m_random_streambuf(size, b, e, seq) { rdbuf(&m_random_streambuf); }
+};
+
 } // namespace utils
@@ -2,6 +2,8 @@
 
 #include <vector>
 #include <functional>
+#include <algorithm>
+#include <cstdlib>
 
 // Register global (POD) types and do callbacks per object once main is reached.
 //
@@ -105,4 +107,85 @@ class Register : public RegisterGlobals
 template<typename T>
 std::vector<std::function<void(size_t)>> Register<T>::s_global_objects;
 
+// The flat variant of Register, for mass registration.
+//
+// A Register stores a std::function per registration: a possible heap
+// allocation at static initialization time and an indirect, type-erased call
+// at finish_registration(). When tens of thousands of translation units each
+// register a factory that is measurable startup cost. A FlatRegister records
+// just a plain function pointer plus one context word in a flat, geometrically
+// grown array (no nodes, no std::function), and finish_registration() becomes
+// a tight linear pass over contiguous memory. The entries are grouped by
+// callback first, so that the - typically very few - distinct callback
+// functions each run as an uninterrupted run of direct calls.
+//
+// Usage is as with Register, except that the callback is a function pointer
+// that receives the context word back:
+//
+//     // .cxx
+//     namespace {
+//     utils::FlatRegister<G> g1_([](size_t n, void* context){ G::register_one(n, *static_cast<G const*>(context), "g1"); }, const_cast<G*>(&g1));
+//     } // namespace
+//
+template<typename T>
+class FlatRegister : public RegisterGlobals
+{
+ public:
+  using callback_type = void (*)(size_t number_of_objects, void* context);
+
+ private:
+  struct Entry
+  {
+    callback_type m_callback;
+    void* m_context;
+  };
+
+  // These are constant-initialized to zero and therefore valid before any
+  // dynamic initialization runs, whatever the order across translation units.
+  static Entry* s_entries;
+  static size_t s_size;
+  static size_t s_capacity;
+
+ public:
+  FlatRegister(callback_type callback, void* context = nullptr)
+  {
+    if (s_size == 0)
+      RegisterGlobals::add(this);
+    if (s_size == s_capacity)
+    {
+      // Static initialization is single threaded; plain realloc doubling.
+      s_capacity = s_capacity == 0 ? 64 : 2 * s_capacity;
+      s_entries = static_cast<Entry*>(std::realloc(s_entries, s_capacity * sizeof(Entry)));
+    }
+    s_entries[s_size++] = Entry{callback, context};
+  }
+
+ private:
+  static void do_finish()
+  {
+    size_t const number_of_objects = s_size;
+    Entry* const entries = s_entries;
+    // Group by callback: registration order across translation units is
+    // unspecified anyway, and this turns the pass into runs of direct calls
+    // to the same function.
+    std::sort(entries, entries + number_of_objects,
+        [](Entry const& e1, Entry const& e2){ return std::less<callback_type>{}(e1.m_callback, e2.m_callback); });
+    for (size_t i = 0; i < number_of_objects; ++i)
+      entries[i].m_callback(number_of_objects, entries[i].m_context);
+    // Free resources.
+    std::free(s_entries);
+    s_entries = nullptr;
+    s_size = s_capacity = 0;
+  }
+
+  void finish() override final { do_finish(); }
+};
+
+template<typename T>
+typename FlatRegister<T>::Entry* FlatRegister<T>::s_entries;
+template<typename T>
+size_t FlatRegister<T>::s_size;
+template<typename T>
+size_t FlatRegister<T>::s_capacity;
+
 } // namespace utils
@@ -28,6 +28,7 @@
 #include "sys.h"
 #include "debug.h"
 #include "Signals.h"
+#include "cpu_relax.h"
 #include "macros.h"
 #include <string>
 #include <cstring>
@@ -84,27 +85,87 @@ std::string signal_name_str(int signum)
 
 } // namespace
 
+//static
+Signal::DeferredSignal Signal::s_deferred[max_deferred_signum + 1];
+
 Signal::~Signal()
 {
+  if (m_dispatcher.joinable())
+  {
+    m_dispatcher_stop.store(true, std::memory_order_release);
+    m_deferred_semaphore.post();
+    m_dispatcher.join();
+  }
+}
+
+//static
+void Signal::deferred_handler(int signum)
+{
+  // This runs in signal context: just a few atomic operations on preallocated
+  // memory and - when there is no spinner inside the semaphore - one futex
+  // system call; all of which is async-signal-safe.
+  DeferredSignal& node = s_deferred[signum];
+  if (node.m_queued.exchange(true, std::memory_order_relaxed))
+    return;             // Already queued; coalesce, just like a blocked signal would.
+  Signal& self = instance();
+  self.m_deferred_queue.push(&node);
+  self.m_deferred_semaphore.post();
+}
+
+void Signal::dispatch_loop()
+{
+  for (;;)
+  {
+    m_deferred_semaphore.wait();
+    if (AI_UNLIKELY(m_dispatcher_stop.load(std::memory_order_acquire)))
+      break;
+    // Every token corresponds to exactly one push, but that push might not
+    // have completed yet (see MpscQueue.h); spin until it did.
+    DeferredSignal* node;
+    while (!(node = static_cast<DeferredSignal*>(m_deferred_queue.pop())))
+      cpu_relax();
+    // From here on the node may be queued again: a signal that arrives while
+    // its callback is running must cause a new invocation, not be lost.
+    node->m_queued.store(false, std::memory_order_relaxed);
+    node->m_callback(node->m_signum);
+  }
+}
+
+void Signal::register_deferred_callback(int signum, std::function<void(int)> cb)
+{
+  DoutEntering(dc::notice, "Signal::register_deferred_callback(" << signum << ", ...)");
+  // Signal numbers run from 1 to SIGRTMAX.
+  ASSERT(0 < signum && signum <= max_deferred_signum);
+  DeferredSignal& node = s_deferred[signum];
+  node.m_signum = signum;
+  node.m_callback = std::move(cb);
+  {
+    std::lock_guard<std::mutex> lock(m_callback_mutex);
+    if (!m_dispatcher.joinable())
+      m_dispatcher = std::thread([this](){ dispatch_loop(); });
+  }
+  // Only install the handler after the callback is in place and the
+  // dispatcher runs; this also does the usual reservation checks.
+  register_callback(signum, &Signal::deferred_handler);
 }
 
 void Signal::print_on(std::ostream& os) const
 {
+  signals_mask_t const reserved = m_reserved_signals.load(std::memory_order_relaxed);
   os << "Reserved signals: ";
   char const* separator = "";
   for (int signum = 1; signum <= max_signum; ++signum)
-    if (sigismember(&m_reserved_signals, signum) == 1)
+    if ((reserved & signum_to_mask(signum)))
     {
       os << separator << signal_name_str(signum);
       separator = ", ";
     }
-  os << "; reserved number of RT signals: " << m_number_of_RT_signals << '.';
+  os << "; reserved number of RT signals: " << m_number_of_RT_signals.load(std::memory_order_relaxed) << '.';
 }
 
 void Signal::priv_reserve(int number_of_RT_signals)
 {
-  int prev_number_of_RT_signals = m_number_of_RT_signals;
-  m_number_of_RT_signals += number_of_RT_signals;
+  int prev_number_of_RT_signals = m_number_of_RT_signals.fetch_add(number_of_RT_signals, std::memory_order_relaxed);
   // Instantiate Signals object(s) before creating any threads!
   // This is necessary because threads created before instantiating Signals will receive all signals,
   // which is probably not what you want. Instead register the signals that your thread is interested
@@ -113,7 +174,9 @@ void Signal::priv_reserve(int number_of_RT_signals)
   ASSERT(!NAMESPACE_DEBUG::threads_created);
 #endif
   // There are only 30 or so Real Time signals available.
-  ASSERT(SIGRTMIN + m_number_of_RT_signals < SIGRTMAX);
+  ASSERT(SIGRTMIN + prev_number_of_RT_signals + number_of_RT_signals < SIGRTMAX);
+  // And they all fit in signals_mask_t (on linux SIGRTMAX is 64).
+  ASSERT(SIGRTMIN + prev_number_of_RT_signals + number_of_RT_signals <= (int)(8 * sizeof(signals_mask_t)));
   struct sigaction action;
   std::memset(&action, 0, sizeof(struct sigaction));
   action.sa_handler = SIG_IGN;
@@ -127,12 +190,23 @@ void Signal::priv_reserve(int number_of_RT_signals)
 
 int Signal::priv_next_rt_signum()
 {
-  std::lock_guard<std::mutex> lock(m_next_rt_signum_mutex);
-  DoutEntering(dc::notice, "Signal::priv_next_rt_signum() with m_next_rt_signum = " << m_next_rt_signum << "; m_number_of_RT_signals = " << m_number_of_RT_signals << ".");
-  // Reserve the number of required Real Time signals in advance by creating an Signals object at the start of main().
-  // In initializer lists of (global) objects, use utils::Signal::reserve_and_next_rt_signum().
-  ASSERT(m_next_rt_signum < SIGRTMIN + m_number_of_RT_signals);
-  return m_next_rt_signum++;
+  DoutEntering(dc::notice, "Signal::priv_next_rt_signum() with m_number_of_RT_signals = " << m_number_of_RT_signals.load(std::memory_order_relaxed) << ".");
+  // A mask with one bit set for every reserved RT signal.
+  signals_mask_t const reserved_rt =
+    BitSet<signals_mask_t>::range2mask(SIGRTMIN - 1, SIGRTMIN - 1 + m_number_of_RT_signals.load(std::memory_order_relaxed));
+  // Claim the lowest reserved RT signal that wasn't handed out yet (lock-free).
+  signals_mask_t claimed = m_claimed_rt_signals.load(std::memory_order_relaxed);
+  signals_mask_t lowest_free;
+  do
+  {
+    signals_mask_t const free = reserved_rt & ~claimed;
+    // Reserve the number of required Real Time signals in advance by creating an Signals object at the start of main().
+    // In initializer lists of (global) objects, use utils::Signal::reserve_and_next_rt_signum().
+    ASSERT(free != 0);
+    lowest_free = free & ~(free - 1);   // Only the least significant free bit.
+  }
+  while (!m_claimed_rt_signals.compare_exchange_weak(claimed, claimed | lowest_free, std::memory_order_relaxed));
+  return ctz(lowest_free) + 1;
 }
 
 int Signal::priv_reserve_and_next_rt_signum()
@@ -162,23 +236,23 @@ void Signal::reserve(std::vector<int> const& signums, unsigned int number_of_RT_
   {
     if (signum == SIGKILL || signum == SIGSTOP)
       continue;
-    if (sigismember(&m_reserved_signals, signum) != 1)
+    if (!(m_reserved_signals.fetch_or(signum_to_mask(signum), std::memory_order_relaxed) & signum_to_mask(signum)))
     {
       if (sigaction(signum, &action, NULL) == -1)
         DoutFatal(dc::core|error_cf, "sigaction(" << signum << ", " << (void*)&action << ", NULL) = -1");
-      sigaddset(&m_reserved_signals, signum);
     }
     else
       Dout(dc::warning, signal_name_str(signum) << " was already registered.");
   }
   // Block all reserved signals before creating any threads.
-  sigset_t rt_signals;
-  sigemptyset(&rt_signals);
-  for (unsigned int signum = SIGRTMIN; signum < SIGRTMIN + number_of_RT_signals; ++signum)
-    sigaddset(&rt_signals, signum);
+  signals_mask_t const reserved = m_reserved_signals.load(std::memory_order_relaxed);
   sigset_t all_signals;
   sigemptyset(&all_signals);
-  sigorset(&all_signals, &m_reserved_signals, &rt_signals);
+  for (int signum = 1; signum <= max_deferred_signum; ++signum)
+    if ((reserved & signum_to_mask(signum)))
+      sigaddset(&all_signals, signum);
+  for (unsigned int signum = SIGRTMIN; signum < SIGRTMIN + number_of_RT_signals; ++signum)
+    sigaddset(&all_signals, signum);
   sigprocmask(SIG_BLOCK, &all_signals, nullptr);
 }
 
@@ -187,13 +261,13 @@ void Signal::register_callback(int signum, void (*cb)(int))
   DoutEntering(dc::notice, "Signal::register_callback(" << signum << ", " << (void*)cb << ")");
   if (0 < signum && signum <= max_signum)
   {
-    // No locking necessary because m_reserved_signals is initialized before any threads are created.
-    if (sigismember(&m_reserved_signals, signum) != 1)
+    if (!is_reserved(signum))
       // Register signals first by creating an Signals object at the start of main.
       // Note that you cannot specify a callback for SIGKILL or SIGSTOP.
       DoutFatal(dc::core, "Trying to register a callback for a signal (" << signal_name_str(signum) << ") that was not registered.");
   }
-  else if (!(SIGRTMIN <= signum && signum < SIGRTMIN + m_next_rt_signum))
+  else if (!(SIGRTMIN <= signum && signum <= max_deferred_signum) ||
+           !(m_claimed_rt_signals.load(std::memory_order_relaxed) & signum_to_mask(signum)))
     // Only use RT signals that were returned by Signal::priv_next_rt_signum.
     DoutFatal(dc::core, "Trying to register a callback for RT signal " << (signum - SIGRTMIN) << " which is not a value returned by Signals::next_rt_signum().");
 
@@ -205,8 +279,8 @@ void Signal::register_callback(int signum, void (*cb)(int))
     DoutFatal(dc::core|error_cf, "sigaction(" << signum << ", " << (void*)&action << ", NULL) = -1");
 #if CW_DEBUG
   // Please only register a callback once for any given signal number. This assert tries to avoid two different threads trying to register the same signal number.
-  ASSERT(sigismember(&m_callback_set, signum) != 1);
-  sigaddset(&m_callback_set, signum);
+  signals_mask_t const prev_callback_set = m_callback_set.fetch_or(signum_to_mask(signum), std::memory_order_relaxed);
+  ASSERT(!(prev_callback_set & signum_to_mask(signum)));
 #endif
 }
 
@@ -235,9 +309,11 @@ void Signal::block_and_unregister(int signum)
   action.sa_handler = SIG_IGN;
   if (sigaction(signum, &action, NULL) == -1)
     DoutFatal(dc::core|error_cf, "sigaction(" << signum << ", " << (void*)&action << ", NULL) = -1");
-  sigdelset(&instance().m_reserved_signals, signum);
+  instance().m_reserved_signals.fetch_and(~signum_to_mask(signum), std::memory_order_relaxed);
+  // If this was an RT signal then release its slot, so that next_rt_signum can hand it out again.
+  instance().m_claimed_rt_signals.fetch_and(~signum_to_mask(signum), std::memory_order_relaxed);
 #if CW_DEBUG
-  sigdelset(&instance().m_callback_set, signum);
+  instance().m_callback_set.fetch_and(~signum_to_mask(signum), std::memory_order_relaxed);
 #endif
 }
 
@@ -256,6 +332,11 @@ void Signals::register_callback(int signum, void (*cb)(int))
   utils::Signal::instance().register_callback(signum, cb);
 }
 
+void Signals::register_deferred_callback(int signum, std::function<void(int)> cb)
+{
+  utils::Signal::instance().register_deferred_callback(signum, std::move(cb));
+}
+
 void Signals::default_handler(int signum)
 {
   utils::Signal::instance().default_handler(signum);
@@ -34,39 +34,77 @@
 #pragma once
 
 #include "utils/Singleton.h"
+#include "utils/BitSet.h"
+#include "utils/threading/MpscQueue.h"
+#include "utils/threading/SpinSemaphore.h"
 #include <vector>
 #include <csignal>
 #include <iosfwd>
 #include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <thread>
 
 namespace utils {
 
 class Signal : public Singleton<Signal>
 {
   friend_Instance;
+ public:
+  static int constexpr max_deferred_signum = 64;        // The largest signal number that exists (SIGRTMAX).
+
+  // One bit per signal number: bit signum-1 represents signal signum.
+  // The whole signal space [1, SIGRTMAX] fits in a single word, so all
+  // reserved/claimed bookkeeping can be done with lock-free RMW operations
+  // that are callable from anywhere, including signal handler context.
+  using signals_mask_t = uint64_t;
+  static constexpr signals_mask_t signum_to_mask(int signum) { return static_cast<signals_mask_t>(1) << (signum - 1); }
+
  private:
-  Signal() : m_number_of_RT_signals(0), m_next_rt_signum(SIGRTMIN) { sigemptyset(&m_reserved_signals); }
+  Signal() : m_reserved_signals(0), m_claimed_rt_signals(0), m_number_of_RT_signals(0), m_dispatcher_stop(false) { }
   ~Signal();
   Signal(Signal const&) = delete;
 
-  sigset_t m_reserved_signals;          // The signals that this application is interested in. All other signals use their default handler.
-  std::mutex m_next_rt_signum_mutex;
-  int m_number_of_RT_signals;
-  int m_next_rt_signum;
+  std::atomic<signals_mask_t> m_reserved_signals;       // The signals that this application is interested in. All other signals use their default handler.
+  std::atomic<signals_mask_t> m_claimed_rt_signals;     // The reserved RT signals that were already handed out by next_rt_signum.
+  std::atomic<int> m_number_of_RT_signals;
   std::mutex m_callback_mutex;
 #if CW_DEBUG
-  sigset_t m_callback_set;
+  std::atomic<signals_mask_t> m_callback_set{0};
 #endif
 
+  // One preallocated queue node per signal number, so that deferred_handler
+  // never has to allocate; see register_deferred_callback.
+  struct DeferredSignal : public threading::MpscNode
+  {
+    int m_signum;                               // The signal that this node represents.
+    std::atomic<bool> m_queued;                 // True from the moment this node is pushed onto m_deferred_queue
+                                                // until just before its callback is invoked.
+    std::function<void(int)> m_callback;        // The callback to run from the dispatcher thread.
+  };
+  static DeferredSignal s_deferred[max_deferred_signum + 1];    // Indexed by signal number.
+
+  threading::MpscQueue m_deferred_queue;        // The signals that arrived but whose callback didn't run yet.
+  threading::SpinSemaphore m_deferred_semaphore;// Posted once for every node pushed onto m_deferred_queue.
+  std::thread m_dispatcher;                     // The thread that runs the deferred callbacks.
+  std::atomic<bool> m_dispatcher_stop;          // Set to true to make m_dispatcher leave dispatch_loop.
+
  private:
   void priv_reserve(int number_of_RT_signals);
   int priv_reserve_and_next_rt_signum();
   int priv_next_rt_signum();
+  void dispatch_loop();
+  static void deferred_handler(int signum);     // The signal handler installed by register_deferred_callback.
 
  public:
   void reserve(std::vector<int> const& signums, unsigned int number_of_RT_signals);
 
+  // Returns true iff signum was reserved (lock-free, async-signal-safe).
+  bool is_reserved(int signum) const { return (m_reserved_signals.load(std::memory_order_relaxed) & signum_to_mask(signum)) != 0; }
+
   void register_callback(int signum, void (*cb)(int));
+  void register_deferred_callback(int signum, std::function<void(int)> cb);
   static int reserve_and_next_rt_signum() { return instantiate().priv_reserve_and_next_rt_signum(); }
   static int next_rt_signum() { return instance().priv_next_rt_signum(); }
   static void unblock(sigset_t* sigmask, int signum, void (*cb)(int));
@@ -115,6 +153,21 @@ class Signal : public Singleton<Signal>
 //
 // Also note that handlers are per process. You can not set a different handler in
 // different threads.
+//
+// A callback registered with register_callback runs in signal context, in the
+// interrupted thread; almost nothing can be done there safely. When more than a
+// few atomic stores worth of work is needed, register a deferred callback instead:
+//
+//      signals.register_deferred_callback(signum, my_function);
+//
+// where my_function can be any callable (it is stored in a std::function<void(int)>).
+// The signal handler then merely pushes a preallocated node onto a lock-free queue
+// and posts a semaphore - a few atomic operations and at most one futex system
+// call in the interrupted thread - and the callback runs in a dedicated dispatcher
+// thread, outside signal context, where it may block, allocate, take locks, etc.
+//
+// Occurrences of a signal that arrive while its deferred callback is still queued
+// are coalesced into a single invocation, just like blocked ordinary signals are.
 
 class Signals
 {
@@ -126,6 +179,7 @@ class Signals
   Signals(std::initializer_list<int> signums, unsigned int number_of_RT_signals = 0) { Signals(std::vector<int>(signums), number_of_RT_signals); }
 
   void register_callback(int signum, void (*cb)(int));
+  void register_deferred_callback(int signum, std::function<void(int)> cb);
   void default_handler(int signum);
 
   friend std::ostream& operator<<(std::ostream& os, Signals const& signals);
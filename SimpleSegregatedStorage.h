@@ -27,6 +27,7 @@
 
 #pragma once
 
+#include "macros.h"
 #include "debug.h"
 #include <atomic>
 #include <mutex>
@@ -70,6 +71,10 @@ namespace utils {
 //
 // Maintains an unordered free list of blocks.
 //
+// Compile with -DUTILS_CONTENTION_PROFILING to count failed compare_exchange_weak's
+// and entries of the grow path per free list, see contention_stats(). Without that
+// macro the release code is completely untouched.
+//
 class SimpleSegregatedStorage
 {
   struct FreeNode { FreeNode* m_next; };
@@ -79,7 +84,86 @@ class SimpleSegregatedStorage
  public:                                // To be used with std::scoped_lock<std::mutex> from calling classes.
   std::mutex m_add_block_mutex;         // Protect against calling add_block concurrently.
 
+#ifdef UTILS_CONTENTION_PROFILING
+ public:
+  // The contention counters of one free list; a failed CAS means another thread won the
+  // race and the loop had to retry, so these turn "the allocator feels slow" into data.
+  struct ContentionStats
+  {
+    size_t allocate_retries;            // Failed CAS's in allocate()/try_allocate_n().
+    size_t deallocate_retries;          // Failed CAS's in deallocate()/deallocate_list()/add_block().
+    size_t grow_entries;                // Number of times try_allocate_more() was entered.
+  };
+
+  ContentionStats contention_stats() const
+  {
+    return { m_allocate_retries.load(std::memory_order_relaxed),
+             m_deallocate_retries.load(std::memory_order_relaxed),
+             m_grow_entries.load(std::memory_order_relaxed) };
+  }
+
+ private:
+  std::atomic<size_t> m_allocate_retries{0};
+  std::atomic<size_t> m_deallocate_retries{0};
+  std::atomic<size_t> m_grow_entries{0};
+
+  void count_allocate_retry() { m_allocate_retries.fetch_add(1, std::memory_order_relaxed); }
+  void count_deallocate_retry() { m_deallocate_retries.fetch_add(1, std::memory_order_relaxed); }
+  void count_grow_entry() { m_grow_entries.fetch_add(1, std::memory_order_relaxed); }
+#else
+ private:
+  // Compiled away entirely.
+  void count_allocate_retry() { }
+  void count_deallocate_retry() { }
+  void count_grow_entry() { }
+#endif
+
  public:
+  // A privately owned, singly linked chain of free blocks, detached from - or to be
+  // attached to - the free list. Not thread-safe itself: it is owned by one thread.
+  class BlockList
+  {
+    friend class SimpleSegregatedStorage;
+
+   private:
+    FreeNode* m_head = nullptr;         // The first block in the chain, or nullptr when empty.
+    FreeNode* m_tail = nullptr;         // The last block in the chain; only valid when m_head != nullptr.
+    unsigned int m_count = 0;           // The number of blocks in the chain.
+
+    // Splice a chain of count nodes, running from head to tail, in front of this list.
+    void splice(FreeNode* head, FreeNode* tail, unsigned int count)
+    {
+      tail->m_next = m_head;
+      if (!m_head)
+        m_tail = tail;
+      m_head = head;
+      m_count += count;
+    }
+
+   public:
+    unsigned int count() const { return m_count; }
+    bool empty() const { return m_head == nullptr; }
+
+    // Take one block from the chain; returns nullptr when the chain is empty.
+    void* pop()
+    {
+      FreeNode* node = m_head;
+      if (node)
+      {
+        m_head = node->m_next;
+        --m_count;
+      }
+      return node;
+    }
+
+    // Add one block (previously returned by allocate() or pop()) to the chain.
+    void push(void* ptr)
+    {
+      FreeNode* node = static_cast<FreeNode*>(ptr);
+      splice(node, node, 1);
+    }
+  };
+
   // Construct an empty free list.
   SimpleSegregatedStorage() : m_head(nullptr) { }
 
@@ -95,7 +179,7 @@ class SimpleSegregatedStorage
         continue;
       }
       while (AI_UNLIKELY(!m_head.compare_exchange_weak(node, node->m_next, std::memory_order_release, std::memory_order_relaxed) && node))
-        ;
+        count_allocate_retry();
       if (AI_LIKELY(node))
         return node;
     }
@@ -107,11 +191,92 @@ class SimpleSegregatedStorage
     FreeNode* node = static_cast<FreeNode*>(ptr);
     node->m_next = m_head.load(std::memory_order_relaxed);
     while (!m_head.compare_exchange_weak(node->m_next, node, std::memory_order_release, std::memory_order_relaxed))
-      ;
+      count_deallocate_retry();
+  }
+
+  // Detach up to n blocks from the free list into list, with a single CAS (per retry).
+  // Returns the number of blocks detached; 0 means the free list was empty.
+  //
+  // Like allocate(), this walks m_next pointers of nodes that can concurrently be popped
+  // by another thread; the retry loop restarts the walk from the then current head, which
+  // is the same ABA discipline that the single-node pop above relies on.
+  unsigned int try_allocate_n(unsigned int n, BlockList& list)
+  {
+    for (;;)
+    {
+      FreeNode* head = m_head.load(std::memory_order_acquire);
+      if (AI_UNLIKELY(!head))
+        return 0;
+      FreeNode* tail = head;
+      unsigned int count = 1;
+      while (count < n && tail->m_next)
+      {
+        tail = tail->m_next;
+        ++count;
+      }
+      if (AI_LIKELY(m_head.compare_exchange_weak(head, tail->m_next, std::memory_order_release, std::memory_order_relaxed)))
+      {
+        list.splice(head, tail, count);
+        return count;
+      }
+      count_allocate_retry();
+    }
+  }
+
+  // Detach n blocks from the free list into list, growing the pool through add_new_block
+  // whenever the free list runs empty. Returns the number of blocks actually detached,
+  // which is less than n only when add_new_block failed.
+  unsigned int allocate_n(unsigned int n, BlockList& list, std::function<bool()> const& add_new_block)
+  {
+    unsigned int count = 0;
+    while (count < n)
+    {
+      unsigned int detached = try_allocate_n(n - count, list);
+      if (AI_UNLIKELY(detached == 0))
+      {
+        if (!try_allocate_more(add_new_block))
+          break;
+        continue;
+      }
+      count += detached;
+    }
+    return count;
+  }
+
+  // Detach the entire free list into list with a single exchange.
+  // The walk to find the tail runs over the then privately owned chain, so unlike
+  // try_allocate_n it cannot race with concurrent pops.
+  void detach_all(BlockList& list)
+  {
+    FreeNode* head = m_head.exchange(nullptr, std::memory_order_acquire);
+    if (!head)
+      return;
+    FreeNode* tail = head;
+    unsigned int count = 1;
+    while (tail->m_next)
+    {
+      tail = tail->m_next;
+      ++count;
+    }
+    list.splice(head, tail, count);
+  }
+
+  // Attach all blocks in list to the free list with a single CAS (per retry), leaving list empty.
+  void deallocate_list(BlockList& list)
+  {
+    if (AI_UNLIKELY(!list.m_head))
+      return;
+    list.m_tail->m_next = m_head.load(std::memory_order_relaxed);
+    while (!m_head.compare_exchange_weak(list.m_tail->m_next, list.m_head, std::memory_order_release, std::memory_order_relaxed))
+      count_deallocate_retry();
+    list.m_head = nullptr;
+    list.m_tail = nullptr;
+    list.m_count = 0;
   }
 
   bool try_allocate_more(std::function<bool()> const& add_new_block)
   {
+    count_grow_entry();
     std::scoped_lock<std::mutex> lk(m_add_block_mutex);
     return m_head.load(std::memory_order_relaxed) != nullptr || add_new_block();
   }
@@ -138,7 +303,7 @@ class SimpleSegregatedStorage
     FreeNode* last_node = reinterpret_cast<FreeNode*>(last_ptr);
     last_node->m_next = m_head.load(std::memory_order_relaxed);
     while (!m_head.compare_exchange_weak(last_node->m_next, first_node, std::memory_order_release, std::memory_order_relaxed))
-      ;
+      count_deallocate_retry();
   }
 };
 
@@ -121,6 +121,53 @@ public:
 
 template<class FINAL> using SingletonInstance = Global<FINAL, utils::_internal_::singleton, GlobalConverterVoid>;
 
+/// @class StaticSingleton
+/// @brief As Singleton, but without the Global<> machinery: for singletons
+/// whose construction needs no ordering guarantees.
+//
+// The instance is a static data member, so instance() compiles to an address
+// constant: no function call, no converter indirection and no initialization
+// guard. When FINAL has a constexpr default constructor the instance is
+// constant-initialized (it exists before any dynamic initialization runs);
+// otherwise it is dynamically initialized in an unspecified order relative to
+// other globals - only use this when that doesn't matter (or give it a
+// constexpr constructor). There is no instantiate(), no SingletonInstance
+// dummy and no DEBUGGLOBAL checking: that is what Singleton is for.
+//
+// Usage:
+//
+// class MyStats : public StaticSingleton<MyStats> {
+//   friend_StaticSingleton;
+// private:    // IMPORTANT! As with Singleton: without this it is not a real singleton!
+//   constexpr MyStats() = default;
+//   ~MyStats() = default;
+//   MyStats(MyStats const&) = delete;
+//
+// public:
+//   // ...
+// };
+template<class FINAL>
+class StaticSingleton
+{
+protected:
+  using final_type = FINAL;
+  constexpr StaticSingleton() = default;
+  ~StaticSingleton() = default;
+  StaticSingleton(StaticSingleton const&) = delete;
+  StaticSingleton& operator=(StaticSingleton const&) = delete;
+
+private:
+  static FINAL s_instance;
+
+public:
+  static inline FINAL& instance() { return s_instance; }
+};
+
+template<class FINAL>
+FINAL StaticSingleton<FINAL>::s_instance;
+
+#define friend_StaticSingleton friend class StaticSingleton<final_type>
+
 //-------------------------------------------------------------------------
 // Definitions
 
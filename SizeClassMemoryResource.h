@@ -0,0 +1,138 @@
+/**
+ * ai-utils -- C++ Core utilities
+ *
+ * @file
+ * @brief Definition of class SizeClassMemoryResource.
+ *
+ * @Copyright (C) 2021  Carlo Wood.
+ *
+ * RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+ * Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+ *
+ * This file is part of ai-utils.
+ *
+ * ai-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ai-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ai-utils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "utils/MemoryPagePool.h"
+#include "utils/SimpleSegregatedStorage.h"
+#include "utils/log2.h"
+#include "debug.h"
+#include <array>
+#include <memory_resource>
+#include <new>
+
+namespace utils {
+
+// class SizeClassMemoryResource
+//
+// A segregated size-class allocator on top of a shared MemoryPagePool.
+//
+// Requested sizes are rounded up to the nearest power of two (with a minimum of
+// minimum_size_class bytes) and each size class maintains its own lock-free free
+// list of nodes, all carved out of blocks of the same MemoryPagePool. This serves
+// mixed-size allocations from one warm pool, where one NodeMemoryResource per type
+// would each sit on their own cold pages.
+//
+// Like NodeMemoryResource, blocks drawn from the pool are not returned until the
+// pool itself is destructed (or release()-ed); hence the pool must outlive this
+// object and all allocations done through it.
+//
+// The largest size that can be served is the largest power of two not larger than
+// half the block size of the upstream pool, capped at number_of_size_classes classes.
+//
+class SizeClassMemoryResource : public std::pmr::memory_resource
+{
+ public:
+  static constexpr size_t minimum_size_class = 16;      // The smallest served node size, in bytes.
+  static constexpr int number_of_size_classes = 16;     // The maximum number of size classes.
+
+ private:
+  MemoryPagePool& m_mpp;                                                // The upstream pool that all size classes draw their blocks from.
+  int const m_largest_size_class;                                       // The index of the largest usable size class for m_mpp's block size.
+  std::array<SimpleSegregatedStorage, number_of_size_classes> m_sss;    // One free list per size class.
+
+  // The index of the size class that serves an allocation of size bytes.
+  static int size_class_of(size_t size)
+  {
+    return size <= minimum_size_class ? 0 : ceil_log2(size) - log2(minimum_size_class);
+  }
+
+  // The node size of size class sc, in bytes.
+  static constexpr size_t size_of_class(int sc)
+  {
+    return minimum_size_class << sc;
+  }
+
+ public:
+  SizeClassMemoryResource(MemoryPagePool& mpp) :
+    m_mpp(mpp),
+    // A block must be carved into at least two nodes (see SimpleSegregatedStorage::add_block).
+    m_largest_size_class(std::min(number_of_size_classes - 1, log2(mpp.block_size() / 2) - log2(minimum_size_class)))
+  {
+    DoutEntering(dc::notice, "SizeClassMemoryResource::SizeClassMemoryResource({" << (void*)&mpp << "}) [" << this << "]");
+  }
+
+  void* allocate(size_t size)
+  {
+    int const sc = size_class_of(size);
+    // size may not exceed the largest size class, see the comment above this class.
+    ASSERT(sc <= m_largest_size_class);
+    return m_sss[sc].allocate([this, sc](){
+        void* chunk = m_mpp.allocate();
+        if (!chunk)
+          return false;
+        m_sss[sc].add_block(chunk, m_mpp.block_size(), size_of_class(sc));
+        return true;
+      });
+  }
+
+  // ptr must be a value previously returned by allocate(size) with the same size.
+  void deallocate(void* ptr, size_t size)
+  {
+    m_sss[size_class_of(size)].deallocate(ptr);
+  }
+
+  // The size, in bytes, that allocate(size) actually hands out.
+  static size_t allocation_size(size_t size)
+  {
+    return size_of_class(size_class_of(size));
+  }
+
+ protected:
+  void* do_allocate(size_t bytes, size_t DEBUG_ONLY(alignment)) override
+  {
+    // Power-of-two node sizes at power-of-two offsets in page-aligned blocks:
+    // a node is always aligned to its own size class.
+    ASSERT(alignment <= size_of_class(size_class_of(bytes)));
+    void* ptr = allocate(bytes);
+    if (AI_UNLIKELY(ptr == nullptr))
+      throw std::bad_alloc();
+    return ptr;
+  }
+
+  void do_deallocate(void* ptr, size_t bytes, size_t UNUSED_ARG(alignment)) override
+  {
+    deallocate(ptr, bytes);
+  }
+
+  bool do_is_equal(std::pmr::memory_resource const& other) const noexcept override
+  {
+    return this == &other;
+  }
+};
+
+} // namespace utils
@@ -0,0 +1,317 @@
+/**
+ * ai-utils -- C++ Core utilities
+ *
+ * @file
+ * @brief Definition of template class SmallVector in namespace utils.
+ *
+ * @Copyright (C) 2021  Carlo Wood.
+ *
+ * RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+ * Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+ *
+ * This file is part of ai-utils.
+ *
+ * ai-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ai-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ai-utils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "Vector.h"
+#include "macros.h"
+#include "debug.h"
+#include <algorithm>
+#include <cstddef>
+#include <initializer_list>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+namespace utils {
+
+// class SmallVector<T, N, _Index>
+//
+// The small-vector counterpart of utils::Vector: the same type-safe
+// VectorIndex interface (operator[](index_type), ibegin()/iend()), but with
+// inline storage for the first N elements. A SmallVector that never grows
+// beyond N elements never touches the allocator and its elements live inside
+// the object itself - which is what you want for, say, per-node adjacency
+// lists that are nearly always tiny and are iterated over in bulk.
+//
+// Unlike Vector this does not derive from std::vector (a std::vector cannot
+// be made to use inline storage without an allocator whose pointers survive
+// swap/move, which std::allocator_traits does not guarantee); it implements
+// the subset of the std::vector interface that Vector users actually use.
+//
+template<typename T, std::size_t N, typename _Index = VectorIndex<T>>
+class SmallVector
+{
+  static_assert(N > 0, "utils::SmallVector<> requires inline storage for at least one element.");
+
+ public:
+  using value_type = T;
+  using pointer = T*;
+  using const_pointer = T const*;
+  using reference = T&;
+  using const_reference = T const&;
+  using iterator = T*;
+  using const_iterator = T const*;
+  using size_type = std::size_t;
+  using difference_type = std::ptrdiff_t;
+  using index_type = _Index;
+
+ private:
+  T* m_data;                                            // Points to m_inline, or to heap allocated storage.
+  size_type m_size;                                     // The number of constructed elements.
+  size_type m_capacity;                                 // The number of elements that fit in m_data.
+  alignas(T) unsigned char m_inline[N * sizeof(T)];     // The inline storage.
+
+  T* inline_storage() { return reinterpret_cast<T*>(m_inline); }
+  bool is_inline() const { return m_data == reinterpret_cast<T const*>(m_inline); }
+
+  // Move size elements from old_data to new_data, destroying the originals.
+  static void relocate(T* new_data, T* old_data, size_type size)
+  {
+    for (size_type i = 0; i < size; ++i)
+    {
+      new (new_data + i) T(std::move_if_noexcept(old_data[i]));
+      old_data[i].~T();
+    }
+  }
+
+  // Grow the capacity to at least new_capacity, moving the existing elements.
+  void grow(size_type new_capacity)
+  {
+    size_type const capacity = std::max(new_capacity, 2 * m_capacity);
+    T* const new_data = static_cast<T*>(::operator new(capacity * sizeof(T), std::align_val_t{alignof(T)}));
+    relocate(new_data, m_data, m_size);
+    if (!is_inline())
+      ::operator delete(m_data, std::align_val_t{alignof(T)});
+    m_data = new_data;
+    m_capacity = capacity;
+  }
+
+  void destroy_all()
+  {
+    for (size_type i = m_size; i > 0; --i)
+      m_data[i - 1].~T();
+  }
+
+ public:
+  SmallVector() noexcept : m_data(inline_storage()), m_size(0), m_capacity(N) { }
+
+  explicit SmallVector(size_type count) : SmallVector()
+  {
+    resize(count);
+  }
+
+  SmallVector(size_type count, T const& value) : SmallVector()
+  {
+    reserve(count);
+    for (size_type i = 0; i < count; ++i)
+      new (m_data + i) T(value);
+    m_size = count;
+  }
+
+  SmallVector(std::initializer_list<T> ilist) : SmallVector()
+  {
+    reserve(ilist.size());
+    for (T const& value : ilist)
+      new (m_data + m_size++) T(value);
+  }
+
+  SmallVector(SmallVector const& other) : SmallVector()
+  {
+    reserve(other.m_size);
+    for (size_type i = 0; i < other.m_size; ++i)
+      new (m_data + i) T(other.m_data[i]);
+    m_size = other.m_size;
+  }
+
+  SmallVector(SmallVector&& other) noexcept(std::is_nothrow_move_constructible<T>::value) : SmallVector()
+  {
+    if (!other.is_inline())
+    {
+      // Steal the heap allocation.
+      m_data = other.m_data;
+      m_size = other.m_size;
+      m_capacity = other.m_capacity;
+    }
+    else
+    {
+      relocate(m_data, other.m_data, other.m_size);
+      m_size = other.m_size;
+    }
+    other.m_data = other.inline_storage();
+    other.m_size = 0;
+    other.m_capacity = N;
+  }
+
+  ~SmallVector()
+  {
+    destroy_all();
+    if (!is_inline())
+      ::operator delete(m_data, std::align_val_t{alignof(T)});
+  }
+
+  SmallVector& operator=(SmallVector const& other)
+  {
+    if (AI_LIKELY(this != &other))
+    {
+      clear();
+      reserve(other.m_size);
+      for (size_type i = 0; i < other.m_size; ++i)
+        new (m_data + i) T(other.m_data[i]);
+      m_size = other.m_size;
+    }
+    return *this;
+  }
+
+  SmallVector& operator=(SmallVector&& other) noexcept(std::is_nothrow_move_constructible<T>::value)
+  {
+    if (AI_LIKELY(this != &other))
+    {
+      destroy_all();
+      if (!is_inline())
+        ::operator delete(m_data, std::align_val_t{alignof(T)});
+      m_data = inline_storage();
+      m_size = 0;
+      m_capacity = N;
+      if (!other.is_inline())
+      {
+        m_data = other.m_data;
+        m_size = other.m_size;
+        m_capacity = other.m_capacity;
+      }
+      else
+      {
+        relocate(m_data, other.m_data, other.m_size);
+        m_size = other.m_size;
+      }
+      other.m_data = other.inline_storage();
+      other.m_size = 0;
+      other.m_capacity = N;
+    }
+    return *this;
+  }
+
+  // Capacity.
+
+  size_type size() const { return m_size; }
+  size_type capacity() const { return m_capacity; }
+  bool empty() const { return m_size == 0; }
+  // Returns true as long as the elements still live in the inline storage.
+  bool is_small() const { return is_inline(); }
+
+  void reserve(size_type new_capacity)
+  {
+    if (AI_UNLIKELY(new_capacity > m_capacity))
+      grow(new_capacity);
+  }
+
+  void resize(size_type count)
+  {
+    reserve(count);
+    while (m_size > count)
+      m_data[--m_size].~T();
+    while (m_size < count)
+      new (m_data + m_size++) T();
+  }
+
+  void resize(size_type count, T const& value)
+  {
+    reserve(count);
+    while (m_size > count)
+      m_data[--m_size].~T();
+    while (m_size < count)
+      new (m_data + m_size++) T(value);
+  }
+
+  // Modifiers.
+
+  void clear()
+  {
+    destroy_all();
+    m_size = 0;
+  }
+
+  void push_back(T const& value)
+  {
+    if (AI_UNLIKELY(m_size == m_capacity))
+      grow(m_size + 1);
+    new (m_data + m_size++) T(value);
+  }
+
+  void push_back(T&& value)
+  {
+    if (AI_UNLIKELY(m_size == m_capacity))
+      grow(m_size + 1);
+    new (m_data + m_size++) T(std::move(value));
+  }
+
+  template<typename... Args>
+  reference emplace_back(Args&&... args)
+  {
+    if (AI_UNLIKELY(m_size == m_capacity))
+      grow(m_size + 1);
+    T* const element = new (m_data + m_size++) T(std::forward<Args>(args)...);
+    return *element;
+  }
+
+  void pop_back()
+  {
+    // Don't call pop_back on an empty SmallVector.
+    ASSERT(m_size > 0);
+    m_data[--m_size].~T();
+  }
+
+  // Element access.
+
+  reference operator[](index_type __n) { return m_data[__n.get_value()]; }
+  const_reference operator[](index_type __n) const { return m_data[__n.get_value()]; }
+
+  reference at(index_type __n)
+  {
+    if (__n.get_value() >= m_size)
+      throw std::out_of_range("utils::SmallVector::at");
+    return m_data[__n.get_value()];
+  }
+
+  const_reference at(index_type __n) const
+  {
+    if (__n.get_value() >= m_size)
+      throw std::out_of_range("utils::SmallVector::at");
+    return m_data[__n.get_value()];
+  }
+
+  reference front() { return m_data[0]; }
+  const_reference front() const { return m_data[0]; }
+  reference back() { return m_data[m_size - 1]; }
+  const_reference back() const { return m_data[m_size - 1]; }
+
+  pointer data() { return m_data; }
+  const_pointer data() const { return m_data; }
+
+  // Iterator support.
+
+  iterator begin() { return m_data; }
+  const_iterator begin() const { return m_data; }
+  iterator end() { return m_data + m_size; }
+  const_iterator end() const { return m_data + m_size; }
+
+  index_type ibegin() const { return index_type((size_t)0); }
+  index_type iend() const { return index_type(m_size); }
+};
+
+} // namespace utils
@@ -0,0 +1,113 @@
+/**
+ * ai-utils -- C++ Core utilities
+ *
+ * @file
+ * @brief Implementation of digest_file_128.
+ *
+ * @Copyright (C) 2021  Carlo Wood.
+ *
+ * RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+ * Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+ *
+ * This file is part of ai-utils.
+ *
+ * ai-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ai-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ai-utils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sys.h"
+#include "StreamHasher.h"
+#include "AIAlert.h"
+#include "at_scope_end.h"
+#include "macros.h"
+#include <vector>
+#include <atomic>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace utils {
+
+namespace {
+
+// One thread's share of the tree hashing mode: claim the next unhashed chunk
+// until none are left. The chunks are contended over with a single relaxed
+// fetch_add, so threads that run into slow (not yet read ahead) pages simply
+// claim fewer chunks.
+void hash_chunks(char const* data, size_t size, uint64_t seed, size_t number_of_chunks, std::atomic<size_t>& next_chunk, digest128_t* digests)
+{
+  for (size_t chunk = next_chunk.fetch_add(1, std::memory_order_relaxed);
+       chunk < number_of_chunks;
+       chunk = next_chunk.fetch_add(1, std::memory_order_relaxed))
+  {
+    size_t const offset = chunk * digest_file_chunk_size;
+    digests[chunk] = hash_bytes_128(data + offset, std::min(digest_file_chunk_size, size - offset), seed);
+  }
+}
+
+} // namespace
+
+digest128_t digest_file_128(char const* path, uint64_t seed, unsigned int number_of_threads)
+{
+  int const fd = ::open(path, O_RDONLY | O_CLOEXEC);
+  if (AI_UNLIKELY(fd == -1))
+    THROW_ALERTE("open([PATH])", AIArgs("[PATH]", path));
+  auto&& close_fd = at_scope_end([fd]{ ::close(fd); });
+  struct stat st;
+  if (AI_UNLIKELY(::fstat(fd, &st) == -1))
+    THROW_ALERTE("fstat([PATH])", AIArgs("[PATH]", path));
+  size_t const size = st.st_size;
+  if (AI_UNLIKELY(size == 0))
+    return BlockHasher(seed).digest128();
+  void* const map = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (AI_UNLIKELY(map == MAP_FAILED))
+    THROW_ALERTE("mmap([PATH], [SIZE])", AIArgs("[PATH]", path)("[SIZE]", size));
+  auto&& unmap = at_scope_end([map, size]{ ::munmap(map, size); });
+  // We stream over the file once: read ahead aggressively, reclaim early.
+  ::madvise(map, size, MADV_SEQUENTIAL);
+  char const* const data = static_cast<char const*>(map);
+
+  // A file that fits one chunk is hashed as-if streamed through BlockHasher(seed).
+  if (size <= digest_file_chunk_size)
+  {
+    BlockHasher hasher(seed);
+    hasher.update(data, size);
+    return hasher.digest128();
+  }
+
+  // Tree hashing mode: hash fixed-size chunks (in parallel) and then hash the
+  // concatenated chunk digests. The chunk grid only depends on the file size,
+  // so the digest does not depend on the number of threads.
+  size_t const number_of_chunks = (size + digest_file_chunk_size - 1) / digest_file_chunk_size;
+  std::vector<digest128_t> digests(number_of_chunks);
+  std::atomic<size_t> next_chunk{0};
+  size_t const nthreads = std::clamp<size_t>(number_of_threads, 1, number_of_chunks);
+  std::vector<std::thread> threads;
+  threads.reserve(nthreads - 1);
+  for (size_t t = 1; t < nthreads; ++t)
+    threads.emplace_back(hash_chunks, data, size, seed, number_of_chunks, std::ref(next_chunk), digests.data());
+  hash_chunks(data, size, seed, number_of_chunks, next_chunk, digests.data());
+  for (std::thread& thread : threads)
+    thread.join();
+  BlockHasher root(seed);
+  root.update(digests.data(), number_of_chunks * sizeof(digest128_t));
+  return root.digest128();
+}
+
+uint64_t digest_file(char const* path, uint64_t seed, unsigned int number_of_threads)
+{
+  return digest_file_128(path, seed, number_of_threads).lo;
+}
+
+} // namespace utils
@@ -36,9 +36,11 @@
 //   hasher << &random_streambuf;
 //   ASSERT(hasher.digest() == 0xf373022bdeab5158);
 
+#include "BlockHash.h"
 #include <ostream>
 #include <array>
 #include <algorithm>
+#include <thread>
 #include <tuple>
 #include <boost/functional/hash.hpp>
 
@@ -111,4 +113,89 @@ class StreamHasher : public std::ostream
   size_t digest() { return m_streambuf.hash(); }
 };
 
+// As HasherStreamBuf, but with a pluggable block hash backend (by default
+// BlockHasher, see BlockHash.h) instead of the per-put-area boost scheme.
+// Bulk writes bypass the put area: xsputn() hands whole runs straight to the
+// backend, so hashing a serialized object costs one block hash pass, not one
+// virtual call per character. For already contiguous data utils::hash_bytes
+// can be used directly, without any stream at all.
+//
+// Note: the digest is unrelated to (and much faster than) that of StreamHasher.
+template<typename Hasher = BlockHasher>
+class BlockHasherStreamBuf : public std::streambuf
+{
+ private:
+  Hasher m_hasher;
+  std::array<char, Hasher::block_size> m_buf;
+  static constexpr size_t bufsize = std::tuple_size_v<decltype(m_buf)>;
+
+  void flush_put_area()
+  {
+    if (pptr() > pbase())
+      m_hasher.update(pbase(), pptr() - pbase());
+    setp(&m_buf[0], &m_buf[bufsize]);
+  }
+
+ protected:
+  int_type overflow(int_type c) override
+  {
+    if (c != EOF)
+    {
+      if (pptr() == epptr())
+        flush_put_area();
+      *pptr() = c;
+      pbump(1);
+    }
+    return 0;
+  }
+
+  std::streamsize xsputn(char const* s, std::streamsize count) override
+  {
+    flush_put_area();
+    m_hasher.update(s, count);
+    return count;
+  }
+
+ public:
+  explicit BlockHasherStreamBuf(uint64_t seed = 0) : m_hasher(seed) { setp(&m_buf[0], &m_buf[bufsize]); }
+
+  uint64_t digest() { flush_put_area(); return m_hasher.digest(); }
+  digest128_t digest128() { flush_put_area(); return m_hasher.digest128(); }
+};
+
+template<typename Hasher = BlockHasher>
+class BlockStreamHasher : public std::ostream
+{
+ private:
+  BlockHasherStreamBuf<Hasher> m_streambuf;
+
+ public:
+  explicit BlockStreamHasher(uint64_t seed = 0) : m_streambuf(seed) { rdbuf(&m_streambuf); }
+
+  uint64_t digest() { return m_streambuf.digest(); }
+  digest128_t digest128() { return m_streambuf.digest128(); }
+};
+
+// The fixed chunk size of the tree hashing mode of digest_file_128, see below.
+inline constexpr size_t digest_file_chunk_size = size_t{64} << 20;      // 64 MB.
+
+// Hash the contents of the file at path by mmap(2)ing it, instead of streaming
+// it through a streambuf: no read(2) calls, no put area shuffling. The mapping
+// is advised MADV_SEQUENTIAL so the kernel reads ahead aggressively and can
+// drop pages behind us.
+//
+// A file that fits a single digest_file_chunk_size chunk produces the same
+// digest as feeding its bytes to BlockHasher(seed). A larger file is cut into
+// fixed digest_file_chunk_size chunks that are hashed in parallel by up to
+// number_of_threads threads (including the calling thread), after which the
+// concatenated chunk digests are hashed into the root digest. Because the
+// chunk grid only depends on the file size, the digest is a deterministic
+// function of the file contents and the seed - never of number_of_threads.
+//
+// Throws an AIAlert::ErrorCode when the file cannot be opened or mapped.
+digest128_t digest_file_128(char const* path, uint64_t seed = 0, unsigned int number_of_threads = std::thread::hardware_concurrency());
+
+// Idem, but return only the low 64 bits.
+uint64_t digest_file(char const* path, uint64_t seed = 0, unsigned int number_of_threads = std::thread::hardware_concurrency());
+
 } // namespace utils
@@ -27,6 +27,9 @@
 
 #pragma once
 
+#include "utils/macros.h"
+#include "debug.h"
+
 // Usage:
 //
 // If a class is not derived (from a class that has also a VTPtr):
@@ -188,4 +191,75 @@ struct VTPtr<Self, void, void> : VTPtrBase<Self>
   }
 };
 
+// SealedVTPtr is a drop-in replacement for VTPtr for classes whose virtual
+// table is rewritten a few times at the start of the life of an object and
+// then stays the same, while the object receives very many calls (an event
+// loop dispatching through VT_ptr, say). A normal VTPtr call is a double
+// indirection - load VT_ptr, then load the entry from a table that is shared
+// between objects - which the CPU predicts poorly when objects with different
+// tables interleave.
+//
+// Once the behavior of the object is final, call
+//
+//   VT_ptr.seal(this);
+//
+// This snapshots the current virtual table into storage embedded in the
+// VTPtr itself - per-object direct function pointers - and repoints VT_ptr
+// (also that of the base classes) at the snapshot, so that every dispatch
+// reads from the object's own memory. Hot call sites can avoid the first
+// load entirely by dispatching through vt():
+//
+//   void x(int a) { return VT_ptr.vt()._x(this, a); }
+//
+// which uses the inline snapshot when sealed (one well-predicted branch)
+// and falls back to *VT_ptr when not.
+//
+// Calling set() or clone() afterwards unseals again; seal anew when done.
+// Note that sealing costs sizeof(VT_type) per object, which is why this is
+// a separate class and not part of VTPtr itself.
+template<class Self, class Base1 = void, class Base2 = void>
+struct SealedVTPtr : VTPtr<Self, Base1, Base2>
+{
+  using VT_type = typename Self::VT_type;
+
+  VT_type m_sealed_VT;          // Per-object snapshot of the virtual table, made by seal(). Only valid while m_sealed is set.
+  bool m_sealed = false;
+
+  SealedVTPtr(Self* self) : VTPtr<Self, Base1, Base2>(self) { }
+
+  // Snapshot the current virtual table; the behavior of the object must be final (until the next set()/clone()).
+  void seal(Self* self)
+  {
+    m_sealed_VT = *this->VT_ptr;
+    m_sealed = true;
+    // Let all dispatch (including that of base classes) read from the snapshot.
+    VTPtr<Self, Base1, Base2>::set(self, &m_sealed_VT);
+  }
+
+  // Replacing the virtual table unseals; hide the members of VTPtr to enforce that.
+  void set(Self* self, VT_type const* vt_ptr)
+  {
+    m_sealed = false;
+    VTPtr<Self, Base1, Base2>::set(self, vt_ptr);
+  }
+
+  VT_type* clone(Self* self)
+  {
+    m_sealed = false;
+    return VTPtr<Self, Base1, Base2>::clone(self);
+  }
+
+  // Monomorphic dispatch for hot call sites; see above.
+  [[gnu::always_inline]] VT_type const& vt() const
+  {
+    if (AI_LIKELY(m_sealed))
+    {
+      // Detect a virtual table replacement that bypassed set() while sealed.
+      ASSERT(this->VT_ptr == &m_sealed_VT);
+      return m_sealed_VT;
+    }
+    return *this->VT_ptr;
+  }
+};
+
 } // namespace utils
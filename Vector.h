@@ -29,6 +29,9 @@
 
 #include <vector>
 #include <iostream>
+#include <type_traits>
+#include "IndexRange.h"
+#include "malloc_size.h"
 #include "debug.h"
 
 namespace utils {
@@ -145,6 +148,38 @@ class Vector : public std::vector<T, _Alloc>
 
   index_type ibegin() const { return index_type((size_t)0); }
   index_type iend() const { return index_type(_Base::size()); }
+
+  // Change the size to __n elements without value-initializing new elements
+  // (resize() memsets them, which is a pure loss when they are about to be
+  // overwritten anyway, e.g. when deserializing). Only for value_types where
+  // skipping that is meaningful and safe: trivially constructible and
+  // destructible ones. Returns the index range of the new, uninitialized
+  // elements (empty when the size didn't grow): reading them before writing
+  // them is undefined behavior.
+  IndexRange<index_type> resize_uninitialized(size_type __n)
+  {
+    static_assert(std::is_trivially_default_constructible<T>::value && std::is_trivially_destructible<T>::value,
+        "resize_uninitialized requires a trivially constructible and destructible value_type.");
+    size_type const __old_size = _Base::size();
+    if (__n > _Base::capacity())
+    {
+      // Grow geometrically, like resize() would, but round the allocation
+      // request up to the full usable size that malloc actually hands back
+      // (see malloc_size.h): the extra elements are free, and not counting
+      // them would cause a re-allocation at the nominal capacity.
+      size_type const __wanted = std::max(__n, 2 * _Base::capacity());
+      _Base::reserve(malloc_size(__wanted * sizeof(T)) / sizeof(T));
+    }
+    // The elements are trivial: just move the end of the vector (libstdc++).
+    this->_M_impl._M_finish = this->_M_impl._M_start + __n;
+    return { index_type(std::min(__old_size, __n)), index_type(__n) };
+  }
+
+  // Grow by __n uninitialized elements; returns their index range.
+  IndexRange<index_type> append_uninitialized(size_type __n)
+  {
+    return resize_uninitialized(_Base::size() + __n);
+  }
 };
 
 } // namespace utils
@@ -0,0 +1,241 @@
+/**
+ * ai-utils -- C++ Core utilities
+ *
+ * @file
+ * @brief Declaration of class WideBitSet.
+ *
+ * @Copyright (C) 2021  Carlo Wood.
+ *
+ * RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+ * Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+ *
+ * This file is part of ai-utils.
+ *
+ * ai-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ai-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ai-utils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "ctz.h"
+#include "popcount.h"
+#include "debug.h"
+#include <cstdint>
+#include <cstddef>
+
+namespace utils {
+
+// class WideBitSet<number_of_bits>
+//
+// A BitSet of arbitrary fixed bit count: an array of uint64_t words, for
+// the cases where BitSet<T> - which is capped at a single machine word -
+// is too small (e.g. the free-slot map of a 4096-entry table).
+//
+// The whole-set operations (and/or/xor/andnot, count, find_first) iterate
+// over the 32-byte aligned word array in simple fixed-length loops that the
+// compiler vectorizes with the widest instructions available (AVX2/AVX-512
+// when compiling with -march for such a target).
+//
+// Iteration follows the idiom of BitSet: the const_iterator visits the
+// indices of the set bits, from least to most significant:
+//
+//   utils::WideBitSet<4096> free_slots;
+//   ...
+//   for (int slot : free_slots) { ... }
+//
+// Indices are plain int (bitset::Index is an int8_t and therefore too small
+// here); the value number_of_bits plays the role of index_end.
+//
+template<int number_of_bits>
+class WideBitSet
+{
+  static_assert(number_of_bits > 0, "utils::WideBitSet<> requires a positive number of bits.");
+
+ public:
+  static constexpr int nbits = number_of_bits;
+  static constexpr int nwords = (nbits + 63) / 64;
+  // The bits in the last word at position nbits or higher; always zero (the invariant maintained below).
+  static constexpr uint64_t unused_bits = (nbits % 64 == 0) ? 0 : ~uint64_t{0} << (nbits % 64);
+
+ private:
+  alignas(32) uint64_t m_words[nwords];         // 32-byte aligned so whole-set loops can use full-width vector loads.
+
+ public:
+  // Construct a WideBitSet with all bits zero.
+  WideBitSet() : m_words{} { }
+
+  // Initialization.
+
+  // Set all bits to zero.
+  void reset()
+  {
+    for (int w = 0; w < nwords; ++w)
+      m_words[w] = 0;
+  }
+
+  // Set all bits to one.
+  void set()
+  {
+    for (int w = 0; w < nwords; ++w)
+      m_words[w] = ~uint64_t{0};
+    m_words[nwords - 1] &= ~unused_bits;
+  }
+
+  // Bit manipulation.
+
+  // Reset the bit at index.
+  void reset(int index) { m_words[index / 64] &= ~(uint64_t{1} << (index % 64)); }
+
+  // Set the bit at index.
+  void set(int index) { m_words[index / 64] |= uint64_t{1} << (index % 64); }
+
+  // Toggle the bit at index.
+  void flip(int index) { m_words[index / 64] ^= uint64_t{1} << (index % 64); }
+
+  // Accessors.
+
+  // Returns the number of bits that the bitset can hold.
+  constexpr std::size_t size() const { return nbits; }
+
+  // Test if the bit at index is set.
+  bool test(int index) const { return m_words[index / 64] & (uint64_t{1} << (index % 64)); }
+
+  // Test if all, any or none of the bits are set.
+  bool all() const
+  {
+    uint64_t missing = 0;
+    for (int w = 0; w < nwords - 1; ++w)
+      missing |= ~m_words[w];
+    // The unused bits of the last word are always zero; they don't count as missing.
+    missing |= ~m_words[nwords - 1] & ~unused_bits;
+    return missing == 0;
+  }
+
+  bool any() const
+  {
+    uint64_t found = 0;
+    for (int w = 0; w < nwords; ++w)
+      found |= m_words[w];
+    return found != 0;
+  }
+
+  bool none() const { return !any(); }
+
+  // Returns the number of bits set to 1.
+  std::size_t count() const
+  {
+    int sum = 0;
+    for (int w = 0; w < nwords; ++w)
+      sum += _popcount(m_words[w]);
+    return sum;
+  }
+
+  // Return the index of the least significant set bit, or nbits when the set is empty.
+  int find_first() const
+  {
+    for (int w = 0; w < nwords; ++w)
+      if (m_words[w] != 0)
+        return w * 64 + ctz(m_words[w]);
+    return nbits;
+  }
+
+  // Return the index of the first set bit larger than index, or nbits when there is none.
+  int find_next(int index) const
+  {
+    ++index;
+    if (index >= nbits)
+      return nbits;
+    int w = index / 64;
+    uint64_t word = m_words[w] >> (index % 64);
+    if (word != 0)
+      return index + ctz(word);
+    while (++w < nwords)
+      if (m_words[w] != 0)
+        return w * 64 + ctz(m_words[w]);
+    return nbits;
+  }
+
+  // Whole-set bitwise operators.
+
+  WideBitSet& operator|=(WideBitSet const& m1)
+  {
+    for (int w = 0; w < nwords; ++w)
+      m_words[w] |= m1.m_words[w];
+    return *this;
+  }
+  friend WideBitSet operator|(WideBitSet m1, WideBitSet const& m2) { m1 |= m2; return m1; }
+
+  WideBitSet& operator&=(WideBitSet const& m1)
+  {
+    for (int w = 0; w < nwords; ++w)
+      m_words[w] &= m1.m_words[w];
+    return *this;
+  }
+  friend WideBitSet operator&(WideBitSet m1, WideBitSet const& m2) { m1 &= m2; return m1; }
+
+  WideBitSet& operator^=(WideBitSet const& m1)
+  {
+    for (int w = 0; w < nwords; ++w)
+      m_words[w] ^= m1.m_words[w];
+    return *this;
+  }
+  friend WideBitSet operator^(WideBitSet m1, WideBitSet const& m2) { m1 ^= m2; return m1; }
+
+  // Reset every bit that is set in m1 (and-not; the free-slot "allocate these" operation).
+  WideBitSet& andnot(WideBitSet const& m1)
+  {
+    for (int w = 0; w < nwords; ++w)
+      m_words[w] &= ~m1.m_words[w];
+    return *this;
+  }
+
+  WideBitSet operator~() const
+  {
+    WideBitSet result;
+    for (int w = 0; w < nwords; ++w)
+      result.m_words[w] = ~m_words[w];
+    result.m_words[nwords - 1] &= ~unused_bits;
+    return result;
+  }
+
+  friend bool operator==(WideBitSet const& m1, WideBitSet const& m2)
+  {
+    uint64_t diff = 0;
+    for (int w = 0; w < nwords; ++w)
+      diff |= m1.m_words[w] ^ m2.m_words[w];
+    return diff == 0;
+  }
+  friend bool operator!=(WideBitSet const& m1, WideBitSet const& m2) { return !(m1 == m2); }
+
+  // Iterator support: visits the indices of the set bits.
+
+  class const_iterator
+  {
+   private:
+    WideBitSet const* m_set;
+    int m_index;                // The current bit index, or nbits for end.
+
+   public:
+    const_iterator(WideBitSet const* set, int index) : m_set(set), m_index(index) { }
+
+    int operator*() const { return m_index; }
+    const_iterator& operator++() { m_index = m_set->find_next(m_index); return *this; }
+    bool operator==(const_iterator const& iter) const { return m_index == iter.m_index; }
+    bool operator!=(const_iterator const& iter) const { return m_index != iter.m_index; }
+  };
+
+  const_iterator begin() const { return {this, find_first()}; }
+  const_iterator end() const { return {this, nbits}; }
+};
+
+} // namespace utils
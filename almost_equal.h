@@ -27,8 +27,11 @@
 
 #pragma once
 
+#include <algorithm>
 #include <complex>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <type_traits>
 
 namespace utils {
@@ -114,4 +117,76 @@ typename std::enable_if<std::is_floating_point<T>::value, bool>::type
   return 2 * std::abs(x - y) <= abs_relative_error * std::abs(x + y);
 }
 
+// Return true when x and y are at most ulps representable values apart.
+//
+// The IEEE754 bit patterns are reinterpreted as integers and mapped such
+// that adjacent floats differ by one, monotonically over the whole range
+// (+0 and -0 map to the same value), so the test is a branchless integer
+// subtract and compare. Comparisons involving NaN return false, also
+// for ulps distance zero (two identical NaN patterns).
+template<class T>
+typename std::enable_if<std::is_floating_point<T>::value, bool>::type
+   almost_equal_ulps(T x, T y, unsigned int const ulps)
+{
+  static_assert(sizeof(T) == 4 || sizeof(T) == 8, "almost_equal_ulps requires IEEE754 single or double precision.");
+  using uint_type = typename std::conditional<sizeof(T) == 4, uint32_t, uint64_t>::type;
+  constexpr uint_type sign_bit = static_cast<uint_type>(1) << (8 * sizeof(T) - 1);
+  constexpr uint_type infinity_bits =                           // The bit pattern of +infinity: all exponent bits set.
+      sizeof(T) == 4 ? static_cast<uint_type>(0x7f800000) : static_cast<uint_type>(0x7ff0000000000000);
+  uint_type xi, yi;
+  std::memcpy(&xi, &x, sizeof(T));
+  std::memcpy(&yi, &y, sizeof(T));
+  bool const is_nan = (xi & ~sign_bit) > infinity_bits || (yi & ~sign_bit) > infinity_bits;
+  // Map to a monotonic unsigned range: negative floats are reflected below the positive ones.
+  uint_type const xm = (xi & sign_bit) ? ~xi + 1 : (xi | sign_bit);
+  uint_type const ym = (yi & sign_bit) ? ~yi + 1 : (yi | sign_bit);
+  uint_type const distance = xm > ym ? xm - ym : ym - xm;
+  return !is_nan && distance <= ulps;
+}
+
+// The return value of almost_equal_range when there is no mismatch.
+inline constexpr size_t almost_equal_npos = static_cast<size_t>(-1);
+
+// Compare the count values at x with the count values at y, and return the
+// index of the first pair that is more than ulps ULPs apart (almost_equal_ulps),
+// or almost_equal_npos when there is none.
+//
+// The comparison loop is branchless integer arithmetic over 64-element
+// blocks, which the compiler turns into SIMD compares; only a block that
+// contains a mismatch is rescanned to find the exact index. When
+// number_of_mismatches is non-null the whole range is always scanned and
+// the total number of mismatching pairs is stored there.
+template<class T>
+typename std::enable_if<std::is_floating_point<T>::value, size_t>::type
+   almost_equal_range(T const* x, T const* y, size_t count, unsigned int const ulps, size_t* number_of_mismatches = nullptr)
+{
+  constexpr size_t block_size = 64;
+  size_t first_mismatch = almost_equal_npos;
+  size_t mismatches = 0;
+  size_t i = 0;
+  while (i < count)
+  {
+    size_t const block_end = std::min(i + block_size, count);
+    unsigned int any_mismatch = 0;
+    for (size_t j = i; j < block_end; ++j)
+      any_mismatch |= !almost_equal_ulps(x[j], y[j], ulps);
+    if (any_mismatch)
+    {
+      for (size_t j = i; j < block_end; ++j)
+        if (!almost_equal_ulps(x[j], y[j], ulps))
+        {
+          if (first_mismatch == almost_equal_npos)
+            first_mismatch = j;
+          ++mismatches;
+        }
+      if (!number_of_mismatches)
+        return first_mismatch;
+    }
+    i = block_end;
+  }
+  if (number_of_mismatches)
+    *number_of_mismatches = mismatches;
+  return first_mismatch;
+}
+
 } // namespace utils
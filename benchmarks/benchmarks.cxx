@@ -0,0 +1,221 @@
+/**
+ * ai-utils -- C++ Core utilities
+ *
+ * @file
+ * @brief Benchmark suite covering the concurrency and allocator hot paths.
+ *
+ * @Copyright (C) 2021  Carlo Wood.
+ *
+ * RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+ * Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+ *
+ * This file is part of ai-utils.
+ *
+ * ai-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ai-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ai-utils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Runs a fixed set of microbenchmarks over the performance critical parts of
+// ai-utils and prints one tab-separated line per benchmark to stdout:
+//
+//   <name>\t<nanoseconds per operation>\tns/op
+//
+// so that an acceptance pipeline can diff the numbers of two builds without
+// any parsing heroics. Debug output (if compiled in) goes to stderr.
+
+#include "sys.h"
+#include "utils/Microbench.h"
+#include "utils/BitSet.h"
+#include "utils/MemoryPagePool.h"
+#include "utils/cpu_relax.h"
+#include "utils/itoa.h"
+#include "utils/threading/FIFOBuffer.h"
+#include "utils/threading/MpscQueue.h"
+#include "utils/threading/SpinSemaphore.h"
+#include "debug.h"
+#include <array>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+void report(char const* name, double ns_per_op)
+{
+  std::cout << name << '\t' << ns_per_op << "\tns/op" << std::endl;
+}
+
+// Run fn with Microbench and report the robust per-invocation estimate.
+void bench_single_threaded(char const* name, utils::FunctionView<void()> fn)
+{
+  unsigned int const iterations = utils::Microbench::calibrate_iterations(fn);
+  utils::Microbench bench(fn, iterations);
+  report(name, bench.run().low_avg * 1e6);      // ms --> ns.
+}
+
+// Time one invocation of fn that internally performs operations operations.
+double ns_per_op_of(unsigned long operations, utils::FunctionView<void()> fn)
+{
+  auto start = clock_type::now();
+  fn();
+  auto stop = clock_type::now();
+  return std::chrono::duration<double, std::nano>(stop - start).count() / operations;
+}
+
+void bench_itoa()
+{
+  std::array<char, 32> buf;
+  bench_single_threaded("itoa", [&]{ utils::itoa(buf, 123456789); });
+}
+
+void bench_bitset_scan()
+{
+  // Scan a bitset with every third bit set, accumulating the set bits.
+  utils::BitSet<uint64_t> const pattern{0x9249249249249249UL};
+  bench_single_threaded("bitset_scan", [&]{
+    utils::BitSet<uint64_t> bitset = pattern;
+    uint64_t sum = 0;
+    while (bitset.any())
+    {
+      utils::BitSet<uint64_t> const bit = bitset.lssb();
+      sum += bit();
+      bitset.reset(bit);
+    }
+    asm volatile ("" :: "r" (sum));    // Don't optimize away the scan.
+  });
+}
+
+void bench_memory_page_pool(int number_of_threads)
+{
+  unsigned long const allocations_per_thread = 100000;
+  utils::MemoryPagePool mpp(0x8000);
+  std::vector<std::thread> threads;
+  auto start = clock_type::now();
+  for (int t = 0; t < number_of_threads; ++t)
+    threads.emplace_back([&]{
+      std::array<void*, 16> blocks;
+      for (unsigned long i = 0; i < allocations_per_thread; i += blocks.size())
+      {
+        for (void*& block : blocks)
+          block = mpp.allocate();
+        for (void* block : blocks)
+          mpp.deallocate(block);
+      }
+    });
+  for (std::thread& thread : threads)
+    thread.join();
+  auto stop = clock_type::now();
+  double ns = std::chrono::duration<double, std::nano>(stop - start).count();
+  std::string name = "memory_page_pool_alloc_free/threads=" + std::to_string(number_of_threads);
+  report(name.c_str(), ns / (number_of_threads * allocations_per_thread));
+}
+
+void bench_spin_semaphore_ping_pong()
+{
+  // On a single CPU the spinner burns its entire time slice before the other
+  // thread can run, which turns this benchmark into a scheduler benchmark.
+  if (std::thread::hardware_concurrency() < 2)
+  {
+    std::cerr << "spin_semaphore_ping_pong: skipped (need at least 2 CPUs)." << std::endl;
+    return;
+  }
+  unsigned long const round_trips = 100000;
+  utils::threading::SpinSemaphore ping;
+  utils::threading::SpinSemaphore pong;
+  std::thread echo([&]{
+    for (unsigned long i = 0; i < round_trips; ++i)
+    {
+      ping.wait();
+      pong.post();
+    }
+  });
+  double ns_per_round_trip = ns_per_op_of(round_trips, [&]{
+    for (unsigned long i = 0; i < round_trips; ++i)
+    {
+      ping.post();
+      pong.wait();
+    }
+  });
+  echo.join();
+  report("spin_semaphore_ping_pong", ns_per_round_trip);
+}
+
+void bench_mpsc_queue()
+{
+  unsigned long const messages = 1000000;
+  utils::threading::MpscQueue queue;
+  std::vector<utils::threading::MpscNode> nodes(4096);
+  // Single producer, single consumer; the producer recycles nodes that the
+  // consumer already popped (they chase eachother around the nodes vector,
+  // which is large enough that the queue is effectively never empty).
+  std::atomic<unsigned long> popped{0};
+  std::thread consumer([&]{
+    for (unsigned long i = 0; i < messages; ++i)
+    {
+      while (queue.pop() == nullptr)
+        cpu_relax();
+      popped.store(i + 1, std::memory_order_release);
+    }
+  });
+  double ns_per_message = ns_per_op_of(messages, [&]{
+    for (unsigned long i = 0; i < messages; ++i)
+    {
+      // Don't overtake the consumer.
+      while (i - popped.load(std::memory_order_acquire) >= nodes.size() - 1)
+        cpu_relax();
+      queue.push(&nodes[i % nodes.size()]);
+    }
+  });
+  consumer.join();
+  report("mpsc_queue_throughput", ns_per_message);
+}
+
+void bench_fifo_buffer()
+{
+  unsigned long const messages = 1000000;
+  utils::threading::FIFOBuffer<1, unsigned long> buffer(256);
+  std::thread consumer([&]{
+    for (unsigned long i = 0; i < messages; ++i)
+    {
+      unsigned long* message;
+      while ((message = buffer.pop()) == nullptr)
+        cpu_relax();
+      asm volatile ("" :: "r" (*message));
+    }
+  });
+  double ns_per_message = ns_per_op_of(messages, [&]{
+    for (unsigned long i = 0; i < messages; ++i)
+      while (!buffer.push(&i))
+        cpu_relax();
+  });
+  consumer.join();
+  report("fifo_buffer_throughput", ns_per_message);
+}
+
+} // namespace
+
+int main()
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  bench_itoa();
+  bench_bitset_scan();
+  for (int number_of_threads : { 1, 2, 4 })
+    bench_memory_page_pool(number_of_threads);
+  bench_spin_semaphore_ping_pong();
+  bench_mpsc_queue();
+  bench_fifo_buffer();
+}
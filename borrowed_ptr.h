@@ -0,0 +1,113 @@
+/**
+ * ai-utils -- C++ Core utilities
+ *
+ * @file
+ * @brief Definition of borrowed_ptr.
+ *
+ * @Copyright (C) 2021  Carlo Wood.
+ *
+ * RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+ * Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+ *
+ * This file is part of ai-utils.
+ *
+ * ai-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ai-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ai-utils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "AIRefCount.h"
+#include "debug.h"
+#include <cstddef>
+#include <type_traits>
+#include <boost/intrusive_ptr.hpp>
+
+// Just like boost::intrusive_ptr, borrowed_ptr points to an object derived
+// from AIRefCount - but it doesn't own a reference: it just borrows one from
+// a caller that does. Thus, it's a good choice mainly as a function argument
+// when the function only observes the object and some boost::intrusive_ptr
+// is guaranteed to keep the object alive for the duration of the call;
+// passing a boost::intrusive_ptr by value there would pay two atomic
+// operations per call for nothing.
+//
+// Its constructor is implicit, so that callers won't have to convert their
+// boost::intrusive_ptr<T> explicitly. Construction from a temporary
+// intrusive_ptr is rejected at compile time, because the borrowed reference
+// would be gone before the call even starts.
+//
+// Example use:
+//
+//   void some_function(utils::borrowed_ptr<MyClass> object);
+//   ...
+//   boost::intrusive_ptr<MyClass> my_class = new MyClass;
+//   some_function(my_class);
+//
+// When a callee does need to extend the lifetime of the object after all,
+// it can take its own reference with own().
+//
+// Note: borrowed_ptr is just a raw pointer and trivially copyable, so pass
+// it by value. When compiled with debugging every dereference ASSERTs that
+// the borrowed object is still referenced (see AIRefCount::ref_count),
+// which catches a borrowed_ptr that outlived the owning intrusive_ptr.
+
+namespace utils {
+
+template<typename T>
+class borrowed_ptr
+{
+  static_assert(std::is_convertible<T const*, AIRefCount const*>::value, "borrowed_ptr<T> requires T to be derived from AIRefCount.");
+
+ private:
+  T* m_ptr;
+
+ public:
+  borrowed_ptr() : m_ptr(nullptr) { }
+  borrowed_ptr(std::nullptr_t) : m_ptr(nullptr) { }
+
+  // Borrow from a raw pointer; the caller is responsible for the existence of an owner.
+  explicit borrowed_ptr(T* ptr) : m_ptr(ptr) { ASSERT(!ptr || ptr->ref_count() > 0); }
+
+  // Borrow from an intrusive_ptr (implicit; this is the intended use).
+  template<typename U, typename std::enable_if<std::is_convertible<U*, T*>::value>::type* = nullptr>
+  borrowed_ptr(boost::intrusive_ptr<U> const& ptr) : m_ptr(ptr.get()) { }
+
+  // Borrowing from a temporary would dangle immediately.
+  template<typename U, typename std::enable_if<std::is_convertible<U*, T*>::value>::type* = nullptr>
+  borrowed_ptr(boost::intrusive_ptr<U>&& ptr) = delete;
+
+  // Allow borrowed_ptr<Derived> --> borrowed_ptr<Base>.
+  template<typename U, typename std::enable_if<std::is_convertible<U*, T*>::value && !std::is_same<U, T>::value>::type* = nullptr>
+  borrowed_ptr(borrowed_ptr<U> ptr) : m_ptr(ptr.get()) { }
+
+  // Accessors.
+
+  T* get() const { ASSERT(!m_ptr || m_ptr->ref_count() > 0); return m_ptr; }
+  T& operator*() const { ASSERT(m_ptr && m_ptr->ref_count() > 0); return *m_ptr; }
+  T* operator->() const { ASSERT(m_ptr && m_ptr->ref_count() > 0); return m_ptr; }
+  explicit operator bool() const { return m_ptr != nullptr; }
+
+  // Take a real (counted) reference after all, extending the lifetime of the object.
+  boost::intrusive_ptr<T> own() const { return boost::intrusive_ptr<T>(get()); }
+
+  // Comparison operators.
+
+  friend bool operator==(borrowed_ptr p1, borrowed_ptr p2) { return p1.m_ptr == p2.m_ptr; }
+  friend bool operator!=(borrowed_ptr p1, borrowed_ptr p2) { return p1.m_ptr != p2.m_ptr; }
+  friend bool operator==(borrowed_ptr p1, std::nullptr_t) { return p1.m_ptr == nullptr; }
+  friend bool operator==(std::nullptr_t, borrowed_ptr p2) { return p2.m_ptr == nullptr; }
+  friend bool operator!=(borrowed_ptr p1, std::nullptr_t) { return p1.m_ptr != nullptr; }
+  friend bool operator!=(std::nullptr_t, borrowed_ptr p2) { return p2.m_ptr != nullptr; }
+};
+
+} // namespace utils
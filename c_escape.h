@@ -1,17 +1,110 @@
 #pragma once
 
 #include "c_escape_iterator.h"
+#include "macros.h"
+#include <string>
 #include <string_view>
 #include <algorithm>
 #include <iostream>
+#include <type_traits>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 namespace utils {
 
+// Return true iff c is a character that c_escape escapes:
+// control characters, backslash, DEL and bytes >= 128.
+inline constexpr bool needs_c_escape(char c)
+{
+  // Same test as c_escape_iterator<>::prepare_escape_buf (char is signed: bytes >= 128 are negative).
+  return !(c > 31 && c != 92 && c != 127);
+}
+
+// Return the index of the first character of data that needs escaping, or data.size() if there is none.
+inline std::size_t c_escape_find(std::string_view data)
+{
+  std::size_t i = 0;
+#if defined(__SSE2__)
+  // Classify 16 bytes at a time. The signed compare with 32 catches both the
+  // control characters and the bytes >= 128 (which are negative), leaving
+  // just backslash and DEL for the two equality compares.
+  __m128i const lowest_printable = _mm_set1_epi8(32);
+  __m128i const backslash = _mm_set1_epi8('\\');
+  __m128i const del = _mm_set1_epi8(127);
+  for (; i + 16 <= data.size(); i += 16)
+  {
+    __m128i const chunk = _mm_loadu_si128(reinterpret_cast<__m128i const*>(data.data() + i));
+    __m128i const escape = _mm_or_si128(_mm_cmplt_epi8(chunk, lowest_printable),
+        _mm_or_si128(_mm_cmpeq_epi8(chunk, backslash), _mm_cmpeq_epi8(chunk, del)));
+    int const mask = _mm_movemask_epi8(escape);
+    if (AI_UNLIKELY(mask != 0))
+      return i + __builtin_ctz(mask);
+  }
+#endif
+  for (; i < data.size(); ++i)
+    if (needs_c_escape(data[i]))
+      return i;
+  return data.size();
+}
+
+// Append the escape sequence for c (which must need escaping) to out.
+inline void c_escape_append(std::string& out, char c)
+{
+  out += '\\';
+  if (c > 6 && c < 14)
+    out += "abtnvfr"[c - 7];
+  else if (c == 27)
+    out += 'e';
+  else if (c == '\\')
+    out += '\\';
+  else
+  {
+    unsigned int const xval = (unsigned char)c;
+    out += 'x';
+    out += "0123456789ABCDEF"[xval >> 4];
+    out += "0123456789ABCDEF"[xval & 0xf];
+  }
+}
+
+// Bulk escape: return data itself when it contains nothing that needs
+// escaping (the common case; buf is left untouched), otherwise escape
+// into buf - copying the clean runs between escapes wholesale - and
+// return a view of buf.
+inline std::string_view c_escape(std::string_view data, std::string& buf)
+{
+  std::size_t first = c_escape_find(data);
+  if (AI_LIKELY(first == data.size()))
+    return data;
+  buf.clear();
+  buf.reserve(data.size() + 16);
+  std::size_t pos = 0;
+  for (;;)
+  {
+    buf.append(data.data() + pos, first - pos);
+    if (first == data.size())
+      break;
+    c_escape_append(buf, data[first]);
+    pos = first + 1;
+    first = pos + c_escape_find(data.substr(pos));
+  }
+  return buf;
+}
+
 template<typename T>
 void c_escape(std::ostream& os, T const& data)
 {
-  using it_escaped_t = c_escape_iterator<typename T::const_iterator>;
-  std::copy(it_escaped_t(data.begin(), data.end()), it_escaped_t(data.end()), std::ostreambuf_iterator<char>(os));
+  if constexpr (std::is_convertible<T const&, std::string_view>::value)
+  {
+    // Contiguous character data: use the bulk path.
+    std::string buf;
+    os << c_escape(std::string_view(data), buf);
+  }
+  else
+  {
+    using it_escaped_t = c_escape_iterator<typename T::const_iterator>;
+    std::copy(it_escaped_t(data.begin(), data.end()), it_escaped_t(data.end()), std::ostreambuf_iterator<char>(os));
+  }
 }
 
 } // namespace utils
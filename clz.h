@@ -48,6 +48,15 @@ constexpr int _clz(unsigned long long n)
   return __builtin_clzll(n);
 }
 
+#ifdef __SIZEOF_INT128__
+constexpr int _clz(unsigned __int128 n)
+{
+  // Two-word composition; the branch compiles to a conditional move.
+  unsigned long long const hi = n >> 64;
+  return hi != 0 ? _clz(hi) : 64 + _clz(static_cast<unsigned long long>(n));
+}
+#endif
+
 } // namespace
 
 // Function utils::clz(n)
@@ -58,8 +67,11 @@ constexpr int _clz(unsigned long long n)
 template<typename T>
 constexpr int clz(T n)
 {
-  static_assert(std::is_same<T, unsigned int>::value || std::is_same<T, unsigned long>::value || std::is_same<T, unsigned long long>::value,
-      "The type of the argument to clz can only be unsigned int, unsigned long or unsigned long long.");
+  static_assert(std::is_same<T, unsigned int>::value || std::is_same<T, unsigned long>::value || std::is_same<T, unsigned long long>::value
+#ifdef __SIZEOF_INT128__
+      || std::is_same<T, unsigned __int128>::value
+#endif
+      , "The type of the argument to clz can only be unsigned int, unsigned long, unsigned long long or unsigned __int128.");
   return _clz(n);
 }
 
@@ -48,6 +48,15 @@ constexpr int _ctz(unsigned long long n)
   return __builtin_ctzll(n);
 }
 
+#ifdef __SIZEOF_INT128__
+constexpr int _ctz(unsigned __int128 n)
+{
+  // Two-word composition; the branch compiles to a conditional move.
+  unsigned long long const lo = n;
+  return lo != 0 ? _ctz(lo) : 64 + _ctz(static_cast<unsigned long long>(n >> 64));
+}
+#endif
+
 } // namespace
 
 // Function utils::ctz(n)
@@ -58,8 +67,11 @@ constexpr int _ctz(unsigned long long n)
 template<typename T>
 constexpr int ctz(T n)
 {
-  static_assert(std::is_same<T, unsigned int>::value || std::is_same<T, unsigned long>::value || std::is_same<T, unsigned long long>::value,
-      "The type of the argument to ctz can only be unsigned int, unsigned long or unsigned long long.");
+  static_assert(std::is_same<T, unsigned int>::value || std::is_same<T, unsigned long>::value || std::is_same<T, unsigned long long>::value
+#ifdef __SIZEOF_INT128__
+      || std::is_same<T, unsigned __int128>::value
+#endif
+      , "The type of the argument to ctz can only be unsigned int, unsigned long, unsigned long long or unsigned __int128.");
   return _ctz(n);
 }
 
@@ -26,21 +26,11 @@
  */
 
 #include "double_to_str_precision.h"
-
-#include <sstream>
-#include <iomanip>
+#include "dtoa.h"
 
 std::string double_to_str_precision(double d, int min, int max)
 {
-  std::ostringstream oss;
-  oss << std::fixed << std::setprecision(max) << d;
-  std::string str = oss.str();
-  int dot = str.find_first_of(".");
-  int pos = str.find_last_of("123456789");
-  if (dot != (int)std::string::npos)
-  {
-    int precision = std::max(min, (pos != (int)std::string::npos) ? pos - dot : 0);
-    str = str.substr(0, dot + ((precision > 0) ? 1 + precision : 0));
-  }
-  return str;
+  char buf[352];
+  char* end = utils::dtoa_fixed(buf, buf + sizeof(buf), d, min, max);
+  return {buf, end};
 }
@@ -0,0 +1,93 @@
+/**
+ * ai-utils -- C++ Core utilities
+ *
+ * @file
+ * @brief Implementation of dtoa_shortest and dtoa_fixed.
+ *
+ * @Copyright (C) 2021  Carlo Wood.
+ *
+ * RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+ * Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+ *
+ * This file is part of ai-utils.
+ *
+ * ai-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ai-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ai-utils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sys.h"
+#include "dtoa.h"
+#include "debug.h"
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace utils {
+
+char* dtoa_shortest(char* ptr, char* end, double d)
+{
+#if defined(__cpp_lib_to_chars)
+  // libstdc++ implements this with Ryu: the shortest representation that
+  // round-trips, in roughly a hundred nanoseconds and without allocating.
+  std::to_chars_result result = std::to_chars(ptr, end, d);
+  // The buffer must be large enough; 32 bytes always suffice.
+  ASSERT(result.ec == std::errc());
+  return result.ptr;
+#else
+  // Fallback for standard libraries without floating-point to_chars: probe
+  // increasing %g precisions until the value round-trips. 17 significant
+  // digits always round-trip for a double, so the loop is bounded; typical
+  // values need far fewer digits and only a handful of iterations.
+  char buf[32];
+  int len = 0;
+  for (int precision = 1; precision <= 17; ++precision)
+  {
+    len = std::snprintf(buf, sizeof(buf), "%.*g", precision, d);
+    if (precision == 17 || std::strtod(buf, nullptr) == d)
+      break;
+  }
+  // The buffer must be large enough; 32 bytes always suffice.
+  ASSERT(end - ptr >= len);
+  std::memcpy(ptr, buf, len);
+  return ptr + len;
+#endif
+}
+
+char* dtoa_fixed(char* ptr, char* end, double d, int min, int max)
+{
+  // A double in %f notation needs at most 309 digits before the point,
+  // plus sign, point, max fraction digits and the terminating NUL.
+  ASSERT(0 <= min && min <= max && max < 32);
+  char buf[352];
+  int len = std::snprintf(buf, sizeof(buf), "%.*f", max, d);
+  // Strip trailing fractional zeros down to min digits (and the decimal
+  // point itself when nothing remains behind it).
+  char const* dot = static_cast<char const*>(std::memchr(buf, '.', len));
+  if (dot)
+  {
+    int const dot_index = dot - buf;
+    int fraction_digits = len - dot_index - 1;
+    while (fraction_digits > 0 && buf[dot_index + fraction_digits] == '0')
+      --fraction_digits;
+    int const precision = std::max(min, fraction_digits);
+    len = dot_index + (precision > 0 ? 1 + precision : 0);
+  }
+  // The buffer must be large enough.
+  ASSERT(end - ptr >= len);
+  std::memcpy(ptr, buf, len);
+  return ptr + len;
+}
+
+} // namespace utils
@@ -0,0 +1,51 @@
+/**
+ * ai-utils -- C++ Core utilities
+ *
+ * @file
+ * @brief Declaration of dtoa_shortest and dtoa_fixed.
+ *
+ * @Copyright (C) 2021  Carlo Wood.
+ *
+ * RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+ * Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+ *
+ * This file is part of ai-utils.
+ *
+ * ai-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ai-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ai-utils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+
+namespace utils {
+
+// Fast double formatting (std::to_chars style).
+//
+// Both functions write to [ptr, end> without a terminating NUL and return a
+// pointer one past the last character written, so values can be appended
+// directly into an output buffer. The buffer must be large enough (ASSERT'ed).
+
+// Write the shortest decimal representation of d that converts back to
+// exactly d (Ryu-class shortest round-trip formatting; no allocation, no
+// locale). 32 bytes always suffice.
+char* dtoa_shortest(char* ptr, char* end, double d);
+
+// Write d in fixed notation with at most max and at least min digits behind
+// the decimal point: trailing zeros beyond min are stripped, and when that
+// leaves no fractional digits the decimal point is dropped too. This covers
+// the semantics of double_to_str_precision with a buffer API.
+char* dtoa_fixed(char* ptr, char* end, double d, int min, int max);
+
+} // namespace utils
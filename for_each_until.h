@@ -27,6 +27,12 @@
 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <thread>
+#include <vector>
+
 namespace utils {
 
 template<class InputIterator, class Function>
@@ -43,4 +49,64 @@ bool for_each_until(InputIterator first, InputIterator last, Function& fn)
   return false;
 }
 
+// As for_each_until, but scan the range with number_of_threads threads and
+// return an iterator to the earliest element for which fn returned true,
+// or last when there is none.
+//
+// The range is partitioned into number_of_threads contiguous partitions,
+// each scanned by its own thread with the serial loop above. The index of
+// the earliest match found so far is shared through an atomic that every
+// thread checks between chunks of 256 elements, so the other threads stop
+// promptly after a hit. fn is called concurrently from multiple threads
+// and therefore must be thread-safe; it can be called for elements after
+// the returned one (in other partitions), but never for elements that
+// precede a chunk in which a match was already published.
+template<class RandomAccessIterator, class Function>
+RandomAccessIterator parallel_for_each_until(RandomAccessIterator first, RandomAccessIterator last, Function& fn,
+    unsigned int number_of_threads = std::thread::hardware_concurrency())
+{
+  using difference_type = typename std::iterator_traits<RandomAccessIterator>::difference_type;
+  constexpr difference_type chunk_size = 256;   // The granularity at which workers poll for a match elsewhere.
+  difference_type const count = last - first;
+  // Fall back to a serial scan when threads can't pay for themselves.
+  if (number_of_threads <= 1 || count <= 2 * chunk_size)
+  {
+    for (difference_type i = 0; i < count; ++i)
+      if (fn(first[i]))
+        return first + i;
+    return last;
+  }
+  number_of_threads = std::min(static_cast<difference_type>(number_of_threads), (count + chunk_size - 1) / chunk_size);
+  difference_type const partition_size = (count + number_of_threads - 1) / number_of_threads;
+  std::atomic<difference_type> earliest_match{count};   // The index of the earliest match found so far; count means none.
+  auto scan_partition = [first, count, partition_size, &earliest_match, &fn](unsigned int partition){
+    difference_type const partition_begin = partition * partition_size;
+    difference_type const partition_end = std::min(partition_begin + partition_size, count);
+    for (difference_type chunk_begin = partition_begin; chunk_begin < partition_end; chunk_begin += chunk_size)
+    {
+      if (earliest_match.load(std::memory_order_relaxed) < chunk_begin)
+        return;         // Another thread found a match that precedes anything we can still find.
+      difference_type const chunk_end = std::min(chunk_begin + chunk_size, partition_end);
+      for (difference_type i = chunk_begin; i < chunk_end; ++i)
+        if (fn(first[i]))
+        {
+          // Lock-free fetch-min: only publish i when it precedes the current earliest match.
+          difference_type expected = earliest_match.load(std::memory_order_relaxed);
+          while (i < expected && !earliest_match.compare_exchange_weak(expected, i, std::memory_order_relaxed))
+            ;
+          return;       // Matches later in this partition can't be the earliest anymore.
+        }
+    }
+  };
+  std::vector<std::thread> threads;
+  threads.reserve(number_of_threads - 1);
+  for (unsigned int partition = 1; partition < number_of_threads; ++partition)
+    threads.emplace_back(scan_partition, partition);
+  scan_partition(0);
+  for (std::thread& thread : threads)
+    thread.join();
+  difference_type const match = earliest_match.load(std::memory_order_relaxed);
+  return match == count ? last : first + match;
+}
+
 } // namespace utils
@@ -27,10 +27,12 @@
 
 #pragma once
 
+#include "debug.h"
+#include "macros.h"
 #include <iostream>
+#include <atomic>
 #include <cstring>      // std::memset
 #include <utility>      // std::move
-#include "debug.h"
 
 namespace utils {
 namespace iomanip {
@@ -245,6 +247,179 @@ void UnstickyStore<max_number_of_streams>::from_to(std::ostream& os, DataTransfe
   m_pword[stream] = data.get_pword_from(os);
 }
 
+// class StickyStore
+//
+// Fast per-stream storage for sticky manipulator state.
+//
+// Every use of os.iword(index) / os.pword(index) walks through the stream's
+// internal sparse arrays, growing (allocating) them on first use per stream.
+// A StickyStore instead associates a single pword entry with the stream that
+// caches a pointer to a Slot holding slots_per_stream iword/pword pairs, so
+// that after the first use reading or writing manipulator state is just an
+// indexed load/store through one pointer dereference.
+//
+// Slots are handed out from a lock-free fixed freelist of
+// max_number_of_streams entries (a tagged Treiber stack), so streams coming
+// and going - thousands of short-lived ostringstreams - never hit the
+// allocator: a stream's Slot is returned to the freelist from the stream's
+// erase_event callback when it is destructed. Should more than
+// max_number_of_streams streams use the store simultaneously, the excess
+// slots fall back to heap allocation (still freed via the same callback).
+//
+// Usage:
+//
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~{.h}
+// class MyManipulator
+// {
+//  private:
+//   static utils::iomanip::StickyStore<1> s_store;      // This manipulator needs one iword/pword pair per stream.
+//   long m_value;
+//
+//  public:
+//   MyManipulator(long value) : m_value(value) { }
+//
+//   friend std::ostream& operator<<(std::ostream& os, MyManipulator const& manipulator)
+//   {
+//     s_store.iword(os, 0) = manipulator.m_value;       // An indexed store.
+//     return os;
+//   }
+//
+//   static long get_iword_value(std::ostream& os) { return s_store.iword(os, 0); }
+// };
+//
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~{.cpp}
+// //static
+// utils::iomanip::StickyStore<1> MyManipulator::s_store;
+//
+// As with iword/pword, the default - returned when the manipulator was never
+// used on the stream - is 0 respectively nullptr, and a stream that is
+// copyfmt'ed receives a copy of the source stream's values.
+//
+template<int slots_per_stream, int max_number_of_streams = 64>
+class StickyStore
+{
+ public:
+  struct Slot
+  {
+    long m_iword[slots_per_stream];
+    void* m_pword[slots_per_stream];
+    StickyStore* m_store;       // The owning store.
+    bool m_heap;                // True when this Slot was heap allocated (freelist exhausted).
+    void const* m_stream;       // The stream this Slot belongs to (guards against duplicate callbacks).
+    uint32_t m_next;            // Index plus one of the next free Slot, while on the freelist.
+
+    void zero()
+    {
+      std::memset(m_iword, 0, sizeof(m_iword));
+      std::memset(m_pword, 0, sizeof(m_pword));
+    }
+  };
+
+ private:
+  Slot m_slots[max_number_of_streams];
+  std::atomic<uint64_t> m_head; // (tag << 32) | index plus one of the first free Slot; incrementing the tag on every change defeats ABA.
+  Index m_index;                // The single pword index caching the Slot pointer.
+
+  Slot* pop()
+  {
+    uint64_t head = m_head.load(std::memory_order_relaxed);
+    for (;;)
+    {
+      uint32_t const index = head & 0xffffffff;
+      if (index == 0)
+        return nullptr;         // Freelist exhausted.
+      Slot& slot = m_slots[index - 1];
+      uint64_t const new_head = (((head >> 32) + 1) << 32) | slot.m_next;
+      if (m_head.compare_exchange_weak(head, new_head, std::memory_order_acquire, std::memory_order_relaxed))
+        return &slot;
+    }
+  }
+
+  void push(Slot* slot)
+  {
+    uint32_t const index = slot - m_slots + 1;
+    uint64_t head = m_head.load(std::memory_order_relaxed);
+    for (;;)
+    {
+      slot->m_next = head & 0xffffffff;
+      uint64_t const new_head = (((head >> 32) + 1) << 32) | index;
+      if (m_head.compare_exchange_weak(head, new_head, std::memory_order_release, std::memory_order_relaxed))
+        return;
+    }
+  }
+
+  Slot* allocate(std::ios_base& ios)
+  {
+    Slot* slot = pop();
+    bool const heap = !slot;
+    if (AI_UNLIKELY(heap))
+    {
+      // More than max_number_of_streams streams use this store simultaneously.
+      slot = new Slot;
+    }
+    slot->m_store = this;
+    slot->m_heap = heap;
+    slot->zero();
+    slot->m_stream = &ios;
+    return slot;
+  }
+
+  void release(Slot* slot)
+  {
+    if (AI_UNLIKELY(slot->m_heap))
+      delete slot;
+    else
+      push(slot);
+  }
+
+  static void callback(std::ios_base::event event, std::ios_base& ios, int index)
+  {
+    Slot* slot = static_cast<Slot*>(ios.pword(index));
+    if (!slot)
+      return;
+    if (event == std::ios_base::erase_event)
+    {
+      // The stream is destructed (or about to be overwritten by copyfmt).
+      ios.pword(index) = nullptr;
+      slot->m_store->release(slot);
+    }
+    else if (event == std::ios_base::copyfmt_event && slot->m_stream != &ios)
+    {
+      // copyfmt copied the source stream's Slot pointer into ios; give ios its own copy of the values.
+      // register_callback was copied along, so no need to register again.
+      Slot* copy = slot->m_store->allocate(ios);
+      std::memcpy(copy->m_iword, slot->m_iword, sizeof(slot->m_iword));
+      std::memcpy(copy->m_pword, slot->m_pword, sizeof(slot->m_pword));
+      ios.pword(index) = copy;
+    }
+  }
+
+  Slot* get(std::ostream& os)
+  {
+    void*& cached = os.pword(m_index);
+    if (AI_UNLIKELY(!cached))
+    {
+      Slot* slot = allocate(os);
+      os.register_callback(&StickyStore::callback, m_index);
+      cached = slot;
+    }
+    return static_cast<Slot*>(cached);
+  }
+
+ public:
+  StickyStore() : m_head(0)
+  {
+    // Build the initial freelist: slot i links to slot i + 1.
+    for (int i = 0; i < max_number_of_streams; ++i)
+      m_slots[i].m_next = (i + 1 < max_number_of_streams) ? i + 2 : 0;
+    m_head.store(1, std::memory_order_relaxed);
+  }
+
+  // Return a reference to iword/pword number i of this store, for stream os.
+  long& iword(std::ostream& os, int i) { ASSERT(0 <= i && i < slots_per_stream); return get(os)->m_iword[i]; }
+  void*& pword(std::ostream& os, int i) { ASSERT(0 <= i && i < slots_per_stream); return get(os)->m_pword[i]; }
+};
+
 template<int max_number_of_streams>
 class Object : public Unsticky<max_number_of_streams>
 {
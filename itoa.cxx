@@ -27,9 +27,59 @@
 
 #include "sys.h"
 #include "itoa.h"
+#include "debug.h"
+#include <cstring>
 
 namespace utils {
 
+namespace {
+
+// "00", "01", ..., "99".
+constexpr char two_digits[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+int decimal_digits(unsigned long n)
+{
+  int digits = 1;
+  for (;;)
+  {
+    if (n < 10) return digits;
+    if (n < 100) return digits + 1;
+    if (n < 1000) return digits + 2;
+    if (n < 10000) return digits + 3;
+    n /= 10000;
+    digits += 4;
+  }
+}
+
+// Emit exactly digits decimal digits of n at [p, p + digits>.
+inline void emit_digits(char* p, int digits, unsigned long n)
+{
+  char* q = p + digits;
+  while (n >= 100)
+  {
+    unsigned int const d = n % 100;
+    n /= 100;
+    q -= 2;
+    std::memcpy(q, two_digits + 2 * d, 2);
+  }
+  if (n >= 10)
+    std::memcpy(p, two_digits + 2 * n, 2);
+  else
+    *p = '0' + n;
+}
+
+} // namespace
+
 char* backwards_itoa_unsigned(char* p, unsigned long n, unsigned int base)
 {
   static char const digit[36] = {
@@ -48,6 +98,95 @@ char* backwards_itoa_unsigned(char* p, unsigned long n, unsigned int base)
   return p;
 }
 
+char* itoa_unsigned(char* ptr, char* end, unsigned long n)
+{
+  int const digits = decimal_digits(n);
+  // The buffer must be large enough for the decimal representation of n.
+  ASSERT(end - ptr >= digits);
+  emit_digits(ptr, digits, n);
+  return ptr + digits;
+}
+
+char* itoa_signed(char* ptr, char* end, long n)
+{
+  unsigned long const mask = n >> (sizeof(long) * 8 - 1);        // All 1's when n < 0, all 0's otherwise.
+  unsigned long abs_n = (n + mask) ^ mask;
+  if (mask)
+  {
+    ASSERT(ptr < end);
+    *ptr++ = '-';
+  }
+  return itoa_unsigned(ptr, end, abs_n);
+}
+
+char* itoa_batch_unsigned(char* ptr, char* end, unsigned long const* values, std::size_t count, char separator, int width)
+{
+  if (count == 0)
+    return ptr;
+  // The length pre-pass.
+  std::size_t total = count - 1;                // The separators.
+  for (std::size_t i = 0; i < count; ++i)
+    total += width > 0 ? width : decimal_digits(values[i]);
+  // The buffer must be large enough for all values plus separators.
+  ASSERT(static_cast<std::size_t>(end - ptr) >= total);
+  char* p = ptr;
+  for (std::size_t i = 0; i < count; ++i)
+  {
+    if (i > 0)
+      *p++ = separator;
+    int const digits = decimal_digits(values[i]);
+    if (width > 0)
+    {
+      // In fixed-width mode every value must fit.
+      ASSERT(digits <= width);
+      std::memset(p, '0', width - digits);
+      p += width - digits;
+    }
+    emit_digits(p, digits, values[i]);
+    p += digits;
+  }
+  return p;
+}
+
+char* itoa_batch_signed(char* ptr, char* end, long const* values, std::size_t count, char separator, int width)
+{
+  if (count == 0)
+    return ptr;
+  // The length pre-pass.
+  std::size_t total = count - 1;                // The separators.
+  for (std::size_t i = 0; i < count; ++i)
+  {
+    long const n = values[i];
+    unsigned long const mask = n >> (sizeof(long) * 8 - 1);
+    total += width > 0 ? width : decimal_digits((n + mask) ^ mask) + (mask ? 1 : 0);
+  }
+  // The buffer must be large enough for all values plus separators.
+  ASSERT(static_cast<std::size_t>(end - ptr) >= total);
+  char* p = ptr;
+  for (std::size_t i = 0; i < count; ++i)
+  {
+    if (i > 0)
+      *p++ = separator;
+    long const n = values[i];
+    unsigned long const mask = n >> (sizeof(long) * 8 - 1);      // All 1's when n < 0, all 0's otherwise.
+    unsigned long const abs_n = (n + mask) ^ mask;
+    int const digits = decimal_digits(abs_n);
+    if (mask)
+      *p++ = '-';
+    if (width > 0)
+    {
+      int const used = digits + (mask ? 1 : 0);
+      // In fixed-width mode every value must fit, including its sign.
+      ASSERT(used <= width);
+      std::memset(p, '0', width - used);
+      p += width - used;
+    }
+    emit_digits(p, digits, abs_n);
+    p += digits;
+  }
+  return p;
+}
+
 char* backwards_itoa_signed(char* p, long n, int base)
 {
   unsigned long const mask = n >> (sizeof(long) * 8 - 1);        // All 1's when n < 0, all 0's otherwise.
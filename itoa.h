@@ -36,6 +36,31 @@ namespace utils {
 char* backwards_itoa_unsigned(char* p, unsigned long n, unsigned int base);
 char* backwards_itoa_signed(char* p, long n, int base);
 
+// Fast forward decimal formatting (std::to_chars style).
+//
+// Write the decimal representation of n to [ptr, end> and return a pointer
+// one past the last character written (no terminating NUL is added), so that
+// values can be appended directly into an output buffer. The number of digits
+// is computed up front and the digits are then emitted two per division from
+// a 100-entry lookup table, instead of one generic div/mod per digit.
+// The buffer must be large enough (ASSERT'ed); 21 bytes always suffice.
+char* itoa_unsigned(char* ptr, char* end, unsigned long n);
+char* itoa_signed(char* ptr, char* end, long n);
+
+// Batch formatting, for whole columns of integers at once.
+//
+// Format values[0..count) into [ptr, end>, with separator between consecutive
+// values, and return a pointer one past the last character written (no NUL).
+// The total length is computed in a single pre-pass (and ASSERT'ed against the
+// buffer), then the values are emitted in one tight loop over the two-digit
+// lookup table - no per-value call or bookkeeping overhead.
+//
+// When width > 0 every value is right-aligned and zero-padded to exactly
+// width characters (a minus sign leads, inside the width), so that rows
+// align; each value must then fit in width characters (ASSERT'ed).
+char* itoa_batch_unsigned(char* ptr, char* end, unsigned long const* values, std::size_t count, char separator = ',', int width = 0);
+char* itoa_batch_signed(char* ptr, char* end, long const* values, std::size_t count, char separator = ',', int width = 0);
+
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wattributes"
 
@@ -55,6 +80,26 @@ char const* itoa(std::array<char, sz>& buf, T n)
     return backwards_itoa_unsigned(&buf[sz], n, 10);
 }
 
+template<typename T>
+[[gnu::always_inline]] inline char* itoa(char* ptr, char* end, T n)
+{
+  if constexpr (std::is_signed<T>::value)
+    return itoa_signed(ptr, end, n);
+  else
+    return itoa_unsigned(ptr, end, n);
+}
+
+template<typename T>
+inline char* itoa_batch(char* ptr, char* end, T const* values, std::size_t count, char separator = ',', int width = 0)
+{
+  static_assert(std::is_integral<T>::value && sizeof(T) == sizeof(long),
+      "itoa_batch requires an array of long-sized integers (e.g. int64_t / uint64_t); convert smaller element types first.");
+  if constexpr (std::is_signed<T>::value)
+    return itoa_batch_signed(ptr, end, reinterpret_cast<long const*>(values), count, separator, width);
+  else
+    return itoa_batch_unsigned(ptr, end, reinterpret_cast<unsigned long const*>(values), count, separator, width);
+}
+
 #pragma GCC diagnostic pop
 
 } // namespace utils
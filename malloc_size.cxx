@@ -27,8 +27,11 @@
 
 #include "sys.h"
 #include "malloc_size.h"
+#include "log2.h"
+#include "macros.h"
 #include "nearest_multiple_of_power_of_two.h"
 #include "nearest_power_of_two.h"
+#include <algorithm>
 #include <unistd.h>     // sysconf.
 
 namespace utils {
@@ -36,6 +39,29 @@ namespace utils {
 static size_t const page_size = sysconf(_SC_PAGE_SIZE);   // It is assumed that this is a power of two.
 static constexpr size_t minimum_heap_size = 32;
 
+namespace {
+
+// The size-class ladder for heap chunks smaller than one page, precomputed
+// once at startup: m_heap_size[log2(required - 1)] is the power of two (at
+// least minimum_heap_size) that a required heap space of `required` bytes
+// rounds up to. Containers consult malloc_size on every growth decision,
+// so the common (sub-page) case should be a plain table lookup.
+struct SizeClassTable
+{
+  static constexpr int entries = 8 * sizeof(size_t);
+  size_t m_heap_size[entries];
+
+  SizeClassTable()
+  {
+    for (int i = 0; i < entries; ++i)
+      m_heap_size[i] = std::max(minimum_heap_size, size_t{2} << i);
+  }
+};
+
+SizeClassTable const size_class_table;
+
+} // namespace
+
 // It seems that glibc 2.27 malloc is pretty efficient with memory;
 // it uses a multiple of 16 bytes (mostly for alignment reasons)
 // and has an overhead of 8 bytes. Sizes larger than 128kB are
@@ -51,12 +77,11 @@ static constexpr size_t minimum_heap_size = 32;
 // 4096 bytes.
 size_t malloc_size(size_t min_size)
 {
-  size_t required_heap_space = min_size + config::malloc_overhead_c;
+  size_t const required_heap_space = min_size + config::malloc_overhead_c;
   size_t actual_used_heap_space;
-  if (required_heap_space <= minimum_heap_size)
-    actual_used_heap_space = minimum_heap_size;
-  else if (required_heap_space < page_size)
-    actual_used_heap_space = nearest_power_of_two(required_heap_space);
+  if (AI_LIKELY(required_heap_space <= page_size))
+    // required_heap_space >= malloc_overhead_c > 1, so the log2 argument is never 0.
+    actual_used_heap_space = size_class_table.m_heap_size[log2(required_heap_space - 1)];
   else
     actual_used_heap_space = nearest_multiple_of_power_of_two(required_heap_space, page_size);
   return actual_used_heap_space - config::malloc_overhead_c;
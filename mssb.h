@@ -73,6 +73,20 @@ constexpr uint64_t extend_mssb(uint64_t n)
   return n;
 }
 
+#ifdef __SIZEOF_INT128__
+constexpr unsigned __int128 extend_mssb(unsigned __int128 n)
+{
+  n |= n >> 1;
+  n |= n >> 2;
+  n |= n >> 4;
+  n |= n >> 8;
+  n |= n >> 16;
+  n |= n >> 32;
+  n |= n >> 64;
+  return n;
+}
+#endif
+
 } // namespace
 
 // Function utils::mssb(n)
@@ -83,8 +97,11 @@ constexpr uint64_t extend_mssb(uint64_t n)
 template<typename T>
 constexpr T mssb(T n)
 {
-  static_assert(std::is_unsigned<T>::value && sizeof(T) <= sizeof(uint64_t),
-      "The type of the argument to mssb can only be an unsigned integral of at most uint64_t.");
+  static_assert((std::is_unsigned<T>::value && sizeof(T) <= sizeof(uint64_t))
+#ifdef __SIZEOF_INT128__
+      || std::is_same<T, unsigned __int128>::value
+#endif
+      , "The type of the argument to mssb can only be an unsigned integral of at most uint64_t, or unsigned __int128.");
   return extend_mssb(n >> 1) + 1;
 }
 
@@ -0,0 +1,112 @@
+/**
+ * ai-utils -- C++ Core utilities
+ *
+ * @file
+ * @brief Definition of partition and parallel_for_each.
+ *
+ * @Copyright (C) 2021  Carlo Wood.
+ *
+ * RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+ * Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+ *
+ * This file is part of ai-utils.
+ *
+ * ai-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ai-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ai-utils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "utils/config.h"
+#include "IndexRange.h"
+#include "debug.h"
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+namespace utils {
+
+// Split the index range of container (a utils::Vector or utils::Array) into at
+// most number_of_parts contiguous sub-ranges of roughly equal size, without
+// giving up the index type: each sub-range is an [m_begin, m_end) pair of
+// container's index_type.
+//
+// When the element size divides the cacheline size, the split points are
+// rounded up to a whole number of cachelines (counting from the first
+// element), so that - provided the container itself starts cacheline aligned -
+// no two parts write to the same cacheline.
+//
+// Fewer than number_of_parts sub-ranges are returned when the container is too
+// small to fill them all; none at all when it is empty.
+template<typename CONTAINER>
+std::vector<IndexRange<typename CONTAINER::index_type>> partition(CONTAINER const& container, unsigned int number_of_parts)
+{
+  using index_type = typename CONTAINER::index_type;
+  using value_type = typename CONTAINER::value_type;
+  // The number of elements that a split point must be a multiple of.
+  constexpr size_t quantum =
+      (sizeof(value_type) < (size_t)config::cacheline_size_c && config::cacheline_size_c % sizeof(value_type) == 0)
+          ? config::cacheline_size_c / sizeof(value_type)
+          : 1;
+  ASSERT(number_of_parts >= 1);
+  size_t const size = container.size();
+  std::vector<IndexRange<index_type>> ranges;
+  size_t begin = 0;
+  for (unsigned int part = 0; part < number_of_parts && begin < size; ++part)
+  {
+    // Divide what is left evenly over the remaining parts, rounded up to a whole quantum.
+    size_t count = (size - begin + (number_of_parts - part) - 1) / (number_of_parts - part);
+    count = (count + quantum - 1) / quantum * quantum;
+    size_t const end = std::min(size, begin + count);
+    ranges.push_back({container.ibegin() + static_cast<int>(begin), container.ibegin() + static_cast<int>(end)});
+    begin = end;
+  }
+  return ranges;
+}
+
+// Invoke f(index) for every index of container, the work divided over
+// number_of_threads threads along the sub-ranges produced by partition (the
+// calling thread processes the first sub-range itself and number_of_threads - 1
+// threads are started for the rest). Returns after all invocations finished.
+//
+// f must be callable with an index_type of the container and, together with
+// whatever it touches, be thread-safe for concurrent invocation on distinct
+// indexes.
+//
+// Usage:
+//
+//   utils::Vector<double, RowIndex> row_sum(rows);
+//   utils::parallel_for_each(row_sum, number_of_threads, [&](RowIndex row){
+//     row_sum[row] = matrix.sum_of_row(row);
+//   });
+template<typename CONTAINER, typename F>
+void parallel_for_each(CONTAINER& container, unsigned int number_of_threads, F f)
+{
+  using index_type = typename CONTAINER::index_type;
+  auto const ranges = partition(container, number_of_threads);
+  if (ranges.empty())
+    return;
+  auto const run = [&f](IndexRange<index_type> const& range){
+    for (index_type index = range.m_begin; index != range.m_end; ++index)
+      f(index);
+  };
+  std::vector<std::thread> threads;
+  threads.reserve(ranges.size() - 1);
+  for (size_t part = 1; part < ranges.size(); ++part)
+    threads.emplace_back(run, ranges[part]);
+  run(ranges[0]);
+  for (std::thread& thread : threads)
+    thread.join();
+}
+
+} // namespace utils
@@ -0,0 +1,103 @@
+/**
+ * ai-utils -- C++ Core utilities
+ *
+ * @file
+ * @brief Definition of pdep.
+ *
+ * @Copyright (C) 2021  Carlo Wood.
+ *
+ * RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+ * Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+ *
+ * This file is part of ai-utils.
+ *
+ * ai-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ai-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ai-utils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <type_traits>
+#include <cstdint>
+#include <cstddef>
+
+namespace utils {
+
+namespace {
+constexpr uint64_t _pdep_fallback(uint64_t val, uint64_t mask)
+{
+  uint64_t result = 0;
+  uint64_t bit = 1;
+  for (uint64_t m = mask; m != 0; m &= m - 1, bit <<= 1)
+    if ((val & bit))
+      result |= m & -m;         // Deposit this bit of val at the least significant set bit of m.
+  return result;
+}
+
+constexpr unsigned int _pdep(unsigned int val, unsigned int mask)
+{
+#ifdef __BMI2__
+  if (!__builtin_is_constant_evaluated())
+    return __builtin_ia32_pdep_si(val, mask);
+#endif
+  return _pdep_fallback(val, mask);
+}
+
+constexpr unsigned long _pdep(unsigned long val, unsigned long mask)
+{
+#ifdef __BMI2__
+  if (!__builtin_is_constant_evaluated())
+    return __builtin_ia32_pdep_di(val, mask);
+#endif
+  return _pdep_fallback(val, mask);
+}
+
+constexpr unsigned long long _pdep(unsigned long long val, unsigned long long mask)
+{
+#ifdef __BMI2__
+  if (!__builtin_is_constant_evaluated())
+    return __builtin_ia32_pdep_di(val, mask);
+#endif
+  return _pdep_fallback(val, mask);
+}
+} // namespace
+
+// Function utils::pdep(val, mask)
+//
+// Parallel bit Deposit: scatters the contiguous low bits of val to the
+// positions of the set bits of mask (the inverse of utils::pext). For example,
+// pdep(0b000111, 0b101010) == 0b101010 and pdep(0b000110, 0b101010) == 0b101000.
+//
+// Uses the BMI2 pdep instruction when compiling for a target that has it, and
+// a constexpr software loop over the set bits of mask otherwise (and in
+// constant evaluation).
+//
+template<typename T>
+constexpr T pdep(T val, T mask)
+{
+  static_assert(std::is_same<T, unsigned int>::value || std::is_same<T, unsigned long>::value || std::is_same<T, unsigned long long>::value,
+      "The type of the arguments to pdep can only be unsigned int, unsigned long or unsigned long long.");
+  return _pdep(val, mask);
+}
+
+// Deposit the low bits of each of the n words of in under mask, storing the
+// results in out (which may be equal to in). A simple loop: with BMI2 it runs
+// at one pdep per element, which is what column-oriented scatter kernels want.
+template<typename T>
+void pdep_bulk(T* out, T const* in, std::size_t n, T mask)
+{
+  for (std::size_t i = 0; i < n; ++i)
+    out[i] = pdep(in[i], mask);
+}
+
+} // namespace utils
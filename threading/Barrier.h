@@ -0,0 +1,108 @@
+/**
+ * ai-utils -- C++ Core utilities
+ *
+ * @file
+ * @brief Declaration of class Barrier.
+ *
+ * @Copyright (C) 2021  Carlo Wood.
+ *
+ * RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+ * Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+ *
+ * This file is part of ai-utils.
+ *
+ * ai-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ai-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with ai-utils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "Futex.h"
+#include "utils/config.h"
+#include "utils/cpu_relax.h"
+#include "utils/macros.h"
+#include "debug.h"
+#include <limits>
+
+namespace utils::threading {
+
+// class Barrier
+//
+// A reusable phase barrier for a fixed number of threads: every thread calls
+// arrive_and_wait() at the end of a phase and is released as soon as all of
+// them arrived; then the barrier is immediately ready for the next phase.
+//
+// Where StartingGate synchronizes a single start event, this generalizes it
+// to thousands of phases per second: the futex word is a generation counter
+// (the "sense" that reverses every phase), so a release and the arrivals of
+// the next phase can never be confused and no reconstruction or gate pairing
+// is needed between phases. Waiters spin briefly before sleeping in the
+// futex, so in lock-step workloads where the last thread arrives quickly
+// no syscall is made at all.
+//
+// The generation word and the arrival counter each live in their own cache
+// line: the arrival counter is hammered with RMWs by arriving threads and
+// would otherwise invalidate the line that the waiters spin on.
+//
+class Barrier : public Futex<uint32_t, config::cacheline_size_c>
+{
+ private:
+  static constexpr int spin_cycles = 400;       // How long a waiter spins before going into FUTEX_WAIT;
+                                                // roughly 100 ns - the release latency of a well-tuned phase.
+
+  int const m_nthreads;                                         // The number of threads that participate in every phase.
+  alignas(config::cacheline_size_c) std::atomic<int> m_arrived; // The number of threads that arrived in the current phase.
+
+ public:
+  Barrier(int nthreads) : Futex<uint32_t, config::cacheline_size_c>(0), m_nthreads(nthreads), m_arrived(0)
+  {
+    // A barrier for less than one thread makes no sense.
+    ASSERT(nthreads >= 1);
+  }
+
+  // The current generation (the number of completed phases, mod 2^32).
+  uint32_t generation() const { return m_word.load(std::memory_order_relaxed); }
+
+  void arrive_and_wait() noexcept
+  {
+    uint32_t const gen = m_word.load(std::memory_order_relaxed);
+    // Acq_rel: the arrivals of this phase synchronize with each other through this counter.
+    if (m_arrived.fetch_add(1, std::memory_order_acq_rel) + 1 == m_nthreads)
+    {
+      // We are the last to arrive: begin a new phase and release the others.
+      // m_arrived must be reset before the generation is bumped: a released
+      // thread can re-enter arrive_and_wait() immediately.
+      m_arrived.store(0, std::memory_order_relaxed);
+      m_word.store(gen + 1, std::memory_order_release);
+      Futex<uint32_t, config::cacheline_size_c>::wake(std::numeric_limits<uint32_t>::max());
+      return;
+    }
+    // Spin briefly: in lock-step workloads the last thread normally arrives
+    // within the spin window and the futex is never touched.
+    for (int spin = spin_cycles; spin != 0; --spin)
+    {
+      if (AI_LIKELY(m_word.load(std::memory_order_acquire) != gen))
+        return;
+      cpu_relax();
+    }
+    while (m_word.load(std::memory_order_acquire) == gen)
+    {
+      // Sleeps only while the generation didn't change yet; returns immediately
+      // (with EAGAIN) when the last thread just bumped it. A return of 0 can be
+      // a spurious wake-up, hence the loop.
+      Futex<uint32_t, config::cacheline_size_c>::wait(gen);
+    }
+  }
+};
+
+} // namespace utils::threading
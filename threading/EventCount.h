@@ -0,0 +1,175 @@
+/**
+ * ai-utils -- C++ Core utilities
+ *
+ * @file
+ * @brief Definition of EventCount.
+ *
+ * @Copyright (C) 2021  Carlo Wood.
+ *
+ * RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+ * Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+ *
+ * This file is part of ai-utils.
+ *
+ * ai-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ai-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with ai-utils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "Futex.h"
+#include "utils/macros.h"
+#include "debug.h"
+#include <atomic>
+#include <cstdint>
+#include <limits>
+
+namespace utils::threading {
+
+// class EventCount
+//
+// Lets a thread block until an arbitrary lock-free condition becomes true,
+// without a lost-wakeup window and without adding cost to the fast path of
+// the threads that make the condition true.
+//
+// The futex word holds a waiter count (low 10 bits) and an epoch (upper 22
+// bits). A waiter announces itself by incrementing the waiter count
+// (prepare_wait()), re-checks the condition, and only then goes to sleep
+// (commit_wait()) - but the sleep aborts when the epoch changed since
+// prepare_wait(). A notifier bumps the epoch and wakes sleepers, but only
+// after seeing a non-zero waiter count: when no one is waiting, notify_one()
+// and notify_all() are a fence plus a single relaxed load - no
+// read-modify-write, no system call, and the cacheline stays shared.
+// Consequently either the notifier sees the waiter count and wakes, or the
+// waiter's re-check sees the new state of the condition; sleeping can never
+// miss a notification.
+//
+// Usage - a consumer that blocks while a lock-free queue is empty:
+//
+//   for (;;)
+//   {
+//     if ((node = queue.pop()))
+//       break;
+//     utils::threading::EventCount::Key key = m_nonempty.prepare_wait();
+//     if ((node = queue.pop()))
+//     {
+//       m_nonempty.cancel_wait();
+//       break;
+//     }
+//     m_nonempty.commit_wait(key);
+//   }
+//
+// and the producer, after pushing:
+//
+//   m_nonempty.notify_one();
+//
+// or use the convenience wrapper that encapsulates that loop:
+//
+//   m_nonempty.wait([&]{ return (node = queue.pop()) != nullptr; });
+//
+// Note that, as with a condition variable, the condition itself lives
+// outside the EventCount: it must be read with at least acquire semantics
+// and written before the notify call.
+class EventCount : public Futex<uint32_t>
+{
+ public:
+  using Key = uint32_t;                 // An epoch snapshot, returned by prepare_wait().
+
+ private:
+  static constexpr int epoch_shift = 10;
+  static constexpr uint32_t one_waiter = 1;
+  static constexpr uint32_t one_epoch = uint32_t{1} << epoch_shift;
+  static constexpr uint32_t waiters_mask = one_epoch - 1;
+
+ public:
+  EventCount() : Futex<uint32_t>(0) { }
+
+  // Announce that this thread is about to wait and return the current epoch.
+  // Must be paired with exactly one commit_wait(key) or cancel_wait().
+  // The seq_cst increment orders this announcement before the subsequent
+  // re-check of the condition, pairing with the fence in notify().
+  Key prepare_wait()
+  {
+    uint32_t const prev = m_word.fetch_add(one_waiter, std::memory_order_seq_cst);
+    ASSERT((prev & waiters_mask) != waiters_mask);      // More than 1023 simultaneous waiters?!
+    return prev >> epoch_shift;
+  }
+
+  // The condition turned out to be true after all; undo prepare_wait().
+  void cancel_wait()
+  {
+    m_word.fetch_sub(one_waiter, std::memory_order_relaxed);
+  }
+
+  // Sleep until the epoch advances past key. Returns with the waiter count
+  // decremented again; the caller must re-check its condition (a wake-up
+  // only means that some notify happened after prepare_wait()).
+  void commit_wait(Key key)
+  {
+    uint32_t word = m_word.load(std::memory_order_acquire);
+    while ((word >> epoch_shift) == key)
+    {
+      // Fails with EAGAIN when word changed in the meantime (e.g. another
+      // waiter arrived); then just reload and re-test the epoch.
+      Futex<uint32_t>::wait(word);
+      word = m_word.load(std::memory_order_acquire);
+    }
+    cancel_wait();
+  }
+
+  // Wake one thread that is blocked in commit_wait(), if any.
+  void notify_one()
+  {
+    notify(1);
+  }
+
+  // Wake all threads that are blocked in commit_wait(), if any.
+  void notify_all()
+  {
+    notify(std::numeric_limits<uint32_t>::max());
+  }
+
+  // The encapsulated prepare/re-check/commit loop: returns once condition()
+  // returned true; condition must be safe to call from this thread at any
+  // moment and is polled once per wake-up, not busily.
+  template<typename Condition>
+  void wait(Condition condition)
+  {
+    while (!condition())
+    {
+      Key const key = prepare_wait();
+      if (condition())
+      {
+        cancel_wait();
+        break;
+      }
+      commit_wait(key);
+    }
+  }
+
+ private:
+  void notify(uint32_t n_threads)
+  {
+    // The fence orders the caller's preceding writes (that made the
+    // condition true) before the waiter count load, pairing with the
+    // seq_cst increment in prepare_wait(): either we see their waiter
+    // count, or their condition re-check sees our writes.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (AI_LIKELY((m_word.load(std::memory_order_relaxed) & waiters_mask) == 0))
+      return;                                   // Nobody is waiting.
+    m_word.fetch_add(one_epoch, std::memory_order_acq_rel);
+    Futex<uint32_t>::wake(n_threads);
+  }
+};
+
+} // namespace utils::threading
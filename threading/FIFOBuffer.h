@@ -40,6 +40,12 @@
 
 #pragma once
 
+#include "utils/config.h"
+#include "debug.h"
+#include <atomic>
+#include <cstring>
+#include <type_traits>
+
 namespace utils::threading {
 
 // Lock-free ring buffer for trivially copyable objects, to be written and
@@ -105,8 +111,11 @@ class FIFOBuffer
     T* m_buffer;           // Buffer start.
     typename std::aligned_storage<sizeof(T), alignof(T)>::type* m_storage;
   };
-  std::atomic<T*> m_head;  // Write position in circular buffer.
-  T* m_readptr;            // Non-destructive read position in circular buffer.
+  // The producer-owned write position lives on its own cache line, and the two
+  // consumer-owned positions together on another, so that the store of one side
+  // doesn't invalidate the index that the other side spins on.
+  alignas(config::cacheline_size_c) std::atomic<T*> m_head;  // Write position in circular buffer.
+  alignas(config::cacheline_size_c) T* m_readptr;            // Non-destructive read position in circular buffer.
   std::atomic<T*> m_tail;  // Read position in circular buffer.
 
  private:
@@ -164,6 +173,40 @@ class FIFOBuffer
     return false;  // Full queue.
   }
 
+  // Copy up to nchunks chunks from `in' to the buffer with a single store to m_head,
+  // amortizing the release-store/acquire-load pair over the whole batch.
+  // Returns the number of chunks that was copied: less than nchunks when the buffer
+  // had no room for more, possibly 0.
+  int push_n(T const* in, int nchunks)
+  {
+    T* const current_head = m_head.load(std::memory_order_relaxed);
+    intptr_t distance = m_tail.load(std::memory_order_acquire) - current_head;
+    if (distance <= 0)
+      distance += m_capacity;
+    // As with push(), one chunk always stays unused so that m_head never becomes equal to m_tail.
+    intptr_t count = distance / objects_per_chunk - 1;
+    if (count > nchunks)
+      count = nchunks;
+    if (count <= 0)
+      return 0;  // Full queue.
+
+    intptr_t const objects  = count * objects_per_chunk;
+    intptr_t const till_end = m_buffer + m_capacity - current_head;
+    if (objects <= till_end)
+      std::memcpy(current_head, in, objects * sizeof(T));
+    else
+    {
+      // The batch wraps around the end of the buffer.
+      std::memcpy(current_head, in, till_end * sizeof(T));
+      std::memcpy(m_buffer, in + till_end, (objects - till_end) * sizeof(T));
+    }
+    T* next_head = current_head + objects;
+    if (next_head >= m_buffer + m_capacity)
+      next_head -= m_capacity;
+    m_head.store(next_head, std::memory_order_release);
+    return count;
+  }
+
   //-------------------------------------------------------------------------
   // Consumer thread.
 
@@ -179,6 +222,47 @@ class FIFOBuffer
     return current_tail;
   }
 
+  // Copy up to nchunks chunks to `out' and advance m_tail with a single store,
+  // amortizing the release-store/acquire-load pair over the whole batch.
+  // Unlike pop(), the chunks are copied out (the batch may wrap around the end
+  // of the buffer and its space is handed back to the producer immediately).
+  // Returns the number of chunks that was copied: less than nchunks when the
+  // buffer had no more data, possibly 0.
+  int pop_n(T* out, int nchunks)
+  {
+    T* const current_tail = m_tail.load(std::memory_order_relaxed);
+    intptr_t available = m_head.load(std::memory_order_acquire) - current_tail;
+    if (available < 0)
+      available += m_capacity;
+    intptr_t count = available / objects_per_chunk;
+    if (count > nchunks)
+      count = nchunks;
+    if (count == 0)
+      return 0;  // Empty queue.
+
+    intptr_t const objects  = count * objects_per_chunk;
+    intptr_t const till_end = m_buffer + m_capacity - current_tail;
+    if (objects <= till_end)
+      std::memcpy(out, current_tail, objects * sizeof(T));
+    else
+    {
+      // The batch wraps around the end of the buffer.
+      std::memcpy(out, current_tail, till_end * sizeof(T));
+      std::memcpy(out + till_end, m_buffer, (objects - till_end) * sizeof(T));
+    }
+    T* next_tail = current_tail + objects;
+    if (next_tail >= m_buffer + m_capacity)
+      next_tail -= m_capacity;
+    // If m_readptr points into the popped region then it has to move along with m_tail.
+    intptr_t readptr_offset = m_readptr - current_tail;
+    if (readptr_offset < 0)
+      readptr_offset += m_capacity;
+    if (readptr_offset < objects)
+      m_readptr = next_tail;
+    m_tail.store(next_tail, std::memory_order_release);
+    return count;
+  }
+
   // Return m_readptr and advance it. Returns nullptr if the read pointer is at the end of the buffer.
   T* read()
   {
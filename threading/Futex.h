@@ -31,6 +31,8 @@
 #include <cstdint>
 #include <cstddef>
 #include <atomic>
+#include <cerrno>
+#include <ctime>
 #include <unistd.h>
 #include <sys/syscall.h>
 #include <linux/futex.h>
@@ -61,6 +63,11 @@ class Futex
     return syscall(SYS_futex, futex_word_ptr(), futex_op, val, nullptr, nullptr, val3);
   }
 
+  int futex(int futex_op, uint32_t val, struct timespec const* timeout, uint32_t val3)
+  {
+    return syscall(SYS_futex, futex_word_ptr(), futex_op, val, timeout, nullptr, val3);
+  }
+
   int futex(int futex_op, uint32_t val, uint32_t val2, Futex& futex2, uint32_t val3)
   {
     return syscall(SYS_futex, reinterpret_cast<int*>(&m_word), futex_op, val,
@@ -106,6 +113,39 @@ class Futex
     return futex(FUTEX_WAIT_PRIVATE, expected, 0);
   }
 
+  int wait_until(uint32_t expected, struct timespec const& abs_time) noexcept
+  {
+    // Same as wait() but with a deadline: the thread sleeps until it is
+    // woken up by a FUTEX_WAKE (or FUTEX_WAKE_BITSET with any mask), or
+    // until abs_time - an absolute time measured against CLOCK_MONOTONIC -
+    // passed.
+    //
+    // This uses FUTEX_WAIT_BITSET (with a mask of FUTEX_BITSET_MATCH_ANY)
+    // rather than FUTEX_WAIT, because the timeout of FUTEX_WAIT is relative,
+    // which would make a wait loop around it drift on every spurious wake-up.
+    //
+    // Returns 0 if the caller was woken up (see wait() for how to interpret
+    // this correctly in practice), or -1 with errno set to ETIMEDOUT when
+    // the deadline passed, EAGAIN when the futex word did not contain
+    // expected, or EINTR when interrupted by a signal.
+    return futex(FUTEX_WAIT_BITSET_PRIVATE, expected, &abs_time, FUTEX_BITSET_MATCH_ANY);
+  }
+
+  int wait_for(uint32_t expected, struct timespec const& rel_time) noexcept
+  {
+    // Same as wait_until() but with a timeout relative to now.
+    struct timespec abs_time;
+    clock_gettime(CLOCK_MONOTONIC, &abs_time);
+    abs_time.tv_sec += rel_time.tv_sec;
+    abs_time.tv_nsec += rel_time.tv_nsec;
+    if (abs_time.tv_nsec >= 1000000000L)
+    {
+      ++abs_time.tv_sec;
+      abs_time.tv_nsec -= 1000000000L;
+    }
+    return wait_until(expected, abs_time);
+  }
+
   uint32_t wake(uint32_t n_threads) noexcept
   {
     // This operation wakes at most n_threads of the waiters that are
@@ -218,6 +258,53 @@ class Futex
     // Returns the number of waiters that were woken up.
     return futex(FUTEX_WAKE_BITSET, n_threads, bit_mask);
   }
+
+  // One entry of wait_any: a futex and the value that its word must (still)
+  // contain in order to sleep on it.
+  struct WaitAny
+  {
+    Futex* m_futex;
+    uint32_t m_expected;
+  };
+
+  static int wait_any(WaitAny const* waiters, int n_waiters, struct timespec const* abs_time = nullptr) noexcept
+  {
+    // This operation sleeps on all of the n_waiters (at most 128) futex words
+    // at once, using a single futex_waitv(2) system call (Linux 5.16), and is
+    // woken up by a FUTEX_WAKE on any of them. For example, a consumer can
+    // sleep on "queue non-empty OR shutdown flag" without polling.
+    //
+    // For every entry the same atomic test as for FUTEX_WAIT is performed:
+    // if any futex word does not contain its expected value, the call fails
+    // immediately with the value -1 and errno set to EAGAIN.
+    //
+    // abs_time, when non-null, is an absolute deadline against CLOCK_MONOTONIC,
+    // as with wait_until().
+    //
+    // Returns the index (>= 0) of a woken futex (see wait() for why that can
+    // be spurious; re-test the words to decide whether to continue to block),
+    // or -1 with errno set to ETIMEDOUT when the deadline passed, EINTR when
+    // interrupted by a signal, or ENOSYS on kernels or headers without
+    // futex_waitv support; callers must provide a (polling) fallback for the
+    // latter.
+#if defined(SYS_futex_waitv) && defined(FUTEX_32)
+    struct futex_waitv wv[128];
+    for (int i = 0; i < n_waiters; ++i)
+    {
+      wv[i].val = waiters[i].m_expected;
+      wv[i].uaddr = reinterpret_cast<uintptr_t>(waiters[i].m_futex->futex_word_ptr());
+      wv[i].flags = FUTEX_32;           // futex_waitv only supports process-private futexes.
+      wv[i].__reserved = 0;
+    }
+    return syscall(SYS_futex_waitv, wv, n_waiters, 0, abs_time, CLOCK_MONOTONIC);
+#else
+    (void)waiters;
+    (void)n_waiters;
+    (void)abs_time;
+    errno = ENOSYS;
+    return -1;
+#endif
+  }
 };
 
 } // namespace utils::threading
@@ -0,0 +1,89 @@
+/**
+ * ai-utils -- C++ Core utilities
+ *
+ * @file
+ * @brief Declaration of class FutexGate.
+ *
+ * @Copyright (C) 2021  Carlo Wood.
+ *
+ * RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+ * Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+ *
+ * This file is part of ai-utils.
+ *
+ * ai-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ai-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with ai-utils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "Futex.h"
+#include <limits>
+
+namespace utils::threading {
+
+// Block (multiple) thread(s) until open() is called.
+//
+// A sibling of Gate with the same semantics - if open() was already called
+// before wait() then wait() also doesn't block anymore - but built on a
+// single futex word instead of a mutex plus condition variable: a closed
+// waiter goes straight into FUTEX_WAIT and open() is one store plus one
+// wake-all, so releasing a pool of workers doesn't serialize them through
+// a mutex handover (the condition variable thundering-herd).
+//
+// Unlike Gate, a deadline wait is supported. A FutexGate cannot be closed
+// again once opened.
+//
+class FutexGate : public Futex<uint32_t>
+{
+ private:
+  static constexpr uint32_t closed = 0;
+  static constexpr uint32_t open_state = 1;
+
+ public:
+  FutexGate() : Futex<uint32_t>(closed) { }
+
+  bool is_open() const { return m_word.load(std::memory_order_acquire) == open_state; }
+
+  void wait() noexcept
+  {
+    while (m_word.load(std::memory_order_acquire) == closed)
+    {
+      // Sleeps only when m_word still equals closed; a concurrent open()
+      // makes this return immediately (with EAGAIN). A return of 0 can be
+      // a spurious wake-up, hence the loop.
+      Futex<uint32_t>::wait(closed);
+    }
+  }
+
+  // Wait until the gate is open or until abs_time - an absolute time measured
+  // against CLOCK_MONOTONIC - passed. Returns true when the gate is open.
+  bool wait_until(struct timespec const& abs_time) noexcept
+  {
+    while (m_word.load(std::memory_order_acquire) == closed)
+    {
+      if (Futex<uint32_t>::wait_until(closed, abs_time) == -1 && errno == ETIMEDOUT)
+        return is_open();
+    }
+    return true;
+  }
+
+  void open() noexcept
+  {
+    // Release: everything written before open() is visible to the released waiters.
+    if (m_word.exchange(open_state, std::memory_order_release) == closed)
+      Futex<uint32_t>::wake(std::numeric_limits<uint32_t>::max());
+  }
+};
+
+} // namespace utils::threading
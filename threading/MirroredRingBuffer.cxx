@@ -0,0 +1,78 @@
+/**
+ * ai-utils -- C++ Core utilities
+ *
+ * @file
+ * @brief Definition of class MirroredRingBuffer.
+ *
+ * @Copyright (C) 2021  Carlo Wood.
+ *
+ * RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+ * Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+ *
+ * This file is part of ai-utils.
+ *
+ * ai-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ai-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with ai-utils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sys.h"
+#include "MirroredRingBuffer.h"
+#include "utils/MemoryPagePool.h"
+#include "utils/nearest_power_of_two.h"
+#include "debug.h"
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 1U          // From <linux/memfd.h>, for pre-4.17 kernel headers.
+#endif
+
+namespace utils::threading {
+
+MirroredRingBuffer::MirroredRingBuffer(size_t min_capacity) : m_head(0), m_tail(0)
+{
+  DoutEntering(dc::notice, "MirroredRingBuffer::MirroredRingBuffer(" << min_capacity << ") [" << this << "]");
+  // The mirror trick works at page granularity, and masking requires a power of two;
+  // a power of two that is at least the page size is automatically a whole number of pages.
+  size_t const page_size = details::MemoryPageSize::memory_page_size();
+  m_capacity = utils::nearest_power_of_two(min_capacity < page_size ? page_size : min_capacity);
+
+  // Create an anonymous in-memory file of m_capacity bytes to back both mappings.
+  // Call the syscall directly to support pre-2.27 glibc.
+  int fd = syscall(SYS_memfd_create, "MirroredRingBuffer", MFD_CLOEXEC);
+  // This is a kernel >= 3.17 feature.
+  ASSERT(fd != -1);
+  DEBUG_ONLY(int res =) ftruncate(fd, m_capacity);
+  ASSERT(res == 0);
+
+  // Reserve 2 * m_capacity bytes of contiguous virtual memory, then map the
+  // file twice, back-to-back, over that reservation.
+  m_buffer = static_cast<char*>(mmap(nullptr, 2 * m_capacity, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+  ASSERT(m_buffer != MAP_FAILED);
+  DEBUG_ONLY(void* lo =) mmap(m_buffer, m_capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+  ASSERT(lo == m_buffer);
+  DEBUG_ONLY(void* hi =) mmap(m_buffer + m_capacity, m_capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+  ASSERT(hi == m_buffer + m_capacity);
+  // The mappings keep the file alive.
+  close(fd);
+  Dout(dc::notice, "Mapped " << m_capacity << " bytes twice at " << (void*)m_buffer << '.');
+}
+
+MirroredRingBuffer::~MirroredRingBuffer()
+{
+  DoutEntering(dc::notice, "MirroredRingBuffer::~MirroredRingBuffer() [" << this << "]");
+  munmap(m_buffer, 2 * m_capacity);
+}
+
+} // namespace utils::threading
@@ -0,0 +1,166 @@
+/**
+ * ai-utils -- C++ Core utilities
+ *
+ * @file
+ * @brief Declaration of class MirroredRingBuffer.
+ *
+ * @Copyright (C) 2021  Carlo Wood.
+ *
+ * RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+ * Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+ *
+ * This file is part of ai-utils.
+ *
+ * ai-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ai-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with ai-utils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "utils/config.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace utils::threading {
+
+// class MirroredRingBuffer
+//
+// A lock-free SPSC byte ring for variable-length records, backed by memory
+// pages that are mapped twice back-to-back (a "magic" ring buffer): the
+// second mapping mirrors the first, so a record that crosses the wrap point
+// of the ring is still contiguous in virtual memory. Hence reads and writes
+// are always a single memcpy - or no copy at all when using the raw
+// interface below - and records never have to be split or padded to chunk
+// granularity (compare FIFOBuffer).
+//
+// The capacity is rounded up to a power of two of at least one memory page
+// (the mirror trick works at page granularity).
+//
+// One producer thread and one consumer thread; the producer owns m_head,
+// the consumer owns m_tail (on separate cache lines).
+//
+// Convenience interface:
+//
+//   if (buf.push(&frame, frame_size)) ...     // One memcpy.
+//   size_t len = buf.pop(out, sizeof(out));   // One memcpy.
+//
+// Raw (zero-copy) interface of the producer:
+//
+//   char* ptr = buf.prepare(len);     // Contiguous, even across the wrap.
+//   if (ptr) { ... write len bytes at ptr ...; buf.commit(len); }
+//
+// and of the consumer:
+//
+//   size_t len = buf.data_size();     // Contiguously readable at read_ptr().
+//   ... read len bytes at buf.read_ptr() ...; buf.consume(len);
+//
+class MirroredRingBuffer
+{
+ private:
+  char* m_buffer;                       // The start of the first mapping (2 * m_capacity bytes of virtual memory).
+  size_t m_capacity;                    // The real size of the ring, in bytes; a power of two >= the memory page size.
+
+  // Monotonically increasing byte counts; the ring offset is (count & (m_capacity - 1)).
+  // The producer-owned write count and the consumer-owned read count live on
+  // their own cache lines, see FIFOBuffer.
+  alignas(config::cacheline_size_c) std::atomic<uint64_t> m_head;       // The number of bytes ever committed.
+  alignas(config::cacheline_size_c) std::atomic<uint64_t> m_tail;       // The number of bytes ever consumed.
+
+ public:
+  // Construct a ring of at least min_capacity bytes.
+  MirroredRingBuffer(size_t min_capacity);
+  ~MirroredRingBuffer();
+
+  // Not copyable.
+  MirroredRingBuffer(MirroredRingBuffer const&) = delete;
+  MirroredRingBuffer& operator=(MirroredRingBuffer const&) = delete;
+
+  size_t capacity() const { return m_capacity; }
+
+  //-------------------------------------------------------------------------
+  // Producer thread.
+
+  // The number of bytes that can be written right now (or recently; it only grows under our feet).
+  size_t free_space() const
+  {
+    return m_capacity - (m_head.load(std::memory_order_relaxed) - m_tail.load(std::memory_order_acquire));
+  }
+
+  // Return a pointer to len contiguous writable bytes, or nullptr when the
+  // ring has less than len bytes of room. Must be followed by commit(n) with
+  // n <= len to publish the first n written bytes.
+  char* prepare(size_t len)
+  {
+    if (len > free_space())
+      return nullptr;
+    return m_buffer + (m_head.load(std::memory_order_relaxed) & (m_capacity - 1));
+  }
+
+  // Publish the next len bytes (previously written through prepare()).
+  void commit(size_t len)
+  {
+    uint64_t const head = m_head.load(std::memory_order_relaxed);
+    m_head.store(head + len, std::memory_order_release);
+  }
+
+  // Copy a record of len bytes into the ring. Returns false when the ring is full.
+  bool push(void const* record, size_t len)
+  {
+    char* ptr = prepare(len);
+    if (!ptr)
+      return false;
+    std::memcpy(ptr, record, len);
+    commit(len);
+    return true;
+  }
+
+  //-------------------------------------------------------------------------
+  // Consumer thread.
+
+  // The number of bytes that can be read right now, all of them contiguous at read_ptr().
+  size_t data_size() const
+  {
+    return m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_relaxed);
+  }
+
+  // Return a pointer to the oldest unconsumed byte; valid for data_size() contiguous bytes.
+  char const* read_ptr() const
+  {
+    return m_buffer + (m_tail.load(std::memory_order_relaxed) & (m_capacity - 1));
+  }
+
+  // Hand the first len read bytes back to the producer.
+  void consume(size_t len)
+  {
+    uint64_t const tail = m_tail.load(std::memory_order_relaxed);
+    m_tail.store(tail + len, std::memory_order_release);
+  }
+
+  // Copy up to max_len readable bytes to out and consume them. Returns the number of bytes copied.
+  size_t pop(void* out, size_t max_len)
+  {
+    size_t len = data_size();
+    if (len > max_len)
+      len = max_len;
+    if (len > 0)
+    {
+      std::memcpy(out, read_ptr(), len);
+      consume(len);
+    }
+    return len;
+  }
+};
+
+} // namespace utils::threading
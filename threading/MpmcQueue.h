@@ -0,0 +1,182 @@
+#pragma once
+
+// Translated from http://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+// into modern C++ by Carlo Wood (c) 2021.
+//
+// For this reason this file has the following license.
+//
+// Copyright (c) 2010-2011 Dmitry Vyukov. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+//
+//   1. Redistributions of source code must retain the above copyright notice, this list of
+//      conditions and the following disclaimer.
+//
+//   2. Redistributions in binary form must reproduce the above copyright notice, this list
+//      of conditions and the following disclaimer in the documentation and/or other materials
+//      provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY DMITRY VYUKOV "AS IS" AND ANY EXPRESS OR IMPLIED
+// WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+// SHALL DMITRY VYUKOV OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// The views and conclusions contained in the software and documentation are those of
+// the authors and should not be interpreted as representing official policies,
+// either expressed or implied, of Dmitry Vyukov.
+//
+//
+// All comments and memory orders used are Copyright (c) 2021 Carlo Wood,
+// and also released under the same license.
+
+#include "utils/nearest_power_of_two.h"
+#include "utils/config.h"
+#include "debug.h"
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+namespace utils::threading {
+
+// MpmcQueue<T>
+//
+// A bounded multi-producer multi-consumer queue: an array of capacity cells,
+// where every cell carries a sequence number next to its value.
+//
+// The sequence number of a cell encodes, relative to the monotonically increasing
+// enqueue and dequeue positions, whether the cell is empty or full and in which
+// "lap" around the ring it is:
+//
+//   m_sequence == pos                  the cell is empty and pos is the next enqueue position: a producer may claim it.
+//   m_sequence == pos + 1              the cell is full and pos is the next dequeue position: a consumer may claim it.
+//   anything lower                     the cell is still being worked on by the previous lap: the queue is full (seen
+//                                      by a producer) respectively empty (seen by a consumer).
+//
+// A producer (consumer) claims a cell by a CAS on the shared enqueue (dequeue)
+// position, then writes (reads) the value non-atomically - it owns the cell -
+// and finally publishes the cell by storing its new sequence number. Hence
+// each push and pop is one CAS plus one store on the hot path, and producers
+// and consumers only contend on their own position counter, which live on
+// different cache lines (as does the cell array itself).
+//
+// T must be nothrow move assignable (a raw pointer, typically): a throwing
+// assignment would abandon a claimed cell and deadlock the lap.
+//
+// Usage:
+//
+//   utils::threading::MpmcQueue<Task*> queue(1024);
+//
+//   if (!queue.try_push(task)) { ... the queue is full ... }
+//
+//   Task* task;
+//   if (queue.try_pop(task)) { ... process task ... }
+//
+class MpmcQueueBase
+{
+ protected:
+  // The positions only increment; they are mapped onto a cell by masking with m_mask.
+  alignas(config::cacheline_size_c) std::atomic<size_t> m_enqueue_pos;  // The next position to push to.
+  alignas(config::cacheline_size_c) std::atomic<size_t> m_dequeue_pos;  // The next position to pop from.
+
+  MpmcQueueBase() : m_enqueue_pos(0), m_dequeue_pos(0) { }
+};
+
+template<typename T>
+class MpmcQueue : public MpmcQueueBase
+{
+  static_assert(std::is_nothrow_move_assignable_v<T>, "MpmcQueue<T>: T must be nothrow move assignable.");
+
+ private:
+  struct Cell
+  {
+    std::atomic<size_t> m_sequence;     // See above.
+    T m_data;
+  };
+
+  size_t const m_mask;                  // m_capacity - 1; the capacity is a power of two.
+  std::unique_ptr<Cell[]> m_buffer;     // The m_mask + 1 cells of the ring.
+
+ public:
+  // Construct a queue with a capacity of min_capacity, rounded up to a power of two.
+  MpmcQueue(size_t min_capacity) :
+    m_mask(nearest_power_of_two(min_capacity) - 1), m_buffer(std::make_unique<Cell[]>(m_mask + 1))
+  {
+    // A capacity of at least two is required, because a cell may not be
+    // reused before its previous lap completed.
+    ASSERT(m_mask >= 1);
+    for (size_t i = 0; i <= m_mask; ++i)
+      m_buffer[i].m_sequence.store(i, std::memory_order_relaxed);
+  }
+
+  // Not copyable.
+  MpmcQueue(MpmcQueue const&) = delete;
+  MpmcQueue& operator=(MpmcQueue const&) = delete;
+
+  size_t capacity() const { return m_mask + 1; }
+
+  // Append data to the queue. Returns false when the queue is full.
+  bool try_push(T data)
+  {
+    Cell* cell;
+    size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+    for (;;)
+    {
+      cell = &m_buffer[pos & m_mask];
+      // Acquire: a consumer published this sequence number after reading out m_data.
+      size_t const seq = cell->m_sequence.load(std::memory_order_acquire);
+      intptr_t const diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+      if (diff == 0)
+      {
+        // The cell is empty and ours to claim. On failure pos was reloaded; just retry.
+        if (m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+          break;
+      }
+      else if (diff < 0)
+        return false;                   // The cell still holds the value of the previous lap: the queue is full.
+      else
+        pos = m_enqueue_pos.load(std::memory_order_relaxed);    // Another producer claimed this position; move on.
+    }
+    cell->m_data = std::move(data);
+    // Release: publish m_data to the consumer that will claim this cell.
+    cell->m_sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Pop the oldest value from the queue into data. Returns false when the queue is empty.
+  bool try_pop(T& data)
+  {
+    Cell* cell;
+    size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+    for (;;)
+    {
+      cell = &m_buffer[pos & m_mask];
+      // Acquire: the producer published this sequence number after writing m_data.
+      size_t const seq = cell->m_sequence.load(std::memory_order_acquire);
+      intptr_t const diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+      if (diff == 0)
+      {
+        // The cell is full and ours to claim. On failure pos was reloaded; just retry.
+        if (m_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+          break;
+      }
+      else if (diff < 0)
+        return false;                   // The producer of this lap didn't publish yet: the queue is empty.
+      else
+        pos = m_dequeue_pos.load(std::memory_order_relaxed);    // Another consumer claimed this position; move on.
+    }
+    data = std::move(cell->m_data);
+    // Release: hand the cell to the producer of the next lap.
+    cell->m_sequence.store(pos + m_mask + 1, std::memory_order_release);
+    return true;
+  }
+};
+
+} // namespace utils::threading
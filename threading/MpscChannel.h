@@ -0,0 +1,92 @@
+/**
+ * ai-utils -- C++ Core utilities
+ *
+ * @file
+ * @brief Declaration of class MpscChannel.
+ *
+ * @Copyright (C) 2021  Carlo Wood.
+ *
+ * RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+ * Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+ *
+ * This file is part of ai-utils.
+ *
+ * ai-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ai-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with ai-utils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "MpscQueue.h"
+#include "SpinSemaphore.h"
+#include "utils/cpu_relax.h"
+#include "utils/macros.h"
+
+namespace utils::threading {
+
+// class MpscChannel
+//
+// An MpscQueue paired with a SpinSemaphore, so that the single consumer can
+// block when the queue is empty instead of busy-polling pop().
+//
+// Every push() posts one token; pop() first obtains a token - spinning the
+// calibrated delay loop of SpinSemaphore and then blocking in the futex -
+// which guarantees that a node was pushed. Hence handoff is low-latency
+// while the producers keep up, and costs zero CPU while the channel is idle.
+//
+// As with MpscQueue, any number of threads may call push() concurrently,
+// but only one thread at a time may call pop() / try_pop().
+//
+class MpscChannel
+{
+ private:
+  MpscQueue m_queue;
+  SpinSemaphore m_tokens;       // Counts the number of nodes in m_queue.
+
+ public:
+  void push(MpscNode* node)
+  {
+    m_queue.push(node);
+    m_tokens.post();
+  }
+
+  // Block until a node is available and return it. Never returns nullptr.
+  MpscNode* pop() noexcept
+  {
+    m_tokens.wait();
+    return pop_token();
+  }
+
+  // Return a node when one is available without blocking, otherwise nullptr.
+  MpscNode* try_pop() noexcept
+  {
+    if (!m_tokens.try_wait())
+      return nullptr;
+    return pop_token();
+  }
+
+ private:
+  // Called after obtaining a token: a matching push() already did its exchange on
+  // m_head, but might not have linked its node yet (the transient state described
+  // in MpscQueue.h), in which case MpscQueue::pop() transiently returns nullptr.
+  // That window is a few instructions in the producer; just spin it out.
+  MpscNode* pop_token() noexcept
+  {
+    MpscNode* node;
+    while (AI_UNLIKELY(!(node = m_queue.pop())))
+      cpu_relax();
+    return node;
+  }
+};
+
+} // namespace utils::threading
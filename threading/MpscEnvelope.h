@@ -0,0 +1,143 @@
+/**
+ * ai-utils -- C++ Core utilities
+ *
+ * @file
+ * @brief Definition of MpscEnvelope and MpscMessageQueue.
+ *
+ * @Copyright (C) 2021  Carlo Wood.
+ *
+ * RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+ * Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+ *
+ * This file is part of ai-utils.
+ *
+ * ai-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ai-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with ai-utils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "MpscQueue.h"
+#include "utils/NodeMemoryResource.h"
+#include "utils/macros.h"
+#include "debug.h"
+#include <new>
+#include <utility>
+
+namespace utils::threading {
+
+// MpscEnvelope<T>
+//
+// A fixed-size message envelope for MpscQueue: the intrusive MpscNode header
+// followed by the payload in place. Envelopes are constructed in storage
+// drawn from a NodeMemoryResource and returned to it with destroy(), so
+// pushing messages never touches malloc - the free list of the resource
+// (SimpleSegregatedStorage) is lock-free, allowing the producers to create()
+// and the consumer to destroy() concurrently.
+//
+template<typename T>
+struct MpscEnvelope : public MpscNode
+{
+  T m_message;
+
+  template<typename... Args>
+  MpscEnvelope(Args&&... args) : m_message(std::forward<Args>(args)...) { }
+
+  T& message() { return m_message; }
+  T const& message() const { return m_message; }
+
+  // Construct an envelope in storage allocated from nmr.
+  // Returns nullptr when the resource is out of memory.
+  template<typename... Args>
+  static MpscEnvelope* create(NodeMemoryResource& nmr, Args&&... args)
+  {
+    void* ptr = nmr.allocate(sizeof(MpscEnvelope));
+    if (AI_UNLIKELY(!ptr))
+      return nullptr;
+    return new (ptr) MpscEnvelope(std::forward<Args>(args)...);
+  }
+
+  // Destruct this envelope and return its storage to nmr.
+  void destroy(NodeMemoryResource& nmr)
+  {
+    this->~MpscEnvelope();
+    nmr.deallocate(this);
+  }
+};
+
+// MpscMessageQueue<T>
+//
+// An MpscQueue of MpscEnvelope<T> integrated with its own NodeMemoryResource:
+// push() constructs the message in an envelope from the resource and pop()
+// recycles the envelope after moving the message out. The resource uses
+// cacheline_alignment so that no two envelopes false-share a cache line.
+//
+// Usage:
+//
+//   utils::MemoryPagePool mpp(0x8000);
+//   utils::threading::MpscMessageQueue<Message> queue(mpp);
+//   ...
+//   queue.push(arg1, arg2);              // Any number of producer threads.
+//   ...
+//   Message message;                     // A single consumer thread:
+//   while (queue.pop(message))
+//     process(message);
+//
+// As with MpscQueue, pop() can transiently fail while a push() is in
+// progress; an empty return therefore means "nothing popped", not "nothing
+// pushed". Combine with SpinSemaphore or EventCount (as MpscChannel does)
+// when the consumer must block.
+//
+template<typename T>
+class MpscMessageQueue
+{
+ public:
+  using envelope_type = MpscEnvelope<T>;
+
+ private:
+  NodeMemoryResource m_envelope_pool;   // The storage that the envelopes are drawn from and recycled to.
+  MpscQueue m_queue;
+
+ public:
+  MpscMessageQueue(MemoryPagePool& mpp) :
+    m_envelope_pool(mpp, sizeof(envelope_type), NodeMemoryResource::cacheline_alignment) { }
+
+  // Construct a T from args in a fresh envelope and push it.
+  // Returns false when the underlying MemoryPagePool is out of memory.
+  template<typename... Args>
+  bool push(Args&&... args)
+  {
+    envelope_type* envelope = envelope_type::create(m_envelope_pool, std::forward<Args>(args)...);
+    if (AI_UNLIKELY(!envelope))
+      return false;
+    m_queue.push(envelope);
+    return true;
+  }
+
+  // Pop one message into message and recycle its envelope.
+  // Returns false when nothing could be popped (see above).
+  bool pop(T& message)
+  {
+    envelope_type* envelope = static_cast<envelope_type*>(m_queue.pop());
+    if (!envelope)
+      return false;
+    message = std::move(envelope->m_message);
+    envelope->destroy(m_envelope_pool);
+    return true;
+  }
+
+  // A lock-free snapshot of the usage counters of the envelope pool.
+  MemoryPoolStats::Snapshot stats() const { return m_envelope_pool.stats(); }
+};
+
+} // namespace utils::threading
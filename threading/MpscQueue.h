@@ -35,6 +35,8 @@
 // All comments and memory orders used are Copyright (c) 2021 Carlo Wood,
 // and also released under the same license.
 
+#include "utils/cpu_relax.h"
+#include "utils/macros.h"
 #include <atomic>
 
 namespace utils::threading {
@@ -189,6 +191,65 @@ struct MpscNode
 //
 class MpscQueue
 {
+ public:
+  // A privately owned chain of nodes, detached from the queue by pop_all().
+  class Chain
+  {
+   private:
+    MpscNode* m_next;   // The next node that pop() will return, or nullptr when the chain is exhausted.
+    MpscNode* m_last;   // The last (most recently pushed) node of the chain.
+
+   public:
+    Chain() : m_next(nullptr), m_last(nullptr) { }
+
+    bool empty() const { return m_next == nullptr; }
+
+    // Return the oldest node that wasn't returned yet, or nullptr when the chain is exhausted.
+    // The chain is privately owned, so there is no RMW operation here; the only synchronization
+    // left is one acquire load per node, spinning in the rare case that the push of the successor
+    // hadn't completed yet at the time of the detach (see pop_all()).
+    MpscNode* pop()
+    {
+      MpscNode* node = m_next;
+      if (!node)
+        return nullptr;
+      if (node == m_last)
+        m_next = nullptr;
+      else
+      {
+        MpscNode* next;
+        while (!(next = node->m_next.load(std::memory_order_acquire)))
+          cpu_relax();
+        m_next = next;
+      }
+      return node;
+    }
+
+   private:
+    friend class MpscQueue;
+
+    // Append a single, already popped (hence fully linked) node.
+    void append(MpscNode* node)
+    {
+      node->m_next.store(nullptr, std::memory_order_relaxed);
+      if (!m_last)
+        m_next = node;
+      else
+        m_last->m_next.store(node, std::memory_order_relaxed);
+      m_last = node;
+    }
+
+    // Append the detached segment [first, last].
+    void append_detached(MpscNode* first, MpscNode* last)
+    {
+      if (!m_last)
+        m_next = first;
+      else
+        m_last->m_next.store(first, std::memory_order_relaxed);
+      m_last = last;
+    }
+  };
+
  protected:
   std::atomic<MpscNode*> m_head;
   std::atomic<MpscNode*> m_tail;
@@ -200,7 +261,11 @@ class MpscQueue
   void push(MpscNode* node)
   {
     node->m_next.store(nullptr, std::memory_order_relaxed);
-    MpscNode* prev = m_head.exchange(node, std::memory_order_relaxed);
+    // The acquire is for pop_all(): when prev is the stub that a concurrent pop_all() just
+    // installed with its release-exchange, the store to prev->m_next below must be ordered
+    // after pop_all()'s reset of the stub's m_next (it reads the value that the release-
+    // exchange wrote, and thus synchronizes with it). See pop_all() for the details.
+    MpscNode* prev = m_head.exchange(node, std::memory_order_acquire);
     // Here m_head points to the new node, which either points to null
     // or already points to the NEXT node that was pushed AND completed, etc.
     // Now fix the next pointer of the node that m_head was pointing at.
@@ -268,6 +333,52 @@ class MpscQueue
     }
     return nullptr;
   }
+
+  // Detach every node that was pushed so far with a single RMW operation and return
+  // them as a privately owned Chain: iterating the chain costs one acquire load per
+  // node and no further RMW's at all, which is much cheaper than calling pop() per
+  // node when draining bursts.
+  //
+  // The trick is that this drain leaves m_stub behind as the (sole) node of the then
+  // empty queue: m_stub's m_next is reset to nullptr and the exchange of m_head makes
+  // m_stub the new head, so pushes that lose the race against the exchange simply
+  // start the next batch. The reset of m_next must not race with the producer of the
+  // first node of that next batch, which is why that store is sequenced before the
+  // release-exchange here while push() reads m_head with acquire.
+  //
+  // This is only possible when m_stub is at the front of the queue (m_tail points at
+  // it), which it always is when the consumer drains exclusively with pop_all(). When
+  // earlier pop() calls left the stub elsewhere, the nodes in front of it are popped
+  // one by one (at pop() cost, as before) until the stub surfaces, after which the
+  // rest is detached in one go.
+  //
+  // Like pop(), this must only be called by the (single) consumer, and like pop() it
+  // can return an empty chain while nodes are present, namely when the oldest pending
+  // push did not complete yet; simply call it again later.
+  Chain pop_all()
+  {
+    Chain chain;
+    while (AI_UNLIKELY(m_tail.load(std::memory_order_relaxed) != &m_stub))
+    {
+      MpscNode* node = pop();
+      if (!node)
+        return chain;             // Empty, or the oldest push didn't complete yet.
+      chain.append(node);
+    }
+    // The stub is at the front: m_tail ---> m_stub ===> first ===> ... ===> last.
+    MpscNode* first = m_stub.m_next.load(std::memory_order_acquire);
+    if (!first)
+      return chain;               // Empty, or the oldest push didn't complete yet.
+    // Only the producer of first ever wrote to m_stub's m_next since the stub was
+    // (re)installed, and that store is visible; hence this plain reset cannot lose
+    // a concurrent link. It must be sequenced before the exchange below, see push().
+    m_stub.m_next.store(nullptr, std::memory_order_relaxed);
+    MpscNode* last = m_head.exchange(&m_stub, std::memory_order_release);
+    // m_tail still points at the stub, so the queue is in its empty state again;
+    // [first, last] is now privately ours.
+    chain.append_detached(first, last);
+    return chain;
+  }
 };
 
 } // namespace utils::threading
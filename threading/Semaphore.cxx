@@ -71,4 +71,56 @@ void Semaphore::slow_wait() noexcept
   }
 }
 
+bool Semaphore::slow_wait_until(struct timespec const& abs_time) noexcept
+{
+  // We are (likely) going to block. Add one to the number of waiters.
+  uint64_t word = m_word.fetch_add(one_waiter, std::memory_order_relaxed) + one_waiter;
+
+  // Wait for a token to be available, but no longer than till abs_time.
+  for (;;)
+  {
+    uint32_t ntokens = word & tokens_mask;
+    Dout(dc::semaphore, "Seeing " << ntokens << " tokens and " << (word >> nwaiters_shift) << " waiters.");
+    if (ntokens == 0)
+    {
+      [[maybe_unused]] int res;
+      while ((res = Futex<uint64_t>::wait_until(0, abs_time)) == -1 && errno != EAGAIN && errno != ETIMEDOUT)
+        ;
+      if (res == -1 && errno == ETIMEDOUT)
+      {
+        // The deadline passed. Stop being a waiter, but still grab a token
+        // when one became available in the meantime (in that case a post()
+        // might have spent a wake-up on us that we must not swallow silently
+        // by timing out anyway).
+        word = m_word.load(std::memory_order_relaxed);
+        for (;;)
+        {
+          uint64_t const grabbed = (word & tokens_mask) ? 1 : 0;
+          // word is refreshed when this fails.
+          if (m_word.compare_exchange_weak(word, word - one_waiter - grabbed, std::memory_order_acquire, std::memory_order_relaxed))
+          {
+            Dout(dc::semaphore, (grabbed ? "Timed out, but grabbed a token that arrived in the meantime." : "Timed out."));
+            return grabbed;
+          }
+        }
+      }
+      // EAGAIN happens when the number of tokens was changed in the meantime.
+      // We (supuriously?) woke up or failed to go to sleep because the number of tokens changed.
+      // It is therefore not sure that there is a token for us. Refresh word and try again.
+      word = m_word.load(std::memory_order_relaxed);
+      Dout(dc::semaphore(res == 0), "Woke up! tokens = " << (word & tokens_mask) << "; waiters = " << (word >> nwaiters_shift));
+    }
+    else
+    {
+      // (Try to) atomically grab a token and stop being a waiter.
+      if (m_word.compare_exchange_weak(word, word - one_waiter - 1, std::memory_order_acquire, std::memory_order_acquire))
+      {
+        Dout(dc::semaphore, "Successfully obtained a token. Now " << (ntokens - 1) << " tokens and " << ((word - one_waiter) >> nwaiters_shift) << " waiters left.");
+        return true;
+      }
+      // word was changed, try again.
+    }
+  }
+}
+
 } // namespace utils::threading
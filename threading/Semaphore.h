@@ -28,7 +28,9 @@
 #pragma once
 
 #include "Futex.h"
+#include "utils/cpu_relax.h"
 #include "debug.h"
+#include <chrono>
 
 #if defined(CWDEBUG) && !defined(DOXYGEN)
 NAMESPACE_DEBUG_CHANNELS_START
@@ -101,6 +103,11 @@ class Semaphore : public Futex<uint64_t>
   // there are no tokens so that we are very likely to go to sleep.
   void slow_wait() noexcept;
 
+  // Same as slow_wait() but gives up when abs_time - an absolute time
+  // against CLOCK_MONOTONIC - passed. Returns true when a token was
+  // grabbed and false on timeout.
+  bool slow_wait_until(struct timespec const& abs_time) noexcept;
+
   // Try to remove a token from the semaphore.
   //
   // Returns a recently read value of m_word.
@@ -125,16 +132,42 @@ class Semaphore : public Futex<uint64_t>
     return word;
   }
 
+  // Same as try_wait() but spin for (at most) spin_count iterations of
+  // cpu_relax() before giving up, in the hope that a post() from another
+  // core arrives within that window so that the whole futex dance can be
+  // skipped. Unlike SpinSemaphore there is no dedicated spinner thread:
+  // every caller just spins briefly for itself, which is all that is
+  // needed for low-contention queues.
+  bool spin_try_wait(unsigned int spin_count) noexcept
+  {
+    uint64_t word = m_word.load(std::memory_order_relaxed);
+    for (;;)
+    {
+      if ((word & tokens_mask) != 0)
+      {
+        // We seem to have a token, try to grab it (word is refreshed when this fails).
+        if (m_word.compare_exchange_weak(word, word - 1, std::memory_order_acquire))
+          return true;
+        continue;
+      }
+      if (spin_count-- == 0)
+        return false;
+      cpu_relax();
+      word = m_word.load(std::memory_order_relaxed);
+    }
+  }
+
   // Removes one token from the semaphore.
   //
   // If no token is available then the thread will block until it manages
-  // to grab a new token added with post(n).
-  void wait() noexcept
+  // to grab a new token added with post(n). A non-zero spin_count is the
+  // number of cpu_relax() iterations to spin before blocking.
+  void wait(unsigned int spin_count = 0) noexcept
   {
-    DoutEntering(dc::notice, "Semaphore::wait()");
-    uint64_t word = fast_try_wait();
-    if ((word & tokens_mask) == 0)
-      slow_wait();
+    DoutEntering(dc::notice, "Semaphore::wait(" << spin_count << ")");
+    if (spin_try_wait(spin_count))
+      return;
+    slow_wait();
   }
 
   bool try_wait() noexcept
@@ -142,6 +175,38 @@ class Semaphore : public Futex<uint64_t>
     DoutEntering(dc::notice, "Semaphore::try_wait()");
     return (fast_try_wait() & tokens_mask);
   }
+
+  // Same as wait() but gives up when abs_time - an absolute time against
+  // CLOCK_MONOTONIC - passed. Returns true when a token was grabbed and
+  // false on timeout.
+  bool wait_until(struct timespec const& abs_time, unsigned int spin_count = 0) noexcept
+  {
+    DoutEntering(dc::notice, "Semaphore::wait_until(" << abs_time.tv_sec << "." << abs_time.tv_nsec << ", " << spin_count << ")");
+    if (spin_try_wait(spin_count))
+      return true;
+    return slow_wait_until(abs_time);
+  }
+
+  // Same as wait_until() but with a timeout relative to now.
+  template<class Rep, class Period>
+  bool wait_for(std::chrono::duration<Rep, Period> const& rel_time, unsigned int spin_count = 0) noexcept
+  {
+    if (spin_try_wait(spin_count))
+      return true;
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(rel_time).count();
+    if (ns < 0)
+      ns = 0;
+    struct timespec abs_time;
+    clock_gettime(CLOCK_MONOTONIC, &abs_time);
+    abs_time.tv_sec += ns / 1000000000L;
+    abs_time.tv_nsec += ns % 1000000000L;
+    if (abs_time.tv_nsec >= 1000000000L)
+    {
+      ++abs_time.tv_sec;
+      abs_time.tv_nsec -= 1000000000L;
+    }
+    return slow_wait_until(abs_time);
+  }
 };
 
 } // namespace utils::threading
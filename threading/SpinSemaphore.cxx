@@ -30,6 +30,8 @@
 #include "utils/DelayLoopCalibration.h"
 #include "utils/print_using.h"
 #include <cmath>
+#include <thread>
+#include <pthread.h>
 #ifdef SPINSEMAPHORE_STATS
 #include <iomanip>
 #endif
@@ -123,14 +125,51 @@ futex_sleep:
       Dout(dc::semaphore|continued_cf, "Became spinner; ");
       do
       {
-        // We are the spinner. Spin instead of going to sleep.
+        // We are the spinner. Spin instead of going to sleep - for the current
+        // adaptive window, see m_spin_window in SpinSemaphore.h.
 //        Dout(dc::continued, "entering delay loop... ");
 //        auto start = std::chrono::high_resolution_clock::now();
-        // Spin for 20 milliseconds...
-        word = DelayLoop::delay_loop(m_word, 20 * DelayLoop::s_outer_loop_size, DelayLoop::s_inner_loop_size);
+        uint32_t const base_window = m_spin_window.load(std::memory_order_relaxed);
+        uint32_t spin_window = base_window;
+        // Threads that are already asleep (nwaiters minus ourselves) scale the window down further.
+        // Note: word still holds the value from before our last CAS, in which we ourselves are not
+        // necessarily counted as waiter yet; the current value of m_word always counts us.
+        uint32_t const sleepers = (m_word.load(std::memory_order_relaxed) >> nwaiters_shift) - 1;
+        if (AI_UNLIKELY(sleepers > 1))
+          spin_window >>= utils::log2(sleepers);
+        if (AI_LIKELY(spin_window > 0))
+        {
+          DelayLoop::LoopSizes const loop_sizes = DelayLoop::loop_sizes();
+          word = DelayLoop::delay_loop(m_word, spin_window * loop_sizes.outer, loop_sizes.inner);
+        }
+        else
+          word = m_word.load(std::memory_order_relaxed);        // Immediate "time out": check for a token once and go to sleep.
 //        auto end = std::chrono::high_resolution_clock::now();
 //        std::chrono::duration<double> diff = end - start;
 
+        if ((word & tokens_mask) != 0)
+        {
+          // The spin paid off; restore the full calibrated window.
+          if (base_window != max_spin_window)
+            m_spin_window.store(max_spin_window, std::memory_order_relaxed);
+#ifdef SPINSEMAPHORE_STATS
+          m_spin_successes.fetch_add(1, std::memory_order_relaxed);
+#endif
+        }
+        else
+        {
+          // The window expired without a token arriving; halve it so that
+          // repeated failures converge to a minimal probe window of one loop
+          // (the sleepers shift above takes the used window to zero): without
+          // that probe a later successful spin could never be observed and the
+          // full window would never be restored.
+          if (base_window > 1)
+            m_spin_window.store(base_window / 2, std::memory_order_relaxed);
+#ifdef SPINSEMAPHORE_STATS
+          m_spin_timeouts.fetch_add(1, std::memory_order_relaxed);
+#endif
+        }
+
         for (;;)
         {
           ntokens = word & tokens_mask;
@@ -199,80 +238,156 @@ futex_sleep:
 //static
 unsigned int SpinSemaphore::DelayLoop::s_outer_loop_size;
 unsigned int SpinSemaphore::DelayLoop::s_inner_loop_size;
+std::vector<SpinSemaphore::DelayLoop::LoopSizes> SpinSemaphore::DelayLoop::s_cpu_loop_sizes;
 
-void SpinSemaphore::DelayLoop::calibrate(std::atomic<uint64_t>& word)
+void SpinSemaphore::DelayLoop::calibrate_loop_sizes(std::atomic<uint64_t>& word, unsigned int& outer_loop_size, unsigned int& inner_loop_size)
 {
-  DoutEntering(dc::notice, "SpinSemaphore::DelayLoop::calibrate()");
+  DoutEntering(dc::notice, "SpinSemaphore::DelayLoop::calibrate_loop_sizes() on CPU " << sched_getcpu());
 
   // Define delay loop lambdas. This requires C++17.
-  utils::DelayLoopCalibration fixed_ols_delay_loop([&word](unsigned int ils){ return delay_loop(word, s_outer_loop_size, ils); });
-  utils::DelayLoopCalibration fixed_ils_delay_loop([&word](unsigned int ols){ return delay_loop(word, ols, s_inner_loop_size); });
+  utils::DelayLoopCalibration fixed_ols_delay_loop([&word, &outer_loop_size](unsigned int ils){ return delay_loop(word, outer_loop_size, ils); });
+  utils::DelayLoopCalibration fixed_ils_delay_loop([&word, &inner_loop_size](unsigned int ols){ return delay_loop(word, ols, inner_loop_size); });
 
-  // Determine s_outer_loop_size, with s_inner_loop_size fixed at prefered_min_ils, for a delay time of goal ms.
-  s_inner_loop_size = prefered_min_ils;
-  s_outer_loop_size = fixed_ils_delay_loop.peak_detect(goal);
-  Dout(dc::delayloop, "s_outer_loop_size (with s_inner_loop_size = " << s_inner_loop_size << ") = " << s_outer_loop_size);
+  // Determine outer_loop_size, with inner_loop_size fixed at prefered_min_ils, for a delay time of goal ms.
+  inner_loop_size = prefered_min_ils;
+  outer_loop_size = fixed_ils_delay_loop.peak_detect(goal);
+  Dout(dc::delayloop, "outer_loop_size (with inner_loop_size = " << inner_loop_size << ") = " << outer_loop_size);
 
-  // Find an appropriate value for s_inner_loop_size.
-  if (s_outer_loop_size < min_ols)
+  // Find an appropriate value for inner_loop_size.
+  if (outer_loop_size < min_ols)
   {
-    Dout(dc::warning, "SpinSemaphore::DelayLoop::calibrate: s_outer_loop_size is less than min_ols (" << min_ols << "), will need to use an s_inner_loop_size less than " << prefered_min_ils << "!");
-    // Find the largest s_inner_loop_size (albeit smaller than prefered_min_ils),
-    // with s_outer_loop_size fixed at min_ols, such that the delay loop at least goal ms.
-    s_outer_loop_size = min_ols;
-    for (s_inner_loop_size = 0; s_inner_loop_size < prefered_min_ils; ++s_inner_loop_size)
-      if (fixed_ols_delay_loop.avg_of(s_inner_loop_size) > goal)
+    Dout(dc::warning, "SpinSemaphore::DelayLoop::calibrate_loop_sizes: outer_loop_size is less than min_ols (" << min_ols << "), will need to use an inner_loop_size less than " << prefered_min_ils << "!");
+    // Find the largest inner_loop_size (albeit smaller than prefered_min_ils),
+    // with outer_loop_size fixed at min_ols, such that the delay loop at least goal ms.
+    outer_loop_size = min_ols;
+    for (inner_loop_size = 0; inner_loop_size < prefered_min_ils; ++inner_loop_size)
+      if (fixed_ols_delay_loop.avg_of(inner_loop_size) > goal)
         break;
-    Dout(dc::delayloop, "s_inner_loop_size (with s_outer_loop_size = " << s_outer_loop_size << ") = " << s_inner_loop_size);
+    Dout(dc::delayloop, "inner_loop_size (with outer_loop_size = " << outer_loop_size << ") = " << inner_loop_size);
   }
-  else if (s_outer_loop_size > max_ols)
+  else if (outer_loop_size > max_ols)
   {
-    // Fix s_outer_loop_size at 90% of its maximum value and find the corresponding best s_inner_loop_size for that.
-    s_outer_loop_size = 0.9 * max_ols;
-    s_inner_loop_size = fixed_ols_delay_loop.search_lowest_of(20, goal);
-    Dout(dc::delayloop, "s_inner_loop_size (with s_outer_loop_size = " << s_outer_loop_size << ") = " << s_inner_loop_size);
+    // Fix outer_loop_size at 90% of its maximum value and find the corresponding best inner_loop_size for that.
+    outer_loop_size = 0.9 * max_ols;
+    inner_loop_size = fixed_ols_delay_loop.search_lowest_of(20, goal);
+    Dout(dc::delayloop, "inner_loop_size (with outer_loop_size = " << outer_loop_size << ") = " << inner_loop_size);
   }
   else
   {
-    Dout(dc::notice, "SpinSemaphore::DelayLoop::calibrate: s_outer_loop_size is less than max_ols (" << max_ols << ") while using s_inner_loop_size of only " << s_inner_loop_size << " (slow hardware?)");
-    // Assuming that s_inner_loop_size behaves linear (it actually might, under 10), namely
+    Dout(dc::notice, "SpinSemaphore::DelayLoop::calibrate_loop_sizes: outer_loop_size is less than max_ols (" << max_ols << ") while using inner_loop_size of only " << inner_loop_size << " (slow hardware?)");
+    // Assuming that inner_loop_size behaves linear (it actually might, under 10), namely
     //
-    //   goal = alpha * s_outer_loop_size * (beta + gamma * s_inner_loop_size),
+    //   goal = alpha * outer_loop_size * (beta + gamma * inner_loop_size),
     //
-    // we know that multiplying s_inner_loop_size with a factor s_outer_loop_size / max_ols and setting s_outer_loop_size
+    // we know that multiplying inner_loop_size with a factor outer_loop_size / max_ols and setting outer_loop_size
     // to max_ols we'd get a delay of:
     //
-    //   alpha * max_ols * (beta + gamma * s_inner_loop_size * (s_outer_loop_size / max_ols)) = goal + alpha * beta * (max_ols - s_outer_loop_size)
+    //   alpha * max_ols * (beta + gamma * inner_loop_size * (outer_loop_size / max_ols)) = goal + alpha * beta * (max_ols - outer_loop_size)
     //
-    // So, the delay would become larger than goal and the s_outer_loop_size corresponding
+    // So, the delay would become larger than goal and the outer_loop_size corresponding
     // to goal will thus be smaller than max_ols.
-    unsigned int prev_ils = s_inner_loop_size;
-    s_inner_loop_size = (1.0 * s_outer_loop_size / max_ols) * s_inner_loop_size;
-    while (s_inner_loop_size < prev_ils)
+    unsigned int prev_ils = inner_loop_size;
+    inner_loop_size = (1.0 * outer_loop_size / max_ols) * inner_loop_size;
+    while (inner_loop_size < prev_ils)
     {
-      // Find a corresponding s_outer_loop_size.
-      s_outer_loop_size = fixed_ils_delay_loop.peak_detect(goal /*, "Delay with ils = " + std::to_string(s_inner_loop_size)*/);
-      Dout(dc::delayloop, "s_outer_loop_size (with s_inner_loop_size = " << s_inner_loop_size << ") = " << s_outer_loop_size);
-      if (s_outer_loop_size > min_ols)
+      // Find a corresponding outer_loop_size.
+      outer_loop_size = fixed_ils_delay_loop.peak_detect(goal /*, "Delay with ils = " + std::to_string(inner_loop_size)*/);
+      Dout(dc::delayloop, "outer_loop_size (with inner_loop_size = " << inner_loop_size << ") = " << outer_loop_size);
+      if (outer_loop_size > min_ols)
       {
-        ++s_inner_loop_size;
+        ++inner_loop_size;
         break;
       }
-      prev_ils = s_inner_loop_size;
-      s_inner_loop_size = (1.0 * s_outer_loop_size / max_ols) * s_inner_loop_size;
+      prev_ils = inner_loop_size;
+      inner_loop_size = (1.0 * outer_loop_size / max_ols) * inner_loop_size;
     }
   }
 
-  // Finally, find the best s_outer_loop_size with this s_inner_loop_size.
-  s_outer_loop_size = fixed_ils_delay_loop.peak_detect(goal
-      COMMA_CWDEBUG_ONLY("Delay with goal " + std::to_string(goal) + " ms and ils = " + std::to_string(s_inner_loop_size)));
-  Dout(dc::delayloop, "s_outer_loop_size (with s_inner_loop_size = " << s_inner_loop_size << ") = " << s_outer_loop_size);
+  // Finally, find the best outer_loop_size with this inner_loop_size.
+  outer_loop_size = fixed_ils_delay_loop.peak_detect(goal
+      COMMA_CWDEBUG_ONLY("Delay with goal " + std::to_string(goal) + " ms and ils = " + std::to_string(inner_loop_size)));
+  Dout(dc::delayloop, "outer_loop_size (with inner_loop_size = " << inner_loop_size << ") = " << outer_loop_size);
+
+  // Set outer_loop_size to a value that should lead to a delay_ms delay.
+  outer_loop_size *= std::round(delay_ms / goal);
+
+  Dout(dc::notice, "Delay loop calibration: inner_loop_size = " << inner_loop_size <<
+      "; outer_loop_size = " << outer_loop_size << "; test run: " << fixed_ils_delay_loop.avg_of(outer_loop_size) << " ms.");
+}
+
+void SpinSemaphore::DelayLoop::calibrate(std::atomic<uint64_t>& word)
+{
+  DoutEntering(dc::notice, "SpinSemaphore::DelayLoop::calibrate()");
+
+  // On hybrid hosts (E-cores/P-cores) the delay loop speed differs per core type,
+  // so every distinct core cluster gets its own calibration.
+  std::vector<std::vector<int>> const clusters = utils::core_clusters();
+
+  // Use the result of a previous run on this host, if we have one.
+  utils::DelayLoopCalibrationCache cache;
+  std::vector<unsigned int> cached_values;
+  bool const cached = cache.lookup("SpinSemaphore::DelayLoop", cached_values) && cached_values.size() == 2 * clusters.size();
+
+  std::vector<LoopSizes> cluster_loop_sizes(clusters.size());
+  if (cached)
+  {
+    for (size_t cluster = 0; cluster < clusters.size(); ++cluster)
+      cluster_loop_sizes[cluster] = { cached_values[2 * cluster], cached_values[2 * cluster + 1] };
+  }
+  else
+  {
+    // Calibrate all clusters concurrently - one thread pinned to each cluster -
+    // so that the wall time doesn't grow with the number of core types.
+    std::vector<std::thread> threads;
+    for (size_t cluster = 0; cluster < clusters.size(); ++cluster)
+      threads.emplace_back([&word, &cpus = clusters[cluster], &result = cluster_loop_sizes[cluster]](){
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        for (int cpu : cpus)
+          CPU_SET(cpu, &cpu_set);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+        calibrate_loop_sizes(word, result.outer, result.inner);
+      });
+    for (std::thread& thread : threads)
+      thread.join();
+  }
+
+  // Expose the per-CPU lookup only when there is more than one core type;
+  // on a homogeneous host loop_sizes() avoids the sched_getcpu call entirely.
+  s_cpu_loop_sizes.clear();
+  if (clusters.size() > 1)
+  {
+    int number_of_cpus = 0;
+    for (std::vector<int> const& cpus : clusters)
+      number_of_cpus = std::max(number_of_cpus, *std::max_element(cpus.begin(), cpus.end()) + 1);
+    s_cpu_loop_sizes.assign(number_of_cpus, cluster_loop_sizes[0]);
+    for (size_t cluster = 0; cluster < clusters.size(); ++cluster)
+      for (int cpu : clusters[cluster])
+        s_cpu_loop_sizes[cpu] = cluster_loop_sizes[cluster];
+  }
+
+  // Keep the statics as fall back for when sched_getcpu returns a CPU that we
+  // didn't see during calibration; use the values of the fastest cluster.
+  s_outer_loop_size = cluster_loop_sizes[0].outer;
+  s_inner_loop_size = cluster_loop_sizes[0].inner;
 
-  // Set s_outer_loop_size to a value that should lead to a delay_ms delay.
-  s_outer_loop_size *= std::round(delay_ms / goal);
+#ifdef CWDEBUG
+  for (size_t cluster = 0; cluster < clusters.size(); ++cluster)
+    Dout(dc::notice, "Delay loop calibration" << (cached ? " (cached)" : "") << " of cluster " << cluster <<
+        " (CPUs " << clusters[cluster].front() << "-" << clusters[cluster].back() << "): inner_loop_size = " <<
+        cluster_loop_sizes[cluster].inner << "; outer_loop_size = " << cluster_loop_sizes[cluster].outer << ".");
+#endif
 
-  Dout(dc::notice, "Delay loop calibration: inner_loop_size = " << s_inner_loop_size <<
-      "; outer_loop_size = " << s_outer_loop_size << "; test run: " << fixed_ils_delay_loop.avg_of(s_outer_loop_size) << " ms.");
+  if (!cached)
+  {
+    cached_values.clear();
+    for (LoopSizes const& loop_sizes : cluster_loop_sizes)
+    {
+      cached_values.push_back(loop_sizes.outer);
+      cached_values.push_back(loop_sizes.inner);
+    }
+    cache.store("SpinSemaphore::DelayLoop", cached_values);
+  }
 }
 
 #ifdef SPINSEMAPHORE_STATS
@@ -286,6 +401,8 @@ void SpinSemaphore::print_stats_on(std::ostream& os)
   os << "Calls to wait: " << m_calls_to_wait << '\n';
   os << "Calls to slow_wait: " << m_calls_to_slow_wait << " (" << std::fixed << std::setprecision(2) << (100.0 * m_calls_to_slow_wait / m_calls_to_wait) << "%).\n";
   os << "Calls to Futex::wait: " << m_calls_to_futex_wait << '\n';
+  os << "Spin windows: " << (m_spin_successes + m_spin_timeouts) << " (timed out: " << m_spin_timeouts << " = "
+     << (100.0 * m_spin_timeouts / std::max(1, m_spin_successes + m_spin_timeouts)) << "%).\n";
 }
 #endif
 
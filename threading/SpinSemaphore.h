@@ -34,7 +34,10 @@
 #include "utils/log2.h"
 #include "utils/print_using.h"
 #include "debug.h"
+#include <algorithm>
 #include <mutex>
+#include <vector>
+#include <sched.h>
 
 // Define this to print some stats on semaphore usage.
 #undef SPINSEMAPHORE_STATS
@@ -121,6 +124,27 @@ class SpinSemaphore : public Futex<uint64_t>
     static unsigned int s_inner_loop_size;                // Inner loop size of delay loop.
     static unsigned int s_outer_loop_size;                // Outer loop size of delay loop.
 
+    struct LoopSizes
+    {
+      unsigned int outer;
+      unsigned int inner;
+    };
+    // Per-CPU loop sizes, indexed by the value of sched_getcpu(). Left empty on
+    // homogeneous hosts; on hybrid hosts (E-cores/P-cores) every core type gets
+    // its own calibration, because their delay loop speeds differ up to 2x.
+    static std::vector<LoopSizes> s_cpu_loop_sizes;
+
+    // Returns the loop sizes calibrated for the core type that the calling thread currently runs on.
+    [[gnu::always_inline]] static LoopSizes loop_sizes()
+    {
+      if (AI_LIKELY(s_cpu_loop_sizes.empty()))          // Homogeneous host.
+        return { s_outer_loop_size, s_inner_loop_size };
+      unsigned int cpu = sched_getcpu();
+      if (AI_UNLIKELY(cpu >= s_cpu_loop_sizes.size()))  // CPU hot-plugged after calibration?
+        return { s_outer_loop_size, s_inner_loop_size };
+      return s_cpu_loop_sizes[cpu];
+    }
+
     // This delay loop takes arguments for word, ols and ils for calibration purposes.
     // Returns when either ~1 ms passed or the least significant 32 bits in word changed to non-zero.
     // The last read value of word is returned.
@@ -140,14 +164,34 @@ class SpinSemaphore : public Futex<uint64_t>
       return last_word;
     };
 
+    // Runs the actual calibration algorithm on the core that the calling thread is pinned to.
+    static void calibrate_loop_sizes(std::atomic<uint64_t>& word, unsigned int& outer_loop_size, unsigned int& inner_loop_size);
+
    public:
     // Calibrates delay loop, must be called once before use.
+    // On hybrid hosts every distinct core cluster is calibrated concurrently, by one thread pinned to each cluster.
     static void calibrate(std::atomic<uint64_t>& word);
 
     static int outer_loop_size() { return s_outer_loop_size; }
     static int inner_loop_size() { return s_outer_loop_size; }
   };
 
+  // The adaptive spin window, in units of one calibrated delay loop (~1 ms); see slow_wait().
+  //
+  // Spinning before sleeping only pays off when a token tends to arrive within
+  // the spin window; on an oversubscribed host the spinner instead burns the
+  // very quantum that the token holder needs to produce that token. Therefore
+  // the window adapts to the recent spin success rate of this semaphore: it is
+  // halved every time a window expires without a token arriving - converging,
+  // within a few failures, to a single-loop probe window that keeps the chance
+  // to observe a success - and restored to the full calibrated window as soon
+  // as a spin succeeds again. In addition, threads that are already asleep in
+  // futex_wait are evidence that tokens have not been keeping up, so each
+  // doubling of their number halves the used window once more, down to an
+  // immediate futex sleep. Costs one relaxed load and store per spin window.
+  static constexpr uint32_t max_spin_window = 20;
+  std::atomic<uint32_t> m_spin_window{max_spin_window};
+
  public:
   // Construct a SpinSemaphore with no waiters, no spinner and no tokens.
   SpinSemaphore() : Futex<uint64_t>(0)
@@ -160,7 +204,9 @@ class SpinSemaphore : public Futex<uint64_t>
   m_failed_try_wait(0),
   m_calls_to_wait(0),
   m_calls_to_slow_wait(0),
-  m_calls_to_futex_wait(0)
+  m_calls_to_futex_wait(0),
+  m_spin_successes(0),
+  m_spin_timeouts(0)
 #endif
   {
     // Calibrate the delay loop once (using the m_word atomic of the first SpinSemaphore that is created).
@@ -216,10 +262,14 @@ class SpinSemaphore : public Futex<uint64_t>
 #ifdef SPINSEMAPHORE_STATS
         m_calls_to_futex_wake.fetch_add(1, std::memory_order_relaxed);
 #endif
-        Dout(dc::semaphore, "Calling Futex<uint64_t>::wake(" << n << ") because nwaiters > prev_tokens (" << nwaiters << " > " << prev_ntokens << ").");
-        DEBUG_ONLY(uint32_t woken_up =) Futex<uint64_t>::wake(n);
+        // The prev_ntokens tokens that already existed were (or will be) consumed without
+        // our help; we only need to wake up one thread per token that we just added, and
+        // no more than the number of waiters that don't have a token yet.
+        uint32_t const nwake = std::min(n, nwaiters - prev_ntokens);
+        Dout(dc::semaphore, "Calling Futex<uint64_t>::wake(" << nwake << ") because nwaiters > prev_tokens (" << nwaiters << " > " << prev_ntokens << ").");
+        DEBUG_ONLY(uint32_t woken_up =) Futex<uint64_t>::wake(nwake);
         Dout(dc::semaphore, "Woke up " << woken_up << " threads.");
-        ASSERT(woken_up <= n);
+        ASSERT(woken_up <= nwake);
       }
     }
   }
@@ -307,6 +357,8 @@ class SpinSemaphore : public Futex<uint64_t>
   std::atomic_int m_calls_to_wait;
   std::atomic_int m_calls_to_slow_wait;
   std::atomic_int m_calls_to_futex_wait;
+  std::atomic_int m_spin_successes;
+  std::atomic_int m_spin_timeouts;
 
   void print_stats_on(std::ostream& os);
 #endif
@@ -0,0 +1,87 @@
+/**
+ * ai-utils -- C++ Core utilities
+ *
+ * @file
+ * @brief Definition of class ThreadPool.
+ *
+ * @Copyright (C) 2021  Carlo Wood.
+ *
+ * RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+ * Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+ *
+ * This file is part of ai-utils.
+ *
+ * ai-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ai-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with ai-utils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sys.h"
+#include "ThreadPool.h"
+#include "utils/cpu_relax.h"
+
+namespace utils::threading {
+
+//static
+thread_local int ThreadPool::tl_self = -1;
+
+ThreadPool::ThreadPool(int number_of_threads, size_t queue_capacity) : m_stop(false), m_next_queue(0)
+{
+  DoutEntering(dc::notice, "ThreadPool::ThreadPool(" << number_of_threads << ", " << queue_capacity << ") [" << this << "]");
+  // A thread pool without threads would deadlock the first post() from a non-worker thread.
+  ASSERT(number_of_threads >= 1);
+  m_workers.reserve(number_of_threads);
+  for (int self = 0; self < number_of_threads; ++self)
+    m_workers.push_back(std::make_unique<Worker>(queue_capacity));
+  // Only start the threads after m_workers is complete: a worker reads the vector while stealing.
+  for (int self = 0; self < number_of_threads; ++self)
+    m_workers[self]->m_thread = std::thread([this, self](){ main(self); });
+}
+
+ThreadPool::~ThreadPool()
+{
+  DoutEntering(dc::notice, "ThreadPool::~ThreadPool() [" << this << "]");
+  m_stop.store(true, std::memory_order_release);
+  // Wake every worker; each one consumes a single token, sees m_stop and leaves main().
+  m_semaphore.post(m_workers.size());
+  for (std::unique_ptr<Worker>& worker : m_workers)
+    worker->m_thread.join();
+}
+
+void ThreadPool::main(int self)
+{
+  tl_self = self;
+  int const number_of_workers = m_workers.size();
+  for (;;)
+  {
+    // Sleep until a task was posted (or the destructor posted our stop token).
+    m_semaphore.wait();
+    if (AI_UNLIKELY(m_stop.load(std::memory_order_acquire)))
+      break;
+    // Our token guarantees that a task was pushed (the push completes before
+    // the post); find it. It normally sits in our own queue, but it (or an
+    // equivalent task, we don't care which) may have to be stolen from the
+    // queue of another worker.
+    Task task;
+    int qi = self;
+    while (!m_workers[qi]->m_queue.try_pop(task))
+    {
+      if (++qi == number_of_workers)
+        qi = 0;
+      if (qi == self)
+        cpu_relax();    // Came around: a producer is still publishing its cell.
+    }
+    task();
+  }
+}
+
+} // namespace utils::threading
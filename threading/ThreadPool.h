@@ -0,0 +1,145 @@
+/**
+ * ai-utils -- C++ Core utilities
+ *
+ * @file
+ * @brief Declaration of class ThreadPool.
+ *
+ * @Copyright (C) 2021  Carlo Wood.
+ *
+ * RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+ * Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+ *
+ * This file is part of ai-utils.
+ *
+ * ai-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ai-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with ai-utils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "MpmcQueue.h"
+#include "SpinSemaphore.h"
+#include "debug.h"
+#include <atomic>
+#include <memory>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace utils::threading {
+
+// class ThreadPool
+//
+// A fixed size pool of worker threads with one bounded queue per worker.
+//
+// A task posted by a worker goes into that worker's own queue; a task posted
+// by any other thread is distributed round-robin. A worker that finds its own
+// queue empty steals from the queues of the other workers, so a burst posted
+// by one stage spreads over all cores. Sleeping and waking goes through a
+// single SpinSemaphore that counts the queued tasks: handoff latency is the
+// calibrated spin of SpinSemaphore while busy, and idle workers cost zero CPU.
+//
+// Tasks are stored inline (see ThreadPool::Task): posting does not allocate.
+//
+// Usage:
+//
+//   utils::threading::ThreadPool thread_pool(8);
+//
+//   thread_pool.post([obj](){ obj->run(); });
+//
+// The destructor wakes all workers and joins them; tasks that are still
+// queued at that moment are not executed. Hence the ThreadPool must outlive
+// everything that posts to it.
+//
+class ThreadPool
+{
+ public:
+  // A small type-erased callable that is stored inline, so that posting a
+  // task never touches the heap. The callable must fit in storage_size
+  // bytes and be trivially copyable and destructible (e.g. a lambda that
+  // captures a few pointers or values, or a FunctionView).
+  class Task
+  {
+   public:
+    static constexpr size_t storage_size = 6 * sizeof(void*);
+
+   private:
+    void (*m_invoke)(void*);                    // Calls the callable in m_storage, or nullptr when empty.
+    alignas(void*) char m_storage[storage_size];
+
+   public:
+    Task() : m_invoke(nullptr) { }
+
+    template<typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, Task>>>
+    Task(F functor)
+    {
+      static_assert(sizeof(F) <= storage_size, "The callable of a ThreadPool::Task must fit in Task::storage_size bytes; capture less, or a pointer to more.");
+      static_assert(std::is_trivially_copyable_v<F> && std::is_trivially_destructible_v<F>,
+          "The callable of a ThreadPool::Task must be trivially copyable and destructible (it is moved between threads as raw bytes).");
+      new (m_storage) F(std::move(functor));
+      m_invoke = [](void* storage){ (*static_cast<F*>(storage))(); };
+    }
+
+    explicit operator bool() const { return m_invoke != nullptr; }
+    void operator()() { m_invoke(m_storage); }
+  };
+
+ private:
+  // One per worker thread; the queue of each worker lives in its own cache
+  // lines (MpmcQueue pads its positions, and the Worker's are heap-separated).
+  struct Worker
+  {
+    MpmcQueue<Task> m_queue;            // The tasks posted to this worker; other workers steal from it.
+    std::thread m_thread;
+
+    Worker(size_t queue_capacity) : m_queue(queue_capacity) { }
+  };
+
+  std::vector<std::unique_ptr<Worker>> m_workers;
+  SpinSemaphore m_semaphore;            // Counts the tasks in all queues together; workers sleep here.
+  std::atomic<bool> m_stop;             // Set by the destructor; makes the workers leave main().
+  std::atomic<unsigned int> m_next_queue;       // Round-robin cursor for tasks posted by non-worker threads.
+
+  static thread_local int tl_self;      // The index of this thread in m_workers, or -1 for non-worker threads.
+
+  void main(int self);                  // The main loop of worker thread self.
+
+ public:
+  ThreadPool(int number_of_threads, size_t queue_capacity = 1024);
+  ~ThreadPool();
+
+  // Not copyable.
+  ThreadPool(ThreadPool const&) = delete;
+  ThreadPool& operator=(ThreadPool const&) = delete;
+
+  int number_of_threads() const { return m_workers.size(); }
+
+  // Queue task for execution by one of the workers. When the target queue is
+  // full the task is executed immediately in the calling thread instead, so
+  // that post() never blocks and never allocates.
+  void post(Task task)
+  {
+    int const self = tl_self;
+    size_t const qi = self >= 0 ? (size_t)self : m_next_queue.fetch_add(1, std::memory_order_relaxed) % m_workers.size();
+    if (AI_UNLIKELY(!m_workers[qi]->m_queue.try_push(task)))
+    {
+      task();
+      return;
+    }
+    m_semaphore.post();
+  }
+};
+
+} // namespace utils::threading
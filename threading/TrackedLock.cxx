@@ -0,0 +1,58 @@
+/**
+ * ai-utils -- C++ Core utilities
+ *
+ * @file
+ * @brief Implementation of class LockSite.
+ *
+ * @Copyright (C) 2021  Carlo Wood.
+ *
+ * RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+ * Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+ *
+ * This file is part of ai-utils.
+ *
+ * ai-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ai-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with ai-utils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sys.h"
+#include "TrackedLock.h"
+#include <ostream>
+
+namespace utils::threading {
+
+//static
+std::atomic<LockSite*> LockSite::s_list{nullptr};
+
+LockSite::LockSite(char const* file, int line, char const* function) :
+  m_file(file), m_line(line), m_function(function), m_wait_time("wait"), m_hold_time("hold")
+{
+  // Prepend this site to the global list (sites are static and never destructed).
+  m_next = s_list.load(std::memory_order_relaxed);
+  while (!s_list.compare_exchange_weak(m_next, this, std::memory_order_release, std::memory_order_relaxed))
+    ;
+}
+
+void LockSite::print_on(std::ostream& os) const
+{
+  os << m_file << ':' << m_line << ' ' << m_function << ": " << m_wait_time << "; " << m_hold_time;
+}
+
+//static
+void LockSite::report(std::ostream& os)
+{
+  for (LockSite const* site = s_list.load(std::memory_order_acquire); site; site = site->m_next)
+    os << *site << '\n';
+}
+
+} // namespace utils::threading
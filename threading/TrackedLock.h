@@ -0,0 +1,146 @@
+/**
+ * ai-utils -- C++ Core utilities
+ *
+ * @file
+ * @brief Definition of LockSite, tracked_lock_guard and tracked_unlock_guard.
+ *
+ * @Copyright (C) 2021  Carlo Wood.
+ *
+ * RSA-1024 0x624ACAD5 1997-01-26                    Sign & Encrypt
+ * Fingerprint16 = 32 EC A7 B6 AC DB 65 A6  F6 F6 55 DD 1C DC FF 61
+ *
+ * This file is part of ai-utils.
+ *
+ * ai-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ai-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with ai-utils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "utils/Probe.h"
+#include <atomic>
+#include <cstdint>
+#include <iosfwd>
+
+namespace utils::threading {
+
+// class LockSite
+//
+// Per-call-site lock statistics: one Probe histogram for the time spent
+// waiting to acquire a lock at this site and one for the time the lock was
+// held. The file, line and function of the declaration are captured through
+// default arguments, so a site is identified in the report without passing
+// strings around. All sites link themselves into a global list; report()
+// prints every site constructed so far, which turns "which mutex is behind
+// this p99 spike" from guesswork into reading a table.
+//
+// Instrumentation is opt-in per call site: replace a std::lock_guard (or
+// std::scoped_lock with one mutex) with a tracked_lock_guard, or an
+// unlock_guard with a tracked_unlock_guard, and hand it a function-local
+// static LockSite:
+//
+//   {
+//     static utils::threading::LockSite site;          // Captures file:line:function.
+//     utils::threading::tracked_lock_guard lk(m_mutex, site);
+//     // ... critical section ...
+//   }
+//   ...
+//   utils::threading::LockSite::report(std::cout);     // From a statistics thread.
+//
+// A LockSite embeds two Probes and is therefore as heavyweight as they are;
+// define sites statically at the handful of mutexes under investigation,
+// not on the fly.
+class LockSite
+{
+ private:
+  char const* m_file;
+  int m_line;
+  char const* m_function;
+  Probe m_wait_time;                    // Cycles between calling lock() and obtaining the lock.
+  Probe m_hold_time;                    // Cycles between obtaining the lock and releasing it.
+  LockSite* m_next;                     // The site that was constructed before this one (intrusive list for report()).
+
+  static std::atomic<LockSite*> s_list; // The most recently constructed site.
+
+ public:
+  LockSite(char const* file = __builtin_FILE(), int line = __builtin_LINE(), char const* function = __builtin_FUNCTION());
+
+  [[gnu::always_inline]] void record_wait(uint64_t cycles) { m_wait_time.record(cycles); }
+  [[gnu::always_inline]] void record_hold(uint64_t cycles) { m_hold_time.record(cycles); }
+
+  Probe const& wait_time() const { return m_wait_time; }
+  Probe const& hold_time() const { return m_hold_time; }
+
+  void print_on(std::ostream& os) const;
+  friend std::ostream& operator<<(std::ostream& os, LockSite const& site) { site.print_on(os); return os; }
+
+  // Print every LockSite constructed so far, one per line.
+  static void report(std::ostream& os);
+};
+
+// Like std::lock_guard, but records the wait and hold time into site.
+template<typename T>
+class tracked_lock_guard
+{
+ private:
+  T& m_mutex;
+  LockSite& m_site;
+  uint64_t m_acquired;                  // The timestamp at which the lock was obtained.
+
+ public:
+  tracked_lock_guard(T& mutex, LockSite& site) : m_mutex(mutex), m_site(site)
+  {
+    uint64_t const start = Probe::timestamp();
+    m_mutex.lock();
+    m_acquired = Probe::timestamp();
+    m_site.record_wait(m_acquired - start);
+  }
+  tracked_lock_guard(tracked_lock_guard const&) = delete;
+  tracked_lock_guard(tracked_lock_guard&&) = delete;
+  ~tracked_lock_guard()
+  {
+    m_mutex.unlock();
+    m_site.record_hold(Probe::timestamp() - m_acquired);
+  }
+};
+
+// Like unlock_guard, but records into site the hold time of the critical
+// section that ends at its construction, and the wait time of the
+// re-acquisition in its destructor. lock_obtained is the timestamp at which
+// the surrounding lock was obtained (pass Probe::timestamp() taken right
+// after locking, or 0 to skip the hold time record).
+template<typename T>
+class tracked_unlock_guard
+{
+ private:
+  T& m_mutex;
+  LockSite& m_site;
+
+ public:
+  tracked_unlock_guard(T& mutex, LockSite& site, uint64_t lock_obtained = 0) : m_mutex(mutex), m_site(site)
+  {
+    m_mutex.unlock();
+    if (lock_obtained)
+      m_site.record_hold(Probe::timestamp() - lock_obtained);
+  }
+  tracked_unlock_guard(tracked_unlock_guard const&) = delete;
+  tracked_unlock_guard(tracked_unlock_guard&&) = delete;
+  ~tracked_unlock_guard()
+  {
+    uint64_t const start = Probe::timestamp();
+    m_mutex.lock();
+    m_site.record_wait(Probe::timestamp() - start);
+  }
+};
+
+} // namespace utils::threading
@@ -36,6 +36,11 @@
 
 #include "sys.h"
 #include "aithreadid.h"
+#include "utils/ctz.h"
+#include "utils/cpu_relax.h"
+#include "debug.h"
+#include <atomic>
+#include <cstdint>
 
 namespace aithreadid
 {
@@ -43,4 +48,38 @@ namespace aithreadid
 std::thread::id const s_main_thread_id = std::this_thread::get_id();
 std::thread::id const none;
 
+namespace {
+
+// Bit n of index_in_use[n / 64] is set when dense thread index n is in use.
+std::atomic<uint64_t> index_in_use[max_thread_indices / 64];
+
+} // namespace
+
+int allocate_index()
+{
+  for (;;)
+  {
+    for (int w = 0; w < max_thread_indices / 64; ++w)
+    {
+      uint64_t word = index_in_use[w].load(std::memory_order_relaxed);
+      while (~word != 0)
+      {
+        int const bit = utils::ctz(~word);
+        // On failure word was reloaded; re-test for a(nother) free bit.
+        if (index_in_use[w].compare_exchange_weak(word, word | (uint64_t{1} << bit), std::memory_order_relaxed))
+          return w * 64 + bit;
+      }
+    }
+    // More than max_thread_indices threads requested an index at the same time.
+    ASSERT(false);
+    // Wait for a thread to exit and release its index.
+    cpu_relax();
+  }
+}
+
+void release_index(int index)
+{
+  index_in_use[index / 64].fetch_and(~(uint64_t{1} << (index % 64)), std::memory_order_relaxed);
+}
+
 }
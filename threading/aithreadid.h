@@ -69,4 +69,34 @@ inline bool in_main_thread()
   return s_main_thread_id == std::this_thread::get_id();
 }
 
+// The maximum number of threads that can have a dense index (see index() below) at the same time.
+static constexpr int max_thread_indices = 256;
+
+// Allocate the smallest dense thread index that is not in use. Called once
+// per thread, by index(). Blocks when max_thread_indices threads already
+// hold an index (asserts first, when compiled with debugging).
+int allocate_index();
+
+// Return a dense thread index, previously returned by allocate_index(),
+// so that it can be reused by a new thread.
+void release_index(int index);
+
+// Return a small integer, unique to the calling thread, in the range
+// [0, max_thread_indices): consecutive small values are handed out lock-free
+// and are returned on thread exit, so that indices stay dense. Use this to
+// give threads a slot in a plain array (per-thread statistics, caches,
+// arena pointers), where hashing std::thread::id would be a map lookup on
+// a hot path. The first call by a thread allocates its index.
+inline int index()
+{
+  struct Index
+  {
+    int m_index;
+    Index() : m_index(allocate_index()) { }
+    ~Index() { release_index(m_index); }
+  };
+  static thread_local Index const tl_index;
+  return tl_index.m_index;
+}
+
 } // namespace aithreadid
@@ -29,8 +29,82 @@
 
 namespace translate {
 
+size_t Catalog::add(std::string_view key, std::string_view translation)
+{
+  size_t index = m_keys.find(key);
+  if (index == unknown)
+    index = m_keys.add_extra_word(key);
+  uint32_t const begin = m_arena.size();
+  m_arena += translation;
+  // Parse the "[KEY]" markers once, so that format() never has to scan.
+  uint32_t const segments_begin = m_segments.size();
+  size_t literal_start = 0;
+  for (size_t pos = 0;;)
+  {
+    size_t const open = translation.find('[', pos);
+    if (open == std::string_view::npos)
+      break;
+    size_t const close = translation.find(']', open + 1);
+    if (close == std::string_view::npos)
+      break;
+    m_segments.push_back({
+        begin + (uint32_t)literal_start, begin + (uint32_t)open,
+        begin + (uint32_t)open, begin + (uint32_t)close + 1 });
+    literal_start = pos = close + 1;
+  }
+  // The trailing literal (no marker).
+  m_segments.push_back({
+      begin + (uint32_t)literal_start, begin + (uint32_t)translation.size(),
+      0, 0 });
+  Message const message = { begin, begin + (uint32_t)translation.size(), segments_begin, (uint32_t)m_segments.size() };
+  if (index == m_messages.size())
+    m_messages.push_back(message);
+  else
+  {
+    // Replacing an existing translation; the old segments (and arena bytes) are simply abandoned.
+    ASSERT(index < m_messages.size());
+    m_messages[index] = message;
+  }
+  return index;
+}
+
+std::string Catalog::format(size_t index, format_map_t const& format_map) const
+{
+  Message const& message = m_messages[index];
+  std::string result;
+  result.reserve(message.m_end - message.m_begin + 64);
+  for (uint32_t s = message.m_segments_begin; s != message.m_segments_end; ++s)
+  {
+    Segment const& segment = m_segments[s];
+    result.append(m_arena, segment.m_literal_begin, segment.m_literal_end - segment.m_literal_begin);
+    if (segment.m_marker_begin != segment.m_marker_end)
+    {
+      std::string_view const marker(m_arena.data() + segment.m_marker_begin, segment.m_marker_end - segment.m_marker_begin);
+      format_map_t::value_type const* entry = format_map.find(marker);
+      if (entry)
+        result += entry->second;
+      else
+        result.append(marker.data(), marker.size());
+    }
+  }
+  return result;
+}
+
+//static
+Catalog& Catalog::instance()
+{
+  static Catalog catalog;
+  return catalog;
+}
+
 std::string getString(std::string const& xmlDesc, format_map_t const& format_map)
 {
+  Catalog const& catalog = Catalog::instance();
+  size_t const index = catalog.index_of(xmlDesc);
+  if (index != Catalog::unknown)
+    return catalog.format(index, format_map);
+
+  // Not a registered key: treat xmlDesc itself as the template.
   std::string result = xmlDesc;
   for (format_map_t::const_iterator iter = format_map.begin(); iter != format_map.end(); ++iter)
   {
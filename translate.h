@@ -27,12 +27,127 @@
 
 #pragma once
 
-#include <map>
+#include "SmallVector.h"
+#include "Dictionary.h"
 #include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include <cstdint>
 
 namespace translate {
 
-using format_map_t = std::map<std::string, std::string>;
+// A small flat map of "[KEY]" --> replacement pairs, with inline storage for
+// the usual handful of replacements: no node allocation per argument, and
+// short keys and values stay entirely within the std::string SSO buffer.
+// Insertion order is preserved; lookup is linear, which at these sizes beats
+// a std::map.
+class format_map_t
+{
+ public:
+  using value_type = std::pair<std::string, std::string>;
+  using const_iterator = value_type const*;
+
+ private:
+  utils::SmallVector<value_type, 4> m_map;
+
+ public:
+  // Return a reference to the replacement for key, appending a new empty entry when key is not known yet.
+  std::string& operator[](std::string const& key)
+  {
+    for (value_type& entry : m_map)
+      if (entry.first == key)
+        return entry.second;
+    m_map.emplace_back(key, std::string());
+    return m_map.back().second;
+  }
+
+  // Return a pointer to the entry for key, or nullptr when there is none.
+  value_type const* find(std::string_view key) const
+  {
+    for (value_type const& entry : m_map)
+      if (entry.first == key)
+        return &entry;
+    return nullptr;
+  }
+
+  const_iterator begin() const { return m_map.begin(); }
+  const_iterator end() const { return m_map.end(); }
+  bool empty() const { return m_map.empty(); }
+  size_t size() const { return m_map.size(); }
+};
+
+// class Catalog
+//
+// A message catalog with O(1) hot path lookups: keys are interned once
+// (at startup) into a Dictionary backed index, all translations live back
+// to back in one contiguous arena, and the position of the "[KEY]" markers
+// within each translation is parsed once at add() time. Resolving a key is
+// then one hash table probe, and formatting a registered message walks the
+// precomputed segments - no string scanning at all.
+//
+// Usage:
+//
+//   translate::Catalog& catalog = translate::Catalog::instance();
+//   catalog.add("ExampleKey", "The value of [WHAT] is [VALUE].");    // At startup.
+//   ...
+//   std::string msg = translate::getString("ExampleKey", format_map);  // Uses the catalog.
+//
+// add() must be serialized and finished before concurrent lookups start
+// (the usual rule for Dictionary); getString/format/index_of are read-only
+// and may then run concurrently.
+//
+class Catalog
+{
+ public:
+  static constexpr size_t unknown = utils::DictionaryBase::not_found;
+
+ private:
+  struct Segment
+  {
+    uint32_t m_literal_begin;   // Arena offsets of the literal run preceding the marker.
+    uint32_t m_literal_end;
+    uint32_t m_marker_begin;    // Arena offsets of the "[KEY]" marker following it; begin == end when there is none (trailing literal).
+    uint32_t m_marker_end;
+  };
+  struct Message
+  {
+    uint32_t m_begin;           // Arena offsets of the full translation.
+    uint32_t m_end;
+    uint32_t m_segments_begin;  // The range in m_segments of this message.
+    uint32_t m_segments_end;
+  };
+
+  utils::DictionaryBase m_keys;         // Interned keys; the index returned is the index into m_messages.
+  std::string m_arena;                  // All translations, back to back.
+  std::vector<Segment> m_segments;
+  std::vector<Message> m_messages;
+
+ public:
+  // Register (or replace) the translation for key. Returns the index of the key.
+  size_t add(std::string_view key, std::string_view translation);
+
+  // Return the index of key, or unknown.
+  size_t index_of(std::string_view key) const noexcept { return m_keys.find(key); }
+
+  // Return the unformatted translation of the message with the given index.
+  std::string_view translation(size_t index) const
+  {
+    Message const& message = m_messages[index];
+    return { m_arena.data() + message.m_begin, message.m_end - message.m_begin };
+  }
+
+  // Format the message with the given index: the precomputed literal runs are
+  // copied wholesale and each "[KEY]" marker is replaced with its entry from
+  // format_map (markers without an entry are kept as-is).
+  std::string format(size_t index, format_map_t const& format_map) const;
+
+  static Catalog& instance();
+};
+
+// Translate xmlDesc: when it is a key registered in the Catalog, format its
+// translation (an array load plus precomputed segment walk); otherwise fall
+// back to scanning xmlDesc itself for every key of format_map.
 std::string getString(std::string const& xmlDesc, format_map_t const& format_map);
 
 } // namespace translate
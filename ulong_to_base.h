@@ -27,7 +27,11 @@
 
 #pragma once
 
+#include "ctz.h"
+#include "debug.h"
 #include <string>
+#include <string_view>
+#include <cstddef>
 
 // Usage:
 //
@@ -37,15 +41,46 @@
 
 namespace utils {
 
+// The number of digits that ULONG_MAX has in the given base.
+constexpr int max_digits_for_base(int base)
+{
+  int digits = 0;
+  for (unsigned long n = ~0UL; n != 0; n /= base)
+    ++digits;
+  return digits;
+}
+
+// As ulong_to_base below, but writing into caller provided storage:
+// the digits are written to the *end* of [buffer, buffer + size> and a
+// string_view to them is returned, without any allocation. The buffer
+// must be large enough for the largest value (ASSERT'ed); 64 bytes
+// always suffice, for any base.
+//
+// For bases that are a power of two (2, 8, 16, 64, ...) the digit loop
+// specializes, at compile time, to shift/mask instead of division.
 template<int base_plus_one>
-std::string ulong_to_base(unsigned long n, char const (&digits) [base_plus_one])
+std::string_view ulong_to_base(unsigned long n, char const (&digits) [base_plus_one], char* buffer, std::size_t size)
 {
   int constexpr base = base_plus_one - 1;
+  static_assert(base >= 2, "ulong_to_base requires a base of at least 2.");
+  // The buffer must be large enough for the largest value.
+  ASSERT(size >= (std::size_t)max_digits_for_base(base));
+  char* p = buffer + size;
+  if constexpr ((base & (base - 1)) == 0)
+  {
+    int constexpr shift = ctz(static_cast<unsigned int>(base));
+    do *--p = digits[n & (base - 1)]; while ((n >>= shift));
+  }
+  else
+    do *--p = digits[n % base]; while ((n /= base));
+  return { p, static_cast<std::size_t>(buffer + size - p) };
+}
+
+template<int base_plus_one>
+std::string ulong_to_base(unsigned long n, char const (&digits) [base_plus_one])
+{
   char buf[8 * sizeof(n)];
-  std::string::size_type const end = sizeof(buf);
-  std::string::size_type count = 0;
-  do buf[end - ++count] = digits[n % base]; while ((n /= base));
-  return std::string(buf + end - count, count);
+  return std::string(ulong_to_base(n, digits, buf, sizeof(buf)));
 }
 
 } // namespace utils